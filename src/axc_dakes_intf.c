@@ -3,18 +3,29 @@
 #include "lurch.h"
 #include "idake2session.h"
 #include "lurch_util.h"
+#include "lurch_store.h"
+#include "lurch_arena.h"
+#include "lurch_ctx.h"
+#include "lurch_crypto.h"
 
 #include <glib.h>
 
 extern void lurch_util_axc_log_func(int level, const char * msg, size_t len, void * user_data);
 
-int cachectx_init_by_name(const char* name, axc_context_dake_cache** ctx_pp)
+/* The initialization of an axc context is split in three parts: the setup, which reads
+ * the prefs and opens the store, the expensive part, which opens axc's own db connections,
+ * installs axc if needed and generates the faux registration id, and the log setup.
+ * Only the expensive part may run off the main thread, see cachectx_prewarm().
+ */
+
+static int cachectx_init_setup(const char* name, axc_context_dake_cache** ctx_pp, lurch_store** store_pp)
 {
   int ret_val = 0;
   gchar * err_msg_dbg = NULL;
 
   axc_context_dake_cache* ctx_p = NULL;
   gchar * db_fn = NULL;
+  lurch_store * store_p = NULL;
 
   ret_val = cachectx_create(&ctx_p);
   if (ret_val) {
@@ -29,60 +40,113 @@ int cachectx_init_by_name(const char* name, axc_context_dake_cache** ctx_pp)
     goto cleanup;
   }
 
-  if (purple_prefs_get_bool(LURCH_PREF_AXC_LOGGING)) {
-      axc_context_set_log_func((axc_context*)ctx_p,
-			       lurch_util_axc_log_func);
-      axc_context_set_log_level((axc_context*)ctx_p,
-				purple_prefs_get_int(LURCH_PREF_AXC_LOGGING_LEVEL));
+  ret_val = lurch_store_get(name, &store_p);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to open the stores of %s", name);
+    goto cleanup;
+  }
+  lurch_store_bind_axc_ctx(store_p, (axc_context*)ctx_p);
+
+  ret_val = lurch_store_apply_durability(store_p);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to set the journal mode and sync level for %s", name);
+    goto cleanup;
   }
 
-  cachectx_bind_backend(ctx_p, &axc_session_store_tmpl);
+  cachectx_bind_backend(ctx_p, &lurch_store_session_store_tmpl);
   if (false == cachectx_has_good_backend(ctx_p)) {
     err_msg_dbg = g_strdup("backend session store is invalid");
     ret_val = AXC_ERR;
     goto cleanup;
   }
 
+  *ctx_pp = ctx_p;
+  *store_pp = store_p;
+
+cleanup:
+  if (ret_val) {
+    cachectx_destroy_all(&ctx_p->base.base);
+  }
+  if (err_msg_dbg) {
+    purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
+    g_free(err_msg_dbg);
+  }
+
+  g_free (db_fn);
+  return ret_val;
+}
+
+/* Must not call into libpurple. */
+static int cachectx_init_run(axc_context_dake_cache* ctx_p, lurch_store* store_p, gchar** err_msg_pp)
+{
+  int ret_val = 0;
+
   ret_val = axc_init_with_imp((axc_context*)ctx_p, &cachectx_sess_store_tmpl,
-			      &axc_pre_key_store_tmpl, &axc_signed_pre_key_store_tmpl,
-			      &axc_dakes_identity_key_store_tmpl, &axc_crypto_provider_tmpl);
+			      &lurch_store_pre_key_store_tmpl, &axc_signed_pre_key_store_tmpl,
+			      &axc_dakes_identity_key_store_tmpl, &signal_crypto);
   if (ret_val) {
-    err_msg_dbg = g_strdup("failed to init axc context");
-    goto cleanup;
+    *err_msg_pp = g_strdup("failed to init axc context");
+    return ret_val;
+  }
+
+  ret_val = lurch_axc_prepare(store_p, &ctx_p->base.base, err_msg_pp);
+  if (ret_val) {
+    return ret_val;
+  }
+
+  ret_val = signal_protocol_key_helper_generate_registration_id(&ctx_p->faux_regid, 1,
+								ctx_p->base.base.axolotl_global_context_p);
+  if (ret_val) {
+    *err_msg_pp = g_strdup("failed to generate faux registration id");
+    return ret_val;
   }
 
+  return 0;
+}
+
+/* The log functions go through libpurple, so they are only set once the context is back on the main thread. */
+static void cachectx_init_set_logging(axc_context_dake_cache* ctx_p)
+{
   if (purple_prefs_get_bool(LURCH_PREF_AXC_LOGGING)) {
+    axc_context_set_log_func((axc_context*)ctx_p,
+			     lurch_util_axc_log_func);
+    axc_context_set_log_level((axc_context*)ctx_p,
+			      purple_prefs_get_int(LURCH_PREF_AXC_LOGGING_LEVEL));
     signal_context_set_log_function(axc_context_get_axolotl_ctx((axc_context*)ctx_p),
 				    lurch_util_axc_log_func);
   }
+}
 
-  purple_debug_info("lurch", "%s: preparing installation for %s...\n", __func__, name);
-  ret_val = lurch_axc_prepare(name, &ctx_p->base.base);
+int cachectx_init_by_name(const char* name, axc_context_dake_cache** ctx_pp)
+{
+  int ret_val = 0;
+  gchar * err_msg_dbg = NULL;
+
+  axc_context_dake_cache* ctx_p = NULL;
+  lurch_store * store_p = NULL;
+
+  ret_val = cachectx_init_setup(name, &ctx_p, &store_p);
   if (ret_val) {
-    err_msg_dbg = g_strdup_printf("failed to prepare axc");
-    goto cleanup;
+    return ret_val;
   }
-  purple_debug_info("lurch", "%s: ...done\n", __func__);
 
-  ret_val = signal_protocol_key_helper_generate_registration_id(&ctx_p->faux_regid, 1,
-								ctx_p->base.base.axolotl_global_context_p);
+  purple_debug_info("lurch", "%s: preparing installation for %s...\n", __func__, name);
+  ret_val = cachectx_init_run(ctx_p, store_p, &err_msg_dbg);
   if (ret_val) {
-    err_msg_dbg = g_strdup("failed to generate faux registration id");
     goto cleanup;
   }
+  purple_debug_info("lurch", "%s: ...done\n", __func__);
 
+  cachectx_init_set_logging(ctx_p);
   *ctx_pp = ctx_p;
 
 cleanup:
   if (ret_val) {
     cachectx_destroy_all(&ctx_p->base.base);
-  }
-  if (err_msg_dbg) {
     purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
-    g_free(err_msg_dbg);
   }
+  g_free(err_msg_dbg);
 
-  g_free (db_fn);
   return ret_val;
 }
 
@@ -112,10 +176,8 @@ void reset_acc_axc_ctx_map(void)
 
 axc_context_dake_cache* query_axc_ctx_by_name(GHashTable* map, const char* uname)
 {
-  gchar* bname = lurch_util_uname_strip(uname);
-  axc_context_dake_cache* ctx = (axc_context_dake_cache*)g_hash_table_lookup(map, uname);
-  g_free(bname);
-  return ctx;
+  /* the keys are stripped on insertion and all callers pass a stripped name already */
+  return (axc_context_dake_cache*)g_hash_table_lookup(map, uname);
 }
 
 void insert_axc_ctx_by_name(GHashTable* map, const char* uname, axc_context_dake_cache* ctx)
@@ -124,6 +186,157 @@ void insert_axc_ctx_by_name(GHashTable* map, const char* uname, axc_context_dake
   g_hash_table_insert(map, bname, ctx);
 }
 
+/* An axc context being initialized on its own thread, see cachectx_prewarm(). */
+typedef struct {
+  gchar* name;
+  axc_context_dake_cache* ctx_p;
+  lurch_store* store_p;
+  GThread* thread_p;
+  gint finished;
+  int ret_val;
+  gchar* err_msg;
+  cachectx_prewarm_done_fn done_fn;
+  void* user_data;
+} cachectx_prewarm_job;
+
+/* name -> cachectx_prewarm_job, only accessed on the main thread */
+static GHashTable* prewarm_map = NULL;
+
+static gboolean cachectx_prewarm_dispatch(gpointer data);
+
+static gpointer cachectx_prewarm_run(gpointer data)
+{
+  cachectx_prewarm_job* job_p = data;
+
+  job_p->ret_val = cachectx_init_run(job_p->ctx_p, job_p->store_p, &job_p->err_msg);
+  lurch_crypto_thread_release();
+  g_atomic_int_set(&job_p->finished, 1);
+  g_idle_add(cachectx_prewarm_dispatch, &prewarm_map);
+
+  return NULL;
+}
+
+/* Joins the thread and hands the context to the account map. The job must already be removed from prewarm_map. */
+static void cachectx_prewarm_complete(gpointer data)
+{
+  cachectx_prewarm_job* job_p = data;
+
+  (void) g_thread_join(job_p->thread_p);
+  lurch_store_release(job_p->store_p);
+
+  if (job_p->ret_val) {
+    purple_debug_error("lurch", "%s: %s (%i)\n", __func__, job_p->err_msg, job_p->ret_val);
+    cachectx_destroy_all(&job_p->ctx_p->base.base);
+  } else {
+    cachectx_init_set_logging(job_p->ctx_p);
+    insert_axc_ctx_by_name(get_acc_axc_ctx_map(), job_p->name, job_p->ctx_p);
+    purple_debug_info("lurch", "%s: axc context of %s is ready\n", __func__, job_p->name);
+  }
+
+  if (job_p->done_fn) {
+    job_p->done_fn(job_p->name, job_p->ret_val, job_p->user_data);
+  }
+
+  g_free(job_p->name);
+  g_free(job_p->err_msg);
+  g_free(job_p);
+}
+
+/* Completes all finished jobs. The completions can start new jobs, so they run after the iteration. */
+static gboolean cachectx_prewarm_dispatch(gpointer data)
+{
+  GHashTableIter iter;
+  gpointer value = NULL;
+  GList* done_l_p = NULL;
+
+  (void) data;
+
+  if (prewarm_map) {
+    g_hash_table_iter_init(&iter, prewarm_map);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      if (g_atomic_int_get(&((cachectx_prewarm_job*) value)->finished)) {
+	done_l_p = g_list_prepend(done_l_p, value);
+	g_hash_table_iter_steal(&iter);
+      }
+    }
+  }
+  g_list_free_full(done_l_p, cachectx_prewarm_complete);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Blocks until the job for the given name, if any, is done and completes it right away. */
+static void cachectx_prewarm_wait(const char* name)
+{
+  cachectx_prewarm_job* job_p = prewarm_map ? g_hash_table_lookup(prewarm_map, name) : NULL;
+
+  if (job_p) {
+    (void) g_hash_table_steal(prewarm_map, name);
+    cachectx_prewarm_complete(job_p);
+  }
+}
+
+int cachectx_prewarm(const char* name, cachectx_prewarm_done_fn done_fn, void* user_data)
+{
+  int ret_val = 0;
+  cachectx_prewarm_job* job_p = NULL;
+  GError* err_p = NULL;
+
+  if (query_axc_ctx_by_name(get_acc_axc_ctx_map(), name)) {
+    return 1;
+  }
+  if (prewarm_map && g_hash_table_contains(prewarm_map, name)) {
+    return 0;
+  }
+
+  job_p = g_new0(cachectx_prewarm_job, 1);
+  ret_val = cachectx_init_setup(name, &job_p->ctx_p, &job_p->store_p);
+  if (ret_val) {
+    g_free(job_p);
+    return ret_val;
+  }
+  job_p->name = g_strdup(name);
+  job_p->done_fn = done_fn;
+  job_p->user_data = user_data;
+
+  job_p->thread_p = g_thread_try_new("lurch-prewarm", cachectx_prewarm_run, job_p, &err_p);
+  if (!job_p->thread_p) {
+    purple_debug_error("lurch", "%s: failed to start thread for %s: %s\n", __func__, name, err_p->message);
+    g_error_free(err_p);
+    cachectx_destroy_all(&job_p->ctx_p->base.base);
+    g_free(job_p->name);
+    g_free(job_p);
+    return AXC_ERR;
+  }
+  // the completion runs on the main loop at the earliest, so the lease is in place before it is released
+  lurch_store_lease(job_p->store_p, job_p->thread_p);
+
+  if (!prewarm_map) {
+    prewarm_map = g_hash_table_new(g_str_hash, g_str_equal);
+  }
+  (void) g_hash_table_insert(prewarm_map, job_p->name, job_p);
+
+  return 0;
+}
+
+void cachectx_prewarm_join_all(void)
+{
+  GList* job_l_p = NULL;
+
+  if (!prewarm_map) {
+    return;
+  }
+
+  while (g_idle_remove_by_data(&prewarm_map)) {}
+
+  job_l_p = g_hash_table_get_values(prewarm_map);
+  g_hash_table_steal_all(prewarm_map);
+  g_list_free_full(job_l_p, cachectx_prewarm_complete);
+
+  g_hash_table_destroy(prewarm_map);
+  prewarm_map = NULL;
+}
+
 /** Functions playing the same role as omemo_storage*(), but implemented via an extended
  *  signal_protocol_store_context.
  */
@@ -182,6 +395,15 @@ int cachectx_get_from_map(GHashTable* map, const char* name, axc_context_dake_ca
 {
   int ret = 0;
   axc_context_dake_cache* ctx_p = query_axc_ctx_by_name(map, name);
+  if (ctx_p && map == acc_axc_ctx_map) {
+    // the worker decrypting the account's messages might be using it
+    lurch_ctx_async_drain_account(name);
+  }
+  if (ctx_p == NULL && map == acc_axc_ctx_map) {
+    // do not race the thread initializing the same context
+    cachectx_prewarm_wait(name);
+    ctx_p = query_axc_ctx_by_name(map, name);
+  }
   if (ctx_p == NULL) {
     ret = cachectx_init_by_name(name, &ctx_p);
     if (ret < 0) goto cleanup;
@@ -193,6 +415,38 @@ int cachectx_get_from_map(GHashTable* map, const char* name, axc_context_dake_ca
   return ret;
 }
 
+/* IDAKE messages are unpacked into an arena on the stack, which usually holds all of their
+ * fields, instead of allocating each field and nested message on the heap.
+ */
+static void* dakectx_pb_alloc(void* allocator_data, size_t size)
+{
+  return lurch_arena_alloc((lurch_arena*)allocator_data, size);
+}
+
+static void dakectx_pb_free(void* allocator_data, void* pointer)
+{
+  // released together with the arena
+  (void)allocator_data;
+  (void)pointer;
+}
+
+int dakectx_msg_may_be_idakemsg(const uint8_t* msg, size_t msg_len)
+{
+  if (!msg || !msg_len) {
+    return 1;
+  }
+
+  switch (msg[0] & 0x07) {
+  case 3: // start group
+  case 4: // end group
+  case 6:
+  case 7:
+    return 0;
+  default:
+    return 1;
+  }
+}
+
 int dakectx_handle_idakemsg(axc_context_dake* ctx, const signal_protocol_address* addr,
 			    const uint8_t* msg, size_t msg_len, const signal_buffer** lastauthmsg)
 {
@@ -200,8 +454,21 @@ int dakectx_handle_idakemsg(axc_context_dake* ctx, const signal_protocol_address
     return  axc_Idake_start_for_addr(ctx, addr, lastauthmsg);
   }
 
+  // signal messages go straight to the ratchet, without a protobuf parse that is bound to fail
+  if (!dakectx_msg_may_be_idakemsg(msg, msg_len)) {
+    return SG_ERR_INVALID_MESSAGE;
+  }
+
   int ret = 0;
-  Signaldakez__IdakeMessage* idakemsg = signaldakez__idake_message__unpack(NULL, msg_len, msg);
+  lurch_arena arena;
+  ProtobufCAllocator allocator = {
+    .alloc = dakectx_pb_alloc,
+    .free = dakectx_pb_free,
+    .allocator_data = &arena
+  };
+  lurch_arena_init(&arena);
+
+  Signaldakez__IdakeMessage* idakemsg = signaldakez__idake_message__unpack(&allocator, msg_len, msg);
   if (!idakemsg) {
     ret = SG_ERR_INVALID_MESSAGE;
     goto cleanup;
@@ -210,7 +477,8 @@ int dakectx_handle_idakemsg(axc_context_dake* ctx, const signal_protocol_address
   ret = axc_Idake_handle_msg(ctx, idakemsg, addr, lastauthmsg);
 
  cleanup:
-  signaldakez__idake_message__free_unpacked(idakemsg, 0);
+  // the message and all of its fields are in the arena, there is nothing to free one by one
+  lurch_arena_release(&arena);
   return ret;
 }
 
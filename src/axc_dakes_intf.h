@@ -29,6 +29,26 @@ int axc_ext_user_get_dev_list(axc_context* ctx, const char* user,
 
 int cachectx_get_from_map(GHashTable* map, const char* name, axc_context_dake_cache** ctx_pp);
 
+//Called on the main loop once the context of "name" is in the account map, or failed to initialize.
+typedef void (*cachectx_prewarm_done_fn)(const char* name, int ret_val, void* user_data);
+
+//Starts initializing the context of "name" on its own thread, so that the first message does not wait for it.
+//cachectx_get_from_map() blocks until the thread is done if the context is needed before that.
+//Returns 1 if the context is in the account map already, 0 if the thread is started or running already
+//(then done_fn is not registered a second time), negative on error.
+int cachectx_prewarm(const char* name, cachectx_prewarm_done_fn done_fn, void* user_data);
+
+//Waits for all threads and completes their contexts. Called on plugin unload.
+void cachectx_prewarm_join_all(void);
+
+//Tells signal messages from IDAKE messages by their first byte, without parsing them.
+//An IDAKE message is protobuf, so its first byte is the tag of its first field, whose low 3 bits are the
+//wire type. protobuf-c rejects the group wire types (3 and 4) and the unassigned ones (6 and 7).
+//Signal messages start with libsignal's version byte, (version << 4 | version), i.e. 0x33, wire type 3.
+//Returns 0 if the message cannot be an IDAKE message, 1 if it may be one and has to be parsed.
+int dakectx_msg_may_be_idakemsg(const uint8_t* msg, size_t msg_len);
+
+//Handles the message if it is an IDAKE message, returns SG_ERR_INVALID_MESSAGE if it is not.
 int dakectx_handle_idakemsg(axc_context_dake* ctx, const signal_protocol_address* addr,
 			    const uint8_t* msg, size_t msg_len, const signal_buffer** lastauthmsg);
 
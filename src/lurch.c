@@ -13,7 +13,6 @@
 
 #include "libomemo.h"
 #include "libomemo_crypto.h"
-#include "libomemo_storage.h"
 
 #include "axc.h"
 #include "axc_store.h"
@@ -23,8 +22,13 @@
 
 #include "lurch.h"
 #include "lurch_api.h"
+#include "lurch_arena.h"
 #include "lurch_cmd_ui.h"
+#include "lurch_crypto.h"
+#include "lurch_ctx.h"
+#include "lurch_store.h"
 #include "lurch_util.h"
+#include "lurch_xml.h"
 
 #include "axc_dakes_intf.h"
 #include "omemo_helper.h"
@@ -32,17 +36,22 @@
 
 typedef struct lurch_queued_msg {
   omemo_message * om_msg_p;
+  xmlnode * msg_stanza_p;
   GList * recipient_addr_l_p;
   GList * no_sess_l_p;
   GHashTable * sess_handled_p;
 } lurch_queued_msg;
 
-const omemo_crypto_provider crypto = {
+// the AES-GCM and random functions are selected on load, see lurch_crypto_provider_select()
+omemo_crypto_provider crypto = {
     .random_bytes_func = omemo_default_crypto_random_bytes,
     .aes_gcm_encrypt_func = omemo_default_crypto_aes_gcm_encrypt,
     .aes_gcm_decrypt_func = omemo_default_crypto_aes_gcm_decrypt
 };
 
+// the crypto provider of the axc contexts, a copy of axc's template set up on load, see lurch_crypto_signal_provider_select()
+signal_crypto_provider signal_crypto;
+
 int topic_changed = 0;
 int uninstall = 0;
 
@@ -60,6 +69,7 @@ void lurch_addr_list_destroy_func(gpointer data) {
  * the lifetime of this struct and instead use the destroy function when done.
  *
  * @param om_msg_p Pointer to the omemo_message.
+ * @param msg_stanza_p Pointer to the <message> stanza the encrypted content is put into.
  * @param recipient_addr_l_p Pointer to the list of recipient addresses.
  * @param no_sess_l_p Pointer to the list that contains the addresses that do
  *                    not have sessions, i.e. for which bundles were requested.
@@ -67,6 +77,7 @@ void lurch_addr_list_destroy_func(gpointer data) {
  * @return 0 on success, negative on error.
  */
 static int lurch_queued_msg_create(omemo_message * om_msg_p,
+                                   xmlnode * msg_stanza_p,
                                    GList * recipient_addr_l_p,
                                    GList * no_sess_l_p,
                                    lurch_queued_msg ** qmsg_pp) {
@@ -86,6 +97,7 @@ static int lurch_queued_msg_create(omemo_message * om_msg_p,
   sess_handled_p = g_hash_table_new(g_str_hash, g_str_equal);
 
   qmsg_p->om_msg_p = om_msg_p;
+  qmsg_p->msg_stanza_p = msg_stanza_p;
   qmsg_p->recipient_addr_l_p = recipient_addr_l_p;
   qmsg_p->no_sess_l_p = no_sess_l_p;
   qmsg_p->sess_handled_p = sess_handled_p;
@@ -113,6 +125,9 @@ static int lurch_queued_msg_is_handled(const lurch_queued_msg * qmsg_p) {
 static void lurch_queued_msg_destroy(lurch_queued_msg * qmsg_p) {
   if (qmsg_p) {
     omemo_message_destroy(qmsg_p->om_msg_p);
+    if (qmsg_p->msg_stanza_p) {
+      xmlnode_free(qmsg_p->msg_stanza_p);
+    }
     g_list_free_full(qmsg_p->recipient_addr_l_p, free);
     g_hash_table_destroy(qmsg_p->sess_handled_p);
     free(qmsg_p);
@@ -148,6 +163,40 @@ static void jabber_pep_retract_item(JabberStream *js, const gchar *node, const g
   jabber_pep_publish(js, retract);
 }
 
+/**
+ * Wraps lurch_xml_export_encrypted(), so that it is called with the same options throughout.
+ */
+static int lurch_export_encrypted(omemo_message * om_msg_p, xmlnode * msg_stanza_p) {
+  return lurch_xml_export_encrypted(om_msg_p, OMEMO_ADD_MSG_EME, msg_stanza_p);
+}
+
+/**
+ * Creates the omemo message for the body of the stanza, without the string round-trip of
+ * omemo_message_prepare_encryption().
+ *
+ * @param msg_stanza_p Pointer to the <message> stanza.
+ * @param own_id The own device ID.
+ * @param om_msg_pp Will point to the omemo message.
+ * @return 0 on success, negative on error.
+ */
+static int lurch_msg_prepare_encryption(xmlnode * msg_stanza_p, uint32_t own_id, omemo_message ** om_msg_pp) {
+  int ret_val = 0;
+  xmlnode * body_node_p = (void *) 0;
+  char * body = (void *) 0;
+
+  // a body consisting of a single text node, which is the usual case, is encrypted without copying it first
+  body_node_p = xmlnode_get_child(msg_stanza_p, BODY_NODE_NAME);
+  if (body_node_p && body_node_p->child && body_node_p->child->type == XMLNODE_TYPE_DATA && !body_node_p->child->next) {
+    return omemo_message_create_for_text_len(body_node_p->child->data, body_node_p->child->data_sz, own_id, &crypto, om_msg_pp);
+  }
+
+  body = xmlnode_get_data(body_node_p);
+  ret_val = omemo_message_create_for_text(body, own_id, &crypto, om_msg_pp);
+  g_free(body);
+
+  return ret_val;
+}
+
 int lurch_dake_create_idake_msg(xmlnode** idakemsg_node_pp,
 				gchar** err_msg_pp,
 				JabberStream* js,
@@ -159,30 +208,19 @@ int lurch_dake_create_idake_msg(xmlnode** idakemsg_node_pp,
 				size_t len)
 {
   int ret_val = 0;
-  int xmllen = 0;
-  char* str_ktmsg = NULL;
+  omemo_message* ktmsg_p = NULL;
   xmlnode* node_p = jabber_create_message_on_stream(js, type, to);
   if (!node_p) {
     ret_val = SG_ERR_INVAL;
     *err_msg_pp = g_strdup_printf("failed to create template message to %s", to);
     goto cleanup;
   }
-  gchar* str_tmplmsg = xmlnode_to_str(node_p, &xmllen);
-  xmlnode_free(node_p);
-  node_p = NULL;
-  omemo_message* ktmsg_p = omemo_message_create_bare();
+  ktmsg_p = omemo_message_create_bare();
   ret_val = omemo_message_set_sender_devid(ktmsg_p, s_devid);
   if (ret_val < 0) {
     *err_msg_pp = g_strdup_printf("failed to create simplest omemo message to %s", to);
     goto cleanup;
   }
-  ret_val = omemo_message_set_plain_msg(ktmsg_p, str_tmplmsg);
-  g_free(str_tmplmsg);
-  str_tmplmsg = NULL;
-  if (ret_val < 0) {
-    *err_msg_pp = g_strdup_printf("failed to create template msg for %s", to);
-    goto cleanup;
-  }
   ret_val = omemo_message_add_recipient(ktmsg_p, to, to_devid,
 					data, len, 1);
   if (ret_val < 0) {
@@ -190,13 +228,11 @@ int lurch_dake_create_idake_msg(xmlnode** idakemsg_node_pp,
 				  to, to_devid);
     goto cleanup;
   }
-  ret_val = omemo_message_export_encrypted(ktmsg_p, OMEMO_ADD_MSG_NONE, &str_ktmsg);
+  ret_val = lurch_xml_export_encrypted(ktmsg_p, OMEMO_ADD_MSG_NONE, node_p);
   if (ret_val < 0) {
     *err_msg_pp = g_strdup_printf("failed to export encrypted msg");
     goto cleanup;
   }
-  node_p = xmlnode_from_str(str_ktmsg, -1);
-  free(str_ktmsg);
 
  cleanup:
   if (ret_val < 0)
@@ -218,15 +254,18 @@ int lurch_dake_create_idake_msg(xmlnode** idakemsg_node_pp,
  * If an initialized DB already exists, this function exits with success without doing anything.
  * This is checked by trying to retrieve the device ID from it.
  *
- * @param uname The username.
+ * Does not call into libpurple, so that it can run on the threads initializing the axc contexts.
+ *
+ * @param store_p The store of the account.
+ * @param axc_ctx_p The axc context to install.
+ * @param err_msg_pp Will point to a g_malloc()'d message on error.
  * @return 0 on success, negative on error.
  */
-int lurch_axc_prepare(const char * uname, axc_context * axc_ctx_p) {
+int lurch_axc_prepare(lurch_store * store_p, axc_context * axc_ctx_p, char ** err_msg_pp) {
   int ret_val = 0;
   char * err_msg_dbg = (void *) 0;
 
   uint32_t device_id = 0;
-  char * db_fn_omemo = (void *) 0;
 
   ret_val = axc_get_device_id(axc_ctx_p, &device_id);
   if (!ret_val) {
@@ -234,8 +273,6 @@ int lurch_axc_prepare(const char * uname, axc_context * axc_ctx_p) {
     goto cleanup;
   }
 
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
-
   while (1) {
     ret_val = axc_install(axc_ctx_p);
     if (ret_val) {
@@ -249,7 +286,7 @@ int lurch_axc_prepare(const char * uname, axc_context * axc_ctx_p) {
       goto cleanup;
     }
 
-    ret_val = omemo_storage_global_device_id_exists(device_id, db_fn_omemo);
+    ret_val = lurch_store_global_device_id_exists(store_p, device_id);
     if (0 && (ret_val == 1))  {
       ret_val = axc_db_init_status_set(AXC_DB_NEEDS_ROLLBACK, axc_ctx_p);
       if (ret_val) {
@@ -257,7 +294,7 @@ int lurch_axc_prepare(const char * uname, axc_context * axc_ctx_p) {
         goto cleanup;
       }
     } else if (ret_val < 0) {
-      err_msg_dbg = g_strdup_printf("failed to access the db %s", db_fn_omemo);
+      err_msg_dbg = g_strdup_printf("failed to access the db %s", lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO));
       goto cleanup;
     } else {
       break;
@@ -265,11 +302,7 @@ int lurch_axc_prepare(const char * uname, axc_context * axc_ctx_p) {
   }
 
 cleanup:
-  if (err_msg_dbg) {
-    purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
-    g_free(err_msg_dbg);
-  }
-  g_free(db_fn_omemo);
+  *err_msg_pp = err_msg_dbg;
 
   return ret_val;
 }
@@ -301,6 +334,7 @@ static int lurch_dake_key_encrypt(const lurch_addr * recipient_addr_p,
 
   key_buf_p = axc_buf_create(key_p, key_len);
   if (!key_buf_p) {
+    ret_val = LURCH_ERR_NOMEM;
     err_msg_dbg = g_strdup_printf("failed to create buffer for the key");
     goto cleanup;
   }
@@ -325,7 +359,8 @@ cleanup:
     purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
     g_free(err_msg_dbg);
   }
-  axc_buf_free(key_buf_p);
+  // the message key in plaintext
+  signal_buffer_bzero_free(key_buf_p);
 
   return ret_val;
 }
@@ -348,9 +383,14 @@ static int lurch_msg_encrypt_for_addrs(omemo_message * om_msg_p, GList * addr_l_
   lurch_addr * curr_addr_p = (void *) 0;
   axc_address addr = {0};
   axc_buf * curr_key_ct_buf_p = (void *) 0;
+  lurch_store * store_p = lurch_store_from_axc_ctx(axc_ctx_p);
+  int commit_ret = 0;
 
   purple_debug_info("lurch", "%s: trying to encrypt key for %i devices\n", __func__, g_list_length(addr_l_p));
 
+  // the ratchets of all recipients are saved together once the message is complete
+  lurch_store_msg_begin(store_p);
+
   for (curr_l_p = addr_l_p; curr_l_p; curr_l_p = curr_l_p->next) {
     curr_addr_p = (lurch_addr *) curr_l_p->data;
     addr.name = curr_addr_p->jid;
@@ -391,6 +431,16 @@ static int lurch_msg_encrypt_for_addrs(omemo_message * om_msg_p, GList * addr_l_
   }
 
 cleanup:
+  if (err_msg_dbg) {
+    lurch_store_msg_rollback(store_p);
+  } else {
+    commit_ret = lurch_store_msg_commit(store_p);
+    if (commit_ret) {
+      // the keys were encrypted with ratchet states that are not saved, so the message must not go out
+      ret_val = commit_ret;
+      err_msg_dbg = g_strdup_printf("failed to save the sessions");
+    }
+  }
   if (err_msg_dbg) {
     purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
     g_free(err_msg_dbg);
@@ -625,13 +675,6 @@ cleanup:
   return ret_val;
 }
 
-/**
- * Wraps the omemo_message_export_encrypted message, so that it is called with the same options throughout.
- */
-static int lurch_export_encrypted(omemo_message * om_msg_p, char ** xml_pp) {
-  return omemo_message_export_encrypted(om_msg_p, OMEMO_ADD_MSG_EME, xml_pp);
-}
-
 /**
  * Implements JabberIqCallback.
  * Callback for a bundle request.
@@ -654,12 +697,11 @@ static void lurch_bundle_request_cb(JabberStream * js_p, const char * from,
   xmlnode * items_node_p = (void *) 0;
   int msg_handled = 0;
   char * addr_key = (void *) 0;
-  char * msg_xml = (void *) 0;
   xmlnode * msg_node_p = (void *) 0;
   lurch_queued_msg * qmsg_p = (lurch_queued_msg *) data_p;
 
   uname = lurch_util_uname_strip(purple_account_get_username(purple_connection_get_account(js_p->gc)));
-  recipient = omemo_message_get_recipient_name_bare(qmsg_p->om_msg_p);
+  recipient = jabber_get_bare_jid(xmlnode_get_attrib(qmsg_p->msg_stanza_p, "to"));
 
   if (!from) {
     // own user
@@ -733,18 +775,14 @@ static void lurch_bundle_request_cb(JabberStream * js_p, const char * from,
       goto cleanup;
     }
 
-    ret_val = lurch_export_encrypted(qmsg_p->om_msg_p, &msg_xml);
+    ret_val = lurch_export_encrypted(qmsg_p->om_msg_p, qmsg_p->msg_stanza_p);
     if (ret_val) {
       err_msg_dbg = "failed to export the message to xml";
       goto cleanup;
     }
 
-    msg_node_p = xmlnode_from_str(msg_xml, -1);
-    if (!msg_node_p) {
-      err_msg_dbg = "failed to parse xml from string";
-      ret_val = LURCH_ERR;
-      goto cleanup;
-    }
+    msg_node_p = qmsg_p->msg_stanza_p;
+    qmsg_p->msg_stanza_p = (void *) 0;
 
     purple_debug_info("lurch", "sending encrypted msg\n");
     purple_signal_emit(purple_plugins_find_with_id("prpl-jabber"), "jabber-sending-xmlnode", js_p->gc, &msg_node_p);
@@ -766,7 +804,6 @@ cleanup:
   g_strfreev(split);
   g_free(addr_key);
   g_free(recipient);
-  free(msg_xml);
   if (msg_node_p) {
     xmlnode_free(msg_node_p);
   }
@@ -860,8 +897,6 @@ static void lurch_pep_bundle_for_keytransport(JabberStream * js_p, const char *
   axc_address addr = {0};
   lurch_addr laddr = {0};
   axc_buf * key_ct_buf_p = (void *) 0;
-  char * msg_xml = (void *) 0;
-  int len = 0;
   xmlnode * msg_node_p = (void *) 0;
   char * msg_id = (void *) 0;
   void * jabber_handle_p = purple_plugins_find_with_id("prpl-jabber");
@@ -911,12 +946,7 @@ static void lurch_pep_bundle_for_keytransport(JabberStream * js_p, const char *
   xmlnode_set_attrib(msg_node_p, "id", msg_id);
   xmlnode_set_attrib(msg_node_p, "to", from);
 
-  msg_xml = xmlnode_to_str(msg_node_p, &len);
-  ret_val = omemo_message_prepare_encryption(msg_xml, own_id, &crypto, OMEMO_STRIP_ALL, &msg_p);
-  xmlnode_free(msg_node_p);
-  msg_node_p = (void *) 0;
-  g_free(msg_xml);
-  msg_xml = (void *) 0;
+  ret_val = lurch_msg_prepare_encryption(msg_node_p, own_id, &msg_p);
   if (ret_val) {
     err_msg_dbg = g_strdup_printf("failed to create omemo key transport msg for %s", from);
     goto cleanup;
@@ -944,18 +974,12 @@ static void lurch_pep_bundle_for_keytransport(JabberStream * js_p, const char *
   }
 
   // don't call wrapper function here as EME is not necessary
-  ret_val = omemo_message_export_encrypted(msg_p, OMEMO_ADD_MSG_NONE, &msg_xml);
+  ret_val = lurch_xml_export_encrypted(msg_p, OMEMO_ADD_MSG_NONE, msg_node_p);
   if (ret_val) {
     err_msg_dbg = g_strdup_printf("failed to export encrypted msg");
     goto cleanup;
   }
 
-  msg_node_p = xmlnode_from_str(msg_xml, -1);
-  if (!msg_node_p) {
-    err_msg_dbg = g_strdup_printf("failed to create xml node from xml string");
-    goto cleanup;
-  }
-
   purple_signal_emit(jabber_handle_p, "jabber-sending-xmlnode", js_p->gc, &msg_node_p);
   purple_debug_info("lurch", "%s: %s sent keytransportmsg to %s:%i\n", __func__, uname, from, addr.device_id);
 
@@ -970,7 +994,6 @@ cleanup:
   g_free(msg_id);
   omemo_message_destroy(msg_p);
   axc_buf_free(key_ct_buf_p);
-  free(msg_xml);
   if (msg_node_p) {
     xmlnode_free(msg_node_p);
   }
@@ -989,7 +1012,8 @@ static int lurch_devicelist_process(char * uname, omemo_devicelist * dl_in_p, Ja
   char * err_msg_dbg = (void *) 0;
 
   const char * from = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
   axc_context_dake_cache * cachectx_p = (void *) 0;
   omemo_devicelist * dl_db_p = (void *) 0;
   GList * add_l_p = (void *) 0;
@@ -1001,11 +1025,16 @@ static int lurch_devicelist_process(char * uname, omemo_devicelist * dl_in_p, Ja
   char * debug_str = (void *) 0;
 
   from = omemo_devicelist_get_owner(dl_in_p);
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ret_val = lurch_store_get(uname, &store_p);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to open the stores of %s", uname);
+    goto cleanup;
+  }
+  db_fn_omemo = lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO);
 
   purple_debug_info("lurch", "%s: processing devicelist from %s for %s\n", __func__, from, uname);
 
-  ret_val = omemo_storage_user_devicelist_retrieve(from, db_fn_omemo, &dl_db_p);
+  ret_val = lurch_store_devicelist_retrieve(store_p, from, &dl_db_p);
   if (ret_val) {
     err_msg_dbg = g_strdup_printf("failed to retrieve cached devicelist for %s from db %s", from, db_fn_omemo);
     goto cleanup;
@@ -1020,39 +1049,35 @@ static int lurch_devicelist_process(char * uname, omemo_devicelist * dl_in_p, Ja
     goto cleanup;
   }
 
-  for (curr_p = add_l_p; curr_p; curr_p = curr_p->next) {
-    curr_id = omemo_devicelist_list_data(curr_p);
-    purple_debug_info("lurch", "%s: saving %i for %s to db %s\n", __func__, curr_id, from, db_fn_omemo);
-    ret_val = omemo_storage_user_device_id_save(from, curr_id, db_fn_omemo);
-    if (ret_val) {
-      err_msg_dbg = g_strdup_printf("failed to save %i for %s to %s", curr_id, from, db_fn_omemo);
-      goto cleanup;
-    }
-  }
-
   ret_val = cachectx_get_from_map(get_acc_axc_ctx_map(), uname, &cachectx_p);
   if (ret_val) {
     err_msg_dbg = g_strdup_printf("failed to init axc ctx");
     goto cleanup;
   }
 
+  for (curr_p = add_l_p; curr_p; curr_p = curr_p->next) {
+    curr_id = omemo_devicelist_list_data(curr_p);
+    purple_debug_info("lurch", "%s: saving %i for %s to db %s\n", __func__, curr_id, from, db_fn_omemo);
+  }
+
   for (curr_p = del_l_p; curr_p; curr_p = curr_p->next) {
     curr_id = omemo_devicelist_list_data(curr_p);
     purple_debug_info("lurch", "%s: deleting %i for %s to db %s\n", __func__, curr_id, from, db_fn_omemo);
+  }
 
-    ret_val = omemo_storage_user_device_id_delete(from, curr_id, db_fn_omemo);
-    if (ret_val) {
-      err_msg_dbg = g_strdup_printf("failed to delete %i for %s from %s", curr_id, from, db_fn_omemo);
-      goto cleanup;
-    }
+  ret_val = lurch_store_devicelist_apply(store_p, from, add_l_p, del_l_p);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to apply the devicelist changes for %s to %s", from, db_fn_omemo);
+    goto cleanup;
   }
 
+  lurch_store_devicelist_cache_update(store_p, dl_in_p);
+
 cleanup:
   if (err_msg_dbg) {
     purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
     g_free(err_msg_dbg);
   }
-  g_free(db_fn_omemo);
   omemo_devicelist_destroy(dl_db_p);
   g_list_free_full(add_l_p, free);
   g_list_free_full(del_l_p, free);
@@ -1153,13 +1178,14 @@ void lurch_pep_own_devicelist_request_handler(JabberStream * js_p, const char *
     err_msg_dbg = g_strdup_printf("failed to publish own bundle");
     goto cleanup;
   }
-  gchar* db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
-  ret_val = omemo_storage_user_device_id_save(uname, own_id, db_fn_omemo);
-  g_free(db_fn_omemo);
+  lurch_store* store_p = NULL;
+  ret_val = lurch_store_get(uname, &store_p);
   if (ret_val) {
     err_msg_dbg = g_strdup_printf("failed to temporarily save faux device id");
     goto cleanup;
   }
+  // nothing below depends on it being written already
+  lurch_store_device_id_save_async(store_p, uname, own_id);
 
 #if 0
   ret_val = lurch_devicelist_process(uname, dl_p, js_p);
@@ -1185,15 +1211,20 @@ void lurch_pep_own_devicelist_remove_faux_id(JabberStream * js_p, const char * f
   gchar* err_msg_dbg = NULL;
   PurpleAccount* acc_p = NULL;
   gchar* uname = NULL;
-  gchar* db_fn_omemo = NULL;
+  lurch_store* store_p = NULL;
   omemo_devicelist* dl_p = NULL;
   omemo_devicelist* faux_dl_p = NULL;
 
   acc_p = purple_connection_get_account(js_p->gc);
   uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
 
-  ret_val = omemo_storage_user_devicelist_retrieve(uname, db_fn_omemo, &faux_dl_p);
+  ret_val = lurch_store_get(uname, &store_p);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to open the stores of %s", uname);
+    goto cleanup;
+  }
+
+  ret_val = lurch_store_devicelist_retrieve(store_p, uname, &faux_dl_p);
   if (ret_val) {
     err_msg_dbg = g_strdup_printf("failed to get own device id list");
     goto cleanup;
@@ -1245,7 +1276,6 @@ void lurch_pep_own_devicelist_remove_faux_id(JabberStream * js_p, const char * f
   omemo_devicelist_destroy(dl_p);
   omemo_devicelist_destroy(faux_dl_p);
   g_free(uname);
-  g_free(db_fn_omemo);
 }
 
 void lurch_delete_used_bundle(JabberStream* js_p, const GList* used_faux_devid)
@@ -1278,14 +1308,13 @@ void lurch_delete_used_bundle(JabberStream* js_p, const GList* used_faux_devid)
 
 void lurch_delete_faux_ids(const char* uname, const GList* l_id_to_del)
 {
-  gchar* db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
-  {
-    const GList* cur = l_id_to_del;
-    for (; cur; cur = cur->next) {
-      omemo_storage_user_device_id_delete(uname, omemo_devicelist_list_data(cur), db_fn_omemo);
-    }
+  lurch_store* store_p = NULL;
+  if (lurch_store_get(uname, &store_p)) {
+    purple_debug_error("lurch", "%s: failed to open the stores of %s\n", __func__, uname);
+    return;
   }
-  g_free(db_fn_omemo);
+  lurch_store_devicelist_apply_async(store_p, uname, NULL, l_id_to_del);
+
   session_signed_pre_key* spk = NULL;
   ratchet_identity_key_pair* idk = NULL;
   do {
@@ -1309,12 +1338,15 @@ void lurch_delete_faux_ids(const char* uname, const GList* l_id_to_del)
 			 __func__, uname, ret);
       break;
     }
-    ret = signal_protocol_signed_pre_key_store_key(cachectx->base.base.axolotl_store_context_p, spk);
+    // written by the storage thread through its own handle, axc's store must stay on the main loop
+    signal_buffer* spk_buf = NULL;
+    ret = session_signed_pre_key_serialize(&spk_buf, spk);
     if (ret < 0) {
-      purple_debug_error("lurch", "%s: failed to save new signed pre key to storage:%d",
-			 __func__, ret);
+      purple_debug_error("lurch", "%s: failed to serialize new signed pre key for %s:%d",
+			 __func__, uname, ret);
       break;
     }
+    lurch_store_signed_pre_key_save_async(store_p, session_signed_pre_key_get_id(spk), spk_buf);
   } while(0);
   SIGNAL_UNREF(spk);
   SIGNAL_UNREF(idk);
@@ -1367,6 +1399,7 @@ static void lurch_pep_devicelist_event_handler(JabberStream * js_p, const char *
   char * err_msg_dbg = (void *) 0;
   char * tempxml = (void *) 0;
   char * uname = (void *) 0;
+  lurch_store * store_p = (void *) 0;
   omemo_devicelist * dl_in_p = (void *) 0;
 
   uname = lurch_util_uname_strip(purple_account_get_username(purple_connection_get_account(js_p->gc)));
@@ -1378,6 +1411,11 @@ static void lurch_pep_devicelist_event_handler(JabberStream * js_p, const char *
 
   purple_debug_info("lurch", "%s: %s received devicelist update from %s\n", __func__, uname, from);
 
+  // whatever is cached for the sender is outdated now
+  if (!lurch_store_get(uname, &store_p)) {
+    lurch_store_devicelist_cache_invalidate(store_p, from);
+  }
+
   tempxml = xmlnode_to_str(items_p, &len);
   ret_val = omemo_devicelist_import(tempxml, from, &dl_in_p);
   if (ret_val) {
@@ -1433,11 +1471,27 @@ static void lurch_account_connect_cb(PurpleAccount * acc_p) {
   jabber_pep_request_item(js_p, uname, dl_ns, (void *) 0, lurch_pep_own_devicelist_request_handler);
 #endif
 
+  // set up what the stanza callbacks need once, instead of on every message,
+  // and start initializing the axc context in the background
+  ret_val = lurch_ctx_create(purple_account_get_connection(acc_p), (void *) 0);
+  if (ret_val) {
+    purple_debug_error("lurch", "%s: %s (%i)\n", __func__, "failed to create the context of the connection", ret_val);
+    goto cleanup;
+  }
+
 cleanup:
   g_free(uname);
   free(dl_ns);
 }
 
+/**
+ * Set as callback for the "signing-off" signal.
+ * Drops the context of the connection, as it becomes invalid once the connection is gone.
+ */
+static void lurch_connection_signing_off_cb(PurpleConnection * gc_p) {
+  lurch_ctx_destroy(gc_p);
+}
+
 /**
  * For a list of lurch_addrs, checks which ones do not have an active session.
  * Note that the structs are not copied, the returned list is just a subset
@@ -1535,30 +1589,6 @@ cleanup:
   }
 }
 
-/**
- * Remove plaintext children of the original message stanza, then clone all children nodes of the encrypted
- * message and insert into the original message stanza.
- *
- * @param encrypted_msg_p Pointer to an xmlnode derived from omemo_message_export_encrypted() .
- * @param msg_stanza_pp   Pointer to the pointer to the <message> stanza.
- *
- */
-
-static void replace_msg_children(const xmlnode * encrypted_msg_p, xmlnode ** msg_stanza_pp) {
-  if ( !encrypted_msg_p || !msg_stanza_pp || !(*msg_stanza_pp)) {
-    return;
-  }
-  /* strip all possible child node first, as they should already exist inside `encrypted_msg` */
-  xmlnode * node = (*msg_stanza_pp)->child;
-  for (; node; node = (*msg_stanza_pp)->child) {
-    xmlnode_free(node);
-  }
-
-  for (node = encrypted_msg_p->child; node; node = node->next) {
-    xmlnode_insert_child(*msg_stanza_pp, xmlnode_copy(node));
-  }
-}
-
 /**
  * Does the final steps of encrypting the message.
  * If all devices have sessions, does the actual encrypting.
@@ -1580,8 +1610,6 @@ int lurch_msg_finalize_encryption(JabberStream * js_p, axc_context * axc_ctx_p,
   char * err_msg_dbg = (void *) 0;
 
   GList * no_sess_l_p = (void *) 0;
-  char * xml = (void *) 0;
-  xmlnode * temp_node_p = (void *) 0;
   lurch_queued_msg * qmsg_p = (void *) 0;
   GList * curr_item_p = (void *) 0;
   lurch_addr curr_addr = {0};
@@ -1600,18 +1628,15 @@ int lurch_msg_finalize_encryption(JabberStream * js_p, axc_context * axc_ctx_p,
       goto cleanup;
     }
 
-    ret_val = lurch_export_encrypted(om_msg_p, &xml);
+    ret_val = lurch_export_encrypted(om_msg_p, *msg_stanza_pp);
     if (ret_val) {
       err_msg_dbg = g_strdup_printf("failed to export omemo msg to xml");
       goto cleanup;
     }
 
     omemo_message_destroy(om_msg_p);
-    temp_node_p = xmlnode_from_str(xml, -1);
-    replace_msg_children(temp_node_p, msg_stanza_pp);
-    xmlnode_free(temp_node_p);
   } else {
-    ret_val = lurch_queued_msg_create(om_msg_p, addr_l_p, no_sess_l_p, &qmsg_p);
+    ret_val = lurch_queued_msg_create(om_msg_p, xmlnode_copy(*msg_stanza_pp), addr_l_p, no_sess_l_p, &qmsg_p);
     if (ret_val) {
       err_msg_dbg = g_strdup_printf("failed to create queued message");
       goto cleanup;
@@ -1643,12 +1668,40 @@ cleanup:
     free(qmsg_p);
   }
 
-  free(xml);
-
   return ret_val;
 }
 
 
+/**
+ * Gets the key for the device from the message, but only asks libomemo, which walks all keys on every call,
+ * if the index of the message's keys has one for the device.
+ *
+ * @param msg_p Pointer to the received omemo message.
+ * @param uname The own bare JID.
+ * @param rid The device ID to get the key for.
+ * @param key_index_pp Pointer to the index built by omemo_message_index_keys(), or to NULL to ask libomemo anyway.
+ *                     Freed and set to NULL if libomemo does not find a key the index has, so that it is not trusted any longer.
+ * @param key_pp Will point to the key if there is one, see omemo_message_get_encrypted_key().
+ * @param key_len_p Will be set to its length.
+ * @return 0 on success, even if there is no key, negative on error.
+ */
+static int lurch_msg_get_encrypted_key(omemo_message * msg_p, const char * uname, uint32_t rid,
+                                       GHashTable ** key_index_pp, uint8_t ** key_pp, size_t * key_len_p) {
+  int ret_val = 0;
+
+  if (*key_index_pp && !g_hash_table_contains(*key_index_pp, GUINT_TO_POINTER(rid))) {
+    return 0;
+  }
+
+  ret_val = omemo_message_get_encrypted_key(msg_p, uname, rid, key_pp, key_len_p);
+  if (!ret_val && !*key_pp && *key_index_pp) {
+    g_hash_table_destroy(*key_index_pp);
+    *key_index_pp = (void *) 0;
+  }
+
+  return ret_val;
+}
+
 /**
  * Set as callback for the "sending xmlnode" signal.
  * Encrypts the message body, if applicable.
@@ -1656,11 +1709,11 @@ cleanup:
 static void lurch_message_encrypt_im(PurpleConnection * gc_p, xmlnode ** msg_stanza_pp) {
   int ret_val = 0;
   char * err_msg_dbg = (void *) 0;
-  int len = 0;
 
-  PurpleAccount * acc_p = (void *) 0;
-  char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_ctx * ctx_p = (void *) 0;
+  const char * uname = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
   const char * to = (void *) 0;
   omemo_devicelist * dl_p = (void *) 0;
   GList * recipient_dl_p = (void *) 0;
@@ -1670,16 +1723,29 @@ static void lurch_message_encrypt_im(PurpleConnection * gc_p, xmlnode ** msg_sta
   uint32_t own_id = 0;
   omemo_message * msg_p = (void *) 0;
   GList * addr_l_p = (void *) 0;
-  char * recipient = (void *) 0;
+  lurch_arena arena;
+  const char * recipient = (void *) 0;
   char * tempxml = (void *) 0;
 
-  recipient = jabber_get_bare_jid(xmlnode_get_attrib(*msg_stanza_pp, "to"));
+  lurch_arena_init(&arena);
+  recipient = lurch_arena_bare_jid(&arena, xmlnode_get_attrib(*msg_stanza_pp, "to"));
 
-  acc_p = purple_connection_get_account(gc_p);
-  uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ctx_p = lurch_ctx_get(gc_p);
+  if (!ctx_p) {
+    ret_val = LURCH_ERR;
+    err_msg_dbg = g_strdup_printf("failed to get the context of the connection");
+    goto cleanup;
+  }
+  uname = ctx_p->uname;
+  // the worker might be decrypting with the same sessions
+  lurch_ctx_async_drain(ctx_p);
+  // a sent message advances its ratchets right away, not at the end of the catch-up
+  lurch_ctx_catchup_end(ctx_p);
+  store_p = ctx_p->store_p;
+  db_fn_omemo = ctx_p->db_fn_omemo;
+  cachectx_p = ctx_p->cachectx_p;
 
-  ret_val = omemo_storage_chatlist_exists(recipient, db_fn_omemo);
+  ret_val = lurch_store_chatlist_exists(store_p, recipient);
   if (ret_val < 0) {
     err_msg_dbg = g_strdup_printf("failed to look up %s in DB %s", recipient, db_fn_omemo);
     goto cleanup;
@@ -1688,27 +1754,18 @@ static void lurch_message_encrypt_im(PurpleConnection * gc_p, xmlnode ** msg_sta
     goto cleanup;
   }
 
-  ret_val = cachectx_get_from_map(get_acc_axc_ctx_map(), uname, &cachectx_p);
-  if (ret_val) {
-    err_msg_dbg = g_strdup_printf("failed to get axc ctx for %s", uname);
-    goto cleanup;
-  }
-
-  own_id = cachectx_get_faux_regid(cachectx_p);
-  tempxml = xmlnode_to_str(*msg_stanza_pp, &len);
-  ret_val = omemo_message_prepare_encryption(tempxml, own_id, &crypto, OMEMO_STRIP_ALL, &msg_p);
-  g_free(tempxml);
-  tempxml = (void *) 0;
+  own_id = ctx_p->faux_regid;
+  ret_val = lurch_msg_prepare_encryption(*msg_stanza_pp, own_id, &msg_p);
   if (ret_val) {
     err_msg_dbg = g_strdup_printf("failed to construct omemo message");
     goto cleanup;
   }
 
-  to = omemo_message_get_recipient_name_bare(msg_p);
+  to = recipient;
 
 #if 0
   // determine if recipient is omemo user
-  ret_val = omemo_storage_user_devicelist_retrieve(to, db_fn_omemo, &dl_p);
+  ret_val = lurch_store_devicelist_retrieve(store_p, to, &dl_p);
   if (ret_val) {
     err_msg_dbg = g_strdup_printf("failed to retrieve devicelist for %s", to);
     goto cleanup;
@@ -1739,7 +1796,7 @@ static void lurch_message_encrypt_im(PurpleConnection * gc_p, xmlnode ** msg_sta
 
   //dake only encrypt message for intended recipient.
 #if 0
-  ret_val = omemo_storage_user_devicelist_retrieve(uname, db_fn_omemo, &user_dl_p);
+  ret_val = lurch_store_devicelist_retrieve(store_p, uname, &user_dl_p);
   if (ret_val) {
     err_msg_dbg = g_strdup_printf("failed to retrieve devicelist for %s", uname);
     goto cleanup;
@@ -1793,26 +1850,24 @@ cleanup:
     omemo_message_destroy(msg_p);
     g_list_free_full(addr_l_p, lurch_addr_list_destroy_func);
   }
-  g_free(recipient);
-  g_free(uname);
-  g_free(db_fn_omemo);
   omemo_devicelist_destroy(dl_p);
   g_list_free_full(recipient_dl_p, free);
   omemo_devicelist_destroy(user_dl_p);
   g_list_free_full(own_dl_p, free);
   free(tempxml);
+  lurch_arena_release(&arena);
 }
 
 static void lurch_message_encrypt_groupchat(PurpleConnection * gc_p, xmlnode ** msg_stanza_pp) {
   int ret_val = 0;
   char * err_msg_dbg = (void *) 0;
-  int len;
 
-  char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_ctx * ctx_p = (void *) 0;
+  const char * uname = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
   axc_context_dake_cache * cachectx_p = (void *) 0;
   uint32_t own_id = 0;
-  char * tempxml = (void *) 0;
   omemo_message * om_msg_p = (void *) 0;
   omemo_devicelist * user_dl_p = (void *) 0;
   GList * addr_l_p = (void *) 0;
@@ -1823,15 +1878,30 @@ static void lurch_message_encrypt_groupchat(PurpleConnection * gc_p, xmlnode **
   xmlnode * body_node_p = (void *) 0;
   char * body_data = (void *) 0;
   GList * curr_item_p = (void *) 0;
-  char * curr_muc_member_jid = (void *) 0;
+  lurch_arena arena;
+  const char * curr_muc_member_jid = (void *) 0;
   omemo_devicelist * curr_dl_p = (void *) 0;
 
   const char * to = xmlnode_get_attrib(*msg_stanza_pp, "to");
 
-  uname = lurch_util_uname_strip(purple_account_get_username(purple_connection_get_account(gc_p)));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  lurch_arena_init(&arena);
+
+  ctx_p = lurch_ctx_get(gc_p);
+  if (!ctx_p) {
+    ret_val = LURCH_ERR;
+    err_msg_dbg = g_strdup_printf("failed to get the context of the connection");
+    goto cleanup;
+  }
+  uname = ctx_p->uname;
+  // the worker might be decrypting with the same sessions
+  lurch_ctx_async_drain(ctx_p);
+  // a sent message advances its ratchets right away, not at the end of the catch-up
+  lurch_ctx_catchup_end(ctx_p);
+  store_p = ctx_p->store_p;
+  db_fn_omemo = ctx_p->db_fn_omemo;
+  cachectx_p = ctx_p->cachectx_p;
 
-  ret_val = omemo_storage_chatlist_exists(to, db_fn_omemo);
+  ret_val = lurch_store_chatlist_exists(store_p, to);
   if (ret_val < 0) {
     err_msg_dbg = g_strdup_printf("failed to access db %s", db_fn_omemo);
     goto cleanup;
@@ -1839,21 +1909,14 @@ static void lurch_message_encrypt_groupchat(PurpleConnection * gc_p, xmlnode **
     goto cleanup;
   }
 
-  ret_val = cachectx_get_from_map(get_acc_axc_ctx_map(), uname, &cachectx_p);
-  if (ret_val) {
-    err_msg_dbg = g_strdup_printf("failed to get axc ctx for %s", uname);
-    goto cleanup;
-  }
-
-  own_id = cachectx_get_faux_regid(cachectx_p);
-  tempxml = xmlnode_to_str(*msg_stanza_pp, &len);
-  ret_val = omemo_message_prepare_encryption(tempxml, own_id, &crypto, OMEMO_STRIP_ALL, &om_msg_p);
+  own_id = ctx_p->faux_regid;
+  ret_val = lurch_msg_prepare_encryption(*msg_stanza_pp, own_id, &om_msg_p);
   if (ret_val) {
     err_msg_dbg = g_strdup_printf("failed to construct omemo message");
     goto cleanup;
   }
 
-  ret_val = omemo_storage_user_devicelist_retrieve(uname, db_fn_omemo, &user_dl_p);
+  ret_val = lurch_store_devicelist_retrieve(store_p, uname, &user_dl_p);
   if (ret_val) {
     err_msg_dbg = g_strdup_printf("failed to retrieve devicelist for %s", uname);
     goto cleanup;
@@ -1876,7 +1939,7 @@ static void lurch_message_encrypt_groupchat(PurpleConnection * gc_p, xmlnode **
 
   for (curr_item_p = g_hash_table_get_values(muc_p->members); curr_item_p; curr_item_p = curr_item_p->next) {
     curr_muc_member_p = (JabberChatMember *) curr_item_p->data;
-    curr_muc_member_jid = jabber_get_bare_jid(curr_muc_member_p->jid);
+    curr_muc_member_jid = lurch_arena_bare_jid(&arena, curr_muc_member_p->jid);
 
     if (!curr_muc_member_jid) {
       err_msg_dbg = g_strdup_printf("Could not find the JID for %s - the channel needs to be non-anonymous!", curr_muc_member_p->handle);
@@ -1898,7 +1961,7 @@ static void lurch_message_encrypt_groupchat(PurpleConnection * gc_p, xmlnode **
       continue;
     }
 
-    ret_val = omemo_storage_user_devicelist_retrieve(curr_muc_member_jid, db_fn_omemo, &curr_dl_p);
+    ret_val = lurch_store_devicelist_retrieve(store_p, curr_muc_member_jid, &curr_dl_p);
     if (ret_val) {
       err_msg_dbg = g_strdup_printf("Could not retrieve the devicelist for %s from %s", curr_muc_member_jid, db_fn_omemo);
       goto cleanup;
@@ -1941,11 +2004,9 @@ cleanup:
     g_list_free_full(addr_l_p, lurch_addr_list_destroy_func);
   }
 
-  g_free(uname);
-  g_free(db_fn_omemo);
-  g_free(tempxml);
   g_free(body_data);
   omemo_devicelist_destroy(user_dl_p);
+  lurch_arena_release(&arena);
 }
 
 static void lurch_xml_sent_cb(PurpleConnection * gc_p, xmlnode ** stanza_pp) {
@@ -1977,8 +2038,14 @@ static void lurch_xml_sent_cb(PurpleConnection * gc_p, xmlnode ** stanza_pp) {
     }
 
     if (!g_strcmp0(type, "chat")) {
+      if (lurch_ctx_hold(gc_p, stanza_pp, TRUE)) {
+        return;
+      }
       lurch_message_encrypt_im(gc_p, stanza_pp);
     } else if (FALSE && !g_strcmp0(type, "groupchat")) {
+      if (lurch_ctx_hold(gc_p, stanza_pp, TRUE)) {
+        return;
+      }
       lurch_message_encrypt_groupchat(gc_p, stanza_pp);
     }
   }
@@ -1988,154 +2055,278 @@ static void lurch_xml_sent_cb(PurpleConnection * gc_p, xmlnode ** stanza_pp) {
  * Callback for the "receiving xmlnode" signal.
  * Decrypts message, if applicable.
  */
-static void lurch_message_decrypt(PurpleConnection * gc_p, xmlnode ** msg_stanza_pp) {
+/**
+ * Retracts the bundles of the faux device ids used by the offline messages and drops the ids,
+ * once in the background after the catch-up instead of in the middle of handling a message.
+ */
+static gboolean lurch_offline_cleanup(gpointer data) {
+  lurch_ctx * ctx_p = data;
+  JabberStream * js_p = purple_connection_get_protocol_data(ctx_p->gc_p);
+  GList * faux_l_p = ctx_p->cleanup_faux_l_p;
+
+  ctx_p->cleanup_id = 0;
+  ctx_p->cleanup_faux_l_p = (void *) 0;
+
+  lurch_delete_used_bundle(js_p, faux_l_p);
+  jabber_pep_request_item(js_p, ctx_p->uname, OMEMO_DEVICELIST_PEP_NODE, NULL, lurch_pep_own_devicelist_remove_faux_id);
+  lurch_delete_faux_ids(ctx_p->uname, faux_l_p);
+
+  g_list_free_full(faux_l_p, free);
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * The decryption of a received message, split in what has to run on the main loop before and after it,
+ * so that the part in between can run on the worker of the connection, see lurch_ctx_async_submit().
+ * The results of the work are kept here until they can be presented.
+ */
+typedef struct {
+  PurpleConnection * gc_p;
+  lurch_ctx * ctx_p;
+  lurch_arena arena;
+  gboolean ready;                     // the work can start, otherwise the message is left alone or ret_val is set
+  int ret_val;
+  char * err_msg_dbg;
+  const char * note;                  // logged on the main loop
+
+  const char * type;
+  const char * from;
+  PurpleConversationType e_type;
+  const char * sender;
+  const char * room_name;
+  const char * recipient_bare_jid;
+  gboolean delayed;
+  gboolean is_jabber;
+  omemo_devicelist * own_dl_p;        // taken from the cache on the main loop if it is there
+
+  gboolean no_key;
+  gboolean duplicate;
+  axc_address sender_addr;
+  uint8_t * idake_reply_p;            // the last authentication message of the IDAKE, to be sent back
+  size_t idake_reply_len;
+  gboolean idake_initiated;
+  gboolean offline_done;              // this is the first online message after the offline ones
+  GList * dl;
+  xmlnode * body_node_p;              // set once the message was decrypted
+} lurch_decrypt_job;
+
+static void lurch_decrypt_job_free(gpointer data) {
+  lurch_decrypt_job * job_p = data;
+
+  g_free(job_p->err_msg_dbg);
+  g_free(job_p->idake_reply_p);
+  omemo_devicelist_destroy(job_p->own_dl_p);
+  g_list_free_full(job_p->dl, free);
+  lurch_arena_release(&job_p->arena);
+  g_free(job_p);
+}
+
+/**
+ * Looks up the conversation of the message and what else needs libpurple. Runs on the main loop.
+ *
+ * @param gc_p The connection.
+ * @param msg_stanza_p The received <message> stanza.
+ * @param async Whether the work will run on the worker.
+ * @return The job, to be freed with lurch_decrypt_job_free().
+ */
+static lurch_decrypt_job * lurch_message_decrypt_prepare(PurpleConnection * gc_p, xmlnode * msg_stanza_p, gboolean async) {
   int ret_val = 0;
   char * err_msg_dbg = (void *) 0;
-  int len;
 
-  omemo_message * msg_p = (void *) 0;
-  char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
-  axc_context_dake_cache* cachectx_p = (void *) 0;
-  uint32_t own_id = 0;
-  uint32_t faux_id = 0;
-  uint8_t * key_p = (void *) 0;
-  size_t key_len = 0;
-  axc_buf * key_buf_p = (void *) 0;
-  axc_buf * key_decrypted_p = (void *) 0;
-  char * sender_name = (void *) 0;
-  axc_address sender_addr = {0};
-  char * bundle_node_name = (void *) 0;
-  omemo_message * keytransport_msg_p = (void *) 0;
-  char * xml = (void *) 0;
-  char * sender = (void *) 0;
-  char ** split = (void *) 0;
-  const char * room_name = (void *) 0;
+  lurch_decrypt_job * job_p = g_malloc0(sizeof(lurch_decrypt_job));
+  lurch_ctx * ctx_p = (void *) 0;
+  const char * uname = (void *) 0;
+  const char * slash_p = (void *) 0;
   const char * buddy_nick = (void *) 0;
-  xmlnode * plaintext_msg_node_p = (void *) 0;
-  char * recipient_bare_jid = (void *) 0;
-  char * body_data = (void *) 0;
   PurpleConversation * conv_p = (void *) 0;
   JabberChat * muc_p = (void *) 0;
   JabberChatMember * muc_member_p = (void *) 0;
+  lurch_arena * arena_p = &job_p->arena;
 
-  const char * type = xmlnode_get_attrib(*msg_stanza_pp, "type");
-  PurpleConversationType e_type = PURPLE_CONV_TYPE_UNKNOWN;
-  const char * from = xmlnode_get_attrib(*msg_stanza_pp, "from");
-  const char * to   = xmlnode_get_attrib(*msg_stanza_pp, "to");
+  const char * to = xmlnode_get_attrib(msg_stanza_p, "to");
 
-  GList * dl = (void *) 0;
+  lurch_arena_init(arena_p);
+  job_p->gc_p = gc_p;
+  job_p->e_type = PURPLE_CONV_TYPE_UNKNOWN;
+  // copied, as the stanza is freed before the job if it is not passed on
+  job_p->type = lurch_arena_strdup(arena_p, xmlnode_get_attrib(msg_stanza_p, "type"));
+  job_p->from = lurch_arena_strdup(arena_p, xmlnode_get_attrib(msg_stanza_p, "from"));
 
   if (uninstall) {
     goto cleanup;
   }
 
-  uname = lurch_util_uname_strip(purple_account_get_username(purple_connection_get_account(gc_p)));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ctx_p = lurch_ctx_get(gc_p);
+  if (!ctx_p) {
+    ret_val = LURCH_ERR;
+    err_msg_dbg = g_strdup_printf("failed to get the context of the connection");
+    goto cleanup;
+  }
+  job_p->ctx_p = ctx_p;
+  uname = ctx_p->uname;
+
+  job_p->delayed = xmlnode_get_child_with_namespace(msg_stanza_p, "delay", DELAY_URN) ? TRUE : FALSE;
+  if (async) {
+    // the worker saves the session changes of everything that piled up together instead
+    lurch_ctx_catchup_end(ctx_p);
+  } else {
+    // the offline messages after signing on are saved together
+    lurch_ctx_async_drain(ctx_p);
+    if (job_p->delayed) {
+      lurch_ctx_catchup_add(ctx_p);
+    } else {
+      lurch_ctx_catchup_end(ctx_p);
+    }
+  }
 
   // on prosody and possibly other servers, messages to the own account do not have a recipient
   if (!to) {
-    recipient_bare_jid = g_strdup(uname);
+    job_p->recipient_bare_jid = uname;
   } else {
-    recipient_bare_jid = jabber_get_bare_jid(to);
+    job_p->recipient_bare_jid = lurch_arena_bare_jid(arena_p, to);
   }
 
-  if (!g_strcmp0(type, "chat")) {
-    e_type = PURPLE_CONV_TYPE_IM;
-    sender = jabber_get_bare_jid(from);
-    ret_val = omemo_storage_chatlist_exists(sender, db_fn_omemo);
+  if (!g_strcmp0(job_p->type, "chat")) {
+    job_p->e_type = PURPLE_CONV_TYPE_IM;
+    job_p->sender = lurch_arena_bare_jid(arena_p, job_p->from);
+    ret_val = lurch_store_chatlist_exists(ctx_p->store_p, job_p->sender);
     if (ret_val < 0) {
-      err_msg_dbg = g_strdup_printf("failed to look up %s in %s", sender, db_fn_omemo);
+      err_msg_dbg = g_strdup_printf("failed to look up %s in %s", job_p->sender, ctx_p->db_fn_omemo);
       goto cleanup;
     } else if (ret_val == 1) {
-      purple_conv_present_error(sender, purple_connection_get_account(gc_p), "Received encrypted message in blacklisted conversation.");
+      purple_conv_present_error(job_p->sender, purple_connection_get_account(gc_p), "Received encrypted message in blacklisted conversation.");
     }
-  } else if (!g_strcmp0(type, "groupchat")) {
-    e_type = PURPLE_CONV_TYPE_CHAT;
-    split = g_strsplit(from, "/", 2);
-    room_name = split[0];
-    buddy_nick = split[1];
+  } else if (!g_strcmp0(job_p->type, "groupchat")) {
+    job_p->e_type = PURPLE_CONV_TYPE_CHAT;
+    slash_p = strchr(job_p->from, '/');
+    job_p->room_name = slash_p ? lurch_arena_strndup(arena_p, job_p->from, slash_p - job_p->from) : job_p->from;
+    buddy_nick = slash_p ? slash_p + 1 : (void *) 0;
 
-    ret_val = omemo_storage_chatlist_exists(room_name, db_fn_omemo);
+    ret_val = lurch_store_chatlist_exists(ctx_p->store_p, job_p->room_name);
     if (ret_val < 0) {
-      err_msg_dbg = g_strdup_printf("failed to look up %s in %s", room_name, db_fn_omemo);
+      err_msg_dbg = g_strdup_printf("failed to look up %s in %s", job_p->room_name, ctx_p->db_fn_omemo);
       goto cleanup;
     } else if (ret_val == 0) {
-      purple_conv_present_error(room_name, purple_connection_get_account(gc_p), "Received encrypted message in non-OMEMO room.");
+      purple_conv_present_error(job_p->room_name, purple_connection_get_account(gc_p), "Received encrypted message in non-OMEMO room.");
     }
 
-    conv_p = purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT, room_name, purple_connection_get_account(gc_p));
+    conv_p = purple_find_conversation_with_account(PURPLE_CONV_TYPE_CHAT, job_p->room_name, purple_connection_get_account(gc_p));
     if (!conv_p) {
-      err_msg_dbg = g_strdup_printf("could not find groupchat %s", room_name);
+      err_msg_dbg = g_strdup_printf("could not find groupchat %s", job_p->room_name);
       goto cleanup;
     }
 
     muc_p = jabber_chat_find_by_conv(conv_p);
     if (!muc_p) {
-      err_msg_dbg = g_strdup_printf("could not find muc struct for groupchat %s", room_name);
+      err_msg_dbg = g_strdup_printf("could not find muc struct for groupchat %s", job_p->room_name);
       goto cleanup;
     }
 
     muc_member_p = g_hash_table_lookup(muc_p->members, buddy_nick);
     if (!muc_member_p) {
-      purple_debug_misc("lurch", "Received OMEMO message in MUC %s, but the sender %s is not present in the room, which can happen during history catchup. Skipping.\n", room_name, buddy_nick);
+      purple_debug_misc("lurch", "Received OMEMO message in MUC %s, but the sender %s is not present in the room, which can happen during history catchup. Skipping.\n", job_p->room_name, buddy_nick);
       goto cleanup;
     }
 
     if (!muc_member_p->jid) {
-      err_msg_dbg = g_strdup_printf("jid for user %s in muc %s not found, is the room anonymous?", buddy_nick, room_name);
+      err_msg_dbg = g_strdup_printf("jid for user %s in muc %s not found, is the room anonymous?", buddy_nick, job_p->room_name);
       goto cleanup;
     }
 
-    sender = jabber_get_bare_jid(muc_member_p->jid);
-  }
-  xml = xmlnode_to_str(*msg_stanza_pp, &len);
-  ret_val = omemo_message_prepare_decryption(xml, &msg_p);
-  if (ret_val) {
-    err_msg_dbg = g_strdup_printf("failed import msg for decryption");
-    goto cleanup;
+    job_p->sender = lurch_arena_bare_jid(arena_p, muc_member_p->jid);
   }
 
-  ret_val = cachectx_get_from_map(get_acc_axc_ctx_map(), uname, &cachectx_p);
-  if (ret_val) {
-    err_msg_dbg = g_strdup_printf("failed to get axc ctx for %s", uname);
-    goto cleanup;
+  job_p->is_jabber = !strncmp(purple_account_get_protocol_id(purple_connection_get_account(gc_p)),
+                              JABBER_PROTOCOL_ID, strlen(JABBER_PROTOCOL_ID));
+
+  if (async) {
+    // only needed if the message has no key for the current faux id, but the devicelist cache is not thread-safe,
+    // on a miss the worker reads it from the db instead of the main loop waiting for the worker's lease
+    ret_val = lurch_store_devicelist_cache_peek(ctx_p->store_p, uname, &job_p->own_dl_p);
+    if (ret_val) {
+      err_msg_dbg = g_strdup_printf("failed to get own device id list");
+      goto cleanup;
+    }
   }
 
-#if 0
-  ret_val = axc_get_device_id(&ctx_p->base.base, &own_id);
+  ret_val = 0;
+  job_p->ready = TRUE;
+
+cleanup:
+  job_p->ret_val = ret_val;
+  job_p->err_msg_dbg = err_msg_dbg;
+
+  return job_p;
+}
+
+/**
+ * Decrypts the message and saves the session changes. Does not call into libpurple,
+ * so that it can run on the worker, see lurch_ctx_work_fn.
+ */
+static void lurch_message_decrypt_work(void * data_p, xmlnode * msg_stanza_p) {
+  int ret_val = 0;
+  char * err_msg_dbg = (void *) 0;
+
+  lurch_decrypt_job * job_p = data_p;
+  omemo_message * msg_p = (void *) 0;
+  const char * uname = job_p->ctx_p->uname;
+  lurch_store * store_p = job_p->ctx_p->store_p;
+  gboolean msg_scope_open = FALSE;
+  axc_context_dake_cache* cachectx_p = job_p->ctx_p->cachectx_p;
+  uint32_t faux_id = 0;
+  GHashTable * key_index_p = (void *) 0;
+  uint8_t * key_p = (void *) 0;
+  size_t key_len = 0;
+  axc_buf * key_buf_p = (void *) 0;
+  axc_buf * key_decrypted_p = (void *) 0;
+  axc_address sender_addr = {0};
+  char * bundle_node_name = (void *) 0;
+  char * plaintext = (void *) 0;
+  xmlnode * body_node_p = (void *) 0;
+  char * body_data = (void *) 0;
+
+  ret_val = lurch_xml_prepare_decryption(msg_stanza_p, &msg_p);
   if (ret_val) {
-    err_msg_dbg = g_strdup_printf("failed to get own device id");
+    err_msg_dbg = g_strdup_printf("failed import msg for decryption");
     goto cleanup;
   }
-#endif
 
-  faux_id = cachectx_get_faux_regid(cachectx_p);
+  faux_id = job_p->ctx_p->faux_regid;
+  key_index_p = omemo_message_index_keys(msg_p, uname);
   do {
-    omemo_devicelist* odl = (void *) 0;
-    ret_val = omemo_message_get_encrypted_key(msg_p, uname, faux_id, &key_p, &key_len);
+    ret_val = lurch_msg_get_encrypted_key(msg_p, uname, faux_id, &key_index_p, &key_p, &key_len);
     if (ret_val || key_p) {
       break;
     }
-    ret_val = omemo_storage_user_devicelist_retrieve(uname, db_fn_omemo, &odl);
-    if (ret_val) {
-      err_msg_dbg = g_strdup_printf("failed to get own device id list");
-      goto cleanup;
+    // not meant for any of the own devices, e.g. the message only carries keys for the other participants
+    if (key_index_p && !g_hash_table_size(key_index_p)) {
+      break;
     }
-    dl = omemo_devicelist_get_id_list(odl);
-    omemo_devicelist_destroy(odl);
+    if (!job_p->own_dl_p) {
+      // the worker must not touch the cache, which the main loop keeps using
+      if (job_p->ctx_p->pipe_p && g_thread_self() == lurch_pipe_get_worker(job_p->ctx_p->pipe_p)) {
+        ret_val = lurch_store_devicelist_load(store_p, uname, &job_p->own_dl_p);
+      } else {
+        ret_val = lurch_store_devicelist_retrieve(store_p, uname, &job_p->own_dl_p);
+      }
+      if (ret_val) {
+        err_msg_dbg = g_strdup_printf("failed to get own device id list");
+        goto cleanup;
+      }
+    }
+    job_p->dl = omemo_devicelist_get_id_list(job_p->own_dl_p);
 
     // Special case to handle IDAKE_HINT, with rid == 0
-    ret_val = omemo_message_get_encrypted_key(msg_p, uname, 0, &key_p, &key_len);
+    ret_val = lurch_msg_get_encrypted_key(msg_p, uname, 0, &key_index_p, &key_p, &key_len);
     if (ret_val || key_p) {
       break;
     }
 
     {
-      GList* cur = dl;
+      GList* cur = job_p->dl;
       for (; cur; cur = cur->next) {
 	faux_id = omemo_devicelist_list_data(cur);
-	ret_val = omemo_message_get_encrypted_key(msg_p, uname, faux_id, &key_p, &key_len);
+	ret_val = lurch_msg_get_encrypted_key(msg_p, uname, faux_id, &key_index_p, &key_p, &key_len);
 	if (ret_val || key_p) {
 	  break;
 	}
@@ -2148,17 +2339,14 @@ static void lurch_message_decrypt(PurpleConnection * gc_p, xmlnode ** msg_stanza
     goto cleanup;
   }
   if (!key_p) {
-    const char *to = room_name ?: sender;
-
-    purple_debug_info("lurch", "received omemo message that does not contain a key for this device, skipping\n");
-    purple_conv_present_error(to, purple_connection_get_account(gc_p),
-			      "Received omemo message that does not contain a key for this device");
+    job_p->no_key = TRUE;
     goto cleanup;
   }
 
-  sender_addr.name = sender;
+  sender_addr.name = job_p->sender;
   sender_addr.name_len = strnlen(sender_addr.name, JABBER_MAX_LEN_BARE);
   sender_addr.device_id = omemo_message_get_sender_id(msg_p);
+  job_p->sender_addr = sender_addr;
 
   do {
     const axc_buf* lastauthmsg = NULL;
@@ -2174,35 +2362,13 @@ static void lurch_message_decrypt(PurpleConnection * gc_p, xmlnode ** msg_stanza
     }
 
     if (lastauthmsg) {
-      xmlnode* idakemsg_node_p = NULL;
-      ret_val = lurch_dake_create_idake_msg(&idakemsg_node_p,
-					    &err_msg_dbg,
-					    (JabberStream*)purple_connection_get_protocol_data(gc_p),
-					    type, sender_addr.name, sender_addr.device_id,
-					    cachectx_get_faux_regid(cachectx_p),
-					    axc_buf_get_data((axc_buf*)lastauthmsg),
-					    axc_buf_get_len((axc_buf*)lastauthmsg));
-      if (ret_val < 0) {
-	goto cleanup;
-      }
-      purple_signal_emit(purple_plugins_find_with_id("prpl-jabber"),
-		       "jabber-sending-xmlnode", gc_p, &idakemsg_node_p);
-      xmlnode_free(idakemsg_node_p);
-      purple_debug_info("lurch", "%s: %s sent idakemsg to %s:%i\n", __func__,
-			uname, sender_addr.name, sender_addr.device_id);
+      // copied, as it belongs to the session and the reply is only sent from the main loop
+      job_p->idake_reply_len = axc_buf_get_len((axc_buf*)lastauthmsg);
+      job_p->idake_reply_p = g_malloc(job_p->idake_reply_len);
+      memcpy(job_p->idake_reply_p, axc_buf_get_data((axc_buf*)lastauthmsg), job_p->idake_reply_len);
     }
 
-    if (0 < axc_dake_session_exists_initiated(&sender_addr, &cachectx_p->base)) {
-      conv_p = purple_find_conversation_with_account(PURPLE_CONV_TYPE_ANY, from,
-						     purple_connection_get_account(gc_p));
-      if (!conv_p) {
-	conv_p = purple_conversation_new(e_type, purple_connection_get_account(gc_p), from);
-      }
-      gchar* info = g_strdup_printf("idake session to %s:%i initiated",
-				    sender_addr.name, sender_addr.device_id);
-      purple_conversation_write(conv_p, uname, info, PURPLE_MESSAGE_SYSTEM, time(NULL));
-      g_free(info);
-    }
+    job_p->idake_initiated = 0 < axc_dake_session_exists_initiated(&sender_addr, &cachectx_p->base);
     goto cleanup;
   } while(0);
 
@@ -2212,16 +2378,18 @@ static void lurch_message_decrypt(PurpleConnection * gc_p, xmlnode ** msg_stanza
     goto cleanup;
   }
 
+  // the session changes of this message are only saved once its payload could be decrypted
+  lurch_store_msg_begin(store_p);
+  msg_scope_open = TRUE;
+
   ret_val = axc_pre_key_message_process_dake(key_buf_p, &sender_addr, &cachectx_p->base.base, &key_decrypted_p);
   if (ret_val == AXC_ERR_NOT_A_PREKEY_MSG) {
     if (0 < axc_dake_session_exists_initiated(&sender_addr, &cachectx_p->base)) {
       ret_val = axc_message_dec_from_ser_dake(key_buf_p, &sender_addr, &cachectx_p->base.base, &key_decrypted_p);
       if (ret_val) {
-        if (ret_val == SG_ERR_DUPLICATE_MESSAGE && !g_strcmp0(sender, uname) && !g_strcmp0(recipient_bare_jid, uname)) {
+        if (ret_val == SG_ERR_DUPLICATE_MESSAGE && !g_strcmp0(job_p->sender, uname) && !g_strcmp0(job_p->recipient_bare_jid, uname)) {
           // in combination with message carbons, sending a message to your own account results in it arriving twice
-          purple_debug_warning("lurch", "ignoring decryption error due to a duplicate message from own account to own account\n");
-	  xmlnode_free(*msg_stanza_pp);
-          *msg_stanza_pp = (void *) 0;
+          job_p->duplicate = TRUE;
           goto cleanup;
         } else {
           err_msg_dbg = g_strdup_printf("failed to decrypt key");
@@ -2229,7 +2397,7 @@ static void lurch_message_decrypt(PurpleConnection * gc_p, xmlnode ** msg_stanza
         }
       }
     } else {
-      purple_debug_info("lurch", "received omemo message but no session with the device exists, ignoring\n");
+      job_p->note = "received omemo message but no session with the device exists, ignoring";
       goto cleanup;
     }
   } else if (0 && (ret_val == AXC_ERR_INVALID_KEY_ID)) {
@@ -2239,7 +2407,7 @@ static void lurch_message_decrypt(PurpleConnection * gc_p, xmlnode ** msg_stanza
       goto cleanup;
     }
 
-    jabber_pep_request_item(purple_connection_get_protocol_data(gc_p),
+    jabber_pep_request_item(purple_connection_get_protocol_data(job_p->gc_p),
                             sender_addr.name, bundle_node_name,
                             (void *) 0,
                             lurch_pep_bundle_for_keytransport);
@@ -2248,47 +2416,45 @@ static void lurch_message_decrypt(PurpleConnection * gc_p, xmlnode ** msg_stanza
     err_msg_dbg = g_strdup_printf("failed to prekey msg");
     goto cleanup;
   } else if (0) {
-    lurch_bundle_publish_own(purple_connection_get_protocol_data(gc_p));
+    lurch_bundle_publish_own(purple_connection_get_protocol_data(job_p->gc_p));
   }
 
-  if (xmlnode_get_child_with_namespace(*msg_stanza_pp, "delay", DELAY_URN)) {
+  if (job_p->delayed) {
     // This message is an offline message, set the corresponding status
     cachectx_set_offline_msg_state(cachectx_p, TRUE);
   } else if (cachectx_has_offline_msg(cachectx_p)) {
-    // This message is the first online message, delete former bundles
+    // This message is the first online message, delete former bundles once it is handled
 
-    if (strncmp(purple_account_get_protocol_id(purple_connection_get_account(gc_p)),
-		JABBER_PROTOCOL_ID, strlen(JABBER_PROTOCOL_ID))) {
+    if (!job_p->is_jabber) {
       err_msg_dbg = g_strdup("incompatible protocol");
       goto cleanup;
     }
-    JabberStream* js_p = (JabberStream*)purple_connection_get_protocol_data(gc_p);
-    lurch_delete_used_bundle(js_p, dl);
-    jabber_pep_request_item(js_p, uname, OMEMO_DEVICELIST_PEP_NODE, NULL, lurch_pep_own_devicelist_remove_faux_id);
-    if (ret_val) {
-      goto cleanup;
-    }
-    lurch_delete_faux_ids(uname, dl);
+    job_p->offline_done = TRUE;
     cachectx_set_offline_msg_state(cachectx_p, FALSE);
   }
 
   if (!omemo_message_has_payload(msg_p)) {
-    purple_debug_info("lurch", "received keytransportmsg\n");
+    job_p->note = "received keytransportmsg";
     goto cleanup;
   }
 
-  g_free(xml);
-  xml = (void *) 0;
-  ret_val = omemo_message_export_decrypted(msg_p, axc_buf_get_data(key_decrypted_p), axc_buf_get_len(key_decrypted_p), &crypto, &xml);
+  ret_val = omemo_message_decrypt_payload(msg_p, axc_buf_get_data(key_decrypted_p), axc_buf_get_len(key_decrypted_p), &crypto, &plaintext);
   if (ret_val) {
     err_msg_dbg = g_strdup_printf("failed to decrypt payload");
     goto cleanup;
   }
 
-  plaintext_msg_node_p = xmlnode_from_str(xml, -1);
+  msg_scope_open = FALSE;
+  ret_val = lurch_store_msg_commit(store_p);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to save the session changes");
+    goto cleanup;
+  }
+
+  body_node_p = lurch_xml_set_decrypted_body(msg_stanza_p, plaintext);
 
   {
-    xmlnode* body = xmlnode_get_child(plaintext_msg_node_p, "body");
+    xmlnode* body = body_node_p;
     if (body) {
       body_data = xmlnode_get_data(body);
       if (0 == g_strcmp0(TERM_HINT, body_data)) {
@@ -2306,58 +2472,176 @@ static void lurch_message_decrypt(PurpleConnection * gc_p, xmlnode ** msg_stanza
 					 sender_addr.name, sender_addr.device_id, peer_real_devid);
 	   goto cleanup;
 	} else {
-	  gchar* info = g_strdup_printf("%s:%i (%i) has terminated their dake session to you",
-					sender_addr.name, sender_addr.device_id, peer_real_devid);
+	  const char* info = lurch_arena_printf(&job_p->arena, "%s:%i (%i) has terminated their dake session to you",
+						sender_addr.name, sender_addr.device_id, peer_real_devid);
 	  xmlnode* data_node = body->child;
 	  for (; data_node; data_node = body->child) {
 	    xmlnode_free(data_node);
 	  }
 	  xmlnode_insert_data(body, info, -1);
-	  g_free(info);
 	}
       }
-      g_free(body_data);
-      body_data = NULL;
     }
   }
 
+  job_p->body_node_p = body_node_p;
+
+cleanup:
+  if (msg_scope_open) {
+    // e.g. key transport messages end early, but still advance the ratchet
+    if (err_msg_dbg) {
+      lurch_store_msg_rollback(store_p);
+    } else if (lurch_store_msg_commit(store_p)) {
+      err_msg_dbg = g_strdup_printf("failed to save the session changes");
+    }
+  }
+  job_p->ret_val = ret_val;
+  job_p->err_msg_dbg = err_msg_dbg;
+
+  g_free(plaintext);
+  free(bundle_node_name);
+  signal_buffer_bzero_free(key_decrypted_p);
+  axc_buf_free(key_buf_p);
+  g_free(key_p);
+  g_free(body_data);
+  omemo_message_destroy(msg_p);
+  if (key_index_p) {
+    g_hash_table_destroy(key_index_p);
+  }
+}
+
+/**
+ * Presents the results of the decryption and answers IDAKE messages. Runs on the main loop,
+ * see lurch_ctx_finish_fn.
+ */
+static void lurch_message_decrypt_finish(void * data_p, xmlnode ** msg_stanza_pp) {
+  lurch_decrypt_job * job_p = data_p;
+  int ret_val = job_p->ret_val;
+  char * err_msg_dbg = job_p->err_msg_dbg;
+
+  PurpleConnection * gc_p = job_p->gc_p;
+  lurch_ctx * ctx_p = job_p->ctx_p;
+  axc_address * sender_addr_p = &job_p->sender_addr;
+  PurpleConversation * conv_p = (void *) 0;
+  char * body_data = (void *) 0;
+
+  job_p->err_msg_dbg = (void *) 0;
+
+  if (err_msg_dbg || !job_p->ready) {
+    goto cleanup;
+  }
+
+  if (job_p->note) {
+    purple_debug_info("lurch", "%s\n", job_p->note);
+  }
+
+  if (job_p->no_key) {
+    const char *to = job_p->room_name ?: job_p->sender;
+
+    purple_debug_info("lurch", "received omemo message that does not contain a key for this device, skipping\n");
+    purple_conv_present_error(to, purple_connection_get_account(gc_p),
+			      "Received omemo message that does not contain a key for this device");
+    goto cleanup;
+  }
+
+  if (job_p->idake_reply_p) {
+    xmlnode* idakemsg_node_p = NULL;
+    ret_val = lurch_dake_create_idake_msg(&idakemsg_node_p,
+					  &err_msg_dbg,
+					  (JabberStream*)purple_connection_get_protocol_data(gc_p),
+					  job_p->type, sender_addr_p->name, sender_addr_p->device_id,
+					  cachectx_get_faux_regid(ctx_p->cachectx_p),
+					  job_p->idake_reply_p, job_p->idake_reply_len);
+    if (ret_val < 0) {
+      goto cleanup;
+    }
+    purple_signal_emit(purple_plugins_find_with_id("prpl-jabber"),
+		       "jabber-sending-xmlnode", gc_p, &idakemsg_node_p);
+    xmlnode_free(idakemsg_node_p);
+    purple_debug_info("lurch", "%s: %s sent idakemsg to %s:%i\n", __func__,
+		      ctx_p->uname, sender_addr_p->name, sender_addr_p->device_id);
+  }
+
+  if (job_p->idake_initiated) {
+    conv_p = purple_find_conversation_with_account(PURPLE_CONV_TYPE_ANY, job_p->from,
+						   purple_connection_get_account(gc_p));
+    if (!conv_p) {
+      conv_p = purple_conversation_new(job_p->e_type, purple_connection_get_account(gc_p), job_p->from);
+    }
+    const char* info = lurch_arena_printf(&job_p->arena, "idake session to %s:%i initiated",
+					  sender_addr_p->name, sender_addr_p->device_id);
+    purple_conversation_write(conv_p, ctx_p->uname, info, PURPLE_MESSAGE_SYSTEM, time(NULL));
+  }
+
+  if (job_p->offline_done) {
+    ctx_p->cleanup_faux_l_p = g_list_concat(ctx_p->cleanup_faux_l_p, job_p->dl);
+    job_p->dl = (void *) 0;
+    if (!ctx_p->cleanup_id) {
+      ctx_p->cleanup_id = g_idle_add(lurch_offline_cleanup, ctx_p);
+    }
+  }
+
+  if (job_p->duplicate) {
+    purple_debug_warning("lurch", "ignoring decryption error due to a duplicate message from own account to own account\n");
+    xmlnode_free(*msg_stanza_pp);
+    *msg_stanza_pp = (void *) 0;
+    goto cleanup;
+  }
+
   // libpurple doesn't know what to do with incoming messages addressed to someone else, so they need to be written to the conversation manually
   // incoming messages from the own account in MUCs are fine though
-  xmlnode_free(*msg_stanza_pp);
-  if (!g_strcmp0(sender, uname) && !g_strcmp0(type, "chat")) {
-    conv_p = purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, recipient_bare_jid, purple_connection_get_account(gc_p));
+  if (job_p->body_node_p && !g_strcmp0(job_p->sender, ctx_p->uname) && !g_strcmp0(job_p->type, "chat")) {
+    conv_p = purple_find_conversation_with_account(PURPLE_CONV_TYPE_IM, job_p->recipient_bare_jid, purple_connection_get_account(gc_p));
     if (!conv_p) {
-      conv_p = purple_conversation_new(PURPLE_CONV_TYPE_IM, purple_connection_get_account(gc_p), recipient_bare_jid);
+      conv_p = purple_conversation_new(PURPLE_CONV_TYPE_IM, purple_connection_get_account(gc_p), job_p->recipient_bare_jid);
     }
-    body_data = xmlnode_get_data(xmlnode_get_child(plaintext_msg_node_p, "body"));
-    purple_conversation_write(conv_p, uname, body_data, PURPLE_MESSAGE_SEND, time((void *) 0));
+    body_data = xmlnode_get_data(job_p->body_node_p);
+    purple_conversation_write(conv_p, ctx_p->uname, body_data, PURPLE_MESSAGE_SEND, time((void *) 0));
+    xmlnode_free(*msg_stanza_pp);
     *msg_stanza_pp = (void *) 0;
-  } else {
-    *msg_stanza_pp = plaintext_msg_node_p;
   }
 
 cleanup:
   if (err_msg_dbg) {
-    purple_conv_present_error(sender, purple_connection_get_account(gc_p), LURCH_ERR_STRING_DECRYPT);
+    purple_conv_present_error(job_p->sender, purple_connection_get_account(gc_p), LURCH_ERR_STRING_DECRYPT);
     purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
     g_free(err_msg_dbg);
   }
 
-  g_strfreev(split);
-  g_free(sender);
-  free(xml);
-  free(bundle_node_name);
-  free(sender_name);
-  axc_buf_free(key_decrypted_p);
-  axc_buf_free(key_buf_p);
-  g_free(key_p);
-  g_free(uname);
-  g_free(db_fn_omemo);
-  g_free(recipient_bare_jid);
   g_free(body_data);
-  omemo_message_destroy(keytransport_msg_p);
-  omemo_message_destroy(msg_p);
-  g_list_free_full(dl, free);
+}
+
+static void lurch_message_decrypt(PurpleConnection * gc_p, xmlnode ** msg_stanza_pp) {
+  lurch_decrypt_job * job_p = lurch_message_decrypt_prepare(gc_p, *msg_stanza_pp, FALSE);
+
+  if (job_p->ready) {
+    lurch_message_decrypt_work(job_p, *msg_stanza_pp);
+  }
+  lurch_message_decrypt_finish(job_p, msg_stanza_pp);
+  lurch_decrypt_job_free(job_p);
+}
+
+/**
+ * Like lurch_message_decrypt(), but takes the stanza and decrypts it on the worker of the connection.
+ * It is passed on to libpurple once it is decrypted and the messages before it were passed on.
+ */
+static void lurch_message_decrypt_async(PurpleConnection * gc_p, xmlnode ** msg_stanza_pp) {
+  lurch_decrypt_job * job_p = lurch_message_decrypt_prepare(gc_p, *msg_stanza_pp, TRUE);
+
+  if (!job_p->ready) {
+    // nothing to wait for, unless there are messages before it
+    if (job_p->ctx_p && lurch_ctx_async_pending(gc_p)) {
+      lurch_ctx_async_submit(job_p->ctx_p, msg_stanza_pp, (void *) 0,
+                             lurch_message_decrypt_finish, lurch_decrypt_job_free, job_p);
+      return;
+    }
+    lurch_message_decrypt_finish(job_p, msg_stanza_pp);
+    lurch_decrypt_job_free(job_p);
+    return;
+  }
+
+  lurch_ctx_async_submit(job_p->ctx_p, msg_stanza_pp, lurch_message_decrypt_work,
+                         lurch_message_decrypt_finish, lurch_decrypt_job_free, job_p);
 }
 
 static void lurch_message_warn(PurpleConnection * gc_p, xmlnode ** msg_stanza_pp) {
@@ -2365,7 +2649,7 @@ static void lurch_message_warn(PurpleConnection * gc_p, xmlnode ** msg_stanza_pp
 
   xmlnode * temp_node_p = (void *) 0;
   char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
   axc_context_dake_cache * cachectx_p = (void *) 0;
   char * conv_name = (void *) 0;
   char ** split = (void *) 0;
@@ -2375,7 +2659,10 @@ static void lurch_message_warn(PurpleConnection * gc_p, xmlnode ** msg_stanza_pp
   const char * from = xmlnode_get_attrib(*msg_stanza_pp, "from");
 
   uname = lurch_util_uname_strip(purple_account_get_username(purple_connection_get_account(gc_p)));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ret_val = lurch_store_get(uname, &store_p);
+  if (ret_val) {
+    goto cleanup;
+  }
 
   ret_val = cachectx_get_from_map(get_acc_axc_ctx_map(), uname, &cachectx_p);
   if (ret_val) {
@@ -2403,7 +2690,7 @@ static void lurch_message_warn(PurpleConnection * gc_p, xmlnode ** msg_stanza_pp
     } else if (ret_val == 0) {
       goto cleanup;
     } else if (ret_val == 1) {
-      ret_val = omemo_storage_chatlist_exists(conv_name, db_fn_omemo);
+      ret_val = lurch_store_chatlist_exists(store_p, conv_name);
       if (ret_val == 0) {
         purple_conv_present_error(conv_name, purple_connection_get_account(gc_p),
                                   "Even though you have an encryption session with this user, you received a plaintext message.");
@@ -2413,7 +2700,7 @@ static void lurch_message_warn(PurpleConnection * gc_p, xmlnode ** msg_stanza_pp
     split = g_strsplit(from, "/", 2);
     room_name = split[0];
 
-    ret_val = omemo_storage_chatlist_exists(room_name, db_fn_omemo);
+    ret_val = lurch_store_chatlist_exists(store_p, room_name);
     if (ret_val < 0) {
       goto cleanup;
     } else if (ret_val == 0) {
@@ -2426,11 +2713,27 @@ static void lurch_message_warn(PurpleConnection * gc_p, xmlnode ** msg_stanza_pp
 
 cleanup:
   g_free(uname);
-  g_free(db_fn_omemo);
   g_free(conv_name);
   g_strfreev(split);
 }
 
+static void lurch_message_warn_finish(void * data_p, xmlnode ** msg_stanza_pp) {
+  lurch_message_warn(data_p, msg_stanza_pp);
+}
+
+/**
+ * @return TRUE if the encrypted messages of the connection are decrypted on its worker.
+ */
+static gboolean lurch_message_decrypt_is_async(PurpleConnection * gc_p) {
+  // the worker must not call into libpurple, which axc's logging does
+  if (purple_prefs_get_bool(LURCH_PREF_DECRYPT_ASYNC) && !purple_prefs_get_bool(LURCH_PREF_AXC_LOGGING)) {
+    return TRUE;
+  }
+
+  // keeps the order if the pref was just turned off
+  return lurch_ctx_async_pending(gc_p);
+}
+
 static void lurch_xml_received_cb(PurpleConnection * gc_p, xmlnode ** stanza_pp) {
   xmlnode * temp_node_p  = (void *) 0;
   const char * node_name = (void *) 0;
@@ -2443,12 +2746,27 @@ static void lurch_xml_received_cb(PurpleConnection * gc_p, xmlnode ** stanza_pp)
     return;
   }
 
+  // already handled before the worker passed it on
+  if (lurch_ctx_passing_on()) {
+    return;
+  }
+
   node_name = (*stanza_pp)->name;
 
   if (!g_strcmp0(node_name, "message")) {
     temp_node_p = xmlnode_get_child(*stanza_pp, "encrypted");
     if (temp_node_p) {
-      lurch_message_decrypt(gc_p, stanza_pp);
+      if (lurch_ctx_hold(gc_p, stanza_pp, FALSE)) {
+        return;
+      }
+      if (lurch_message_decrypt_is_async(gc_p)) {
+        lurch_message_decrypt_async(gc_p, stanza_pp);
+      } else {
+        lurch_message_decrypt(gc_p, stanza_pp);
+      }
+    } else if (lurch_ctx_async_pending(gc_p)) {
+      // plaintext messages wait for the encrypted ones before them, so that the conversation keeps its order
+      lurch_ctx_async_submit(lurch_ctx_get(gc_p), stanza_pp, (void *) 0, lurch_message_warn_finish, (void *) 0, gc_p);
     } else {
       lurch_message_warn(gc_p, stanza_pp);
     }
@@ -2462,20 +2780,24 @@ static int lurch_topic_update_im(PurpleConversation * conv_p) {
   const char * partner_name = purple_conversation_get_name(conv_p);
   char * partner_name_bare = (void *) 0;
   axc_context_dake_cache * cachectx_p = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
   omemo_devicelist * dl_p = (void *) 0;
 
   char * new_title = (void *) 0;
 
   uname = lurch_util_uname_strip(purple_account_get_username(purple_conversation_get_account(conv_p)));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
   partner_name_bare = jabber_get_bare_jid(partner_name);
 
   if (uninstall) {
     goto cleanup;
   }
 
-  ret_val = omemo_storage_chatlist_exists(partner_name_bare, db_fn_omemo);
+  ret_val = lurch_store_get(uname, &store_p);
+  if (ret_val) {
+    goto cleanup;
+  }
+
+  ret_val = lurch_store_chatlist_exists(store_p, partner_name_bare);
   if (ret_val < 0 || ret_val > 0) {
     goto cleanup;
   }
@@ -2500,7 +2822,7 @@ static int lurch_topic_update_im(PurpleConversation * conv_p) {
 
   } else {
 #if 0
-    ret_val = omemo_storage_user_devicelist_retrieve(partner_name_bare, db_fn_omemo, &dl_p);
+    ret_val = lurch_store_devicelist_retrieve(store_p, partner_name_bare, &dl_p);
     if (ret_val) {
       goto cleanup;
     }
@@ -2518,7 +2840,6 @@ static int lurch_topic_update_im(PurpleConversation * conv_p) {
 cleanup:
   g_free(uname);
   g_free(new_title);
-  g_free(db_fn_omemo);
   omemo_devicelist_destroy(dl_p);
   g_free(partner_name_bare);
 
@@ -2529,17 +2850,20 @@ static int lurch_topic_update_chat(PurpleConversation * conv_p) {
   int ret_val = 0;
 
   char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
   char * new_title = (void *) 0;
 
   uname = lurch_util_uname_strip(purple_account_get_username(purple_conversation_get_account(conv_p)));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
-
   if (uninstall) {
     goto cleanup;
   }
 
-  ret_val = omemo_storage_chatlist_exists(purple_conversation_get_name(conv_p), db_fn_omemo);
+  ret_val = lurch_store_get(uname, &store_p);
+  if (ret_val) {
+    goto cleanup;
+  }
+
+  ret_val = lurch_store_chatlist_exists(store_p, purple_conversation_get_name(conv_p));
   if (ret_val < 1) {
     goto cleanup;
   }
@@ -2549,7 +2873,6 @@ static int lurch_topic_update_chat(PurpleConversation * conv_p) {
 
 cleanup:
   g_free(uname);
-  g_free(db_fn_omemo);
   g_free(new_title);
 
   return ret_val;
@@ -2602,6 +2925,21 @@ static gboolean lurch_plugin_load(PurplePlugin * plugin_p) {
   PurpleAccount * acc_p = (void *) 0;
 
   omemo_default_crypto_init();
+  lurch_crypto_init();
+  if (lurch_crypto_provider_select(&crypto, purple_prefs_get_string(LURCH_PREF_CRYPTO_AES_GCM))) {
+    purple_debug_info("lurch", "%s: using cached AES-GCM cipher handles (AES and GHASH instructions %s)\n",
+                      __func__, lurch_crypto_has_aes_hw() ? "available" : "not available");
+  }
+  signal_crypto = axc_crypto_provider_tmpl;
+  if (lurch_crypto_signal_provider_select(&signal_crypto, purple_prefs_get_string(LURCH_PREF_CRYPTO_SIGNAL))) {
+    purple_debug_info("lurch", "%s: using cached handles for libsignal's crypto (SHA instructions %s, AES instructions %s)\n",
+                      __func__, lurch_crypto_has_sha_hw() ? "available" : "not available",
+                      lurch_crypto_has_aes_hw() ? "available" : "not available");
+  }
+  if (purple_prefs_get_bool(LURCH_PREF_CRYPTO_RNG_POOL)) {
+    crypto.random_bytes_func = lurch_crypto_random_bytes;
+    signal_crypto.random_func = lurch_crypto_signal_random;
+  }
   lurch_api_init();
   init_acc_axc_ctx_map();
 
@@ -2653,6 +2991,7 @@ static gboolean lurch_plugin_load(PurplePlugin * plugin_p) {
 
   // register install callback
   (void) purple_signal_connect(purple_accounts_get_handle(), "account-signed-on", plugin_p, PURPLE_CALLBACK(lurch_account_connect_cb), NULL);
+  (void) purple_signal_connect(purple_connections_get_handle(), "signing-off", plugin_p, PURPLE_CALLBACK(lurch_connection_signing_off_cb), NULL);
   (void) purple_signal_connect(purple_conversations_get_handle(), "conversation-created", plugin_p, PURPLE_CALLBACK(lurch_conv_created_cb), NULL);
   (void) purple_signal_connect(purple_conversations_get_handle(), "conversation-updated", plugin_p, PURPLE_CALLBACK(lurch_conv_updated_cb), NULL);
 
@@ -2661,6 +3000,7 @@ cleanup:
   g_list_free(accs_l_p);
   if (ret_val) {
     purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
+    lurch_crypto_teardown();
     omemo_default_crypto_teardown();
     return FALSE;
   }
@@ -2672,10 +3012,13 @@ static gboolean lurch_plugin_unload(PurplePlugin * plugin_p) {
   purple_cmd_unregister(lurch_cmd_handle_id[0]);
   purple_cmd_unregister(lurch_cmd_handle_id[1]);
 
+  // the prewarm and storage threads might still use the contexts' stores
+  cachectx_prewarm_join_all();
+  lurch_ctx_destroy_all();
+  lurch_store_sync_all();
   reset_acc_axc_ctx_map();
   lurch_api_unload();
 
-  omemo_default_crypto_teardown();
   GList *accs_l_p = purple_accounts_get_all_active();
   int ret_val = 0;
   const char* err_msg_dbg = NULL;
@@ -2688,31 +3031,32 @@ static gboolean lurch_plugin_unload(PurplePlugin * plugin_p) {
 	  JabberStream* js
 	    = (JabberStream*)purple_connection_get_protocol_data(purple_account_get_connection(acc_p));
 	  gchar* uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-	  gchar* db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
-	  axc_context_dake_cache* cachectx_p = NULL;
+	  lurch_store* store_p = NULL;
 	  omemo_devicelist* odl = NULL;
 	  do {
-	    ret_val = omemo_storage_user_devicelist_retrieve(uname, db_fn_omemo, &odl);
+	    ret_val = lurch_store_get(uname, &store_p);
 	    if (ret_val) {
-	      err_msg_dbg = "failed to get own device id list";
+	      err_msg_dbg = "failed to open the stores";
 	      break;
 	    }
-	    ret_val = cachectx_get_from_map(get_acc_axc_ctx_map(), uname, &cachectx_p);
-	    if(ret_val) {
-	      err_msg_dbg = "failed to get axc ctx";
+	    ret_val = lurch_store_devicelist_retrieve(store_p, uname, &odl);
+	    if (ret_val) {
+	      err_msg_dbg = "failed to get own device id list";
 	      break;
 	    }
+	    // the axc contexts are gone already and must not be created again, they would outlive the stores
 	    GList* l_faux = omemo_devicelist_get_id_list(odl);
 	    lurch_delete_used_bundle(js, l_faux);
 	    g_list_free_full(l_faux, free);
 	  } while(0);
 	  g_free(uname);
-	  g_free(db_fn_omemo);
 	  omemo_devicelist_destroy(odl);
 	}
       }
     }
   }
+  g_list_free(accs_l_p);
+  lurch_store_reset_all();
   {
     char * dl_ns = (void *) 0;
     if(omemo_devicelist_get_pep_node_name(&dl_ns)) {
@@ -2720,9 +3064,10 @@ static gboolean lurch_plugin_unload(PurplePlugin * plugin_p) {
     }
     free(dl_ns);
   }
+  lurch_crypto_teardown();
+  omemo_default_crypto_teardown();
   if (ret_val) {
     purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
-    omemo_default_crypto_teardown();
     return FALSE;
   }
   return TRUE;
@@ -2752,6 +3097,94 @@ static PurplePluginPrefFrame * lurch_get_plugin_pref_frame(PurplePlugin * plugin
   purple_plugin_pref_add_choice(ppref_p, "DEBUG", GINT_TO_POINTER(AXC_LOG_DEBUG));
   purple_plugin_pref_frame_add(frame_p, ppref_p);
 
+  ppref_p = purple_plugin_pref_new_with_label("Storage");
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_name_and_label(
+                    LURCH_PREF_STORE_DL_CACHE_SIZE,
+                    "Number of devicelists kept in memory (0 to disable, takes effect after a restart)");
+  purple_plugin_pref_set_bounds(ppref_p, 0, 100000);
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_label("Journal mode and sync level take effect after a restart");
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_name_and_label(
+                    LURCH_PREF_STORE_OMEMO_JOURNAL,
+                    "Journal mode of the devicelist db (WAL writes faster, both survive crashes)");
+  purple_plugin_pref_set_type(ppref_p, PURPLE_PLUGIN_PREF_CHOICE);
+  purple_plugin_pref_add_choice(ppref_p, "Rollback journal", LURCH_STORE_JOURNAL_ROLLBACK);
+  purple_plugin_pref_add_choice(ppref_p, "WAL", LURCH_STORE_JOURNAL_WAL);
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_name_and_label(
+                    LURCH_PREF_STORE_OMEMO_SYNC,
+                    "Sync level of the devicelist db (NORMAL with WAL can lose the last changes on power loss)");
+  purple_plugin_pref_set_type(ppref_p, PURPLE_PLUGIN_PREF_CHOICE);
+  purple_plugin_pref_add_choice(ppref_p, "FULL", LURCH_STORE_SYNC_FULL);
+  purple_plugin_pref_add_choice(ppref_p, "NORMAL", LURCH_STORE_SYNC_NORMAL);
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_name_and_label(
+                    LURCH_PREF_STORE_AXC_JOURNAL,
+                    "Journal mode of the session db (WAL writes faster, both survive crashes)");
+  purple_plugin_pref_set_type(ppref_p, PURPLE_PLUGIN_PREF_CHOICE);
+  purple_plugin_pref_add_choice(ppref_p, "Rollback journal", LURCH_STORE_JOURNAL_ROLLBACK);
+  purple_plugin_pref_add_choice(ppref_p, "WAL", LURCH_STORE_JOURNAL_WAL);
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_name_and_label(
+                    LURCH_PREF_STORE_AXC_SYNC,
+                    "Sync level of the session db (NORMAL with WAL can lose the newest ratchet state on power loss, "
+                    "which breaks the affected sessions)");
+  purple_plugin_pref_set_type(ppref_p, PURPLE_PLUGIN_PREF_CHOICE);
+  purple_plugin_pref_add_choice(ppref_p, "FULL", LURCH_STORE_SYNC_FULL);
+  purple_plugin_pref_add_choice(ppref_p, "NORMAL", LURCH_STORE_SYNC_NORMAL);
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_name_and_label(
+                    LURCH_PREF_STORE_SESS_BACKEND,
+                    "Where the sessions are kept (takes effect after a restart, which moves the existing sessions over; "
+                    "the sync level above also applies to the file)");
+  purple_plugin_pref_set_type(ppref_p, PURPLE_PLUGIN_PREF_CHOICE);
+  purple_plugin_pref_add_choice(ppref_p, "Session db", LURCH_STORE_BACKEND_SQLITE);
+  purple_plugin_pref_add_choice(ppref_p, "Memory-mapped file", LURCH_STORE_BACKEND_MMAP);
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_label("Decryption");
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_name_and_label(
+                    LURCH_PREF_DECRYPT_ASYNC,
+                    "Decrypt received messages on a thread of the account instead of the main loop (not while logging is on)");
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_label("Encryption");
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_name_and_label(
+                    LURCH_PREF_CRYPTO_AES_GCM,
+                    "AES-GCM implementation for the message payloads (takes effect after reloading the plugin)");
+  purple_plugin_pref_set_type(ppref_p, PURPLE_PLUGIN_PREF_CHOICE);
+  purple_plugin_pref_add_choice(ppref_p, "Automatic (cached handles if the CPU has AES instructions)", LURCH_CRYPTO_AES_GCM_AUTO);
+  purple_plugin_pref_add_choice(ppref_p, "Cached cipher handles", LURCH_CRYPTO_AES_GCM_CACHED);
+  purple_plugin_pref_add_choice(ppref_p, "libomemo default", LURCH_CRYPTO_AES_GCM_DEFAULT);
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_name_and_label(
+                    LURCH_PREF_CRYPTO_SIGNAL,
+                    "HMAC, SHA-512 and AES implementation for the sessions (takes effect after reloading the plugin)");
+  purple_plugin_pref_set_type(ppref_p, PURPLE_PLUGIN_PREF_CHOICE);
+  purple_plugin_pref_add_choice(ppref_p, "Automatic (cached handles for what the CPU has SHA or AES instructions for)", LURCH_CRYPTO_SIGNAL_AUTO);
+  purple_plugin_pref_add_choice(ppref_p, "Cached handles", LURCH_CRYPTO_SIGNAL_CACHED);
+  purple_plugin_pref_add_choice(ppref_p, "axc default", LURCH_CRYPTO_SIGNAL_DEFAULT);
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
+  ppref_p = purple_plugin_pref_new_with_name_and_label(
+                    LURCH_PREF_CRYPTO_RNG_POOL,
+                    "Generate IVs and keys from a per-thread pool seeded by libgcrypt (takes effect after reloading the plugin)");
+  purple_plugin_pref_frame_add(frame_p, ppref_p);
+
   return frame_p;
 }
 
@@ -2809,6 +3242,19 @@ lurch_plugin_init(PurplePlugin * plugin_p) {
   purple_prefs_add_none(LURCH_PREF_ROOT);
   purple_prefs_add_bool(LURCH_PREF_AXC_LOGGING, FALSE);
   purple_prefs_add_int(LURCH_PREF_AXC_LOGGING_LEVEL, AXC_LOG_INFO);
+  purple_prefs_add_none(LURCH_PREF_STORE);
+  purple_prefs_add_int(LURCH_PREF_STORE_DL_CACHE_SIZE, 256);
+  purple_prefs_add_string(LURCH_PREF_STORE_OMEMO_JOURNAL, LURCH_STORE_JOURNAL_ROLLBACK);
+  purple_prefs_add_string(LURCH_PREF_STORE_OMEMO_SYNC, LURCH_STORE_SYNC_FULL);
+  purple_prefs_add_string(LURCH_PREF_STORE_AXC_JOURNAL, LURCH_STORE_JOURNAL_ROLLBACK);
+  purple_prefs_add_string(LURCH_PREF_STORE_AXC_SYNC, LURCH_STORE_SYNC_FULL);
+  purple_prefs_add_string(LURCH_PREF_STORE_SESS_BACKEND, LURCH_STORE_BACKEND_SQLITE);
+  purple_prefs_add_none(LURCH_PREF_DECRYPT);
+  purple_prefs_add_bool(LURCH_PREF_DECRYPT_ASYNC, FALSE);
+  purple_prefs_add_none(LURCH_PREF_ENCRYPT);
+  purple_prefs_add_string(LURCH_PREF_CRYPTO_AES_GCM, LURCH_CRYPTO_AES_GCM_AUTO);
+  purple_prefs_add_string(LURCH_PREF_CRYPTO_SIGNAL, LURCH_CRYPTO_SIGNAL_AUTO);
+  purple_prefs_add_bool(LURCH_PREF_CRYPTO_RNG_POOL, TRUE);
 }
 
 PURPLE_INIT_PLUGIN(lurch, lurch_plugin_init, info)
@@ -4,6 +4,7 @@
 #include <glib.h>
 #include "jabber.h"
 #include "pep.h"
+#include "lurch_store.h"
 
 # define LURCH_VERSION "0.7.0-1317-dev"
 # define LURCH_AUTHOR "*author1317*"
@@ -29,9 +30,10 @@ typedef struct lurch_addr {
   uint32_t device_id;
 } lurch_addr;
 
-extern const omemo_crypto_provider crypto;
+extern omemo_crypto_provider crypto;
+extern signal_crypto_provider signal_crypto;
 
-int lurch_axc_prepare(const char * uname, axc_context * axc_ctx_p);
+int lurch_axc_prepare(lurch_store * store_p, axc_context * axc_ctx_p, char ** err_msg_pp);
 
 xmlnode* jabber_create_message_on_stream(JabberStream* js,
 					 const char* type,
@@ -7,14 +7,32 @@
 
 #include "axc.h"
 #include "libomemo.h"
-#include "libomemo_storage.h"
 
+#include "axc_dakes_intf.h"
 #include "lurch_api.h"
 #include "lurch_api_internal.h"
+#include "lurch_store.h"
 #include "lurch_util.h"
 
 #define MODULE_NAME "lurch-api"
 
+/**
+ * Gets the account's axc context from the map instead of creating a new one on axc's own DB.
+ * Its stores go through lurch_store, so sessions kept in the mmap backend are found as well.
+ * The context belongs to the map and must not be destroyed.
+ */
+static int32_t lurch_api_axc_ctx_get(const char * uname, axc_context ** axc_ctx_pp) {
+  int32_t ret_val = 0;
+  axc_context_dake_cache * cachectx_p = (void *) 0;
+
+  ret_val = cachectx_get_from_map(get_acc_axc_ctx_map(), uname, &cachectx_p);
+  if (!ret_val) {
+    *axc_ctx_pp = &cachectx_p->base.base;
+  }
+
+  return ret_val;
+}
+
 #define DISCO_XMLNS     "http://jabber.org/protocol/disco#info" // see XEP-0030: Service Discovery (https://xmpp.org/extensions/xep-0030.html)
 
 /**
@@ -24,7 +42,8 @@
 static int32_t lurch_api_id_list_get_own(PurpleAccount * acc_p, GList ** list_pp) {
   int32_t ret_val = 0;
   char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
   omemo_devicelist * dl_p = (void *) 0;
   axc_context * axc_ctx_p = (void *) 0;
   uint32_t own_id = 0;
@@ -32,17 +51,22 @@ static int32_t lurch_api_id_list_get_own(PurpleAccount * acc_p, GList ** list_pp
   uint32_t * id_p = (void *) 0;
 
   uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ret_val = lurch_store_get(uname, &store_p);
+  if (ret_val) {
+    purple_debug_error(MODULE_NAME, "Failed to open the stores of %s.", uname);
+    goto cleanup;
+  }
+  db_fn_omemo = lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO);
 
-  ret_val = omemo_storage_user_devicelist_retrieve(uname, db_fn_omemo, &dl_p);
+  ret_val = lurch_store_devicelist_retrieve(store_p, uname, &dl_p);
   if (ret_val) {
     purple_debug_error(MODULE_NAME, "Failed to access OMEMO DB %s.", db_fn_omemo);
     goto cleanup;
   }
 
-  ret_val = lurch_util_axc_get_init_ctx(uname, &axc_ctx_p);
+  ret_val = lurch_api_axc_ctx_get(uname, &axc_ctx_p);
   if (ret_val) {
-    purple_debug_error(MODULE_NAME, "Failed to create axc ctx.");
+    purple_debug_error(MODULE_NAME, "Failed to get axc ctx.");
     goto cleanup;
   }
 
@@ -80,9 +104,7 @@ cleanup:
   }
 
   g_free(uname);
-  g_free(db_fn_omemo);
   omemo_devicelist_destroy(dl_p);
-  axc_context_destroy_all(axc_ctx_p);
 
   return ret_val;
 }
@@ -106,15 +128,21 @@ cleanup:
 void lurch_api_id_remove_handler(PurpleAccount * acc_p, uint32_t device_id, void (*cb)(int32_t err, void * user_data_p), void * user_data_p) {
   int32_t ret_val = 0;
   char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
   omemo_devicelist * dl_p = (void *) 0;
   char * exported_devicelist = (void *) 0;
   xmlnode * publish_node_p = (void *) 0;
 
   uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ret_val = lurch_store_get(uname, &store_p);
+  if (ret_val) {
+    purple_debug_error(MODULE_NAME, "Failed to open the stores of %s.", uname);
+    goto cleanup;
+  }
+  db_fn_omemo = lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO);
 
-  ret_val = omemo_storage_user_devicelist_retrieve(uname, db_fn_omemo, &dl_p);
+  ret_val = lurch_store_devicelist_retrieve(store_p, uname, &dl_p);
   if (ret_val) {
     purple_debug_error(MODULE_NAME, "Failed to access the OMEMO DB %s to retrieve the devicelist.", db_fn_omemo);
     goto cleanup;
@@ -146,7 +174,6 @@ cleanup:
   cb(ret_val, user_data_p);
 
   g_free(uname);
-  g_free(db_fn_omemo);
   omemo_devicelist_destroy(dl_p);
   g_free(exported_devicelist);
 }
@@ -154,12 +181,16 @@ cleanup:
 void lurch_api_enable_im_handler(PurpleAccount * acc_p, const char * contact_bare_jid, void (*cb)(int32_t err, void * user_data_p), void * user_data_p) {
   int32_t ret_val = 0;
   char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
 
   uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ret_val = lurch_store_get(uname, &store_p);
+  db_fn_omemo = lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO);
 
-  ret_val = omemo_storage_chatlist_delete(contact_bare_jid, db_fn_omemo);
+  if (!ret_val) {
+    ret_val = lurch_store_chatlist_delete(store_p, contact_bare_jid);
+  }
   if (ret_val) {
     purple_debug_error(MODULE_NAME, "Failed to delete %s from the blacklist in OMEMO DB %s.", contact_bare_jid, db_fn_omemo);
   }
@@ -167,18 +198,21 @@ void lurch_api_enable_im_handler(PurpleAccount * acc_p, const char * contact_bar
   cb(ret_val, user_data_p);
 
   g_free(uname);
-  g_free(db_fn_omemo);
 }
 
 void lurch_api_disable_im_handler(PurpleAccount * acc_p, const char * contact_bare_jid, void (*cb)(int32_t err, void * user_data_p), void * user_data_p) {
   int32_t ret_val = 0;
   char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
 
   uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ret_val = lurch_store_get(uname, &store_p);
+  db_fn_omemo = lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO);
 
-  ret_val = omemo_storage_chatlist_save(contact_bare_jid, db_fn_omemo);
+  if (!ret_val) {
+    ret_val = lurch_store_chatlist_save(store_p, contact_bare_jid);
+  }
   if (ret_val) {
     purple_debug_error(MODULE_NAME, "Failed to add %s to the blacklist in OMEMO DB %s.", contact_bare_jid, db_fn_omemo);
   }
@@ -186,18 +220,21 @@ void lurch_api_disable_im_handler(PurpleAccount * acc_p, const char * contact_ba
   cb(ret_val, user_data_p);
 
   g_free(uname);
-  g_free(db_fn_omemo);
 }
 
 void lurch_api_enable_chat_handler(PurpleAccount * acc_p, const char * full_conversation_name, void (*cb)(int32_t err, void * user_data_p), void * user_data_p) {
   int32_t ret_val = 0;
   char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
 
   uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ret_val = lurch_store_get(uname, &store_p);
+  db_fn_omemo = lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO);
 
-  ret_val = omemo_storage_chatlist_save(full_conversation_name, db_fn_omemo);
+  if (!ret_val) {
+    ret_val = lurch_store_chatlist_save(store_p, full_conversation_name);
+  }
   if (ret_val) {
     purple_debug_error(MODULE_NAME, "Failed to enable OMEMO for chat %s using DB %s.\n", full_conversation_name, db_fn_omemo);
   }
@@ -205,18 +242,21 @@ void lurch_api_enable_chat_handler(PurpleAccount * acc_p, const char * full_conv
   cb(ret_val, user_data_p);
 
   g_free(uname);
-  g_free(db_fn_omemo);
 }
 
 void lurch_api_disable_chat_handler(PurpleAccount * acc_p, const char * full_conversation_name, void (*cb)(int32_t err, void * user_data_p), void * user_data_p) {
   int32_t ret_val = 0;
   char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
 
   uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ret_val = lurch_store_get(uname, &store_p);
+  db_fn_omemo = lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO);
 
-  ret_val = omemo_storage_chatlist_delete(full_conversation_name, db_fn_omemo);
+  if (!ret_val) {
+    ret_val = lurch_store_chatlist_delete(store_p, full_conversation_name);
+  }
   if (ret_val) {
     purple_debug_error(MODULE_NAME, "Failed to disable OMEMO for chat %s using DB %s.\n", full_conversation_name, db_fn_omemo);
   }
@@ -224,7 +264,6 @@ void lurch_api_disable_chat_handler(PurpleAccount * acc_p, const char * full_con
   cb(ret_val, user_data_p);
 
   g_free(uname);
-  g_free(db_fn_omemo);
 }
 
 void lurch_api_fp_get_handler(PurpleAccount * acc_p, void (*cb)(int32_t err, const char * fp_printable, void * user_data_p), void * user_data_p) {
@@ -236,9 +275,9 @@ void lurch_api_fp_get_handler(PurpleAccount * acc_p, void (*cb)(int32_t err, con
 
   uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
 
-  ret_val = lurch_util_axc_get_init_ctx(uname, &axc_ctx_p);
+  ret_val = lurch_api_axc_ctx_get(uname, &axc_ctx_p);
   if (ret_val) {
-    purple_debug_error(MODULE_NAME, "Failed to create axc ctx.\n");
+    purple_debug_error(MODULE_NAME, "Failed to get axc ctx.\n");
     goto cleanup;
   }
 
@@ -255,7 +294,6 @@ cleanup:
 
   g_free(fp_printable);
   axc_buf_free(key_buf_p);
-  axc_context_destroy_all(axc_ctx_p);
 }
 
 /**
@@ -323,9 +361,9 @@ void lurch_api_fp_list_handler(PurpleAccount * acc_p, void (*cb)(int32_t err, GH
   }
 
   uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-  ret_val = lurch_util_axc_get_init_ctx(uname, &axc_ctx_p);
+  ret_val = lurch_api_axc_ctx_get(uname, &axc_ctx_p);
   if (ret_val) {
-    purple_debug_error(MODULE_NAME, "Failed to create axc ctx for %s.", uname);
+    purple_debug_error(MODULE_NAME, "Failed to get axc ctx for %s.", uname);
     goto cleanup;
   }
 
@@ -347,7 +385,6 @@ cleanup:
 
   g_list_free_full(own_id_list, g_free);
   g_free(uname);
-  axc_context_destroy_all(axc_ctx_p);
   g_hash_table_destroy(id_fp_table);
   axc_buf_free(key_buf_p);
 }
@@ -356,7 +393,8 @@ cleanup:
 void lurch_api_fp_other_handler(PurpleAccount * acc_p, const char * contact_bare_jid, void (*cb)(int32_t err, GHashTable * id_fp_table, void * user_data_p), void * user_data_p) {
   int32_t ret_val = 0;
   char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
   omemo_devicelist * dl_p = (void *) 0;
   axc_context * axc_ctx_p = (void *) 0;
   GHashTable * id_fp_table = (void *) 0;
@@ -364,9 +402,14 @@ void lurch_api_fp_other_handler(PurpleAccount * acc_p, const char * contact_bare
   axc_buf * key_buf_p = (void *) 0;
 
   uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ret_val = lurch_store_get(uname, &store_p);
+  if (ret_val) {
+    purple_debug_error(MODULE_NAME, "Failed to open the stores of %s.", uname);
+    goto cleanup;
+  }
+  db_fn_omemo = lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO);
 
-  ret_val = omemo_storage_user_devicelist_retrieve(contact_bare_jid, db_fn_omemo, &dl_p);
+  ret_val = lurch_store_devicelist_retrieve(store_p, contact_bare_jid, &dl_p);
   if (ret_val) {
     purple_debug_error(MODULE_NAME, "Failed to access OMEMO DB %s.", db_fn_omemo);
     goto cleanup;
@@ -376,9 +419,9 @@ void lurch_api_fp_other_handler(PurpleAccount * acc_p, const char * contact_bare
     goto cleanup;
   }
 
-  ret_val = lurch_util_axc_get_init_ctx(uname, &axc_ctx_p);
+  ret_val = lurch_api_axc_ctx_get(uname, &axc_ctx_p);
   if (ret_val) {
-    purple_debug_error(MODULE_NAME, "Failed to create axc ctx for %s.", uname);
+    purple_debug_error(MODULE_NAME, "Failed to get axc ctx for %s.", uname);
     goto cleanup;
   }
 
@@ -390,9 +433,7 @@ cleanup:
   cb(ret_val, id_fp_table, user_data_p);
 
   g_free(uname);
-  g_free(db_fn_omemo);
   omemo_devicelist_destroy(dl_p);
-  axc_context_destroy_all(axc_ctx_p);
   g_list_free_full(id_list, free);
   axc_buf_free(key_buf_p);
 
@@ -406,14 +447,20 @@ void lurch_api_status_im_handler(PurpleAccount * acc_p, const char * contact_bar
   lurch_status_t status = LURCH_STATUS_DISABLED;
 
   char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
   omemo_devicelist * dl_p = (void *) 0;
   axc_context * axc_ctx_p = (void *) 0;
 
   uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ret_val = lurch_store_get(uname, &store_p);
+  if (ret_val) {
+    purple_debug_error(MODULE_NAME, "Failed to open the stores of %s.", uname);
+    goto cleanup;
+  }
+  db_fn_omemo = lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO);
 
-  ret_val = omemo_storage_chatlist_exists(contact_bare_jid, db_fn_omemo);
+  ret_val = lurch_store_chatlist_exists(store_p, contact_bare_jid);
   if (ret_val < 0 || ret_val > 1) {
     purple_debug_error(MODULE_NAME, "Failed to look up %s in file %s.", contact_bare_jid, db_fn_omemo);
     goto cleanup;
@@ -425,7 +472,7 @@ void lurch_api_status_im_handler(PurpleAccount * acc_p, const char * contact_bar
     goto cleanup;
   }
 
-  ret_val = omemo_storage_user_devicelist_retrieve(contact_bare_jid, db_fn_omemo, &dl_p);
+  ret_val = lurch_store_devicelist_retrieve(store_p, contact_bare_jid, &dl_p);
   if (ret_val) {
     purple_debug_error(MODULE_NAME, "Failed to get the devicelist for %s from %s.", contact_bare_jid, db_fn_omemo);
     goto cleanup;
@@ -437,9 +484,9 @@ void lurch_api_status_im_handler(PurpleAccount * acc_p, const char * contact_bar
     goto cleanup;
   }
 
-  ret_val = lurch_util_axc_get_init_ctx(uname, &axc_ctx_p);
+  ret_val = lurch_api_axc_ctx_get(uname, &axc_ctx_p);
   if (ret_val) {
-    purple_debug_error(MODULE_NAME, "Failed to create axc ctx for %s.", uname);
+    purple_debug_error(MODULE_NAME, "Failed to get axc ctx for %s.", uname);
     goto cleanup;
   }
 
@@ -459,9 +506,7 @@ cleanup:
   cb(ret_val, status, user_data_p);
 
   g_free(uname);
-  g_free(db_fn_omemo);
   omemo_devicelist_destroy(dl_p);
-  axc_context_destroy_all(axc_ctx_p);
 }
 
 /**
@@ -481,6 +526,8 @@ void lurch_api_status_chat_discover_cb(JabberStream * js_p, const char * from, J
   JabberChatMember * curr_muc_member_p = (void *) 0;
   char * curr_muc_member_bare_jid = (void *) 0;
   omemo_devicelist * curr_dl_p = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
 
   lurch_api_status_chat_cb_data * cb_data_p = (lurch_api_status_chat_cb_data *) data_p;
   gboolean is_anonymous = TRUE;
@@ -530,6 +577,13 @@ void lurch_api_status_chat_discover_cb(JabberStream * js_p, const char * from, J
     goto cleanup;
   }
 
+  ret_val = lurch_store_get(cb_data_p->uname, &store_p);
+  if (ret_val) {
+    purple_debug_error(MODULE_NAME, "Failed to open the stores of %s.\n", cb_data_p->uname);
+    goto cleanup;
+  }
+  db_fn_omemo = lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO);
+
   for (curr_item_p = g_hash_table_get_values(muc_p->members); curr_item_p; curr_item_p = curr_item_p->next) {
     curr_muc_member_p = (JabberChatMember *) curr_item_p->data;
     curr_muc_member_bare_jid = jabber_get_bare_jid(curr_muc_member_p->jid);
@@ -542,9 +596,9 @@ void lurch_api_status_chat_discover_cb(JabberStream * js_p, const char * from, J
       goto cleanup;
     }
 
-    ret_val = omemo_storage_user_devicelist_retrieve(curr_muc_member_bare_jid, cb_data_p->db_fn_omemo, &curr_dl_p);
+    ret_val = lurch_store_devicelist_retrieve(store_p, curr_muc_member_bare_jid, &curr_dl_p);
     if (ret_val) {
-      purple_debug_error(MODULE_NAME, "Could not retrieve the devicelist for %s (JID: %s) from %s.\n", curr_muc_member_p->handle, curr_muc_member_bare_jid, cb_data_p->db_fn_omemo);
+      purple_debug_error(MODULE_NAME, "Could not retrieve the devicelist for %s (JID: %s) from %s.\n", curr_muc_member_p->handle, curr_muc_member_bare_jid, db_fn_omemo);
       goto cleanup;
     }
 
@@ -552,7 +606,7 @@ void lurch_api_status_chat_discover_cb(JabberStream * js_p, const char * from, J
       purple_debug_warning(
         MODULE_NAME,
         "Could not find chat %s member %s's devicelist in OMEMO DB %s. This probably means the user is not in this account's contact list.",
-        from, curr_muc_member_bare_jid, cb_data_p->db_fn_omemo
+        from, curr_muc_member_bare_jid, db_fn_omemo
       );
 
       status = LURCH_STATUS_CHAT_NO_DEVICELIST;
@@ -571,7 +625,7 @@ void lurch_api_status_chat_discover_cb(JabberStream * js_p, const char * from, J
 cleanup:
   cb_data_p->cb(ret_val, status, cb_data_p->user_data_p);
 
-  g_free(cb_data_p->db_fn_omemo);
+  g_free(cb_data_p->uname);
   g_free(cb_data_p);
 
   // if loop was exited early, this needs to be cleaned up here
@@ -604,12 +658,19 @@ void lurch_api_status_chat_handler(PurpleAccount * acc_p, const char * full_conv
   gboolean early_exit = FALSE; // call the provided callback directly in this function instead of in the iq query callback
 
   char * uname = (void *) 0;
-  char * db_fn_omemo = (void *) 0;
+  lurch_store * store_p = (void *) 0;
+  const char * db_fn_omemo = (void *) 0;
 
   uname = lurch_util_uname_strip(purple_account_get_username(acc_p));
-  db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  ret_val = lurch_store_get(uname, &store_p);
+  if (ret_val) {
+    purple_debug_error(MODULE_NAME, "Failed to open the stores of %s.", uname);
+    early_exit = TRUE;
+    goto cleanup;
+  }
+  db_fn_omemo = lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO);
 
-  ret_val = omemo_storage_chatlist_exists(full_conversation_name, db_fn_omemo);
+  ret_val = lurch_store_chatlist_exists(store_p, full_conversation_name);
   if (ret_val < 0 || ret_val > 1) {
     purple_debug_error(MODULE_NAME, "Failed to look up %s in file %s.", full_conversation_name, db_fn_omemo);
     early_exit = TRUE;
@@ -631,19 +692,18 @@ void lurch_api_status_chat_handler(PurpleAccount * acc_p, const char * full_conv
     early_exit = TRUE;
     goto cleanup;
   }
-  cb_data_p->db_fn_omemo = db_fn_omemo;
+  cb_data_p->uname = uname;
+  uname = (void *) 0;
   cb_data_p->cb = cb;
   cb_data_p->user_data_p = user_data_p;
 
   lurch_api_status_chat_discover(acc_p, full_conversation_name, cb_data_p);
 
 cleanup:
+  // in the regular case, uname is owned by the cb data and freed when it is destroyed
   g_free(uname);
 
   if (early_exit) {
-    // in other cases, db_fn_omemo will be freed when the cb data is destroyed
-    g_free(db_fn_omemo); 
-
     // in the regular case, the callback is passed on and called later
     cb(ret_val, status, user_data_p);
   }
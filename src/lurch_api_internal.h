@@ -8,7 +8,7 @@
 
 // Bundles the data the MUC feature discovery callback needs.
 typedef struct {
-  char * db_fn_omemo; // Path to the account's OMEMO DB.
+  char * uname; // The account's username, already stripped.
   void (*cb)(int32_t err, lurch_status_chat_t status, void * user_data_p); // The callback for the API call.
   void * user_data_p; // The data to be passed to cb().
 } lurch_api_status_chat_cb_data;
@@ -0,0 +1,179 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <purple.h>
+
+#include "jutil.h"
+
+#include "lurch_arena.h"
+
+#define LURCH_ARENA_ALIGN _Alignof(max_align_t)
+// the longest node or domain jabber_id_new() accepts
+#define LURCH_ARENA_JID_PART_MAX_LEN 1023
+
+struct lurch_arena_block {
+  lurch_arena_block * next_p;
+  union {
+    max_align_t align;
+    uint8_t data[1];
+  } first;
+};
+
+void lurch_arena_init(lurch_arena * arena_p) {
+  arena_p->next_p = arena_p->inline_block.data;
+  arena_p->end_p = arena_p->inline_block.data + sizeof(arena_p->inline_block.data);
+  arena_p->blocks_p = (void *) 0;
+}
+
+void * lurch_arena_alloc(lurch_arena * arena_p, size_t len) {
+  lurch_arena_block * block_p = (void *) 0;
+  size_t data_len = 0;
+  uint8_t * mem_p = (void *) 0;
+
+  // zero-length allocations still get a distinct address
+  if (!len) {
+    len = 1;
+  }
+  // neither the padding nor the block header may wrap around
+  if (len > SIZE_MAX - offsetof(lurch_arena_block, first) - LURCH_ARENA_ALIGN) {
+    return (void *) 0;
+  }
+  // keeps the next allocation aligned
+  if (len % LURCH_ARENA_ALIGN) {
+    len += LURCH_ARENA_ALIGN - len % LURCH_ARENA_ALIGN;
+  }
+
+  if (len > (size_t) (arena_p->end_p - arena_p->next_p)) {
+    data_len = MAX(len, LURCH_ARENA_BLOCK_LEN);
+    block_p = g_malloc(offsetof(lurch_arena_block, first) + data_len);
+    block_p->next_p = arena_p->blocks_p;
+    arena_p->blocks_p = block_p;
+    arena_p->next_p = block_p->first.data;
+    arena_p->end_p = block_p->first.data + data_len;
+  }
+
+  mem_p = arena_p->next_p;
+  arena_p->next_p += len;
+
+  return mem_p;
+}
+
+char * lurch_arena_strndup(lurch_arena * arena_p, const char * str, size_t len) {
+  char * copy = (void *) 0;
+
+  if (!str) {
+    return (void *) 0;
+  }
+
+  len = strnlen(str, len);
+  copy = lurch_arena_alloc(arena_p, len + 1);
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+
+  return copy;
+}
+
+char * lurch_arena_strdup(lurch_arena * arena_p, const char * str) {
+  return str ? lurch_arena_strndup(arena_p, str, strlen(str)) : (void *) 0;
+}
+
+char * lurch_arena_printf(lurch_arena * arena_p, const char * format, ...) {
+  va_list args;
+  int len = 0;
+  char * str = (void *) 0;
+
+  va_start(args, format);
+  len = vsnprintf((void *) 0, 0, format, args);
+  va_end(args);
+  if (len < 0) {
+    return (void *) 0;
+  }
+
+  str = lurch_arena_alloc(arena_p, len + 1);
+  va_start(args, format);
+  (void) vsnprintf(str, len + 1, format, args);
+  va_end(args);
+
+  return str;
+}
+
+/**
+ * Checks whether the bare JID is made up only of characters that nodeprep and nameprep leave alone,
+ * and is valid, so that jabber_get_bare_jid() would return it unchanged.
+ */
+static gboolean lurch_arena_jid_is_canonical(const char * jid, size_t len) {
+  const char * at_p = memchr(jid, '@', len);
+  const char * domain = at_p ? at_p + 1 : jid;
+  size_t domain_len = len - (domain - jid);
+  size_t label_len = 0;
+  size_t i = 0;
+  char c = 0;
+
+  if (at_p && (at_p == jid || at_p - jid > LURCH_ARENA_JID_PART_MAX_LEN)) {
+    return FALSE;
+  }
+  for (i = 0; at_p && jid + i < at_p; i++) {
+    c = jid[i];
+    if (!g_ascii_islower(c) && !g_ascii_isdigit(c) && c != '.' && c != '-' && c != '_' && c != '+') {
+      return FALSE;
+    }
+  }
+
+  if (!domain_len || domain_len > LURCH_ARENA_JID_PART_MAX_LEN) {
+    return FALSE;
+  }
+  for (i = 0; i <= domain_len; i++) {
+    c = (i < domain_len) ? domain[i] : '.';
+    if (c == '.') {
+      // no empty labels, and none starting or ending with a hyphen
+      if (!label_len || domain[i - 1] == '-') {
+        return FALSE;
+      }
+      label_len = 0;
+    } else if (g_ascii_islower(c) || g_ascii_isdigit(c) || (c == '-' && label_len)) {
+      label_len++;
+    } else {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+char * lurch_arena_bare_jid(lurch_arena * arena_p, const char * jid) {
+  const char * slash_p = (void *) 0;
+  size_t len = 0;
+  char * bare_jid = (void *) 0;
+  char * copy = (void *) 0;
+
+  if (!jid) {
+    return (void *) 0;
+  }
+
+  slash_p = strchr(jid, '/');
+  len = slash_p ? (size_t) (slash_p - jid) : strlen(jid);
+  if (lurch_arena_jid_is_canonical(jid, len)) {
+    return lurch_arena_strndup(arena_p, jid, len);
+  }
+
+  bare_jid = jabber_get_bare_jid(jid);
+  copy = lurch_arena_strdup(arena_p, bare_jid);
+  g_free(bare_jid);
+
+  return copy;
+}
+
+void lurch_arena_release(lurch_arena * arena_p) {
+  lurch_arena_block * block_p = arena_p->blocks_p;
+  lurch_arena_block * next_p = (void *) 0;
+
+  while (block_p) {
+    next_p = block_p->next_p;
+    g_free(block_p);
+    block_p = next_p;
+  }
+
+  lurch_arena_init(arena_p);
+}
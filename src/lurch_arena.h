@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glib.h>
+
+// enough for the JIDs and strings of a typical stanza, so that the arena does not allocate at all
+#define LURCH_ARENA_INLINE_LEN 1024
+// the minimum size of the blocks allocated when the inline one is full
+#define LURCH_ARENA_BLOCK_LEN 4096
+
+typedef struct lurch_arena_block lurch_arena_block;
+
+/**
+ * Bump allocator for the short-lived strings and buffers of handling a single stanza.
+ *
+ * Everything is released at once by lurch_arena_release(), there is no way to free single allocations.
+ * The first LURCH_ARENA_INLINE_LEN bytes come from the arena itself, which usually lives on the stack
+ * of the stanza handler, anything beyond that from blocks of at least LURCH_ARENA_BLOCK_LEN bytes.
+ *
+ * Not thread-safe, and nothing allocated from it may be kept after the stanza is handled,
+ * e.g. by passing it to a callback or to the key workers.
+ */
+typedef struct {
+  uint8_t * next_p;
+  uint8_t * end_p;
+  lurch_arena_block * blocks_p;
+  // aligned like anything allocated with malloc()
+  union {
+    max_align_t align;
+    uint8_t data[LURCH_ARENA_INLINE_LEN];
+  } inline_block;
+} lurch_arena;
+
+/**
+ * Prepares the arena for use.
+ *
+ * @param arena_p Pointer to the arena.
+ */
+void lurch_arena_init(lurch_arena * arena_p);
+
+/**
+ * Allocates memory, aligned like malloc() does. Aborts if no memory is left, like g_malloc().
+ *
+ * @param arena_p Pointer to the arena.
+ * @param len The number of bytes.
+ * @return Pointer to the uninitialized memory, valid until lurch_arena_release(),
+ *         or NULL if len is too large to be allocated at all, in which case the arena is left as it was.
+ */
+void * lurch_arena_alloc(lurch_arena * arena_p, size_t len);
+
+/**
+ * Like g_strndup(), but from the arena.
+ *
+ * @return The copy, or NULL if str is NULL.
+ */
+char * lurch_arena_strndup(lurch_arena * arena_p, const char * str, size_t len);
+
+/**
+ * Like g_strdup(), but from the arena.
+ *
+ * @return The copy, or NULL if str is NULL.
+ */
+char * lurch_arena_strdup(lurch_arena * arena_p, const char * str);
+
+/**
+ * Like g_strdup_printf(), but from the arena.
+ */
+char * lurch_arena_printf(lurch_arena * arena_p, const char * format, ...) G_GNUC_PRINTF(2, 3);
+
+/**
+ * Like jabber_get_bare_jid(), but from the arena. JIDs which are already in their canonical form,
+ * which are the ones servers send, are just cut at the resource, all others go through libpurple.
+ *
+ * @param jid The full or bare JID.
+ * @return The bare JID, or NULL if jid is NULL or invalid.
+ */
+char * lurch_arena_bare_jid(lurch_arena * arena_p, const char * jid);
+
+/**
+ * Releases everything allocated from the arena. It can be used again afterwards.
+ *
+ * @param arena_p Pointer to the arena.
+ */
+void lurch_arena_release(lurch_arena * arena_p);
@@ -0,0 +1,438 @@
+#include <string.h>
+
+#include <glib.h>
+
+#include "lurch_b64.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+# define LURCH_B64_X86 1
+# include <immintrin.h>
+#endif
+
+#define LURCH_B64_INVALID 0xff
+#define LURCH_B64_PAD 0xfe
+
+static const char lurch_b64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// the value of each character, LURCH_B64_INVALID for characters GLib skips, LURCH_B64_PAD for '='
+static const uint8_t lurch_b64_values[256] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xfe, 0xff, 0xff,
+  0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+  0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static lurch_b64_impl b64_impl = LURCH_B64_IMPL_SCALAR;
+static gsize b64_impl_once = 0;
+
+#ifdef LURCH_B64_X86
+
+/*
+ * The vector code follows Wojciech Muła's and Daniel Lemire's base64 algorithms: bytes are shuffled
+ * into place and split into 6-bit indices with multiplications when encoding, and merged back
+ * with multiply-adds when decoding. The translation between indices and characters uses range
+ * comparisons, so that every character outside of the alphabet, including '=', is detected and
+ * the block is left to the scalar code.
+ */
+
+__attribute__((target("ssse3")))
+static inline __m128i lurch_b64_enc_split_ssse3(__m128i in) {
+  // every 32 bit lane holds the input bytes 1, 0, 2, 1 of its group of three
+  const __m128i shuffled = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+  const __m128i ac = _mm_mulhi_epu16(_mm_and_si128(shuffled, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+  const __m128i bd = _mm_mullo_epi16(_mm_and_si128(shuffled, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+
+  return _mm_or_si128(ac, bd);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i lurch_b64_enc_translate_ssse3(__m128i indices) {
+  __m128i shift = _mm_set1_epi8('A');
+
+  shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(indices, _mm_set1_epi8(25)), _mm_set1_epi8('a' - 26 - 'A')));
+  shift = _mm_sub_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(indices, _mm_set1_epi8(51)), _mm_set1_epi8('a' - 26 - '0' + 52)));
+  shift = _mm_sub_epi8(shift, _mm_and_si128(_mm_cmpgt_epi8(indices, _mm_set1_epi8(61)), _mm_set1_epi8('0' - 52 - '+' + 62)));
+  shift = _mm_add_epi8(shift, _mm_and_si128(_mm_cmpeq_epi8(indices, _mm_set1_epi8(63)), _mm_set1_epi8('/' - 63 - '+' + 62)));
+
+  return _mm_add_epi8(indices, shift);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i lurch_b64_in_range_ssse3(__m128i in, char lo, char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8(lo - 1)), _mm_cmpgt_epi8(_mm_set1_epi8(hi + 1), in));
+}
+
+/**
+ * @return 0 if all characters are in the alphabet, then values_p is set to their values, -1 otherwise.
+ */
+__attribute__((target("ssse3")))
+static inline int lurch_b64_dec_translate_ssse3(__m128i in, __m128i * values_p) {
+  const __m128i upper = lurch_b64_in_range_ssse3(in, 'A', 'Z');
+  const __m128i lower = lurch_b64_in_range_ssse3(in, 'a', 'z');
+  const __m128i digit = lurch_b64_in_range_ssse3(in, '0', '9');
+  const __m128i plus = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+  const __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+  const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+  __m128i shift = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+
+  if (_mm_movemask_epi8(valid) != 0xffff) {
+    return -1;
+  }
+
+  shift = _mm_or_si128(shift, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+  shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+  shift = _mm_or_si128(shift, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+  shift = _mm_or_si128(shift, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+
+  *values_p = _mm_add_epi8(in, shift);
+  return 0;
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i lurch_b64_dec_pack_ssse3(__m128i values) {
+  // a b c d -> ab cd -> abcd in the low 24 bits of each 32 bit lane, in little endian
+  const __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  const __m128i packed = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+
+  return _mm_shuffle_epi8(packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3")))
+static size_t lurch_b64_encode_blocks_ssse3(const uint8_t * in_p, size_t in_len, char * out_p) {
+  size_t pos = 0;
+
+  // loads 16 bytes, uses 12
+  while (in_len - pos >= 16) {
+    const __m128i in = _mm_loadu_si128((const __m128i *) (in_p + pos));
+
+    _mm_storeu_si128((__m128i *) out_p, lurch_b64_enc_translate_ssse3(lurch_b64_enc_split_ssse3(in)));
+    pos += 12;
+    out_p += 16;
+  }
+
+  return pos;
+}
+
+__attribute__((target("ssse3")))
+static size_t lurch_b64_decode_blocks_ssse3(const uint8_t * in_p, size_t in_len, uint8_t * out_p) {
+  uint8_t buf[16];
+  __m128i values;
+  size_t pos = 0;
+
+  while (in_len - pos >= 16) {
+    if (lurch_b64_dec_translate_ssse3(_mm_loadu_si128((const __m128i *) (in_p + pos)), &values)) {
+      break;
+    }
+
+    // the caller's buffer may only have room for the 12 decoded bytes
+    _mm_storeu_si128((__m128i *) buf, lurch_b64_dec_pack_ssse3(values));
+    memcpy(out_p, buf, 12);
+    pos += 16;
+    out_p += 12;
+  }
+
+  return pos;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i lurch_b64_enc_split_avx2(__m256i in) {
+  const __m256i shuffled = _mm256_shuffle_epi8(in, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                                                     1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+  const __m256i ac = _mm256_mulhi_epu16(_mm256_and_si256(shuffled, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+  const __m256i bd = _mm256_mullo_epi16(_mm256_and_si256(shuffled, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+
+  return _mm256_or_si256(ac, bd);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i lurch_b64_enc_translate_avx2(__m256i indices) {
+  __m256i shift = _mm256_set1_epi8('A');
+
+  shift = _mm256_add_epi8(shift, _mm256_and_si256(_mm256_cmpgt_epi8(indices, _mm256_set1_epi8(25)), _mm256_set1_epi8('a' - 26 - 'A')));
+  shift = _mm256_sub_epi8(shift, _mm256_and_si256(_mm256_cmpgt_epi8(indices, _mm256_set1_epi8(51)), _mm256_set1_epi8('a' - 26 - '0' + 52)));
+  shift = _mm256_sub_epi8(shift, _mm256_and_si256(_mm256_cmpgt_epi8(indices, _mm256_set1_epi8(61)), _mm256_set1_epi8('0' - 52 - '+' + 62)));
+  shift = _mm256_add_epi8(shift, _mm256_and_si256(_mm256_cmpeq_epi8(indices, _mm256_set1_epi8(63)), _mm256_set1_epi8('/' - 63 - '+' + 62)));
+
+  return _mm256_add_epi8(indices, shift);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i lurch_b64_in_range_avx2(__m256i in, char lo, char hi) {
+  return _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8(lo - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), in));
+}
+
+__attribute__((target("avx2")))
+static inline int lurch_b64_dec_translate_avx2(__m256i in, __m256i * values_p) {
+  const __m256i upper = lurch_b64_in_range_avx2(in, 'A', 'Z');
+  const __m256i lower = lurch_b64_in_range_avx2(in, 'a', 'z');
+  const __m256i digit = lurch_b64_in_range_avx2(in, '0', '9');
+  const __m256i plus = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('+'));
+  const __m256i slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+  const __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, _mm256_or_si256(plus, slash)));
+  __m256i shift = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+
+  if ((uint32_t) _mm256_movemask_epi8(valid) != 0xffffffffu) {
+    return -1;
+  }
+
+  shift = _mm256_or_si256(shift, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+  shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+  shift = _mm256_or_si256(shift, _mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')));
+  shift = _mm256_or_si256(shift, _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/')));
+
+  *values_p = _mm256_add_epi8(in, shift);
+  return 0;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i lurch_b64_dec_pack_avx2(__m256i values) {
+  const __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+  const __m256i packed = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+
+  return _mm256_shuffle_epi8(packed, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                      2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("avx2")))
+static size_t lurch_b64_encode_blocks_avx2(const uint8_t * in_p, size_t in_len, char * out_p) {
+  size_t pos = 0;
+
+  // each lane loads 16 bytes and uses 12, the upper one starting at 12
+  while (in_len - pos >= 28) {
+    const __m128i lo = _mm_loadu_si128((const __m128i *) (in_p + pos));
+    const __m128i hi = _mm_loadu_si128((const __m128i *) (in_p + pos + 12));
+    const __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+    _mm256_storeu_si256((__m256i *) out_p, lurch_b64_enc_translate_avx2(lurch_b64_enc_split_avx2(in)));
+    pos += 24;
+    out_p += 32;
+  }
+
+  return pos + lurch_b64_encode_blocks_ssse3(in_p + pos, in_len - pos, out_p);
+}
+
+__attribute__((target("avx2")))
+static size_t lurch_b64_decode_blocks_avx2(const uint8_t * in_p, size_t in_len, uint8_t * out_p) {
+  uint8_t buf[32];
+  __m256i values;
+  size_t pos = 0;
+
+  while (in_len - pos >= 32) {
+    if (lurch_b64_dec_translate_avx2(_mm256_loadu_si256((const __m256i *) (in_p + pos)), &values)) {
+      break;
+    }
+
+    _mm256_storeu_si256((__m256i *) buf, lurch_b64_dec_pack_avx2(values));
+    memcpy(out_p, buf, 12);
+    memcpy(out_p + 12, buf + 16, 12);
+    pos += 32;
+    out_p += 24;
+  }
+
+  return pos + lurch_b64_decode_blocks_ssse3(in_p + pos, in_len - pos, out_p);
+}
+
+#endif
+
+static lurch_b64_impl lurch_b64_impl_detect(void) {
+#ifdef LURCH_B64_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return LURCH_B64_IMPL_AVX2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return LURCH_B64_IMPL_SSSE3;
+  }
+#endif
+  return LURCH_B64_IMPL_SCALAR;
+}
+
+lurch_b64_impl lurch_b64_get_impl(void) {
+  if (g_once_init_enter(&b64_impl_once)) {
+    b64_impl = lurch_b64_impl_detect();
+    g_once_init_leave(&b64_impl_once, 1);
+  }
+
+  return b64_impl;
+}
+
+gboolean lurch_b64_set_impl(lurch_b64_impl impl) {
+  (void) lurch_b64_get_impl();
+
+  // each implementation needs a subset of the instructions of the next one
+  if (impl > lurch_b64_impl_detect()) {
+    return FALSE;
+  }
+
+  b64_impl = impl;
+  return TRUE;
+}
+
+/**
+ * Encodes as many whole blocks as the vector code of the current implementation handles.
+ *
+ * @return The number of input bytes consumed, a multiple of 3.
+ */
+static size_t lurch_b64_encode_blocks(const uint8_t * in_p, size_t in_len, char * out_p) {
+  switch (lurch_b64_get_impl()) {
+#ifdef LURCH_B64_X86
+    case LURCH_B64_IMPL_AVX2:
+      return lurch_b64_encode_blocks_avx2(in_p, in_len, out_p);
+    case LURCH_B64_IMPL_SSSE3:
+      return lurch_b64_encode_blocks_ssse3(in_p, in_len, out_p);
+#endif
+    default:
+      return 0;
+  }
+}
+
+/**
+ * Decodes whole blocks that only consist of characters of the alphabet, stopping at the first other one.
+ *
+ * @return The number of characters consumed, a multiple of 4.
+ */
+static size_t lurch_b64_decode_blocks(const uint8_t * in_p, size_t in_len, uint8_t * out_p) {
+  switch (lurch_b64_get_impl()) {
+#ifdef LURCH_B64_X86
+    case LURCH_B64_IMPL_AVX2:
+      return lurch_b64_decode_blocks_avx2(in_p, in_len, out_p);
+    case LURCH_B64_IMPL_SSSE3:
+      return lurch_b64_decode_blocks_ssse3(in_p, in_len, out_p);
+#endif
+    default:
+      return 0;
+  }
+}
+
+size_t lurch_b64_encode(const uint8_t * in_p, size_t in_len, char * out_p) {
+  char * out_start_p = out_p;
+  size_t pos = 0;
+  uint32_t v = 0;
+
+  pos = lurch_b64_encode_blocks(in_p, in_len, out_p);
+  out_p += pos / 3 * 4;
+
+  while (in_len - pos >= 3) {
+    v = (uint32_t) in_p[pos] << 16 | (uint32_t) in_p[pos + 1] << 8 | in_p[pos + 2];
+    out_p[0] = lurch_b64_alphabet[v >> 18];
+    out_p[1] = lurch_b64_alphabet[(v >> 12) & 0x3f];
+    out_p[2] = lurch_b64_alphabet[(v >> 6) & 0x3f];
+    out_p[3] = lurch_b64_alphabet[v & 0x3f];
+    pos += 3;
+    out_p += 4;
+  }
+
+  if (in_len - pos > 0) {
+    v = (uint32_t) in_p[pos] << 16;
+    if (in_len - pos == 2) {
+      v |= (uint32_t) in_p[pos + 1] << 8;
+    }
+    out_p[0] = lurch_b64_alphabet[v >> 18];
+    out_p[1] = lurch_b64_alphabet[(v >> 12) & 0x3f];
+    out_p[2] = (in_len - pos == 2) ? lurch_b64_alphabet[(v >> 6) & 0x3f] : '=';
+    out_p[3] = '=';
+    out_p += 4;
+  }
+
+  *out_p = '\0';
+  return out_p - out_start_p;
+}
+
+gchar * lurch_b64_encode_alloc(const guchar * data_p, gsize len) {
+  gchar * out_p = g_malloc(LURCH_B64_ENCODED_LEN(len) + 1);
+
+  (void) lurch_b64_encode(data_p, len, out_p);
+  return out_p;
+}
+
+size_t lurch_b64_decode(const char * in_p, size_t in_len, uint8_t * out_p) {
+  const uint8_t * in_u_p = (const uint8_t *) in_p;
+  uint8_t * out_start_p = out_p;
+  size_t pos = 0;
+  size_t consumed = 0;
+  uint32_t v = 0;
+  int count = 0;
+  uint8_t a = 0;
+  uint8_t b = 0;
+  uint8_t c = 0;
+  uint8_t d = 0;
+  uint8_t last[2] = { 0, 0 };
+
+  while (pos < in_len) {
+    if (count == 0) {
+      consumed = lurch_b64_decode_blocks(in_u_p + pos, in_len - pos, out_p);
+      pos += consumed;
+      out_p += consumed / 4 * 3;
+
+      // the groups after the vector blocks, or all of them in the scalar implementation
+      while (in_len - pos >= 4) {
+        a = lurch_b64_values[in_u_p[pos]];
+        b = lurch_b64_values[in_u_p[pos + 1]];
+        c = lurch_b64_values[in_u_p[pos + 2]];
+        d = lurch_b64_values[in_u_p[pos + 3]];
+        if ((a | b | c | d) & 0x80) {
+          break;
+        }
+        v = (uint32_t) a << 18 | (uint32_t) b << 12 | (uint32_t) c << 6 | d;
+        out_p[0] = v >> 16;
+        out_p[1] = v >> 8;
+        out_p[2] = v;
+        pos += 4;
+        out_p += 3;
+      }
+
+      if (pos >= in_len) {
+        break;
+      }
+    }
+
+    /*
+     * One character at a time, exactly like g_base64_decode_step(): other characters are skipped,
+     * '=' counts as zero bits, and only a group ending in '=' is shortened.
+     */
+    a = lurch_b64_values[in_u_p[pos]];
+    if (a == LURCH_B64_INVALID) {
+      pos++;
+      continue;
+    }
+    last[1] = last[0];
+    last[0] = in_u_p[pos];
+    v = (v << 6) | ((a == LURCH_B64_PAD) ? 0 : a);
+    pos++;
+    count++;
+
+    if (count == 4) {
+      *out_p++ = v >> 16;
+      if (last[1] != '=') {
+        *out_p++ = v >> 8;
+      }
+      if (last[0] != '=') {
+        *out_p++ = v;
+      }
+      count = 0;
+    }
+  }
+
+  return out_p - out_start_p;
+}
+
+guchar * lurch_b64_decode_alloc(const gchar * text, gsize * out_len_p) {
+  size_t len = strlen(text);
+  // never 0, so that there is always a buffer to return, as with GLib
+  guchar * out_p = g_malloc(LURCH_B64_DECODED_MAX_LEN(len) + 1);
+
+  *out_len_p = lurch_b64_decode(text, len, out_p);
+  return out_p;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glib.h>
+
+/**
+ * Base64 for the IVs and payloads of OMEMO messages, producing and accepting exactly what
+ * g_base64_encode() and g_base64_decode() do, but writing into buffers of the caller.
+ *
+ * Whole blocks are encoded and decoded with SSSE3 or AVX2 where the CPU has them,
+ * everything else, including input with padding in the middle, whitespace or other characters
+ * GLib skips, goes through the scalar code.
+ */
+
+// without the terminating NUL
+#define LURCH_B64_ENCODED_LEN(len) (((len) + 2) / 3 * 4)
+// an upper bound, as characters outside of the alphabet are skipped
+#define LURCH_B64_DECODED_MAX_LEN(b64_len) ((b64_len) / 4 * 3)
+
+typedef enum {
+  LURCH_B64_IMPL_SCALAR,
+  LURCH_B64_IMPL_SSSE3,
+  LURCH_B64_IMPL_AVX2
+} lurch_b64_impl;
+
+/**
+ * Encodes the data with padding and without line breaks.
+ *
+ * @param in_p The data.
+ * @param in_len Its length.
+ * @param out_p Buffer of at least LURCH_B64_ENCODED_LEN(in_len) + 1 bytes. Will be NUL-terminated.
+ * @return The length of the encoded string.
+ */
+size_t lurch_b64_encode(const uint8_t * in_p, size_t in_len, char * out_p);
+
+/**
+ * Like g_base64_encode().
+ *
+ * @return The encoded string. Free with g_free() when done.
+ */
+gchar * lurch_b64_encode_alloc(const guchar * data_p, gsize len);
+
+/**
+ * Decodes the string the way g_base64_decode() does.
+ *
+ * @param in_p The base64 string, does not have to be NUL-terminated.
+ * @param in_len Its length.
+ * @param out_p Buffer of at least LURCH_B64_DECODED_MAX_LEN(in_len) bytes.
+ * @return The number of decoded bytes.
+ */
+size_t lurch_b64_decode(const char * in_p, size_t in_len, uint8_t * out_p);
+
+/**
+ * Like g_base64_decode().
+ *
+ * @param text The NUL-terminated base64 string.
+ * @param out_len_p Will be set to the number of decoded bytes.
+ * @return The decoded data. Free with g_free() when done.
+ */
+guchar * lurch_b64_decode_alloc(const gchar * text, gsize * out_len_p);
+
+/**
+ * @return The implementation the functions above use, the fastest one the CPU supports by default.
+ */
+lurch_b64_impl lurch_b64_get_impl(void);
+
+/**
+ * Switches the implementation, so that the tests can compare all of them.
+ *
+ * @return TRUE on success, FALSE if the CPU or the compiler do not support it.
+ */
+gboolean lurch_b64_set_impl(lurch_b64_impl impl);
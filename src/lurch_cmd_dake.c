@@ -1,7 +1,7 @@
 #include "lurch_cmd_dake.h"
 #include "axc_dakes_intf.h"
 #include "omemo_helper.h"
-#include "libomemo_storage.h"
+#include "lurch_store.h"
 #include "lurch_api.h"
 #include "lurch_util.h"
 #include "lurch.h"
@@ -360,9 +360,12 @@ static DF_dake_cmd_handler(delete_used_bundle)
   }
   JabberStream* js = (JabberStream*)purple_connection_get_protocol_data(gc);
   gchar* uname = lurch_util_uname_strip(purple_account_get_username(purple_connection_get_account(gc)));
-  gchar* db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  lurch_store* store_p = NULL;
   omemo_devicelist* odl = NULL;
-  ret = omemo_storage_user_devicelist_retrieve(uname, db_fn_omemo, &odl);
+  ret = lurch_store_get(uname, &store_p);
+  if (!ret) {
+    ret = lurch_store_devicelist_retrieve(store_p, uname, &odl);
+  }
   if (ret) {
     *error = g_strdup("failed to get own device id list");
     goto cleanup;
@@ -375,7 +378,6 @@ static DF_dake_cmd_handler(delete_used_bundle)
 
  cleanup:
   g_free(uname);
-  g_free(db_fn_omemo);
 
   if (ret)
     return PURPLE_CMD_RET_FAILED;
@@ -400,15 +402,18 @@ static DF_dake_cmd_handler(purge_all_bundle)
   JabberStream* js = (JabberStream*)purple_connection_get_protocol_data(gc);
   gchar* uname
     = lurch_util_uname_strip(purple_account_get_username(account));
-  gchar* db_fn_omemo = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
   purple_debug_info("lurch", "%s: purging all bundle published by account %s\n", __func__, uname);
   jabber_pep_request_item(js, uname, OMEMO_DEVICELIST_PEP_NODE, NULL, lurch_pep_own_devicelist_purge);
   purple_debug_info("lurch", "%s: deleting device list published by account %s\n", __func__, uname);
   jabber_pep_delete_node(js, OMEMO_NS OMEMO_NS_SEPARATOR BUNDLE_PEP_NAME);
   jabber_pep_delete_node(js, OMEMO_DEVICELIST_PEP_NODE);
   {
+    lurch_store* store_p = NULL;
     omemo_devicelist* faux_dl_p = NULL;
-    ret = omemo_storage_user_devicelist_retrieve(uname, db_fn_omemo, &faux_dl_p);
+    ret = lurch_store_get(uname, &store_p);
+    if (!ret) {
+      ret = lurch_store_devicelist_retrieve(store_p, uname, &faux_dl_p);
+    }
     if (ret) {
       *error = g_strdup("failed to get own device id list");
       goto cleanup;
@@ -421,7 +426,6 @@ static DF_dake_cmd_handler(purge_all_bundle)
 
  cleanup:
   g_free(uname);
-  g_free(db_fn_omemo);
 
   if (ret)
     return PURPLE_CMD_RET_FAILED;
@@ -554,13 +558,8 @@ static DF_dake_cmd_handler(term_session)
 	ret = SG_ERR_INVAL;
 	break;
       }
-      xmlnode* body = xmlnode_new_child(msgnode, "body");
-      xmlnode_insert_data(body, TERM_HINT, -1);
-      int len = 0;
-      gchar* tempxml = xmlnode_to_str(msgnode, &len);
-      ret = omemo_message_prepare_encryption(tempxml, cachectx_get_faux_regid(cachectx),
-					     &crypto, OMEMO_STRIP_ALL, &omsg);
-      g_free(tempxml);
+      ret = omemo_message_create_for_text(TERM_HINT, cachectx_get_faux_regid(cachectx),
+					  &crypto, &omsg);
       if (ret) {
 	*error = g_strdup_printf("failed to construct omemo message");
 	break;
@@ -0,0 +1,880 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <gcrypt.h>
+#include <glib.h>
+
+#include "libomemo.h"
+#include "libomemo_crypto.h"
+#include "signal_protocol.h"
+
+#include "lurch_crypto.h"
+
+// one handle each for AES-128, -192 and -256
+#define LURCH_CRYPTO_KEY_LENS 3
+// libsignal nests at most a few HMACs, e.g. during the key derivation
+#define LURCH_CRYPTO_SPARE_HDS 4
+
+#define LURCH_CRYPTO_HMAC_SHA256_LEN 32
+#define LURCH_CRYPTO_SHA512_LEN 64
+#define LURCH_CRYPTO_AES_BLOCK_LEN 16
+
+// the random bytes come from ChaCha20 keystream blocks, each of which starts with the key of the next one
+#define LURCH_CRYPTO_RNG_KEY_LEN 32
+#define LURCH_CRYPTO_RNG_NONCE_LEN 12
+#define LURCH_CRYPTO_RNG_POOL_LEN 1024
+// a new key from libgcrypt's strong RNG after this many bytes or microseconds, whichever comes first
+#define LURCH_CRYPTO_RNG_RESEED_BYTES (1024 * 1024)
+#define LURCH_CRYPTO_RNG_RESEED_US (10 * 60 * G_USEC_PER_SEC)
+
+typedef struct {
+  gcry_cipher_hd_t gcm_hd[LURCH_CRYPTO_KEY_LENS];
+  gcry_cipher_hd_t cbc_hd[LURCH_CRYPTO_KEY_LENS];
+  gcry_cipher_hd_t ctr_hd[LURCH_CRYPTO_KEY_LENS];
+  gcry_mac_hd_t hmac_hd[LURCH_CRYPTO_SPARE_HDS];
+  int hmac_count;
+  gcry_md_hd_t sha512_hd[LURCH_CRYPTO_SPARE_HDS];
+  int sha512_count;
+  gcry_cipher_hd_t rng_hd;
+  uint8_t rng_pool[LURCH_CRYPTO_RNG_POOL_LEN];
+  size_t rng_avail;
+  size_t rng_since_reseed;
+  gint64 rng_reseed_time;
+} lurch_crypto_thread_ctx;
+
+/*
+ * The thread contexts have no destroy notify, as threads of shared pools can outlive the plugin.
+ * Instead, all of them are kept in a list and closed by lurch_crypto_teardown(), which also
+ * starts a new generation, so that the threads do not touch their old context afterwards.
+ * The threads of lurch itself take theirs out of the list when they end, see lurch_crypto_thread_release().
+ */
+static GPrivate thread_ctx_key = G_PRIVATE_INIT(NULL);
+static GPrivate thread_gen_key = G_PRIVATE_INIT(NULL);
+static GMutex ctx_lock;
+static GSList * ctx_l_p = (void *) 0;
+static gint ctx_gen = 1;
+
+struct lurch_crypto_gcm_stream {
+  gcry_cipher_hd_t hd;
+};
+
+static gboolean aes_hw = FALSE;
+static gboolean sha_hw = FALSE;
+
+void lurch_crypto_init(void) {
+  char * hwf = gcry_get_config(0, "hwflist");
+  gboolean aes = FALSE;
+  gboolean clmul = FALSE;
+
+  if (hwf) {
+    aes = strstr(hwf, "intel-aesni") || strstr(hwf, "arm-aes") || strstr(hwf, "ppc-vcrypto");
+    clmul = strstr(hwf, "intel-pclmul") || strstr(hwf, "arm-pmull") || strstr(hwf, "ppc-vcrypto");
+    sha_hw = strstr(hwf, "intel-shaext") || strstr(hwf, "arm-sha2") || strstr(hwf, "ppc-vcrypto");
+    gcry_free(hwf);
+  }
+
+  aes_hw = aes && clmul;
+}
+
+// memset() on memory which is freed right after may be optimized out
+static void lurch_crypto_wipe(void * buf_p, size_t len) {
+  volatile uint8_t * p = buf_p;
+
+  while (len--) {
+    *p++ = 0;
+  }
+}
+
+static void lurch_crypto_thread_ctx_destroy(gpointer data) {
+  lurch_crypto_thread_ctx * tctx_p = (lurch_crypto_thread_ctx *) data;
+  int i = 0;
+
+  for (i = 0; i < LURCH_CRYPTO_KEY_LENS; i++) {
+    if (tctx_p->gcm_hd[i]) {
+      gcry_cipher_close(tctx_p->gcm_hd[i]);
+    }
+    if (tctx_p->cbc_hd[i]) {
+      gcry_cipher_close(tctx_p->cbc_hd[i]);
+    }
+    if (tctx_p->ctr_hd[i]) {
+      gcry_cipher_close(tctx_p->ctr_hd[i]);
+    }
+  }
+  for (i = 0; i < tctx_p->hmac_count; i++) {
+    gcry_mac_close(tctx_p->hmac_hd[i]);
+  }
+  for (i = 0; i < tctx_p->sha512_count; i++) {
+    gcry_md_close(tctx_p->sha512_hd[i]);
+  }
+  if (tctx_p->rng_hd) {
+    gcry_cipher_close(tctx_p->rng_hd);
+  }
+  lurch_crypto_wipe(tctx_p->rng_pool, sizeof(tctx_p->rng_pool));
+  g_free(tctx_p);
+}
+
+void lurch_crypto_teardown(void) {
+  g_mutex_lock(&ctx_lock);
+  g_atomic_int_inc(&ctx_gen);
+  g_slist_free_full(ctx_l_p, lurch_crypto_thread_ctx_destroy);
+  ctx_l_p = (void *) 0;
+  g_mutex_unlock(&ctx_lock);
+}
+
+void lurch_crypto_thread_release(void) {
+  lurch_crypto_thread_ctx * tctx_p = (void *) 0;
+
+  g_mutex_lock(&ctx_lock);
+  // after a teardown, the context was closed along with the others already
+  if (GPOINTER_TO_INT(g_private_get(&thread_gen_key)) == g_atomic_int_get(&ctx_gen)) {
+    tctx_p = g_private_get(&thread_ctx_key);
+    ctx_l_p = g_slist_remove(ctx_l_p, tctx_p);
+  }
+  g_private_set(&thread_ctx_key, (void *) 0);
+  g_private_set(&thread_gen_key, (void *) 0);
+  g_mutex_unlock(&ctx_lock);
+
+  if (tctx_p) {
+    lurch_crypto_thread_ctx_destroy(tctx_p);
+  }
+}
+
+gboolean lurch_crypto_has_aes_hw(void) {
+  return aes_hw;
+}
+
+gboolean lurch_crypto_has_sha_hw(void) {
+  return sha_hw;
+}
+
+/**
+ * @param impl The pref value.
+ * @param cached The pref's value for the cached handles.
+ * @param dflt The pref's value for the default functions.
+ * @param hw Whether "auto" and unknown values select the cached handles.
+ */
+static gboolean lurch_crypto_impl_is_cached(const char * impl, const char * cached, const char * dflt, gboolean hw) {
+  if (!g_strcmp0(impl, cached)) {
+    return TRUE;
+  } else if (!g_strcmp0(impl, dflt)) {
+    return FALSE;
+  } else {
+    return hw;
+  }
+}
+
+gboolean lurch_crypto_provider_select(omemo_crypto_provider * crypto_p, const char * impl) {
+  gboolean cached = lurch_crypto_impl_is_cached(impl, LURCH_CRYPTO_AES_GCM_CACHED, LURCH_CRYPTO_AES_GCM_DEFAULT, aes_hw);
+
+  if (cached) {
+    crypto_p->aes_gcm_encrypt_func = lurch_crypto_aes_gcm_encrypt;
+    crypto_p->aes_gcm_decrypt_func = lurch_crypto_aes_gcm_decrypt;
+  } else {
+    crypto_p->aes_gcm_encrypt_func = omemo_default_crypto_aes_gcm_encrypt;
+    crypto_p->aes_gcm_decrypt_func = omemo_default_crypto_aes_gcm_decrypt;
+  }
+
+  return cached;
+}
+
+gboolean lurch_crypto_signal_provider_select(signal_crypto_provider * provider_p, const char * impl) {
+  gboolean digest_cached = lurch_crypto_impl_is_cached(impl, LURCH_CRYPTO_SIGNAL_CACHED, LURCH_CRYPTO_SIGNAL_DEFAULT, sha_hw);
+  gboolean cipher_cached = lurch_crypto_impl_is_cached(impl, LURCH_CRYPTO_SIGNAL_CACHED, LURCH_CRYPTO_SIGNAL_DEFAULT, aes_hw);
+
+  // the user data stays that of the template, the random function is left to the caller, see LURCH_PREF_CRYPTO_RNG_POOL
+  if (digest_cached) {
+    provider_p->hmac_sha256_init_func = lurch_crypto_hmac_sha256_init;
+    provider_p->hmac_sha256_update_func = lurch_crypto_hmac_sha256_update;
+    provider_p->hmac_sha256_final_func = lurch_crypto_hmac_sha256_final;
+    provider_p->hmac_sha256_cleanup_func = lurch_crypto_hmac_sha256_cleanup;
+    provider_p->sha512_digest_init_func = lurch_crypto_sha512_digest_init;
+    provider_p->sha512_digest_update_func = lurch_crypto_sha512_digest_update;
+    provider_p->sha512_digest_final_func = lurch_crypto_sha512_digest_final;
+    provider_p->sha512_digest_cleanup_func = lurch_crypto_sha512_digest_cleanup;
+  }
+  if (cipher_cached) {
+    provider_p->encrypt_func = lurch_crypto_encrypt;
+    provider_p->decrypt_func = lurch_crypto_decrypt;
+  }
+
+  return digest_cached || cipher_cached;
+}
+
+static lurch_crypto_thread_ctx * lurch_crypto_thread_ctx_get(void) {
+  gint gen = g_atomic_int_get(&ctx_gen);
+  lurch_crypto_thread_ctx * tctx_p = (void *) 0;
+
+  if (GPOINTER_TO_INT(g_private_get(&thread_gen_key)) == gen) {
+    return g_private_get(&thread_ctx_key);
+  }
+
+  tctx_p = g_new0(lurch_crypto_thread_ctx, 1);
+
+  g_mutex_lock(&ctx_lock);
+  ctx_l_p = g_slist_prepend(ctx_l_p, tctx_p);
+  g_mutex_unlock(&ctx_lock);
+
+  g_private_set(&thread_ctx_key, tctx_p);
+  g_private_set(&thread_gen_key, GINT_TO_POINTER(gen));
+
+  return tctx_p;
+}
+
+/**
+ * Gets one of the calling thread's handles for the key length, opening it on first use,
+ * and sets the key, which also resets the state left by the previous message.
+ *
+ * @param hds The thread's handles of the mode, one per key length.
+ * @param mode The GCRY_CIPHER_MODE_* of the handles.
+ * @param hd_p Will be set to the handle.
+ * @return 0 on success, -1 if the key length is not supported, -2 on a libgcrypt error.
+ */
+static int lurch_crypto_cipher_get(gcry_cipher_hd_t * hds, int mode,
+                                   const uint8_t * key_p, size_t key_len,
+                                   gcry_cipher_hd_t * hd_p) {
+  int algo = 0;
+  int i = 0;
+
+  switch (key_len) {
+    case 16:
+      algo = GCRY_CIPHER_AES128;
+      i = 0;
+      break;
+    case 24:
+      algo = GCRY_CIPHER_AES192;
+      i = 1;
+      break;
+    case 32:
+      algo = GCRY_CIPHER_AES256;
+      i = 2;
+      break;
+    default:
+      return -1;
+  }
+
+  if (!hds[i] && gcry_cipher_open(&hds[i], algo, mode, 0)) {
+    hds[i] = (void *) 0;
+    return -2;
+  }
+
+  if (gcry_cipher_setkey(hds[i], key_p, key_len)) {
+    return -2;
+  }
+
+  *hd_p = hds[i];
+  return 0;
+}
+
+/**
+ * Gets the GCM handle of the calling thread for the key length and prepares it for a new message.
+ *
+ * @param hd_p Will be set to the handle.
+ * @return 0 on success, negative on error.
+ */
+static int lurch_crypto_handle_prepare(const uint8_t * key_p, size_t key_len,
+                                       const uint8_t * iv_p, size_t iv_len,
+                                       gcry_cipher_hd_t * hd_p) {
+  gcry_cipher_hd_t hd = (void *) 0;
+
+  switch (lurch_crypto_cipher_get(lurch_crypto_thread_ctx_get()->gcm_hd, GCRY_CIPHER_MODE_GCM, key_p, key_len, &hd)) {
+    case 0:
+      break;
+    case -1:
+      return OMEMO_ERR_UNSUPPORTED_KEY_LEN;
+    default:
+      return OMEMO_ERR_CRYPTO;
+  }
+
+  if (gcry_cipher_setiv(hd, iv_p, iv_len) || gcry_cipher_final(hd)) {
+    return OMEMO_ERR_CRYPTO;
+  }
+
+  *hd_p = hd;
+  return 0;
+}
+
+int lurch_crypto_aes_gcm_encrypt(const uint8_t * plaintext_p, size_t plaintext_len,
+                                 const uint8_t * iv_p, size_t iv_len,
+                                 const uint8_t * key_p, size_t key_len,
+                                 size_t tag_len,
+                                 void * user_data_p,
+                                 uint8_t ** ciphertext_pp, size_t * ciphertext_len_p,
+                                 uint8_t ** tag_pp) {
+  int ret_val = 0;
+  gcry_cipher_hd_t hd = (void *) 0;
+  uint8_t * ct_p = (void *) 0;
+  uint8_t * tag_p = (void *) 0;
+
+  (void) user_data_p;
+
+  if (!plaintext_p || !iv_p || !key_p || !ciphertext_pp || !ciphertext_len_p || !tag_pp) {
+    return OMEMO_ERR_NULL;
+  }
+
+  ret_val = lurch_crypto_handle_prepare(key_p, key_len, iv_p, iv_len, &hd);
+  if (ret_val) {
+    goto cleanup;
+  }
+
+  ct_p = malloc(plaintext_len ? plaintext_len : 1);
+  tag_p = malloc(tag_len);
+  if (!ct_p || !tag_p) {
+    ret_val = OMEMO_ERR_NOMEM;
+    goto cleanup;
+  }
+
+  if (gcry_cipher_encrypt(hd, ct_p, plaintext_len, plaintext_p, plaintext_len)
+      || gcry_cipher_gettag(hd, tag_p, tag_len)) {
+    ret_val = OMEMO_ERR_CRYPTO;
+    goto cleanup;
+  }
+
+  *ciphertext_pp = ct_p;
+  *ciphertext_len_p = plaintext_len;
+  *tag_pp = tag_p;
+
+cleanup:
+  if (ret_val) {
+    free(ct_p);
+    free(tag_p);
+  }
+
+  return ret_val;
+}
+
+int lurch_crypto_aes_gcm_decrypt(const uint8_t * ciphertext_p, size_t ciphertext_len,
+                                 const uint8_t * iv_p, size_t iv_len,
+                                 const uint8_t * key_p, size_t key_len,
+                                 uint8_t * tag_p, size_t tag_len,
+                                 void * user_data_p,
+                                 uint8_t ** plaintext_pp, size_t * plaintext_len_p) {
+  int ret_val = 0;
+  gcry_cipher_hd_t hd = (void *) 0;
+  uint8_t * pt_p = (void *) 0;
+
+  (void) user_data_p;
+
+  if (!ciphertext_p || !iv_p || !key_p || !tag_p || !plaintext_pp || !plaintext_len_p) {
+    return OMEMO_ERR_NULL;
+  }
+
+  ret_val = lurch_crypto_handle_prepare(key_p, key_len, iv_p, iv_len, &hd);
+  if (ret_val) {
+    goto cleanup;
+  }
+
+  pt_p = malloc(ciphertext_len ? ciphertext_len : 1);
+  if (!pt_p) {
+    ret_val = OMEMO_ERR_NOMEM;
+    goto cleanup;
+  }
+
+  if (gcry_cipher_decrypt(hd, pt_p, ciphertext_len, ciphertext_p, ciphertext_len)) {
+    ret_val = OMEMO_ERR_CRYPTO;
+    goto cleanup;
+  }
+
+  if (gcry_cipher_checktag(hd, tag_p, tag_len)) {
+    ret_val = OMEMO_ERR_AUTH_FAIL;
+    goto cleanup;
+  }
+
+  *plaintext_pp = pt_p;
+  *plaintext_len_p = ciphertext_len;
+
+cleanup:
+  if (ret_val) {
+    free(pt_p);
+  }
+
+  return ret_val;
+}
+
+int lurch_crypto_aes_gcm_stream_begin(const uint8_t * key_p, size_t key_len,
+                                      const uint8_t * iv_p, size_t iv_len,
+                                      lurch_crypto_gcm_stream ** stream_pp) {
+  lurch_crypto_gcm_stream * stream_p = (void *) 0;
+  int algo = 0;
+
+  if (!key_p || !iv_p || !stream_pp) {
+    return OMEMO_ERR_NULL;
+  }
+
+  switch (key_len) {
+    case 16:
+      algo = GCRY_CIPHER_AES128;
+      break;
+    case 24:
+      algo = GCRY_CIPHER_AES192;
+      break;
+    case 32:
+      algo = GCRY_CIPHER_AES256;
+      break;
+    default:
+      return OMEMO_ERR_UNSUPPORTED_KEY_LEN;
+  }
+
+  stream_p = g_new0(lurch_crypto_gcm_stream, 1);
+  if (gcry_cipher_open(&stream_p->hd, algo, GCRY_CIPHER_MODE_GCM, 0)) {
+    g_free(stream_p);
+    return OMEMO_ERR_CRYPTO;
+  }
+
+  if (gcry_cipher_setkey(stream_p->hd, key_p, key_len) || gcry_cipher_setiv(stream_p->hd, iv_p, iv_len)) {
+    lurch_crypto_aes_gcm_stream_free(stream_p);
+    return OMEMO_ERR_CRYPTO;
+  }
+
+  *stream_pp = stream_p;
+  return 0;
+}
+
+int lurch_crypto_aes_gcm_stream_encrypt(lurch_crypto_gcm_stream * stream_p,
+                                        const uint8_t * in_p, uint8_t * out_p, size_t len,
+                                        gboolean last) {
+  if (!stream_p || !in_p || !out_p) {
+    return OMEMO_ERR_NULL;
+  }
+
+  if (last && gcry_cipher_final(stream_p->hd)) {
+    return OMEMO_ERR_CRYPTO;
+  }
+
+  // in place if the buffers are the same
+  if (in_p == out_p) {
+    return gcry_cipher_encrypt(stream_p->hd, out_p, len, (void *) 0, 0) ? OMEMO_ERR_CRYPTO : 0;
+  }
+  return gcry_cipher_encrypt(stream_p->hd, out_p, len, in_p, len) ? OMEMO_ERR_CRYPTO : 0;
+}
+
+int lurch_crypto_aes_gcm_stream_decrypt(lurch_crypto_gcm_stream * stream_p,
+                                        const uint8_t * in_p, uint8_t * out_p, size_t len,
+                                        gboolean last) {
+  if (!stream_p || !in_p || !out_p) {
+    return OMEMO_ERR_NULL;
+  }
+
+  if (last && gcry_cipher_final(stream_p->hd)) {
+    return OMEMO_ERR_CRYPTO;
+  }
+
+  if (in_p == out_p) {
+    return gcry_cipher_decrypt(stream_p->hd, out_p, len, (void *) 0, 0) ? OMEMO_ERR_CRYPTO : 0;
+  }
+  return gcry_cipher_decrypt(stream_p->hd, out_p, len, in_p, len) ? OMEMO_ERR_CRYPTO : 0;
+}
+
+int lurch_crypto_aes_gcm_stream_get_tag(lurch_crypto_gcm_stream * stream_p, uint8_t * tag_p, size_t tag_len) {
+  if (!stream_p || !tag_p) {
+    return OMEMO_ERR_NULL;
+  }
+
+  return gcry_cipher_gettag(stream_p->hd, tag_p, tag_len) ? OMEMO_ERR_CRYPTO : 0;
+}
+
+int lurch_crypto_aes_gcm_stream_check_tag(lurch_crypto_gcm_stream * stream_p, const uint8_t * tag_p, size_t tag_len) {
+  if (!stream_p || !tag_p) {
+    return OMEMO_ERR_NULL;
+  }
+
+  return gcry_cipher_checktag(stream_p->hd, tag_p, tag_len) ? OMEMO_ERR_AUTH_FAIL : 0;
+}
+
+void lurch_crypto_aes_gcm_stream_free(lurch_crypto_gcm_stream * stream_p) {
+  if (!stream_p) {
+    return;
+  }
+
+  gcry_cipher_close(stream_p->hd);
+  g_free(stream_p);
+}
+
+int lurch_crypto_hmac_sha256_init(void ** hmac_context_pp, const uint8_t * key_p, size_t key_len, void * user_data_p) {
+  lurch_crypto_thread_ctx * tctx_p = lurch_crypto_thread_ctx_get();
+  gcry_mac_hd_t hd = (void *) 0;
+
+  (void) user_data_p;
+
+  if (tctx_p->hmac_count > 0) {
+    hd = tctx_p->hmac_hd[--tctx_p->hmac_count];
+  } else if (gcry_mac_open(&hd, GCRY_MAC_HMAC_SHA256, 0, (void *) 0)) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  if (gcry_mac_setkey(hd, key_p, key_len)) {
+    gcry_mac_close(hd);
+    return SG_ERR_UNKNOWN;
+  }
+
+  *hmac_context_pp = hd;
+  return 0;
+}
+
+int lurch_crypto_hmac_sha256_update(void * hmac_context_p, const uint8_t * data_p, size_t data_len, void * user_data_p) {
+  (void) user_data_p;
+
+  return gcry_mac_write((gcry_mac_hd_t) hmac_context_p, data_p, data_len) ? SG_ERR_UNKNOWN : 0;
+}
+
+int lurch_crypto_hmac_sha256_final(void * hmac_context_p, signal_buffer ** output_pp, void * user_data_p) {
+  uint8_t mac[LURCH_CRYPTO_HMAC_SHA256_LEN];
+  size_t mac_len = sizeof(mac);
+  signal_buffer * output_p = (void *) 0;
+
+  (void) user_data_p;
+
+  if (gcry_mac_read((gcry_mac_hd_t) hmac_context_p, mac, &mac_len)) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  output_p = signal_buffer_create(mac, mac_len);
+  if (!output_p) {
+    return SG_ERR_NOMEM;
+  }
+
+  *output_pp = output_p;
+  return 0;
+}
+
+void lurch_crypto_hmac_sha256_cleanup(void * hmac_context_p, void * user_data_p) {
+  lurch_crypto_thread_ctx * tctx_p = (void *) 0;
+  gcry_mac_hd_t hd = (gcry_mac_hd_t) hmac_context_p;
+
+  (void) user_data_p;
+
+  if (!hd) {
+    return;
+  }
+
+  tctx_p = lurch_crypto_thread_ctx_get();
+  if (tctx_p->hmac_count < LURCH_CRYPTO_SPARE_HDS && !gcry_mac_reset(hd)) {
+    tctx_p->hmac_hd[tctx_p->hmac_count++] = hd;
+  } else {
+    gcry_mac_close(hd);
+  }
+}
+
+int lurch_crypto_sha512_digest_init(void ** digest_context_pp, void * user_data_p) {
+  lurch_crypto_thread_ctx * tctx_p = lurch_crypto_thread_ctx_get();
+  gcry_md_hd_t hd = (void *) 0;
+
+  (void) user_data_p;
+
+  if (tctx_p->sha512_count > 0) {
+    hd = tctx_p->sha512_hd[--tctx_p->sha512_count];
+  } else if (gcry_md_open(&hd, GCRY_MD_SHA512, 0)) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  *digest_context_pp = hd;
+  return 0;
+}
+
+int lurch_crypto_sha512_digest_update(void * digest_context_p, const uint8_t * data_p, size_t data_len, void * user_data_p) {
+  (void) user_data_p;
+
+  gcry_md_write((gcry_md_hd_t) digest_context_p, data_p, data_len);
+  return 0;
+}
+
+int lurch_crypto_sha512_digest_final(void * digest_context_p, signal_buffer ** output_pp, void * user_data_p) {
+  gcry_md_hd_t hd = (gcry_md_hd_t) digest_context_p;
+  const unsigned char * md_p = (void *) 0;
+  signal_buffer * output_p = (void *) 0;
+
+  (void) user_data_p;
+
+  md_p = gcry_md_read(hd, GCRY_MD_SHA512);
+  if (!md_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  output_p = signal_buffer_create(md_p, LURCH_CRYPTO_SHA512_LEN);
+  if (!output_p) {
+    return SG_ERR_NOMEM;
+  }
+
+  // libsignal keeps using the context for the next digest
+  gcry_md_reset(hd);
+
+  *output_pp = output_p;
+  return 0;
+}
+
+void lurch_crypto_sha512_digest_cleanup(void * digest_context_p, void * user_data_p) {
+  lurch_crypto_thread_ctx * tctx_p = (void *) 0;
+  gcry_md_hd_t hd = (gcry_md_hd_t) digest_context_p;
+
+  (void) user_data_p;
+
+  if (!hd) {
+    return;
+  }
+
+  tctx_p = lurch_crypto_thread_ctx_get();
+  if (tctx_p->sha512_count < LURCH_CRYPTO_SPARE_HDS) {
+    gcry_md_reset(hd);
+    tctx_p->sha512_hd[tctx_p->sha512_count++] = hd;
+  } else {
+    gcry_md_close(hd);
+  }
+}
+
+/**
+ * Gets the calling thread's handle for the cipher and key length and sets the key and IV or counter.
+ *
+ * @param hd_p Will be set to the handle.
+ * @return 0 on success, negative on error.
+ */
+static int lurch_crypto_signal_cipher_prepare(int cipher,
+                                              const uint8_t * key_p, size_t key_len,
+                                              const uint8_t * iv_p, size_t iv_len,
+                                              gcry_cipher_hd_t * hd_p) {
+  lurch_crypto_thread_ctx * tctx_p = lurch_crypto_thread_ctx_get();
+  gcry_cipher_hd_t hd = (void *) 0;
+  int ret_val = 0;
+
+  if (iv_len != LURCH_CRYPTO_AES_BLOCK_LEN) {
+    return SG_ERR_INVAL;
+  }
+
+  switch (cipher) {
+    case SG_CIPHER_AES_CBC_PKCS5:
+      ret_val = lurch_crypto_cipher_get(tctx_p->cbc_hd, GCRY_CIPHER_MODE_CBC, key_p, key_len, &hd);
+      if (!ret_val && gcry_cipher_setiv(hd, iv_p, iv_len)) {
+        ret_val = -2;
+      }
+      break;
+    case SG_CIPHER_AES_CTR_NOPADDING:
+      ret_val = lurch_crypto_cipher_get(tctx_p->ctr_hd, GCRY_CIPHER_MODE_CTR, key_p, key_len, &hd);
+      if (!ret_val && gcry_cipher_setctr(hd, iv_p, iv_len)) {
+        ret_val = -2;
+      }
+      break;
+    default:
+      return SG_ERR_INVAL;
+  }
+
+  switch (ret_val) {
+    case 0:
+      *hd_p = hd;
+      return 0;
+    case -1:
+      return SG_ERR_INVAL;
+    default:
+      return SG_ERR_UNKNOWN;
+  }
+}
+
+int lurch_crypto_encrypt(signal_buffer ** output_pp, int cipher,
+                         const uint8_t * key_p, size_t key_len,
+                         const uint8_t * iv_p, size_t iv_len,
+                         const uint8_t * plaintext_p, size_t plaintext_len,
+                         void * user_data_p) {
+  int ret_val = 0;
+  gcry_cipher_hd_t hd = (void *) 0;
+  signal_buffer * output_p = (void *) 0;
+  uint8_t * out_p = (void *) 0;
+  size_t pad_len = 0;
+
+  (void) user_data_p;
+
+  ret_val = lurch_crypto_signal_cipher_prepare(cipher, key_p, key_len, iv_p, iv_len, &hd);
+  if (ret_val) {
+    return ret_val;
+  }
+
+  if (cipher == SG_CIPHER_AES_CBC_PKCS5) {
+    pad_len = LURCH_CRYPTO_AES_BLOCK_LEN - (plaintext_len % LURCH_CRYPTO_AES_BLOCK_LEN);
+  }
+
+  output_p = signal_buffer_alloc(plaintext_len + pad_len);
+  if (!output_p) {
+    return SG_ERR_NOMEM;
+  }
+
+  // padded in place and encrypted in place, so that there is no second buffer
+  out_p = signal_buffer_data(output_p);
+  memcpy(out_p, plaintext_p, plaintext_len);
+  memset(out_p + plaintext_len, (int) pad_len, pad_len);
+
+  if (gcry_cipher_encrypt(hd, out_p, plaintext_len + pad_len, (void *) 0, 0)) {
+    signal_buffer_bzero_free(output_p);
+    return SG_ERR_UNKNOWN;
+  }
+
+  *output_pp = output_p;
+  return 0;
+}
+
+int lurch_crypto_decrypt(signal_buffer ** output_pp, int cipher,
+                         const uint8_t * key_p, size_t key_len,
+                         const uint8_t * iv_p, size_t iv_len,
+                         const uint8_t * ciphertext_p, size_t ciphertext_len,
+                         void * user_data_p) {
+  int ret_val = 0;
+  gcry_cipher_hd_t hd = (void *) 0;
+  signal_buffer * plain_p = (void *) 0;
+  signal_buffer * output_p = (void *) 0;
+  uint8_t * pt_p = (void *) 0;
+  size_t pad_len = 0;
+  size_t i = 0;
+
+  (void) user_data_p;
+
+  if (cipher == SG_CIPHER_AES_CBC_PKCS5
+      && (!ciphertext_len || ciphertext_len % LURCH_CRYPTO_AES_BLOCK_LEN)) {
+    return SG_ERR_INVAL;
+  }
+
+  ret_val = lurch_crypto_signal_cipher_prepare(cipher, key_p, key_len, iv_p, iv_len, &hd);
+  if (ret_val) {
+    return ret_val;
+  }
+
+  plain_p = signal_buffer_alloc(ciphertext_len);
+  if (!plain_p) {
+    return SG_ERR_NOMEM;
+  }
+  pt_p = signal_buffer_data(plain_p);
+
+  if (gcry_cipher_decrypt(hd, pt_p, ciphertext_len, ciphertext_p, ciphertext_len)) {
+    ret_val = SG_ERR_UNKNOWN;
+    goto cleanup;
+  }
+
+  if (cipher == SG_CIPHER_AES_CBC_PKCS5) {
+    pad_len = pt_p[ciphertext_len - 1];
+    if (!pad_len || pad_len > LURCH_CRYPTO_AES_BLOCK_LEN) {
+      ret_val = SG_ERR_UNKNOWN;
+      goto cleanup;
+    }
+    for (i = ciphertext_len - pad_len; i < ciphertext_len; i++) {
+      if (pt_p[i] != pad_len) {
+        ret_val = SG_ERR_UNKNOWN;
+        goto cleanup;
+      }
+    }
+  }
+
+  if (!pad_len) {
+    *output_pp = plain_p;
+    return 0;
+  }
+
+  output_p = signal_buffer_create(pt_p, ciphertext_len - pad_len);
+  if (!output_p) {
+    ret_val = SG_ERR_NOMEM;
+    goto cleanup;
+  }
+  *output_pp = output_p;
+
+cleanup:
+  signal_buffer_bzero_free(plain_p);
+
+  return ret_val;
+}
+
+/**
+ * Generates the next block of random bytes into the thread's pool.
+ * The first bytes of each block become the key of the next one and are wiped from the pool,
+ * so that earlier output cannot be recovered from the state. The key is replaced by one from
+ * libgcrypt's strong RNG on first use and then on the reseed schedule.
+ *
+ * @return 0 on success, -1 on a libgcrypt error.
+ */
+static int lurch_crypto_rng_refill(lurch_crypto_thread_ctx * tctx_p) {
+  static const uint8_t nonce[LURCH_CRYPTO_RNG_NONCE_LEN] = { 0 };
+  uint8_t seed[LURCH_CRYPTO_RNG_KEY_LEN];
+  gint64 now = g_get_monotonic_time();
+  int ret_val = 0;
+
+  if (!tctx_p->rng_hd) {
+    if (gcry_cipher_open(&tctx_p->rng_hd, GCRY_CIPHER_CHACHA20, GCRY_CIPHER_MODE_STREAM, 0)) {
+      tctx_p->rng_hd = (void *) 0;
+      return -1;
+    }
+    tctx_p->rng_reseed_time = 0;
+  }
+
+  if (!tctx_p->rng_reseed_time
+      || tctx_p->rng_since_reseed >= LURCH_CRYPTO_RNG_RESEED_BYTES
+      || now - tctx_p->rng_reseed_time >= LURCH_CRYPTO_RNG_RESEED_US) {
+    gcry_randomize(seed, sizeof(seed), GCRY_STRONG_RANDOM);
+    ret_val = gcry_cipher_setkey(tctx_p->rng_hd, seed, sizeof(seed)) ? -1 : 0;
+    lurch_crypto_wipe(seed, sizeof(seed));
+    if (ret_val) {
+      // do not keep going with a key that did not get replaced
+      tctx_p->rng_reseed_time = 0;
+      return -1;
+    }
+    tctx_p->rng_reseed_time = now;
+    tctx_p->rng_since_reseed = 0;
+  }
+
+  memset(tctx_p->rng_pool, 0, sizeof(tctx_p->rng_pool));
+  if (gcry_cipher_setiv(tctx_p->rng_hd, nonce, sizeof(nonce))
+      || gcry_cipher_encrypt(tctx_p->rng_hd, tctx_p->rng_pool, sizeof(tctx_p->rng_pool), (void *) 0, 0)
+      || gcry_cipher_setkey(tctx_p->rng_hd, tctx_p->rng_pool, LURCH_CRYPTO_RNG_KEY_LEN)) {
+    tctx_p->rng_reseed_time = 0;
+    tctx_p->rng_avail = 0;
+    return -1;
+  }
+  lurch_crypto_wipe(tctx_p->rng_pool, LURCH_CRYPTO_RNG_KEY_LEN);
+  tctx_p->rng_avail = LURCH_CRYPTO_RNG_POOL_LEN - LURCH_CRYPTO_RNG_KEY_LEN;
+
+  return 0;
+}
+
+int lurch_crypto_random_fill(uint8_t * buf_p, size_t buf_len) {
+  lurch_crypto_thread_ctx * tctx_p = lurch_crypto_thread_ctx_get();
+  uint8_t * pool_p = (void *) 0;
+  size_t len = 0;
+
+  while (buf_len > 0) {
+    if (!tctx_p->rng_avail && lurch_crypto_rng_refill(tctx_p)) {
+      return -1;
+    }
+
+    len = MIN(buf_len, tctx_p->rng_avail);
+    pool_p = tctx_p->rng_pool + LURCH_CRYPTO_RNG_POOL_LEN - tctx_p->rng_avail;
+    memcpy(buf_p, pool_p, len);
+    lurch_crypto_wipe(pool_p, len);
+
+    tctx_p->rng_avail -= len;
+    tctx_p->rng_since_reseed += len;
+    buf_p += len;
+    buf_len -= len;
+  }
+
+  return 0;
+}
+
+int lurch_crypto_random_bytes(uint8_t ** buf_pp, size_t buf_len, void * user_data_p) {
+  uint8_t * buf_p = (void *) 0;
+
+  (void) user_data_p;
+
+  if (!buf_pp) {
+    return OMEMO_ERR_NULL;
+  }
+
+  buf_p = malloc(buf_len ? buf_len : 1);
+  if (!buf_p) {
+    return OMEMO_ERR_NOMEM;
+  }
+
+  if (lurch_crypto_random_fill(buf_p, buf_len)) {
+    free(buf_p);
+    return OMEMO_ERR_CRYPTO;
+  }
+
+  *buf_pp = buf_p;
+  return 0;
+}
+
+int lurch_crypto_signal_random(uint8_t * data_p, size_t len, void * user_data_p) {
+  (void) user_data_p;
+
+  return lurch_crypto_random_fill(data_p, len) ? SG_ERR_UNKNOWN : 0;
+}
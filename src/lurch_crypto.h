@@ -0,0 +1,197 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glib.h>
+
+#include "libomemo.h"
+#include "signal_protocol.h"
+
+/**
+ * AES-GCM for the omemo_crypto_provider, with the same signatures and allocation rules
+ * as the omemo_default_crypto_aes_gcm_*() functions, and HMAC-SHA256, SHA-512 and AES-CBC/CTR
+ * for the signal_crypto_provider of the axc contexts, as a replacement for axc's template.
+ *
+ * Instead of opening a libgcrypt handle for every payload, each thread keeps one cipher handle
+ * per mode and key length and only sets the key and IV on it, and a few MAC and digest handles
+ * which are reset instead of closed. libgcrypt picks its AES, GHASH and SHA implementation
+ * from the CPU features, so the handles use AES-NI, PCLMULQDQ and the SHA extensions where present
+ * and libgcrypt's portable code everywhere else.
+ *
+ * The random functions hand out bytes from a per-thread ChaCha20 pool, which is keyed from
+ * libgcrypt's strong RNG and reseeded after 1 MiB of output or ten minutes, instead of going
+ * to the strong RNG and its lock for every IV and key.
+ */
+
+// values of the AES-GCM implementation pref
+#define LURCH_CRYPTO_AES_GCM_AUTO    "auto"
+#define LURCH_CRYPTO_AES_GCM_CACHED  "cached"
+#define LURCH_CRYPTO_AES_GCM_DEFAULT "default"
+
+// values of the libsignal crypto implementation pref
+#define LURCH_CRYPTO_SIGNAL_AUTO    "auto"
+#define LURCH_CRYPTO_SIGNAL_CACHED  "cached"
+#define LURCH_CRYPTO_SIGNAL_DEFAULT "default"
+
+/**
+ * Checks which AES and GHASH acceleration libgcrypt uses on this CPU.
+ * Has to be called after the libgcrypt initialization, i.e. after omemo_default_crypto_init().
+ */
+void lurch_crypto_init(void);
+
+/**
+ * Closes the cipher handles of all threads.
+ * Threads using the functions afterwards open new ones.
+ */
+void lurch_crypto_teardown(void);
+
+/**
+ * Closes the cipher handles of the calling thread. Has to be called by the threads lurch starts
+ * before they end, as their contexts are otherwise only freed by lurch_crypto_teardown().
+ * The thread opens new ones if it uses the functions afterwards.
+ */
+void lurch_crypto_thread_release(void);
+
+/**
+ * @return TRUE if libgcrypt reported both AES and carry-less multiplication instructions
+ *         (e.g. AES-NI and PCLMULQDQ, or the ARMv8 crypto extensions) in lurch_crypto_init().
+ */
+gboolean lurch_crypto_has_aes_hw(void);
+
+/**
+ * @return TRUE if libgcrypt reported SHA-2 instructions in lurch_crypto_init().
+ */
+gboolean lurch_crypto_has_sha_hw(void);
+
+/**
+ * Sets the AES-GCM functions of the provider according to the pref value.
+ * "auto" selects the cached handles if lurch_crypto_has_aes_hw(), where the saved setup matters most
+ * relative to the encryption itself, and libomemo's default functions otherwise.
+ *
+ * @param crypto_p The provider to change.
+ * @param impl One of the LURCH_CRYPTO_AES_GCM_* values. Unknown values are treated as "auto".
+ * @return TRUE if the cached handles were selected.
+ */
+gboolean lurch_crypto_provider_select(omemo_crypto_provider * crypto_p, const char * impl);
+
+/**
+ * Replaces the HMAC, digest and cipher functions of a copy of axc's crypto provider template
+ * according to the pref value. "auto" selects the cached HMAC-SHA256 and SHA-512 handles
+ * if lurch_crypto_has_sha_hw() and the cached AES-CBC/CTR handles if lurch_crypto_has_aes_hw().
+ * The other functions are kept, the random function can be replaced with lurch_crypto_signal_random().
+ *
+ * @param provider_p The provider to change.
+ * @param impl One of the LURCH_CRYPTO_SIGNAL_* values. Unknown values are treated as "auto".
+ * @return TRUE if any of the cached handles were selected.
+ */
+gboolean lurch_crypto_signal_provider_select(signal_crypto_provider * provider_p, const char * impl);
+
+/**
+ * Implements omemo_crypto_provider.aes_gcm_encrypt_func.
+ * The ciphertext and the tag are malloc()'d.
+ */
+int lurch_crypto_aes_gcm_encrypt(const uint8_t * plaintext_p, size_t plaintext_len,
+                                 const uint8_t * iv_p, size_t iv_len,
+                                 const uint8_t * key_p, size_t key_len,
+                                 size_t tag_len,
+                                 void * user_data_p,
+                                 uint8_t ** ciphertext_pp, size_t * ciphertext_len_p,
+                                 uint8_t ** tag_pp);
+
+/**
+ * Implements omemo_crypto_provider.aes_gcm_decrypt_func.
+ * The plaintext is malloc()'d.
+ */
+int lurch_crypto_aes_gcm_decrypt(const uint8_t * ciphertext_p, size_t ciphertext_len,
+                                 const uint8_t * iv_p, size_t iv_len,
+                                 const uint8_t * key_p, size_t key_len,
+                                 uint8_t * tag_p, size_t tag_len,
+                                 void * user_data_p,
+                                 uint8_t ** plaintext_pp, size_t * plaintext_len_p);
+
+typedef struct lurch_crypto_gcm_stream lurch_crypto_gcm_stream;
+
+/**
+ * Starts an AES-GCM encryption or decryption that is fed in blocks, so that large payloads
+ * do not have to be held in full, or can be processed in place.
+ * Uses its own cipher handle, not the thread's cached one.
+ *
+ * @param stream_pp Will point to the stream. Free with lurch_crypto_aes_gcm_stream_free() when done.
+ * @return 0 on success, negative on error.
+ */
+int lurch_crypto_aes_gcm_stream_begin(const uint8_t * key_p, size_t key_len,
+                                      const uint8_t * iv_p, size_t iv_len,
+                                      lurch_crypto_gcm_stream ** stream_pp);
+
+/**
+ * Encrypts or decrypts the next block. All blocks but the last one must be a multiple of 16 bytes long.
+ *
+ * @param in_p The input.
+ * @param out_p The output, can be the same as in_p.
+ * @param len The length of both.
+ * @param last TRUE for the last block.
+ * @return 0 on success, negative on error.
+ */
+int lurch_crypto_aes_gcm_stream_encrypt(lurch_crypto_gcm_stream * stream_p,
+                                        const uint8_t * in_p, uint8_t * out_p, size_t len,
+                                        gboolean last);
+int lurch_crypto_aes_gcm_stream_decrypt(lurch_crypto_gcm_stream * stream_p,
+                                        const uint8_t * in_p, uint8_t * out_p, size_t len,
+                                        gboolean last);
+
+/**
+ * Gets the tag after the last block was encrypted.
+ */
+int lurch_crypto_aes_gcm_stream_get_tag(lurch_crypto_gcm_stream * stream_p, uint8_t * tag_p, size_t tag_len);
+
+/**
+ * Checks the tag after the last block was decrypted.
+ *
+ * @return 0 if it matches, OMEMO_ERR_AUTH_FAIL if not, other negative values on error.
+ */
+int lurch_crypto_aes_gcm_stream_check_tag(lurch_crypto_gcm_stream * stream_p, const uint8_t * tag_p, size_t tag_len);
+
+void lurch_crypto_aes_gcm_stream_free(lurch_crypto_gcm_stream * stream_p);
+
+/**
+ * Implement the signal_crypto_provider functions of the same names.
+ * The HMAC and digest contexts must be cleaned up on the thread that initialized them.
+ */
+int lurch_crypto_hmac_sha256_init(void ** hmac_context_pp, const uint8_t * key_p, size_t key_len, void * user_data_p);
+int lurch_crypto_hmac_sha256_update(void * hmac_context_p, const uint8_t * data_p, size_t data_len, void * user_data_p);
+int lurch_crypto_hmac_sha256_final(void * hmac_context_p, signal_buffer ** output_pp, void * user_data_p);
+void lurch_crypto_hmac_sha256_cleanup(void * hmac_context_p, void * user_data_p);
+int lurch_crypto_sha512_digest_init(void ** digest_context_pp, void * user_data_p);
+int lurch_crypto_sha512_digest_update(void * digest_context_p, const uint8_t * data_p, size_t data_len, void * user_data_p);
+int lurch_crypto_sha512_digest_final(void * digest_context_p, signal_buffer ** output_pp, void * user_data_p);
+void lurch_crypto_sha512_digest_cleanup(void * digest_context_p, void * user_data_p);
+int lurch_crypto_encrypt(signal_buffer ** output_pp, int cipher,
+                         const uint8_t * key_p, size_t key_len,
+                         const uint8_t * iv_p, size_t iv_len,
+                         const uint8_t * plaintext_p, size_t plaintext_len,
+                         void * user_data_p);
+int lurch_crypto_decrypt(signal_buffer ** output_pp, int cipher,
+                         const uint8_t * key_p, size_t key_len,
+                         const uint8_t * iv_p, size_t iv_len,
+                         const uint8_t * ciphertext_p, size_t ciphertext_len,
+                         void * user_data_p);
+
+/**
+ * Fills the buffer with random bytes from the calling thread's pool. Does not allocate,
+ * except for the pool itself on first use.
+ *
+ * @return 0 on success, -1 on a libgcrypt error.
+ */
+int lurch_crypto_random_fill(uint8_t * buf_p, size_t buf_len);
+
+/**
+ * Implements omemo_crypto_provider.random_bytes_func on top of lurch_crypto_random_fill().
+ * The buffer is malloc()'d, as libomemo frees the IV and key it gets from this function.
+ */
+int lurch_crypto_random_bytes(uint8_t ** buf_pp, size_t buf_len, void * user_data_p);
+
+/**
+ * Implements signal_crypto_provider.random_func on top of lurch_crypto_random_fill().
+ */
+int lurch_crypto_signal_random(uint8_t * data_p, size_t len, void * user_data_p);
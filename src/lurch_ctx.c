@@ -0,0 +1,552 @@
+#include <glib.h>
+#include <purple.h>
+
+#include "jabber.h"
+
+#include "axc_dakes_intf.h"
+#include "lurch_ctx.h"
+#include "lurch_store.h"
+#include "lurch_util.h"
+
+typedef struct {
+  xmlnode * node_p;
+  gboolean sending;
+} lurch_ctx_held_stanza;
+
+// a stanza submitted to the worker of a connection, see lurch_ctx_async_submit()
+typedef struct {
+  lurch_ctx * ctx_p;
+  xmlnode * node_p;
+  lurch_ctx_work_fn work_fn;
+  lurch_ctx_finish_fn finish_fn;
+  GDestroyNotify free_fn;
+  void * data_p;
+} lurch_ctx_async_job;
+
+// the catch-up ends if no delayed message came in for this long
+#define LURCH_CTX_CATCHUP_IDLE_MS 1000
+// bounds the memory and what is lost on a crash
+#define LURCH_CTX_CATCHUP_BATCH_MAX 256
+
+// PurpleConnection * -> lurch_ctx *
+static GHashTable * ctx_map = (void *) 0;
+
+// set while the held stanzas are passed on, so that they are not held again
+static gboolean flushing = FALSE;
+
+// set while a stanza handled by a worker is passed on, see lurch_ctx_passing_on()
+static gboolean passing_on = FALSE;
+
+static void lurch_ctx_held_stanza_free(gpointer data) {
+  lurch_ctx_held_stanza * held_p = data;
+
+  xmlnode_free(held_p->node_p);
+  g_free(held_p);
+}
+
+static void lurch_ctx_async_job_free(gpointer data) {
+  lurch_ctx_async_job * job_p = data;
+
+  if (job_p->free_fn) {
+    job_p->free_fn(job_p->data_p);
+  }
+  if (job_p->node_p) {
+    xmlnode_free(job_p->node_p);
+  }
+  g_free(job_p);
+}
+
+static void lurch_ctx_free(gpointer data) {
+  lurch_ctx * ctx_p = data;
+
+  if (!ctx_p) {
+    return;
+  }
+
+  // waits for the worker, which saves its batch before it stops
+  lurch_pipe_free(ctx_p->pipe_p, lurch_ctx_async_job_free);
+  ctx_p->pipe_p = (void *) 0;
+  lurch_ctx_catchup_end(ctx_p);
+  if (ctx_p->cleanup_id) {
+    (void) g_source_remove(ctx_p->cleanup_id);
+  }
+  g_list_free_full(ctx_p->cleanup_faux_l_p, free);
+  g_queue_clear_full(&ctx_p->held, lurch_ctx_held_stanza_free);
+  g_free(ctx_p->uname);
+  g_free(ctx_p);
+}
+
+/**
+ * Passes the held stanzas of a connection to libpurple again, the same way its parser and send functions do.
+ */
+static void lurch_ctx_flush(PurpleConnection * gc_p) {
+  lurch_ctx * ctx_p = (void *) 0;
+  lurch_ctx_held_stanza * held_p = (void *) 0;
+  JabberStream * js_p = purple_connection_get_protocol_data(gc_p);
+
+  flushing = TRUE;
+  // the callbacks can drop the context, so it is looked up for every stanza
+  while (ctx_map && (ctx_p = g_hash_table_lookup(ctx_map, gc_p)) && (held_p = g_queue_pop_head(&ctx_p->held))) {
+    if (held_p->sending) {
+      jabber_send(js_p, held_p->node_p);
+    } else {
+      jabber_process_packet(js_p, &held_p->node_p);
+    }
+    if (held_p->node_p) {
+      xmlnode_free(held_p->node_p);
+    }
+    g_free(held_p);
+  }
+  flushing = FALSE;
+}
+
+static void lurch_ctx_flush_all(void) {
+  lurch_ctx * ctx_p = (void *) 0;
+  GList * gc_l_p = (void *) 0;
+  GList * curr_p = (void *) 0;
+
+  if (!ctx_map) {
+    return;
+  }
+
+  gc_l_p = g_hash_table_get_keys(ctx_map);
+  for (curr_p = gc_l_p; curr_p && ctx_map; curr_p = curr_p->next) {
+    ctx_p = g_hash_table_lookup(ctx_map, curr_p->data);
+    if (ctx_p && !ctx_p->warming) {
+      lurch_ctx_flush(curr_p->data);
+    }
+  }
+  g_list_free(gc_l_p);
+}
+
+static gboolean lurch_ctx_flush_dispatch(gpointer data) {
+  (void) data;
+  lurch_ctx_flush_all();
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * Completion of cachectx_prewarm(). Fills in the axc context of all connections of the account
+ * and passes on their held stanzas from the main loop, as this can run in the middle of other callbacks.
+ * On error, the axc context is left empty, so that lurch_ctx_get() tries again synchronously.
+ */
+static void lurch_ctx_prewarm_done(const char * name, int ret_val, void * user_data) {
+  GHashTableIter iter;
+  gpointer value = (void *) 0;
+  lurch_ctx * ctx_p = (void *) 0;
+  gboolean any_held = FALSE;
+
+  (void) user_data;
+
+  if (!ctx_map) {
+    return;
+  }
+
+  g_hash_table_iter_init(&iter, ctx_map);
+  while (g_hash_table_iter_next(&iter, (void *) 0, &value)) {
+    ctx_p = value;
+    if (!ctx_p->warming || g_strcmp0(ctx_p->uname, name)) {
+      continue;
+    }
+
+    ctx_p->warming = FALSE;
+    if (!ret_val) {
+      ctx_p->cachectx_p = query_axc_ctx_by_name(get_acc_axc_ctx_map(), name);
+      ctx_p->faux_regid = cachectx_get_faux_regid(ctx_p->cachectx_p);
+    }
+    any_held = any_held || !g_queue_is_empty(&ctx_p->held);
+  }
+
+  if (any_held) {
+    g_idle_add(lurch_ctx_flush_dispatch, &ctx_map);
+  }
+}
+
+/**
+ * Gets the axc context from the account map, waiting for its initialization if it is underway.
+ */
+static int lurch_ctx_fill(lurch_ctx * ctx_p) {
+  int ret_val = 0;
+
+  ret_val = cachectx_get_from_map(get_acc_axc_ctx_map(), ctx_p->uname, &ctx_p->cachectx_p);
+  if (ret_val) {
+    purple_debug_error("lurch", "%s: failed to get axc ctx for %s (%i)\n", __func__, ctx_p->uname, ret_val);
+    return ret_val;
+  }
+  ctx_p->faux_regid = cachectx_get_faux_regid(ctx_p->cachectx_p);
+  ctx_p->warming = FALSE;
+
+  return 0;
+}
+
+int lurch_ctx_create(PurpleConnection * gc_p, lurch_ctx ** ctx_pp) {
+  int ret_val = 0;
+  char * err_msg_dbg = (void *) 0;
+
+  lurch_ctx * ctx_p = (void *) 0;
+
+  ctx_p = g_malloc0(sizeof(lurch_ctx));
+  ctx_p->gc_p = gc_p;
+  ctx_p->uname = lurch_util_uname_strip(purple_account_get_username(purple_connection_get_account(gc_p)));
+  g_queue_init(&ctx_p->held);
+
+  ret_val = lurch_store_get(ctx_p->uname, &ctx_p->store_p);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to open the stores of %s", ctx_p->uname);
+    goto cleanup;
+  }
+  ctx_p->db_fn_omemo = lurch_store_get_db_fn(ctx_p->store_p, LURCH_STORE_DB_OMEMO);
+  ctx_p->db_fn_axc = lurch_store_get_db_fn(ctx_p->store_p, LURCH_STORE_DB_AXC);
+
+  ret_val = cachectx_prewarm(ctx_p->uname, lurch_ctx_prewarm_done, (void *) 0);
+  if (ret_val == 1) {
+    ret_val = lurch_ctx_fill(ctx_p);
+    if (ret_val) {
+      err_msg_dbg = g_strdup_printf("failed to get axc ctx for %s", ctx_p->uname);
+      goto cleanup;
+    }
+  } else if (ret_val == 0) {
+    ctx_p->warming = TRUE;
+  } else {
+    // not fatal, lurch_ctx_get() initializes it synchronously instead
+    purple_debug_error("lurch", "%s: failed to start initializing the axc ctx of %s (%i)\n", __func__, ctx_p->uname, ret_val);
+    ret_val = 0;
+  }
+
+  if (!ctx_map) {
+    ctx_map = g_hash_table_new_full(g_direct_hash, g_direct_equal, (void *) 0, lurch_ctx_free);
+  }
+  (void) g_hash_table_replace(ctx_map, gc_p, ctx_p);
+
+  if (ctx_pp) {
+    *ctx_pp = ctx_p;
+  }
+
+cleanup:
+  if (ret_val) {
+    lurch_ctx_free(ctx_p);
+  }
+  if (err_msg_dbg) {
+    purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
+    g_free(err_msg_dbg);
+  }
+
+  return ret_val;
+}
+
+lurch_ctx * lurch_ctx_get(PurpleConnection * gc_p) {
+  lurch_ctx * ctx_p = ctx_map ? g_hash_table_lookup(ctx_map, gc_p) : (void *) 0;
+
+  if (!ctx_p && lurch_ctx_create(gc_p, &ctx_p)) {
+    return (void *) 0;
+  }
+
+  if (!ctx_p->cachectx_p && lurch_ctx_fill(ctx_p)) {
+    return (void *) 0;
+  }
+
+  return ctx_p;
+}
+
+gboolean lurch_ctx_hold(PurpleConnection * gc_p, xmlnode ** stanza_pp, gboolean sending) {
+  lurch_ctx * ctx_p = ctx_map ? g_hash_table_lookup(ctx_map, gc_p) : (void *) 0;
+  lurch_ctx_held_stanza * held_p = (void *) 0;
+
+  if (!ctx_p || flushing || (!ctx_p->warming && g_queue_is_empty(&ctx_p->held))) {
+    return FALSE;
+  }
+
+  held_p = g_malloc0(sizeof(lurch_ctx_held_stanza));
+  held_p->node_p = sending ? xmlnode_copy(*stanza_pp) : *stanza_pp;
+  held_p->sending = sending;
+  g_queue_push_tail(&ctx_p->held, held_p);
+
+  purple_debug_info("lurch", "%s: holding back %s stanza until the axc ctx of %s is ready\n",
+                    __func__, sending ? "outgoing" : "incoming", ctx_p->uname);
+
+  *stanza_pp = (void *) 0;
+  return TRUE;
+}
+
+static void lurch_ctx_catchup_commit(lurch_ctx * ctx_p) {
+  int ret_val = 0;
+
+  ret_val = lurch_store_batch_commit(ctx_p->store_p);
+  if (ret_val) {
+    purple_debug_error("lurch", "%s: failed to save the session changes of %u offline messages of %s (%i)\n",
+                       __func__, ctx_p->catchup_batch_msgs, ctx_p->uname, ret_val);
+  }
+  ctx_p->catchup_batch_msgs = 0;
+}
+
+/**
+ * Ends the catch-up, see lurch_ctx_catchup_end().
+ *
+ * @param end_us When the last message was handled, so that the throughput does not include the time waited for more.
+ */
+static void lurch_ctx_catchup_stop(lurch_ctx * ctx_p, gint64 end_us) {
+  gint64 commit_start_us = 0;
+  gint64 elapsed_us = 0;
+
+  if (!ctx_p->catchup_msgs) {
+    return;
+  }
+
+  // the batch is on the main loop's side, but the worker might still use the store
+  lurch_ctx_async_drain(ctx_p);
+
+  if (ctx_p->catchup_timer_id) {
+    (void) g_source_remove(ctx_p->catchup_timer_id);
+    ctx_p->catchup_timer_id = 0;
+  }
+
+  commit_start_us = g_get_monotonic_time();
+  lurch_ctx_catchup_commit(ctx_p);
+  elapsed_us = MAX(end_us - ctx_p->catchup_start_us + g_get_monotonic_time() - commit_start_us, 1);
+
+  purple_debug_info("lurch", "%s: caught up on %u offline messages of %s in %.3f s (%.1f messages/s)\n",
+                    __func__, ctx_p->catchup_msgs, ctx_p->uname,
+                    elapsed_us / 1e6, ctx_p->catchup_msgs * 1e6 / elapsed_us);
+  ctx_p->catchup_msgs = 0;
+}
+
+static gboolean lurch_ctx_catchup_timeout(gpointer data) {
+  lurch_ctx * ctx_p = data;
+  gint64 idle_ms = (g_get_monotonic_time() - ctx_p->catchup_last_us) / 1000;
+
+  // rearmed here instead of on every message
+  if (idle_ms < LURCH_CTX_CATCHUP_IDLE_MS) {
+    ctx_p->catchup_timer_id = g_timeout_add(LURCH_CTX_CATCHUP_IDLE_MS - idle_ms, lurch_ctx_catchup_timeout, ctx_p);
+    return G_SOURCE_REMOVE;
+  }
+
+  ctx_p->catchup_timer_id = 0;
+  lurch_ctx_catchup_stop(ctx_p, ctx_p->catchup_last_us);
+  return G_SOURCE_REMOVE;
+}
+
+void lurch_ctx_catchup_add(lurch_ctx * ctx_p) {
+  int ret_val = 0;
+
+  ctx_p->catchup_last_us = g_get_monotonic_time();
+  if (!ctx_p->catchup_msgs) {
+    ctx_p->catchup_start_us = ctx_p->catchup_last_us;
+    purple_debug_info("lurch", "%s: catching up on the offline messages of %s\n", __func__, ctx_p->uname);
+  }
+  ctx_p->catchup_msgs++;
+
+  if (ctx_p->catchup_batch_msgs >= LURCH_CTX_CATCHUP_BATCH_MAX) {
+    lurch_ctx_catchup_commit(ctx_p);
+  }
+  if (!lurch_store_batch_is_open(ctx_p->store_p)) {
+    ret_val = lurch_store_batch_begin(ctx_p->store_p);
+    if (ret_val) {
+      // the message is saved on its own then
+      purple_debug_error("lurch", "%s: failed to start a store batch for %s (%i)\n", __func__, ctx_p->uname, ret_val);
+    }
+  }
+  if (lurch_store_batch_is_open(ctx_p->store_p)) {
+    ctx_p->catchup_batch_msgs++;
+  }
+
+  if (!ctx_p->catchup_timer_id) {
+    ctx_p->catchup_timer_id = g_timeout_add(LURCH_CTX_CATCHUP_IDLE_MS, lurch_ctx_catchup_timeout, ctx_p);
+  }
+}
+
+void lurch_ctx_catchup_end(lurch_ctx * ctx_p) {
+  lurch_ctx_catchup_stop(ctx_p, g_get_monotonic_time());
+}
+
+/**
+ * Leases the store to the worker once it has something to do. Called on the main loop.
+ */
+static void lurch_ctx_async_busy(void * user_data) {
+  lurch_ctx * ctx_p = user_data;
+
+  lurch_store_lease(ctx_p->store_p, lurch_pipe_get_worker(ctx_p->pipe_p));
+}
+
+static void lurch_ctx_async_batch_commit(lurch_ctx * ctx_p) {
+  int ret_val = 0;
+
+  ret_val = lurch_store_batch_commit(ctx_p->store_p);
+  if (ret_val) {
+    g_atomic_int_set(&ctx_p->async_err, ret_val);
+  }
+  ctx_p->async_batch_msgs = 0;
+}
+
+/**
+ * Saves the session changes of everything the worker handled since the last flush.
+ * Called on the worker, which still holds the store.
+ */
+static void lurch_ctx_async_batch_flush(void * user_data) {
+  lurch_ctx * ctx_p = user_data;
+
+  lurch_ctx_async_batch_commit(ctx_p);
+}
+
+/**
+ * Hands the store back once the worker is idle. Called on the worker.
+ */
+static void lurch_ctx_async_idle(void * user_data) {
+  lurch_ctx * ctx_p = user_data;
+
+  lurch_store_release(ctx_p->store_p);
+}
+
+static void lurch_ctx_async_work(void * data) {
+  lurch_ctx_async_job * job_p = data;
+  lurch_ctx * ctx_p = job_p->ctx_p;
+
+  if (!job_p->work_fn) {
+    return;
+  }
+
+  if (ctx_p->async_batch_msgs >= LURCH_CTX_CATCHUP_BATCH_MAX) {
+    lurch_ctx_async_batch_commit(ctx_p);
+  }
+  // if the batch cannot be started, the stanza's changes are saved on their own
+  if (lurch_store_batch_is_open(ctx_p->store_p) || !lurch_store_batch_begin(ctx_p->store_p)) {
+    ctx_p->async_batch_msgs++;
+  }
+
+  job_p->work_fn(job_p->data_p, job_p->node_p);
+}
+
+/**
+ * Completion of a submitted stanza. Passes it on to libpurple, unless the context was dropped meanwhile.
+ */
+static void lurch_ctx_async_done(void * data, void * user_data) {
+  lurch_ctx_async_job * job_p = data;
+  lurch_ctx * ctx_p = user_data;
+  PurpleConnection * gc_p = ctx_p->gc_p;
+  int ret_val = 0;
+
+  ret_val = g_atomic_int_get(&ctx_p->async_err);
+  if (ret_val && g_atomic_int_compare_and_exchange(&ctx_p->async_err, ret_val, 0)) {
+    purple_debug_error("lurch", "%s: failed to save the session changes of the messages of %s (%i)\n",
+                       __func__, ctx_p->uname, ret_val);
+  }
+
+  if (job_p->finish_fn) {
+    job_p->finish_fn(job_p->data_p, &job_p->node_p);
+  }
+
+  // the completion can drop the context along with the connection
+  if (job_p->node_p && ctx_map && g_hash_table_lookup(ctx_map, gc_p) == ctx_p) {
+    passing_on = TRUE;
+    jabber_process_packet(purple_connection_get_protocol_data(gc_p), &job_p->node_p);
+    passing_on = FALSE;
+  }
+
+  lurch_ctx_async_job_free(job_p);
+}
+
+void lurch_ctx_async_submit(lurch_ctx * ctx_p, xmlnode ** stanza_pp,
+                            lurch_ctx_work_fn work_fn, lurch_ctx_finish_fn finish_fn,
+                            GDestroyNotify free_fn, void * data_p) {
+  lurch_ctx_async_job * job_p = (void *) 0;
+
+  if (!ctx_p->pipe_p) {
+    ctx_p->pipe_p = lurch_pipe_new("lurch-decrypt", lurch_ctx_async_done, lurch_ctx_async_busy,
+                                   lurch_ctx_async_batch_flush, lurch_ctx_async_idle, ctx_p);
+  }
+  if (!ctx_p->pipe_p) {
+    if (work_fn) {
+      work_fn(data_p, *stanza_pp);
+    }
+    if (finish_fn) {
+      finish_fn(data_p, stanza_pp);
+    }
+    if (free_fn) {
+      free_fn(data_p);
+    }
+    return;
+  }
+
+  job_p = g_malloc0(sizeof(lurch_ctx_async_job));
+  job_p->ctx_p = ctx_p;
+  job_p->node_p = *stanza_pp;
+  job_p->work_fn = work_fn;
+  job_p->finish_fn = finish_fn;
+  job_p->free_fn = free_fn;
+  job_p->data_p = data_p;
+
+  lurch_pipe_push(ctx_p->pipe_p, lurch_ctx_async_work, job_p);
+  *stanza_pp = (void *) 0;
+}
+
+gboolean lurch_ctx_async_pending(PurpleConnection * gc_p) {
+  lurch_ctx * ctx_p = ctx_map ? g_hash_table_lookup(ctx_map, gc_p) : (void *) 0;
+
+  return ctx_p && lurch_pipe_pending(ctx_p->pipe_p);
+}
+
+void lurch_ctx_async_drain(lurch_ctx * ctx_p) {
+  lurch_pipe_drain(ctx_p->pipe_p);
+}
+
+void lurch_ctx_async_drain_account(const char * uname) {
+  GHashTableIter iter;
+  gpointer value = (void *) 0;
+
+  if (!ctx_map) {
+    return;
+  }
+
+  g_hash_table_iter_init(&iter, ctx_map);
+  while (g_hash_table_iter_next(&iter, (void *) 0, &value)) {
+    if (!g_strcmp0(((lurch_ctx *) value)->uname, uname)) {
+      lurch_ctx_async_drain(value);
+    }
+  }
+}
+
+gboolean lurch_ctx_passing_on(void) {
+  return passing_on;
+}
+
+/**
+ * Waits for the worker of the connection and passes on what it handled right away.
+ */
+static void lurch_ctx_async_flush(PurpleConnection * gc_p) {
+  lurch_ctx * ctx_p = ctx_map ? g_hash_table_lookup(ctx_map, gc_p) : (void *) 0;
+
+  if (!ctx_p || !ctx_p->pipe_p) {
+    return;
+  }
+
+  lurch_pipe_drain(ctx_p->pipe_p);
+  lurch_pipe_dispatch(ctx_p->pipe_p);
+}
+
+void lurch_ctx_destroy(PurpleConnection * gc_p) {
+  if (ctx_map) {
+    lurch_ctx_async_flush(gc_p);
+  }
+  if (ctx_map) {
+    (void) g_hash_table_remove(ctx_map, gc_p);
+  }
+}
+
+void lurch_ctx_destroy_all(void) {
+  GList * gc_l_p = (void *) 0;
+  GList * curr_p = (void *) 0;
+
+  if (ctx_map) {
+    gc_l_p = g_hash_table_get_keys(ctx_map);
+    for (curr_p = gc_l_p; curr_p && ctx_map; curr_p = curr_p->next) {
+      lurch_ctx_async_flush(curr_p->data);
+    }
+    g_list_free(gc_l_p);
+  }
+
+  if (ctx_map) {
+    while (g_idle_remove_by_data(&ctx_map)) {}
+    lurch_ctx_flush_all();
+    g_hash_table_destroy(ctx_map);
+    ctx_map = (void *) 0;
+  }
+}
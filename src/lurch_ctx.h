@@ -0,0 +1,186 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <glib.h>
+#include <purple.h>
+
+#include "axc_dakes_intf.h"
+#include "lurch_pipe.h"
+#include "lurch_store.h"
+
+/**
+ * Per-connection runtime state.
+ *
+ * Holds what the stanza callbacks would otherwise derive from the account on every call,
+ * i.e. the stripped username, the db paths and the account's stores and axc context.
+ * It is created when the account signs on and found by the connection in constant time.
+ * Everything in here is owned by the context or, for the stores and the axc context,
+ * by their account maps, so callers must not free any of it.
+ *
+ * The axc context is initialized on a thread of its own, see cachectx_prewarm().
+ * Until it is ready, cachectx_p is NULL and the stanzas lurch would have to encrypt
+ * or decrypt are held back by lurch_ctx_hold().
+ *
+ * Received stanzas can also be handled on a worker thread of the connection, see lurch_ctx_async_submit().
+ * While it is busy, the worker owns the store and the axc context.
+ */
+typedef struct lurch_ctx {
+  PurpleConnection * gc_p;
+  char * uname;                          // the bare jid of the account, already stripped
+  const char * db_fn_omemo;              // owned by the store
+  const char * db_fn_axc;                // owned by the store
+  lurch_store * store_p;
+  axc_context_dake_cache * cachectx_p;   // NULL until the axc context is initialized
+  uint32_t faux_regid;
+  gboolean warming;                      // the axc context is being initialized in the background
+  GQueue held;                           // of lurch_ctx_held_stanza, in the order they came in
+
+  // see lurch_ctx_catchup_add()
+  guint catchup_msgs;                    // delayed messages since the catch-up started, 0 if none is underway
+  guint catchup_batch_msgs;              // of them in the store batch that is currently open
+  gint64 catchup_start_us;
+  gint64 catchup_last_us;                // when the last one came in
+  guint catchup_timer_id;
+  GList * cleanup_faux_l_p;              // of uint32_t *, the faux device ids to retract once the offline messages are done
+  guint cleanup_id;                      // idle source doing so
+
+  // see lurch_ctx_async_submit()
+  lurch_pipe * pipe_p;                   // NULL until the first stanza is submitted
+  guint async_batch_msgs;                // in the store batch the worker has open, only used by the worker
+  gint async_err;                        // set by the worker if the batch could not be saved, logged on the main loop
+} lurch_ctx;
+
+/**
+ * Work on a received stanza, called on the worker. Must not call into libpurple.
+ *
+ * @param data_p The data given to lurch_ctx_async_submit().
+ * @param stanza_p The stanza, which can be changed.
+ */
+typedef void (*lurch_ctx_work_fn)(void * data_p, xmlnode * stanza_p);
+
+/**
+ * Completion of a received stanza, called on the main loop before it is passed on to libpurple.
+ *
+ * @param data_p The data given to lurch_ctx_async_submit().
+ * @param stanza_pp The stanza. Can be freed and set to NULL so that it is not passed on.
+ */
+typedef void (*lurch_ctx_finish_fn)(void * data_p, xmlnode ** stanza_pp);
+
+/**
+ * Creates the context of a connection and attaches it, replacing an existing one.
+ * Starts initializing the account's axc context in the background if it does not exist yet.
+ *
+ * @param gc_p The connection.
+ * @param ctx_pp Will point to the context on success. Can be NULL.
+ * @return 0 on success, negative on error.
+ */
+int lurch_ctx_create(PurpleConnection * gc_p, lurch_ctx ** ctx_pp);
+
+/**
+ * Returns the context attached to the connection, with the axc context ready.
+ * Creates the context if the connection has none yet, e.g. if a stanza arrives
+ * before the account is signed on, and waits for the axc context if necessary.
+ *
+ * @param gc_p The connection.
+ * @return The context, or NULL if it could not be created.
+ */
+lurch_ctx * lurch_ctx_get(PurpleConnection * gc_p);
+
+/**
+ * Holds back a stanza while the axc context of the connection is initialized.
+ * Once it is ready, the held stanzas are passed to libpurple again in order, so that
+ * they go through the "jabber-receiving-xmlnode" or "jabber-sending-xmlnode" callbacks anew.
+ * A stanza is also held while older ones are still waiting, so the order is kept.
+ *
+ * @param gc_p The connection.
+ * @param stanza_pp The stanza from the signal. Set to NULL if it was held.
+ * @param sending TRUE for outgoing stanzas, which are copied as libpurple frees them itself.
+ * @return TRUE if the stanza was held, FALSE if it can be handled right away.
+ */
+gboolean lurch_ctx_hold(PurpleConnection * gc_p, xmlnode ** stanza_pp, gboolean sending);
+
+/**
+ * Counts a delayed message, i.e. one of the offline messages the server sends right after signing on,
+ * and starts the catch-up if it is the first one.
+ * During the catch-up, the session changes of the messages are kept in a store batch
+ * (see lurch_store_batch_begin()) and written together, at most every few hundred messages.
+ * It ends with the first message that is not delayed, or when no delayed one came in for a moment.
+ *
+ * Has to be called before the message scope of the message is opened.
+ *
+ * @param ctx_p The context of the connection.
+ */
+void lurch_ctx_catchup_add(lurch_ctx * ctx_p);
+
+/**
+ * Ends the catch-up, writes the remaining session changes and logs how many messages were handled how fast.
+ * Does nothing if none is underway.
+ *
+ * @param ctx_p The context of the connection.
+ */
+void lurch_ctx_catchup_end(lurch_ctx * ctx_p);
+
+/**
+ * Takes a received stanza and handles it on the worker thread of the connection, which is started on first use.
+ * The stanzas are handled one after the other and passed on to libpurple from the main loop in the order
+ * they were submitted, the same way its parser does, so that they go through the "jabber-receiving-xmlnode"
+ * callbacks anew, see lurch_ctx_passing_on(). A stanza which needs no work can be submitted to keep its place.
+ *
+ * While the worker is busy, the store is leased to it (see lurch_store_lease()) and the session changes of
+ * the stanzas are kept in a store batch, written whenever the worker runs out of stanzas, or every few hundred.
+ * Anything on the main loop using the axc context has to call lurch_ctx_async_drain() first.
+ *
+ * If the worker cannot be started, the stanza is handled right away and left in place.
+ *
+ * @param ctx_p The context of the connection.
+ * @param stanza_pp The stanza from the signal. Set to NULL if it was taken.
+ * @param work_fn Called on the worker, can be NULL.
+ * @param finish_fn Called on the main loop, can be NULL.
+ * @param free_fn Frees data_p once the stanza was passed on or dropped, can be NULL.
+ * @param data_p Passed to the functions above.
+ */
+void lurch_ctx_async_submit(lurch_ctx * ctx_p, xmlnode ** stanza_pp,
+                            lurch_ctx_work_fn work_fn, lurch_ctx_finish_fn finish_fn,
+                            GDestroyNotify free_fn, void * data_p);
+
+/**
+ * @param gc_p The connection.
+ * @return TRUE if stanzas of the connection were submitted, but not passed on yet.
+ *         Received stanzas have to be submitted as well then, so that they do not overtake them.
+ */
+gboolean lurch_ctx_async_pending(PurpleConnection * gc_p);
+
+/**
+ * Blocks until the worker of the connection is idle, so that the axc context and the store can be used.
+ * The stanzas it handled are still passed on from the main loop.
+ * Does nothing if there is no worker or if called from the worker itself.
+ *
+ * @param ctx_p The context of the connection.
+ */
+void lurch_ctx_async_drain(lurch_ctx * ctx_p);
+
+/**
+ * Calls lurch_ctx_async_drain() for all connections of the account.
+ *
+ * @param uname The username, already stripped.
+ */
+void lurch_ctx_async_drain_account(const char * uname);
+
+/**
+ * @return TRUE while a stanza handled by the worker is passed on to libpurple,
+ *         which the "jabber-receiving-xmlnode" callback should leave alone.
+ */
+gboolean lurch_ctx_passing_on(void);
+
+/**
+ * Detaches and frees the context of the connection, if there is one.
+ * Stanzas still handled by the worker are passed on first, those still held are dropped, a catch-up is ended.
+ */
+void lurch_ctx_destroy(PurpleConnection * gc_p);
+
+/**
+ * Passes on the held stanzas and those handled by the workers and frees all contexts.
+ * Has to be called after cachectx_prewarm_join_all() and before the stores and axc contexts are closed.
+ */
+void lurch_ctx_destroy_all(void);
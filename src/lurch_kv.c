@@ -0,0 +1,627 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <purple.h>
+
+#include "lurch_api.h"
+#include "lurch_kv.h"
+
+#define LURCH_KV_MAGIC       "LURCHKV1"
+#define LURCH_KV_MAGIC_LEN   8
+#define LURCH_KV_TOMBSTONE   UINT32_MAX
+#define LURCH_KV_MIN_MAP     (1 << 20)
+// files smaller than this are not compacted, no matter how much of them is garbage
+#define LURCH_KV_MIN_COMPACT (1 << 16)
+
+/**
+ * Each record is this header, followed by the key and the value.
+ * A record with an empty key commits all records since the previous commit.
+ */
+typedef struct {
+  uint32_t key_len;
+  uint32_t val_len; // LURCH_KV_TOMBSTONE for deletions, which have no value
+  uint32_t check;   // FNV-1a of the lengths, the key and the value
+} lurch_kv_rec_hdr;
+
+// where the value of a key is in the file
+typedef struct {
+  uint64_t val_off;
+  uint32_t val_len; // LURCH_KV_TOMBSTONE for deletions in the open transaction
+  uint64_t rec_len; // of the whole record, to know how much becomes garbage when it is overwritten
+} lurch_kv_loc;
+
+struct lurch_kv {
+  char * fn;
+  int fd;
+  gboolean sync;
+  uint8_t * map_p;
+  size_t map_len;
+  uint64_t end;           // end of the data written so far
+  uint64_t txn_start;     // end of the last commit record
+  guint txn_depth;
+  gboolean txn_failed;
+  GHashTable * index_p;   // key -> lurch_kv_loc, for everything committed
+  GHashTable * pending_p; // key -> lurch_kv_loc, for the changes in the open transaction
+  uint64_t live_bytes;    // size of the records in the index, the rest of the file is garbage
+  GByteArray * buf_p;     // records are assembled here, so that each takes a single write
+};
+
+static uint32_t lurch_kv_fnv1a(uint32_t hash, const uint8_t * data_p, size_t len) {
+  size_t i = 0;
+
+  for (i = 0; i < len; i++) {
+    hash ^= data_p[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+static uint32_t lurch_kv_check(uint32_t key_len, uint32_t val_len, const uint8_t * key_p, const uint8_t * val_p) {
+  uint32_t hash = 2166136261u;
+
+  hash = lurch_kv_fnv1a(hash, (const uint8_t *) &key_len, sizeof(key_len));
+  hash = lurch_kv_fnv1a(hash, (const uint8_t *) &val_len, sizeof(val_len));
+  hash = lurch_kv_fnv1a(hash, key_p, key_len);
+  if (val_len != LURCH_KV_TOMBSTONE) {
+    hash = lurch_kv_fnv1a(hash, val_p, val_len);
+  }
+
+  return hash;
+}
+
+static uint64_t lurch_kv_rec_len(uint32_t key_len, uint32_t val_len) {
+  return sizeof(lurch_kv_rec_hdr) + key_len + ((val_len == LURCH_KV_TOMBSTONE) ? 0 : val_len);
+}
+
+/**
+ * Makes sure the map covers the first need bytes of the file.
+ * The map is larger than the file, so that appending does not need a new one each time.
+ */
+static int lurch_kv_remap(lurch_kv * kv_p, uint64_t need) {
+  size_t new_len = MAX(kv_p->map_len, LURCH_KV_MIN_MAP);
+  void * map_p = (void *) 0;
+
+  if (kv_p->map_p && need <= kv_p->map_len) {
+    return 0;
+  }
+
+  while (new_len < need) {
+    new_len *= 2;
+  }
+
+  map_p = mmap((void *) 0, new_len, PROT_READ, MAP_SHARED, kv_p->fd, 0);
+  if (map_p == MAP_FAILED) {
+    purple_debug_error("lurch", "%s: failed to map %s: %s\n", __func__, kv_p->fn, g_strerror(errno));
+    return LURCH_ERR;
+  }
+
+  if (kv_p->map_p) {
+    (void) munmap(kv_p->map_p, kv_p->map_len);
+  }
+  kv_p->map_p = map_p;
+  kv_p->map_len = new_len;
+
+  return 0;
+}
+
+static int lurch_kv_pwrite(int fd, const uint8_t * data_p, size_t len, uint64_t off) {
+  ssize_t written = 0;
+
+  while (len > 0) {
+    written = pwrite(fd, data_p, len, off);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return LURCH_ERR;
+    }
+    data_p += written;
+    len -= written;
+    off += written;
+  }
+
+  return 0;
+}
+
+/**
+ * Writes a record at the given offset of the file.
+ *
+ * @param val_len LURCH_KV_TOMBSTONE for a deletion.
+ * @return 0 on success, negative on error.
+ */
+static int lurch_kv_write_rec(lurch_kv * kv_p, int fd, uint64_t off,
+                              const char * key, uint32_t key_len, const uint8_t * val_p, uint32_t val_len) {
+  lurch_kv_rec_hdr hdr = { .key_len = key_len, .val_len = val_len };
+
+  hdr.check = lurch_kv_check(key_len, val_len, (const uint8_t *) key, val_p);
+
+  g_byte_array_set_size(kv_p->buf_p, 0);
+  (void) g_byte_array_append(kv_p->buf_p, (const guint8 *) &hdr, sizeof(hdr));
+  (void) g_byte_array_append(kv_p->buf_p, (const guint8 *) key, key_len);
+  if (val_len != LURCH_KV_TOMBSTONE) {
+    (void) g_byte_array_append(kv_p->buf_p, val_p, val_len);
+  }
+
+  if (lurch_kv_pwrite(fd, kv_p->buf_p->data, kv_p->buf_p->len, off)) {
+    purple_debug_error("lurch", "%s: failed to write to %s: %s\n", __func__, kv_p->fn, g_strerror(errno));
+    return LURCH_ERR;
+  }
+
+  return 0;
+}
+
+/**
+ * Moves the changes of the transaction into the index.
+ */
+static void lurch_kv_apply_pending(lurch_kv * kv_p) {
+  GHashTableIter iter;
+  gpointer key = (void *) 0;
+  gpointer value = (void *) 0;
+  lurch_kv_loc * loc_p = (void *) 0;
+  lurch_kv_loc * old_loc_p = (void *) 0;
+
+  g_hash_table_iter_init(&iter, kv_p->pending_p);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    loc_p = value;
+    g_hash_table_iter_steal(&iter);
+
+    old_loc_p = g_hash_table_lookup(kv_p->index_p, key);
+    if (old_loc_p) {
+      kv_p->live_bytes -= old_loc_p->rec_len;
+    }
+
+    if (loc_p->val_len == LURCH_KV_TOMBSTONE) {
+      (void) g_hash_table_remove(kv_p->index_p, key);
+      g_free(key);
+      g_free(loc_p);
+    } else {
+      kv_p->live_bytes += loc_p->rec_len;
+      (void) g_hash_table_replace(kv_p->index_p, key, loc_p);
+    }
+  }
+}
+
+/**
+ * Drops the changes of the transaction and cuts them off the file.
+ */
+static void lurch_kv_discard(lurch_kv * kv_p) {
+  g_hash_table_remove_all(kv_p->pending_p);
+  if (kv_p->end != kv_p->txn_start && ftruncate(kv_p->fd, kv_p->txn_start)) {
+    // the records are never committed, so they are cut off on the next open
+    purple_debug_error("lurch", "%s: failed to truncate %s: %s\n", __func__, kv_p->fn, g_strerror(errno));
+  }
+  kv_p->end = kv_p->txn_start;
+  kv_p->txn_failed = FALSE;
+}
+
+/**
+ * Builds the index from the file and cuts off whatever follows the last valid commit record.
+ */
+static int lurch_kv_load(lurch_kv * kv_p, uint64_t size) {
+  uint64_t off = LURCH_KV_MAGIC_LEN;
+  uint64_t rec_len = 0;
+  lurch_kv_rec_hdr hdr = {0};
+  const uint8_t * key_p = (void *) 0;
+  lurch_kv_loc * loc_p = (void *) 0;
+
+  kv_p->end = LURCH_KV_MAGIC_LEN;
+
+  while (off + sizeof(hdr) <= size) {
+    memcpy(&hdr, kv_p->map_p + off, sizeof(hdr));
+    rec_len = lurch_kv_rec_len(hdr.key_len, hdr.val_len);
+    if (off + rec_len > size) {
+      break;
+    }
+
+    key_p = kv_p->map_p + off + sizeof(hdr);
+    if (hdr.check != lurch_kv_check(hdr.key_len, hdr.val_len, key_p, key_p + hdr.key_len)) {
+      break;
+    }
+
+    if (hdr.key_len == 0) {
+      lurch_kv_apply_pending(kv_p);
+      kv_p->end = off + rec_len;
+    } else {
+      loc_p = g_malloc0(sizeof(lurch_kv_loc));
+      loc_p->val_off = off + sizeof(hdr) + hdr.key_len;
+      loc_p->val_len = hdr.val_len;
+      loc_p->rec_len = rec_len;
+      (void) g_hash_table_replace(kv_p->pending_p, g_strndup((const char *) key_p, hdr.key_len), loc_p);
+    }
+
+    off += rec_len;
+  }
+
+  g_hash_table_remove_all(kv_p->pending_p);
+  kv_p->txn_start = kv_p->end;
+
+  if (kv_p->end < size) {
+    purple_debug_info("lurch", "%s: dropping %" G_GUINT64_FORMAT " uncommitted or damaged bytes at the end of %s\n",
+                      __func__, size - kv_p->end, kv_p->fn);
+    if (ftruncate(kv_p->fd, kv_p->end)) {
+      purple_debug_error("lurch", "%s: failed to truncate %s: %s\n", __func__, kv_p->fn, g_strerror(errno));
+      return LURCH_ERR;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Writes the current values to a new file and replaces the old one with it.
+ */
+static int lurch_kv_compact(lurch_kv * kv_p) {
+  int ret_val = 0;
+  char * err_msg_dbg = (void *) 0;
+
+  char * tmp_fn = g_strconcat(kv_p->fn, ".tmp", NULL);
+  int fd = -1;
+  uint64_t off = LURCH_KV_MAGIC_LEN;
+  GHashTable * index_p = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  GHashTableIter iter;
+  gpointer key = (void *) 0;
+  gpointer value = (void *) 0;
+  lurch_kv_loc * loc_p = (void *) 0;
+  lurch_kv_loc * new_loc_p = (void *) 0;
+  uint32_t key_len = 0;
+
+  fd = open(tmp_fn, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    err_msg_dbg = g_strdup_printf("failed to create %s: %s", tmp_fn, g_strerror(errno));
+    ret_val = LURCH_ERR;
+    goto cleanup;
+  }
+
+  ret_val = lurch_kv_pwrite(fd, (const uint8_t *) LURCH_KV_MAGIC, LURCH_KV_MAGIC_LEN, 0);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to write to %s: %s", tmp_fn, g_strerror(errno));
+    goto cleanup;
+  }
+
+  g_hash_table_iter_init(&iter, kv_p->index_p);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    loc_p = value;
+    key_len = strlen(key);
+    ret_val = lurch_kv_write_rec(kv_p, fd, off, key, key_len, kv_p->map_p + loc_p->val_off, loc_p->val_len);
+    if (ret_val) {
+      err_msg_dbg = g_strdup_printf("failed to copy the records to %s", tmp_fn);
+      goto cleanup;
+    }
+
+    new_loc_p = g_malloc0(sizeof(lurch_kv_loc));
+    new_loc_p->val_off = off + sizeof(lurch_kv_rec_hdr) + key_len;
+    new_loc_p->val_len = loc_p->val_len;
+    new_loc_p->rec_len = loc_p->rec_len;
+    (void) g_hash_table_insert(index_p, g_strdup(key), new_loc_p);
+    off += loc_p->rec_len;
+  }
+
+  ret_val = lurch_kv_write_rec(kv_p, fd, off, "", 0, (void *) 0, 0);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to commit %s", tmp_fn);
+    goto cleanup;
+  }
+  off += sizeof(lurch_kv_rec_hdr);
+
+  if (fdatasync(fd) || rename(tmp_fn, kv_p->fn)) {
+    err_msg_dbg = g_strdup_printf("failed to replace %s: %s", kv_p->fn, g_strerror(errno));
+    ret_val = LURCH_ERR;
+    goto cleanup;
+  }
+
+  (void) munmap(kv_p->map_p, kv_p->map_len);
+  kv_p->map_p = (void *) 0;
+  kv_p->map_len = 0;
+  (void) close(kv_p->fd);
+  kv_p->fd = fd;
+  fd = -1;
+
+  g_hash_table_destroy(kv_p->index_p);
+  kv_p->index_p = index_p;
+  index_p = (void *) 0;
+  kv_p->end = off;
+  kv_p->txn_start = off;
+  kv_p->live_bytes = off - LURCH_KV_MAGIC_LEN - sizeof(lurch_kv_rec_hdr);
+
+  ret_val = lurch_kv_remap(kv_p, kv_p->end);
+
+cleanup:
+  if (fd >= 0) {
+    (void) close(fd);
+    (void) unlink(tmp_fn);
+  }
+  if (index_p) {
+    g_hash_table_destroy(index_p);
+  }
+  if (err_msg_dbg) {
+    purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
+    g_free(err_msg_dbg);
+  }
+  g_free(tmp_fn);
+
+  return ret_val;
+}
+
+int lurch_kv_open(const char * fn, gboolean sync, lurch_kv ** kv_pp) {
+  int ret_val = 0;
+  char * err_msg_dbg = (void *) 0;
+
+  lurch_kv * kv_p = (void *) 0;
+  struct stat st;
+  uint64_t garbage = 0;
+
+  kv_p = g_malloc0(sizeof(lurch_kv));
+  kv_p->fn = g_strdup(fn);
+  kv_p->sync = sync;
+  kv_p->index_p = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  kv_p->pending_p = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  kv_p->buf_p = g_byte_array_new();
+
+  kv_p->fd = open(fn, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (kv_p->fd < 0 || fstat(kv_p->fd, &st)) {
+    err_msg_dbg = g_strdup_printf("failed to open %s: %s", fn, g_strerror(errno));
+    ret_val = LURCH_ERR;
+    goto cleanup;
+  }
+
+  if (st.st_size == 0) {
+    ret_val = lurch_kv_pwrite(kv_p->fd, (const uint8_t *) LURCH_KV_MAGIC, LURCH_KV_MAGIC_LEN, 0);
+    if (ret_val) {
+      err_msg_dbg = g_strdup_printf("failed to write to %s: %s", fn, g_strerror(errno));
+      goto cleanup;
+    }
+    st.st_size = LURCH_KV_MAGIC_LEN;
+  }
+
+  ret_val = lurch_kv_remap(kv_p, st.st_size);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to map %s", fn);
+    goto cleanup;
+  }
+
+  if (st.st_size < LURCH_KV_MAGIC_LEN || memcmp(kv_p->map_p, LURCH_KV_MAGIC, LURCH_KV_MAGIC_LEN)) {
+    err_msg_dbg = g_strdup_printf("%s is not a lurch key-value file", fn);
+    ret_val = LURCH_ERR;
+    goto cleanup;
+  }
+
+  ret_val = lurch_kv_load(kv_p, st.st_size);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to load %s", fn);
+    goto cleanup;
+  }
+
+  garbage = kv_p->end - LURCH_KV_MAGIC_LEN - kv_p->live_bytes;
+  if (kv_p->end > LURCH_KV_MIN_COMPACT && garbage > kv_p->live_bytes) {
+    // not fatal, the old file is still complete
+    (void) lurch_kv_compact(kv_p);
+  }
+
+  *kv_pp = kv_p;
+
+cleanup:
+  if (ret_val) {
+    lurch_kv_close(kv_p);
+  }
+  if (err_msg_dbg) {
+    purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
+    g_free(err_msg_dbg);
+  }
+
+  return ret_val;
+}
+
+void lurch_kv_close(lurch_kv * kv_p) {
+  if (!kv_p) {
+    return;
+  }
+
+  if (kv_p->txn_depth > 0) {
+    kv_p->txn_depth = 0;
+    lurch_kv_discard(kv_p);
+  }
+
+  if (kv_p->map_p) {
+    (void) munmap(kv_p->map_p, kv_p->map_len);
+  }
+  if (kv_p->fd >= 0) {
+    (void) close(kv_p->fd);
+  }
+
+  g_hash_table_destroy(kv_p->index_p);
+  g_hash_table_destroy(kv_p->pending_p);
+  g_byte_array_free(kv_p->buf_p, TRUE);
+  g_free(kv_p->fn);
+  g_free(kv_p);
+}
+
+static const lurch_kv_loc * lurch_kv_lookup(lurch_kv * kv_p, const char * key) {
+  const lurch_kv_loc * loc_p = (void *) 0;
+
+  if (kv_p->txn_depth > 0 && (loc_p = g_hash_table_lookup(kv_p->pending_p, key))) {
+    return loc_p;
+  }
+
+  return g_hash_table_lookup(kv_p->index_p, key);
+}
+
+int lurch_kv_get(lurch_kv * kv_p, const char * key, const uint8_t ** val_pp, size_t * val_len_p) {
+  const lurch_kv_loc * loc_p = lurch_kv_lookup(kv_p, key);
+
+  if (!loc_p || loc_p->val_len == LURCH_KV_TOMBSTONE) {
+    return 0;
+  }
+
+  if (val_pp) {
+    *val_pp = kv_p->map_p + loc_p->val_off;
+  }
+  if (val_len_p) {
+    *val_len_p = loc_p->val_len;
+  }
+
+  return 1;
+}
+
+/**
+ * Appends a change to the open transaction.
+ */
+static int lurch_kv_append(lurch_kv * kv_p, const char * key, const uint8_t * val_p, uint32_t val_len) {
+  int ret_val = 0;
+  uint32_t key_len = strlen(key);
+  lurch_kv_loc * loc_p = (void *) 0;
+
+  ret_val = lurch_kv_write_rec(kv_p, kv_p->fd, kv_p->end, key, key_len, val_p, val_len);
+  if (ret_val) {
+    return ret_val;
+  }
+
+  loc_p = g_malloc0(sizeof(lurch_kv_loc));
+  loc_p->val_off = kv_p->end + sizeof(lurch_kv_rec_hdr) + key_len;
+  loc_p->val_len = val_len;
+  loc_p->rec_len = lurch_kv_rec_len(key_len, val_len);
+  kv_p->end += loc_p->rec_len;
+  (void) g_hash_table_replace(kv_p->pending_p, g_strdup(key), loc_p);
+
+  return lurch_kv_remap(kv_p, kv_p->end);
+}
+
+static int lurch_kv_change(lurch_kv * kv_p, const char * key, const uint8_t * val_p, uint32_t val_len) {
+  int ret_val = 0;
+
+  if (kv_p->txn_depth > 0) {
+    ret_val = lurch_kv_append(kv_p, key, val_p, val_len);
+    if (ret_val) {
+      kv_p->txn_failed = TRUE;
+    }
+    return ret_val;
+  }
+
+  lurch_kv_begin(kv_p);
+  ret_val = lurch_kv_append(kv_p, key, val_p, val_len);
+  if (ret_val) {
+    lurch_kv_rollback(kv_p);
+    return ret_val;
+  }
+
+  return lurch_kv_commit(kv_p);
+}
+
+int lurch_kv_put(lurch_kv * kv_p, const char * key, const uint8_t * val_p, size_t val_len) {
+  if (!*key || val_len >= LURCH_KV_TOMBSTONE) {
+    return LURCH_ERR;
+  }
+
+  return lurch_kv_change(kv_p, key, val_p, val_len);
+}
+
+int lurch_kv_delete(lurch_kv * kv_p, const char * key) {
+  int ret_val = 0;
+
+  if (!lurch_kv_get(kv_p, key, (void *) 0, (void *) 0)) {
+    return 0;
+  }
+
+  ret_val = lurch_kv_change(kv_p, key, (void *) 0, LURCH_KV_TOMBSTONE);
+  return ret_val ? ret_val : 1;
+}
+
+int lurch_kv_foreach_prefix(lurch_kv * kv_p, const char * prefix, lurch_kv_foreach_fn fn, void * user_data) {
+  int count = 0;
+  GHashTableIter iter;
+  gpointer key = (void *) 0;
+  gpointer value = (void *) 0;
+  const lurch_kv_loc * loc_p = (void *) 0;
+
+  g_hash_table_iter_init(&iter, kv_p->index_p);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    // changed keys are reported with their pending value below
+    if (!g_str_has_prefix(key, prefix) || (kv_p->txn_depth > 0 && g_hash_table_contains(kv_p->pending_p, key))) {
+      continue;
+    }
+    loc_p = value;
+    fn(key, kv_p->map_p + loc_p->val_off, loc_p->val_len, user_data);
+    count++;
+  }
+
+  if (kv_p->txn_depth > 0) {
+    g_hash_table_iter_init(&iter, kv_p->pending_p);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      loc_p = value;
+      if (loc_p->val_len == LURCH_KV_TOMBSTONE || !g_str_has_prefix(key, prefix)) {
+        continue;
+      }
+      fn(key, kv_p->map_p + loc_p->val_off, loc_p->val_len, user_data);
+      count++;
+    }
+  }
+
+  return count;
+}
+
+guint lurch_kv_count(const lurch_kv * kv_p) {
+  return g_hash_table_size(kv_p->index_p);
+}
+
+void lurch_kv_begin(lurch_kv * kv_p) {
+  if (kv_p->txn_depth++ == 0) {
+    kv_p->txn_start = kv_p->end;
+    kv_p->txn_failed = FALSE;
+  }
+}
+
+int lurch_kv_commit(lurch_kv * kv_p) {
+  int ret_val = 0;
+
+  if (kv_p->txn_depth == 0) {
+    return 0;
+  }
+
+  kv_p->txn_depth--;
+  if (kv_p->txn_depth > 0) {
+    return 0;
+  }
+
+  if (kv_p->txn_failed) {
+    lurch_kv_discard(kv_p);
+    return LURCH_ERR;
+  }
+
+  if (g_hash_table_size(kv_p->pending_p) == 0) {
+    return 0;
+  }
+
+  ret_val = lurch_kv_write_rec(kv_p, kv_p->fd, kv_p->end, "", 0, (void *) 0, 0);
+  if (!ret_val && kv_p->sync && fdatasync(kv_p->fd)) {
+    purple_debug_error("lurch", "%s: failed to sync %s: %s\n", __func__, kv_p->fn, g_strerror(errno));
+    ret_val = LURCH_ERR;
+  }
+  if (ret_val) {
+    lurch_kv_discard(kv_p);
+    return ret_val;
+  }
+
+  kv_p->end += sizeof(lurch_kv_rec_hdr);
+  kv_p->txn_start = kv_p->end;
+  lurch_kv_apply_pending(kv_p);
+
+  return lurch_kv_remap(kv_p, kv_p->end);
+}
+
+void lurch_kv_rollback(lurch_kv * kv_p) {
+  if (kv_p->txn_depth == 0) {
+    return;
+  }
+
+  kv_p->txn_failed = TRUE;
+  kv_p->txn_depth--;
+  if (kv_p->txn_depth == 0) {
+    lurch_kv_discard(kv_p);
+  }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glib.h>
+
+/**
+ * Append-only key-value file, read through a memory map.
+ *
+ * Every change is appended as a record, deletions as tombstones. Changes become
+ * visible to other readers of the file only with the commit record closing them,
+ * so a crash in the middle of a transaction loses the whole transaction and nothing else.
+ * On open, the file is scanned once to build the in-memory index of the latest value
+ * of each key, the uncommitted tail is cut off, and the file is compacted if most of it
+ * is taken up by overwritten values.
+ *
+ * Values are returned as pointers into the map, without copying. Such a pointer is only
+ * valid until the next change, as the map can move when the file grows.
+ *
+ * Not thread-safe, every file has to be used by one thread at a time.
+ */
+typedef struct lurch_kv lurch_kv;
+
+/**
+ * Called for each entry by lurch_kv_foreach_prefix().
+ *
+ * @param key The key, including the prefix.
+ * @param val_p The value, pointing into the map.
+ * @param val_len Its length.
+ * @param user_data The data passed to lurch_kv_foreach_prefix().
+ */
+typedef void (*lurch_kv_foreach_fn)(const char * key, const uint8_t * val_p, size_t val_len, void * user_data);
+
+/**
+ * Opens or creates a file.
+ *
+ * @param fn The path of the file.
+ * @param sync Whether every commit waits until the data is on disk.
+ * @param kv_pp Will point to the opened file on success.
+ * @return 0 on success, negative on error.
+ */
+int lurch_kv_open(const char * fn, gboolean sync, lurch_kv ** kv_pp);
+
+/**
+ * Rolls back an open transaction and closes the file.
+ */
+void lurch_kv_close(lurch_kv * kv_p);
+
+/**
+ * @param key The key.
+ * @param val_pp Will point to the value in the map, can be NULL.
+ * @param val_len_p Will be set to its length, can be NULL.
+ * @return 1 if the key exists, 0 if not.
+ */
+int lurch_kv_get(lurch_kv * kv_p, const char * key, const uint8_t ** val_pp, size_t * val_len_p);
+
+/**
+ * Sets the value of a key. Commits right away unless a transaction is open.
+ *
+ * @return 0 on success, negative on error.
+ */
+int lurch_kv_put(lurch_kv * kv_p, const char * key, const uint8_t * val_p, size_t val_len);
+
+/**
+ * Deletes a key. Commits right away unless a transaction is open.
+ *
+ * @return 1 if the key existed, 0 if not, negative on error.
+ */
+int lurch_kv_delete(lurch_kv * kv_p, const char * key);
+
+/**
+ * Calls the function for each key starting with the given prefix, in no particular order.
+ * The function must not change the file.
+ *
+ * @return The number of keys found.
+ */
+int lurch_kv_foreach_prefix(lurch_kv * kv_p, const char * prefix, lurch_kv_foreach_fn fn, void * user_data);
+
+/**
+ * @return The number of keys in the file.
+ */
+guint lurch_kv_count(const lurch_kv * kv_p);
+
+/**
+ * Starts a transaction. Transactions can be nested, only the outermost commit writes the commit record.
+ */
+void lurch_kv_begin(lurch_kv * kv_p);
+
+/**
+ * Ends a transaction. If an inner transaction was rolled back, the outermost commit fails and rolls back everything.
+ *
+ * @return 0 on success, negative on error, in which case the changes are rolled back.
+ */
+int lurch_kv_commit(lurch_kv * kv_p);
+
+/**
+ * Ends a transaction and discards the changes made in it.
+ */
+void lurch_kv_rollback(lurch_kv * kv_p);
@@ -0,0 +1,210 @@
+#include <glib.h>
+#include <purple.h>
+
+#include "lurch_crypto.h"
+#include "lurch_pipe.h"
+
+typedef struct {
+  lurch_pipe_work_fn work_fn;
+  void * data_p;
+} lurch_pipe_item;
+
+struct lurch_pipe {
+  GThread * worker_p;
+  GAsyncQueue * work_q_p;   // of lurch_pipe_item, handled by the worker in order
+  GAsyncQueue * done_q_p;   // of lurch_pipe_item, waiting for their completion in the same order
+  lurch_pipe_done_fn done_fn;
+  lurch_pipe_hook_fn busy_fn;
+  lurch_pipe_hook_fn flush_fn;
+  lurch_pipe_hook_fn idle_fn;
+  void * user_data;
+
+  GMutex lock;
+  GCond idle_cond;          // signalled whenever the worker becomes idle
+  guint in_work;            // pushed, but not yet worked on
+  gint dispatch_queued;     // an idle source running the completions is on the main loop
+
+  // main loop only
+  guint pending;            // pushed, but not yet completed
+  gboolean dispatching;
+  gboolean freed;           // lurch_pipe_free() was called by a completion
+  GDestroyNotify drop_fn;
+};
+
+// pushed to stop the worker
+static lurch_pipe_item lurch_pipe_stop;
+
+static gboolean lurch_pipe_dispatch_cb(gpointer data) {
+  lurch_pipe * pipe_p = data;
+
+  g_atomic_int_set(&pipe_p->dispatch_queued, 0);
+  lurch_pipe_dispatch(pipe_p);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gpointer lurch_pipe_run(gpointer data) {
+  lurch_pipe * pipe_p = data;
+  lurch_pipe_item * item_p = (void *) 0;
+  gboolean last = FALSE;
+
+  while ((item_p = g_async_queue_pop(pipe_p->work_q_p)) != &lurch_pipe_stop) {
+    if (item_p->work_fn) {
+      item_p->work_fn(item_p->data_p);
+    }
+
+    // the flush can take long, so it runs without the lock to not block a push on the main loop,
+    // the worker still counts as busy meanwhile
+    if (pipe_p->flush_fn) {
+      g_mutex_lock(&pipe_p->lock);
+      last = pipe_p->in_work == 1;
+      g_mutex_unlock(&pipe_p->lock);
+      if (last) {
+        pipe_p->flush_fn(pipe_p->user_data);
+      }
+    }
+
+    g_mutex_lock(&pipe_p->lock);
+    // only idle if nothing was pushed during the flush, otherwise the worker just goes on,
+    // and before the item is handed over, so that its completion does not see the worker busy
+    if (pipe_p->in_work == 1 && pipe_p->idle_fn) {
+      pipe_p->idle_fn(pipe_p->user_data);
+    }
+    g_async_queue_push(pipe_p->done_q_p, item_p);
+    pipe_p->in_work--;
+    if (pipe_p->in_work == 0) {
+      g_cond_broadcast(&pipe_p->idle_cond);
+    }
+    g_mutex_unlock(&pipe_p->lock);
+
+    if (g_atomic_int_compare_and_exchange(&pipe_p->dispatch_queued, 0, 1)) {
+      g_idle_add(lurch_pipe_dispatch_cb, pipe_p);
+    }
+  }
+
+  lurch_crypto_thread_release();
+
+  return (void *) 0;
+}
+
+lurch_pipe * lurch_pipe_new(const char * name, lurch_pipe_done_fn done_fn, lurch_pipe_hook_fn busy_fn,
+                            lurch_pipe_hook_fn flush_fn, lurch_pipe_hook_fn idle_fn, void * user_data) {
+  lurch_pipe * pipe_p = g_malloc0(sizeof(lurch_pipe));
+  GError * err_p = (void *) 0;
+
+  pipe_p->work_q_p = g_async_queue_new();
+  pipe_p->done_q_p = g_async_queue_new();
+  pipe_p->done_fn = done_fn;
+  pipe_p->busy_fn = busy_fn;
+  pipe_p->flush_fn = flush_fn;
+  pipe_p->idle_fn = idle_fn;
+  pipe_p->user_data = user_data;
+  g_mutex_init(&pipe_p->lock);
+  g_cond_init(&pipe_p->idle_cond);
+
+  pipe_p->worker_p = g_thread_try_new(name, lurch_pipe_run, pipe_p, &err_p);
+  if (!pipe_p->worker_p) {
+    purple_debug_error("lurch", "%s: failed to start thread %s: %s\n", __func__, name, err_p->message);
+    g_error_free(err_p);
+    g_async_queue_unref(pipe_p->work_q_p);
+    g_async_queue_unref(pipe_p->done_q_p);
+    g_mutex_clear(&pipe_p->lock);
+    g_cond_clear(&pipe_p->idle_cond);
+    g_free(pipe_p);
+    return (void *) 0;
+  }
+
+  return pipe_p;
+}
+
+void lurch_pipe_push(lurch_pipe * pipe_p, lurch_pipe_work_fn work_fn, void * data_p) {
+  lurch_pipe_item * item_p = g_malloc0(sizeof(lurch_pipe_item));
+
+  item_p->work_fn = work_fn;
+  item_p->data_p = data_p;
+
+  g_mutex_lock(&pipe_p->lock);
+  if (pipe_p->in_work == 0 && pipe_p->busy_fn) {
+    pipe_p->busy_fn(pipe_p->user_data);
+  }
+  pipe_p->in_work++;
+  g_mutex_unlock(&pipe_p->lock);
+
+  pipe_p->pending++;
+  g_async_queue_push(pipe_p->work_q_p, item_p);
+}
+
+GThread * lurch_pipe_get_worker(const lurch_pipe * pipe_p) {
+  return pipe_p->worker_p;
+}
+
+gboolean lurch_pipe_pending(const lurch_pipe * pipe_p) {
+  return pipe_p && pipe_p->pending > 0;
+}
+
+void lurch_pipe_drain(lurch_pipe * pipe_p) {
+  if (!pipe_p || g_thread_self() == pipe_p->worker_p) {
+    return;
+  }
+
+  g_mutex_lock(&pipe_p->lock);
+  while (pipe_p->in_work > 0) {
+    g_cond_wait(&pipe_p->idle_cond, &pipe_p->lock);
+  }
+  g_mutex_unlock(&pipe_p->lock);
+}
+
+static void lurch_pipe_destroy(lurch_pipe * pipe_p) {
+  lurch_pipe_item * item_p = (void *) 0;
+
+  while ((item_p = g_async_queue_try_pop(pipe_p->done_q_p))) {
+    if (pipe_p->drop_fn) {
+      pipe_p->drop_fn(item_p->data_p);
+    }
+    g_free(item_p);
+  }
+
+  g_async_queue_unref(pipe_p->work_q_p);
+  g_async_queue_unref(pipe_p->done_q_p);
+  g_mutex_clear(&pipe_p->lock);
+  g_cond_clear(&pipe_p->idle_cond);
+  g_free(pipe_p);
+}
+
+void lurch_pipe_dispatch(lurch_pipe * pipe_p) {
+  lurch_pipe_item * item_p = (void *) 0;
+
+  // a completion dispatching again would overtake the ones after it
+  if (pipe_p->dispatching) {
+    return;
+  }
+
+  pipe_p->dispatching = TRUE;
+  while (!pipe_p->freed && (item_p = g_async_queue_try_pop(pipe_p->done_q_p))) {
+    pipe_p->pending--;
+    pipe_p->done_fn(item_p->data_p, pipe_p->user_data);
+    g_free(item_p);
+  }
+  pipe_p->dispatching = FALSE;
+
+  if (pipe_p->freed) {
+    lurch_pipe_destroy(pipe_p);
+  }
+}
+
+void lurch_pipe_free(lurch_pipe * pipe_p, GDestroyNotify drop_fn) {
+  if (!pipe_p || pipe_p->freed) {
+    return;
+  }
+
+  // the worker gets to the marker only after the items pushed before it
+  g_async_queue_push(pipe_p->work_q_p, &lurch_pipe_stop);
+  (void) g_thread_join(pipe_p->worker_p);
+  while (g_idle_remove_by_data(pipe_p)) {}
+
+  pipe_p->drop_fn = drop_fn;
+  pipe_p->freed = TRUE;
+  if (!pipe_p->dispatching) {
+    lurch_pipe_destroy(pipe_p);
+  }
+}
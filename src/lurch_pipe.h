@@ -0,0 +1,99 @@
+#pragma once
+
+#include <glib.h>
+
+/**
+ * Hands work to a thread of its own and delivers the results back to the main loop,
+ * in the order the work was pushed.
+ *
+ * The items are worked on one after the other, so that the work can use state which is
+ * not thread-safe, as long as the main loop stays away from it while the worker is busy,
+ * see lurch_pipe_drain(). The worker is busy from the moment an item is pushed to an idle pipe
+ * until the last pushed item is done, which the hooks given to lurch_pipe_new() are told about.
+ * Before becoming idle, the worker can flush what it kept from the items without blocking pushes.
+ *
+ * Apart from pushing and the completions, which have to be on the main loop, nothing
+ * of a pipe may be used from more than one thread.
+ */
+typedef struct lurch_pipe lurch_pipe;
+
+/**
+ * Work on an item, called on the worker.
+ *
+ * @param data_p The data given to lurch_pipe_push().
+ */
+typedef void (*lurch_pipe_work_fn)(void * data_p);
+
+/**
+ * Completion of an item, called on the main loop in the order the items were pushed.
+ * The pipe can be freed in here.
+ *
+ * @param data_p The data given to lurch_pipe_push(), to be freed here if needed.
+ * @param user_data The data given to lurch_pipe_new().
+ */
+typedef void (*lurch_pipe_done_fn)(void * data_p, void * user_data);
+
+/**
+ * Called when the worker becomes busy, on the main loop while pushing,
+ * and when it becomes idle, on the worker right after the last item.
+ * Both are called under the pipe's lock, so they have to be quick.
+ * The flush is called on the worker when the last item seems done, before the idle hook,
+ * but without the lock, so items can be pushed meanwhile and the worker then stays busy.
+ *
+ * @param user_data The data given to lurch_pipe_new().
+ */
+typedef void (*lurch_pipe_hook_fn)(void * user_data);
+
+/**
+ * Starts a pipe and its worker.
+ *
+ * @param name The name of the worker thread.
+ * @param done_fn The completion of the items.
+ * @param busy_fn Called when the worker becomes busy, can be NULL.
+ * @param flush_fn Called on the worker before it may become idle, can be NULL.
+ * @param idle_fn Called when the worker becomes idle, can be NULL.
+ * @param user_data Passed to the functions above.
+ * @return The pipe, or NULL if the thread could not be started. Free with lurch_pipe_free() when done.
+ */
+lurch_pipe * lurch_pipe_new(const char * name, lurch_pipe_done_fn done_fn, lurch_pipe_hook_fn busy_fn,
+                            lurch_pipe_hook_fn flush_fn, lurch_pipe_hook_fn idle_fn, void * user_data);
+
+/**
+ * Queues an item.
+ *
+ * @param pipe_p The pipe.
+ * @param work_fn The work, can be NULL for items which only have to keep their place in the order.
+ * @param data_p Passed to the work and the completion.
+ */
+void lurch_pipe_push(lurch_pipe * pipe_p, lurch_pipe_work_fn work_fn, void * data_p);
+
+/**
+ * @return The worker thread, e.g. to lease state to it in the busy hook.
+ */
+GThread * lurch_pipe_get_worker(const lurch_pipe * pipe_p);
+
+/**
+ * @return TRUE if items were pushed whose completion did not run yet.
+ */
+gboolean lurch_pipe_pending(const lurch_pipe * pipe_p);
+
+/**
+ * Blocks until the worker is idle, so that the state it uses can be used on the main loop.
+ * The completions of the items are not run, they stay in order on the main loop.
+ * Returns right away if called from the worker itself.
+ */
+void lurch_pipe_drain(lurch_pipe * pipe_p);
+
+/**
+ * Runs the completions of the items which are done now, instead of waiting for the main loop.
+ */
+void lurch_pipe_dispatch(lurch_pipe * pipe_p);
+
+/**
+ * Waits for the worker, stops it and frees the pipe.
+ * Items whose completion did not run yet are dropped.
+ *
+ * @param pipe_p The pipe, can be NULL.
+ * @param drop_fn Called with the data of each dropped item, can be NULL.
+ */
+void lurch_pipe_free(lurch_pipe * pipe_p, GDestroyNotify drop_fn);
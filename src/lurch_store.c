@@ -0,0 +1,2401 @@
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <purple.h>
+#include <sqlite3.h>
+
+#include "axc.h"
+#include "libomemo.h"
+
+// included for error codes
+#include "signal_protocol.h"
+
+#include "lurch_crypto.h"
+#include "lurch_kv.h"
+#include "lurch_store.h"
+#include "lurch_util.h"
+
+#define LURCH_STORE_BUSY_TIMEOUT_MS 1000
+
+// keys of the sessions in the key-value file are "s:<name>\n<device id>"
+#define LURCH_STORE_KV_SESS_PREFIX "s:"
+
+// same tables as in libomemo's storage
+#define OMEMO_DB_INIT "CREATE TABLE IF NOT EXISTS devicelists(" \
+                        "name TEXT NOT NULL, " \
+                        "id INTEGER NOT NULL, " \
+                        "date INTEGER, " \
+                        "PRIMARY KEY(name, id));" \
+                      "CREATE TABLE IF NOT EXISTS cl(" \
+                        "name TEXT NOT NULL, " \
+                        "PRIMARY KEY(name));"
+
+typedef enum {
+  LURCH_STMT_DL_SAVE = 0,
+  LURCH_STMT_DL_DELETE,
+  LURCH_STMT_DL_EXISTS,
+  LURCH_STMT_DL_GLOBAL_EXISTS,
+  LURCH_STMT_DL_RETRIEVE,
+  LURCH_STMT_CL_SAVE,
+  LURCH_STMT_CL_DELETE,
+  LURCH_STMT_CL_ALL,
+  LURCH_STMT_SESS_LOAD,
+  LURCH_STMT_SESS_SUB_DEVICES,
+  LURCH_STMT_SESS_STORE,
+  LURCH_STMT_SESS_DELETE,
+  LURCH_STMT_SESS_DELETE_ALL,
+  LURCH_STMT_PK_LOAD,
+  LURCH_STMT_PK_STORE,
+  LURCH_STMT_PK_REMOVE,
+  LURCH_STMT_SPK_STORE,
+  LURCH_STMT_COUNT
+} lurch_stmt_t;
+
+typedef struct {
+  lurch_store_db_t db;
+  const char * sql;
+} lurch_stmt_info;
+
+static const lurch_stmt_info stmt_infos[LURCH_STMT_COUNT] = {
+  [LURCH_STMT_DL_SAVE]          = { LURCH_STORE_DB_OMEMO, "INSERT OR REPLACE INTO devicelists VALUES(?1, ?2, ?3);" },
+  [LURCH_STMT_DL_DELETE]        = { LURCH_STORE_DB_OMEMO, "DELETE FROM devicelists WHERE name IS ?1 AND id IS ?2;" },
+  [LURCH_STMT_DL_EXISTS]        = { LURCH_STORE_DB_OMEMO, "SELECT id FROM devicelists WHERE name IS ?1 AND id IS ?2;" },
+  [LURCH_STMT_DL_GLOBAL_EXISTS] = { LURCH_STORE_DB_OMEMO, "SELECT id FROM devicelists WHERE id IS ?1;" },
+  [LURCH_STMT_DL_RETRIEVE]      = { LURCH_STORE_DB_OMEMO, "SELECT id FROM devicelists WHERE name IS ?1;" },
+  [LURCH_STMT_CL_SAVE]          = { LURCH_STORE_DB_OMEMO, "INSERT OR REPLACE INTO cl VALUES(?1);" },
+  [LURCH_STMT_CL_DELETE]        = { LURCH_STORE_DB_OMEMO, "DELETE FROM cl WHERE name IS ?1;" },
+  [LURCH_STMT_CL_ALL]           = { LURCH_STORE_DB_OMEMO, "SELECT name FROM cl;" },
+  [LURCH_STMT_SESS_LOAD]        = { LURCH_STORE_DB_AXC,   "SELECT session_record, record_len FROM session_store WHERE name IS ?1 AND device_id IS ?2;" },
+  [LURCH_STMT_SESS_SUB_DEVICES] = { LURCH_STORE_DB_AXC,   "SELECT device_id FROM session_store WHERE name IS ?1;" },
+  [LURCH_STMT_SESS_STORE]       = { LURCH_STORE_DB_AXC,   "INSERT OR REPLACE INTO session_store VALUES(?1, ?2, ?3, ?4, ?5);" },
+  [LURCH_STMT_SESS_DELETE]      = { LURCH_STORE_DB_AXC,   "DELETE FROM session_store WHERE name IS ?1 AND device_id IS ?2;" },
+  [LURCH_STMT_SESS_DELETE_ALL]  = { LURCH_STORE_DB_AXC,   "DELETE FROM session_store WHERE name IS ?1;" },
+  [LURCH_STMT_PK_LOAD]          = { LURCH_STORE_DB_AXC,   "SELECT pre_key_record, record_len FROM pre_key_store WHERE id IS ?1;" },
+  [LURCH_STMT_PK_STORE]         = { LURCH_STORE_DB_AXC,   "INSERT OR REPLACE INTO pre_key_store VALUES(?1, ?2, ?3);" },
+  [LURCH_STMT_PK_REMOVE]        = { LURCH_STORE_DB_AXC,   "DELETE FROM pre_key_store WHERE id IS ?1;" },
+  [LURCH_STMT_SPK_STORE]        = { LURCH_STORE_DB_AXC,   "INSERT OR REPLACE INTO signed_pre_key_store VALUES(?1, ?2, ?3);" },
+};
+
+// device ids of one user in the devicelist cache
+typedef struct {
+  GArray * ids_p;     // of uint32_t
+  GList * lru_link_p; // this entry's node in the lru queue
+} lurch_store_dl_entry;
+
+/**
+ * Where the sessions of a store are kept, chosen with LURCH_PREF_STORE_SESS_BACKEND.
+ * The functions return what libsignal expects from the corresponding store functions,
+ * except for list(), which appends the device ids to the array and returns 0 on success.
+ * A backend without begin(), commit() and rollback() writes in the transaction of the axc db.
+ */
+typedef struct {
+  int (*load)(lurch_store * store_p, const char * name, size_t name_len, int32_t device_id, signal_buffer ** record);
+  int (*list)(lurch_store * store_p, const char * name, size_t name_len, GArray * ids_p);
+  int (*store)(lurch_store * store_p, const char * name, size_t name_len, int32_t device_id,
+               const uint8_t * record, size_t record_len);
+  int (*delete)(lurch_store * store_p, const char * name, size_t name_len, int32_t device_id);
+  int (*delete_all)(lurch_store * store_p, const char * name, size_t name_len);
+  void (*begin)(lurch_store * store_p);
+  int (*commit)(lurch_store * store_p);
+  void (*rollback)(lurch_store * store_p);
+} lurch_store_sess_backend;
+
+static const lurch_store_sess_backend sess_db_backend;
+static const lurch_store_sess_backend sess_kv_backend;
+static int lurch_store_sess_backend_open(lurch_store * store_p);
+
+struct lurch_store {
+  char * uname;
+  char * db_fn[LURCH_STORE_DB_COUNT];
+  sqlite3 * db_p[LURCH_STORE_DB_COUNT];
+  sqlite3_stmt * stmt_p[LURCH_STMT_COUNT];
+  GHashTable * chatlist_p; // set of all names in the chatlist table, kept in sync on writes
+
+  const lurch_store_sess_backend * sess_backend_p;
+  lurch_kv * kv_p;         // the sessions, if they are not kept in the axc db
+
+  GHashTable * dl_cache_p; // bare jid -> lurch_store_dl_entry
+  GQueue dl_lru;           // bare jids in the devicelist cache, most recently used first
+  guint dl_cache_max;
+  guint dl_cache_hits;
+  guint dl_cache_misses;
+
+  // see lurch_store_msg_begin()
+  guint msg_depth;
+  gboolean msg_failed;
+  GHashTable * msg_sess_p;   // "device_id:name" -> lurch_store_pending_sess
+  GHashTable * msg_wiped_p;  // set of names whose sessions were all deleted
+  GArray * msg_pk_removed_p; // of uint32_t
+  // see lurch_store_batch_begin()
+  guint msg_batch_depth;          // depth of the batch scope, 0 without a batch
+  GHashTable * msg_undo_sess_p;   // "device_id:name" -> copy of the lurch_store_pending_sess before the message, or NULL
+  GHashTable * msg_undo_wiped_p;  // set of names the message added to msg_wiped_p
+  GArray * msg_undo_pk_p;         // msg_pk_removed_p before the message
+
+  // see lurch_store_submit()
+  GThread * worker_p;
+  GAsyncQueue * req_q_p;                   // of lurch_store_req, handled by the worker
+  GMutex pending_lock;
+  GCond pending_cond;                      // signalled whenever a request was handled
+  guint pending[LURCH_STORE_DB_COUNT];     // submitted, but not yet handled requests per db
+  GThread * lease_owner_p;                 // see lurch_store_lease()
+};
+
+typedef struct {
+  char * uname;
+  lurch_store_db_t which;
+  lurch_store_work_fn work_fn;
+  lurch_store_done_fn done_fn;
+  void * data_p;
+  int ret_val;
+  char * err_msg;
+} lurch_store_req;
+
+// the worker stops once it pops this
+static lurch_store_req worker_stop_req;
+
+// requests handled by the workers, waiting for their completion on the main loop
+static GAsyncQueue * done_q_p = (void *) 0;
+
+// a session write held back until the end of the message
+typedef struct {
+  char * name;
+  size_t name_len;
+  int32_t device_id;
+  signal_buffer * record_p; // NULL if the session was deleted
+} lurch_store_pending_sess;
+
+static GHashTable * store_map = (void *) 0;
+
+// axc_context * -> lurch_store *, for the store templates which only get the context as user data
+static GHashTable * axc_ctx_store_map = (void *) 0;
+// the templates are also used by the threads initializing axc contexts, see lurch_store_lease()
+static GMutex axc_ctx_store_lock;
+
+static void lurch_store_log_db_err(const lurch_store * store_p, lurch_store_db_t which, const char * func, const char * what) {
+  purple_debug_error("lurch", "%s: %s in %s: %s\n", func, what, store_p->db_fn[which], sqlite3_errmsg(store_p->db_p[which]));
+}
+
+/**
+ * Blocks until the worker handled all requests submitted for the given db,
+ * so that the main thread's handle sees their changes.
+ * Also blocks while another thread holds a lease on the store.
+ */
+static void lurch_store_wait(lurch_store * store_p, lurch_store_db_t which) {
+  g_mutex_lock(&store_p->pending_lock);
+  while (store_p->pending[which] > 0
+         || (store_p->lease_owner_p && store_p->lease_owner_p != g_thread_self())) {
+    g_cond_wait(&store_p->pending_cond, &store_p->pending_lock);
+  }
+  g_mutex_unlock(&store_p->pending_lock);
+}
+
+/**
+ * Returns the cached statement, compiling it on first use.
+ * Statements are compiled lazily as the axc tables only exist after the installation.
+ *
+ * @return The statement, reset and without bindings, or NULL on error.
+ */
+static sqlite3_stmt * lurch_store_stmt(lurch_store * store_p, lurch_stmt_t id) {
+  const lurch_stmt_info * info_p = &stmt_infos[id];
+  int ret_val = 0;
+
+  lurch_store_wait(store_p, info_p->db);
+
+  if (store_p->stmt_p[id]) {
+    return store_p->stmt_p[id];
+  }
+
+  ret_val = sqlite3_prepare_v2(store_p->db_p[info_p->db], info_p->sql, -1, &store_p->stmt_p[id], (void *) 0);
+  if (ret_val != SQLITE_OK) {
+    lurch_store_log_db_err(store_p, info_p->db, __func__, "failed to prepare statement");
+    store_p->stmt_p[id] = (void *) 0;
+  }
+
+  return store_p->stmt_p[id];
+}
+
+/**
+ * Makes a used statement ready for the next call and releases the locks it might hold.
+ */
+static void lurch_store_stmt_done(sqlite3_stmt * pstmt_p) {
+  (void) sqlite3_reset(pstmt_p);
+  (void) sqlite3_clear_bindings(pstmt_p);
+}
+
+/**
+ * Executes a statement which does not return rows.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int lurch_store_stmt_exec(lurch_store * store_p, lurch_stmt_t id, sqlite3_stmt * pstmt_p, const char * func) {
+  int ret_val = 0;
+
+  if (sqlite3_step(pstmt_p) != SQLITE_DONE) {
+    lurch_store_log_db_err(store_p, stmt_infos[id].db, func, "failed to execute statement");
+    ret_val = -1;
+  }
+
+  lurch_store_stmt_done(pstmt_p);
+  return ret_val;
+}
+
+/**
+ * Executes a statement and checks if it returned a row.
+ *
+ * @return 1 if it did, 0 if not, -1 on error.
+ */
+static int lurch_store_stmt_has_row(lurch_store * store_p, lurch_stmt_t id, sqlite3_stmt * pstmt_p, const char * func) {
+  int ret_val = 0;
+
+  switch (sqlite3_step(pstmt_p)) {
+    case SQLITE_ROW:
+      ret_val = 1;
+      break;
+    case SQLITE_DONE:
+      ret_val = 0;
+      break;
+    default:
+      lurch_store_log_db_err(store_p, stmt_infos[id].db, func, "failed to execute statement");
+      ret_val = -1;
+  }
+
+  lurch_store_stmt_done(pstmt_p);
+  return ret_val;
+}
+
+/**
+ * Executes a statement without parameters or results, like BEGIN or COMMIT.
+ *
+ * @return 0 on success, OMEMO_ERR_STORAGE on error.
+ */
+static int lurch_store_db_exec(lurch_store * store_p, lurch_store_db_t which, const char * sql, const char * func) {
+  lurch_store_wait(store_p, which);
+
+  if (sqlite3_exec(store_p->db_p[which], sql, (void *) 0, (void *) 0, (void *) 0) != SQLITE_OK) {
+    lurch_store_log_db_err(store_p, which, func, sql);
+    return OMEMO_ERR_STORAGE;
+  }
+
+  return 0;
+}
+
+static int lurch_store_db_open(lurch_store * store_p, lurch_store_db_t which) {
+  int ret_val = 0;
+
+  ret_val = sqlite3_open(store_p->db_fn[which], &store_p->db_p[which]);
+  if (ret_val != SQLITE_OK) {
+    lurch_store_log_db_err(store_p, which, __func__, "failed to open db");
+    return -1;
+  }
+
+  // axc opens its own connections for the stores lurch does not replace
+  (void) sqlite3_busy_timeout(store_p->db_p[which], LURCH_STORE_BUSY_TIMEOUT_MS);
+
+  return 0;
+}
+
+/**
+ * Runs on the main loop and completes one request handled by a worker.
+ */
+static void lurch_store_req_finish(lurch_store_req * req_p) {
+  if (req_p->ret_val && req_p->err_msg) {
+    purple_debug_error("lurch", "%s: %s in %s's db (%i)\n", __func__, req_p->err_msg, req_p->uname, req_p->ret_val);
+  }
+  if (req_p->done_fn) {
+    req_p->done_fn(req_p->uname, req_p->ret_val, req_p->data_p);
+  }
+
+  g_free(req_p->err_msg);
+  g_free(req_p->uname);
+  g_free(req_p);
+}
+
+static gboolean lurch_store_done_dispatch(gpointer data) {
+  lurch_store_req * req_p = g_async_queue_try_pop(done_q_p);
+  (void) data;
+
+  if (req_p) {
+    lurch_store_req_finish(req_p);
+  }
+
+  return FALSE;
+}
+
+/**
+ * Completes the requests whose idle callbacks did not run yet.
+ * Called once all workers are stopped.
+ */
+static void lurch_store_done_drain(void) {
+  lurch_store_req * req_p = (void *) 0;
+
+  if (!done_q_p) {
+    return;
+  }
+
+  while (g_idle_remove_by_data(&done_q_p)) {
+    // one source per handled request
+  }
+  while ((req_p = g_async_queue_try_pop(done_q_p))) {
+    lurch_store_req_finish(req_p);
+  }
+}
+
+/**
+ * The worker thread. Owns its own handles to both databases, as sqlite handles
+ * must not be shared with the main thread, and must not call into libpurple.
+ */
+static gpointer lurch_store_worker_run(gpointer data) {
+  lurch_store * store_p = data;
+  sqlite3 * db_p[LURCH_STORE_DB_COUNT] = { (void *) 0 };
+  int open_ret[LURCH_STORE_DB_COUNT] = { 0 };
+  lurch_store_req * req_p = (void *) 0;
+  lurch_store_db_t which = LURCH_STORE_DB_OMEMO;
+  int i = 0;
+
+  for (i = 0; i < LURCH_STORE_DB_COUNT; i++) {
+    open_ret[i] = sqlite3_open(store_p->db_fn[i], &db_p[i]);
+    (void) sqlite3_busy_timeout(db_p[i], LURCH_STORE_BUSY_TIMEOUT_MS);
+  }
+
+  while ((req_p = g_async_queue_pop(store_p->req_q_p)) != &worker_stop_req) {
+    // the request belongs to the main loop once it is pushed
+    which = req_p->which;
+    if (open_ret[req_p->which] != SQLITE_OK) {
+      req_p->err_msg = g_strdup_printf("failed to open db: %s", sqlite3_errmsg(db_p[req_p->which]));
+      req_p->ret_val = OMEMO_ERR_STORAGE;
+    } else {
+      req_p->ret_val = req_p->work_fn(db_p[req_p->which], req_p->data_p, &req_p->err_msg);
+    }
+
+    g_async_queue_push(done_q_p, req_p);
+    (void) g_idle_add(lurch_store_done_dispatch, &done_q_p);
+
+    g_mutex_lock(&store_p->pending_lock);
+    store_p->pending[which]--;
+    g_cond_broadcast(&store_p->pending_cond);
+    g_mutex_unlock(&store_p->pending_lock);
+  }
+
+  for (i = 0; i < LURCH_STORE_DB_COUNT; i++) {
+    sqlite3_close(db_p[i]);
+  }
+  lurch_crypto_thread_release();
+
+  return (void *) 0;
+}
+
+static void lurch_store_pending_sess_free(gpointer data) {
+  lurch_store_pending_sess * pending_p = data;
+
+  if (!pending_p) {
+    return;
+  }
+
+  g_free(pending_p->name);
+  signal_buffer_free(pending_p->record_p);
+  g_free(pending_p);
+}
+
+static void lurch_store_dl_entry_free(gpointer data) {
+  lurch_store_dl_entry * entry_p = data;
+
+  g_array_free(entry_p->ids_p, TRUE);
+  g_free(entry_p);
+}
+
+/**
+ * Looks up a user's devicelist in the cache and marks it as recently used.
+ * Counts the hit or miss.
+ *
+ * @return The entry, or NULL if the user's devicelist is not cached.
+ */
+static lurch_store_dl_entry * lurch_store_dl_cache_lookup(lurch_store * store_p, const char * user) {
+  lurch_store_dl_entry * entry_p = g_hash_table_lookup(store_p->dl_cache_p, user);
+
+  if (!entry_p) {
+    store_p->dl_cache_misses++;
+    return (void *) 0;
+  }
+
+  store_p->dl_cache_hits++;
+  g_queue_unlink(&store_p->dl_lru, entry_p->lru_link_p);
+  g_queue_push_head_link(&store_p->dl_lru, entry_p->lru_link_p);
+
+  return entry_p;
+}
+
+static void lurch_store_dl_cache_remove(lurch_store * store_p, const char * user) {
+  lurch_store_dl_entry * entry_p = g_hash_table_lookup(store_p->dl_cache_p, user);
+
+  if (!entry_p) {
+    return;
+  }
+
+  // the queue only borrows the key, so it has to go first
+  g_queue_delete_link(&store_p->dl_lru, entry_p->lru_link_p);
+  (void) g_hash_table_remove(store_p->dl_cache_p, user);
+}
+
+/**
+ * Puts a user's device ids into the cache, replacing the previous entry and
+ * evicting the least recently used ones if the cache is full.
+ * Takes ownership of ids_p.
+ */
+static void lurch_store_dl_cache_insert(lurch_store * store_p, const char * user, GArray * ids_p) {
+  lurch_store_dl_entry * entry_p = (void *) 0;
+  char * key = (void *) 0;
+
+  lurch_store_dl_cache_remove(store_p, user);
+
+  if (store_p->dl_cache_max == 0) {
+    g_array_free(ids_p, TRUE);
+    return;
+  }
+
+  while (g_hash_table_size(store_p->dl_cache_p) >= store_p->dl_cache_max) {
+    lurch_store_dl_cache_remove(store_p, g_queue_peek_tail(&store_p->dl_lru));
+  }
+
+  key = g_strdup(user);
+  entry_p = g_malloc0(sizeof(lurch_store_dl_entry));
+  entry_p->ids_p = ids_p;
+  g_queue_push_head(&store_p->dl_lru, key);
+  entry_p->lru_link_p = g_queue_peek_head_link(&store_p->dl_lru);
+  (void) g_hash_table_insert(store_p->dl_cache_p, key, entry_p);
+}
+
+static gboolean lurch_store_dl_entry_contains(const lurch_store_dl_entry * entry_p, uint32_t device_id) {
+  guint i = 0;
+
+  for (i = 0; i < entry_p->ids_p->len; i++) {
+    if (g_array_index(entry_p->ids_p, uint32_t, i) == device_id) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/**
+ * Reads the whole chatlist into memory, so that lookups do not need to touch the db.
+ *
+ * @return 0 on success, OMEMO_ERR_STORAGE on error.
+ */
+static int lurch_store_chatlist_load(lurch_store * store_p) {
+  int step_result = 0;
+  sqlite3_stmt * pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_CL_ALL);
+
+  if (!pstmt_p) {
+    return OMEMO_ERR_STORAGE;
+  }
+
+  while ((step_result = sqlite3_step(pstmt_p)) == SQLITE_ROW) {
+    (void) g_hash_table_add(store_p->chatlist_p, g_strdup((const char *) sqlite3_column_text(pstmt_p, 0)));
+  }
+  lurch_store_stmt_done(pstmt_p);
+
+  if (step_result != SQLITE_DONE) {
+    lurch_store_log_db_err(store_p, LURCH_STORE_DB_OMEMO, __func__, "failed to load the chatlist");
+    return OMEMO_ERR_STORAGE;
+  }
+
+  return 0;
+}
+
+int lurch_store_open(const char * uname, lurch_store ** store_pp) {
+  int ret_val = 0;
+  char * err_msg_dbg = (void *) 0;
+  int dl_cache_size = 0;
+
+  lurch_store * store_p = (void *) 0;
+
+  store_p = g_malloc0(sizeof(lurch_store));
+  store_p->uname = g_strdup(uname);
+  store_p->db_fn[LURCH_STORE_DB_OMEMO] = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_OMEMO);
+  store_p->db_fn[LURCH_STORE_DB_AXC] = lurch_util_uname_get_db_fn(uname, LURCH_DB_NAME_AXC);
+  store_p->chatlist_p = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (void *) 0);
+  store_p->dl_cache_p = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, lurch_store_dl_entry_free);
+  g_queue_init(&store_p->dl_lru);
+  dl_cache_size = purple_prefs_get_int(LURCH_PREF_STORE_DL_CACHE_SIZE);
+  store_p->dl_cache_max = (dl_cache_size > 0) ? dl_cache_size : 0;
+  store_p->msg_sess_p = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, lurch_store_pending_sess_free);
+  store_p->msg_wiped_p = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (void *) 0);
+  store_p->msg_pk_removed_p = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+  store_p->msg_undo_sess_p = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, lurch_store_pending_sess_free);
+  store_p->msg_undo_wiped_p = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (void *) 0);
+  store_p->msg_undo_pk_p = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+  g_mutex_init(&store_p->pending_lock);
+  g_cond_init(&store_p->pending_cond);
+
+  ret_val = lurch_store_db_open(store_p, LURCH_STORE_DB_OMEMO);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to open the omemo db %s", store_p->db_fn[LURCH_STORE_DB_OMEMO]);
+    goto cleanup;
+  }
+
+  ret_val = sqlite3_exec(store_p->db_p[LURCH_STORE_DB_OMEMO], OMEMO_DB_INIT, (void *) 0, (void *) 0, (void *) 0);
+  if (ret_val != SQLITE_OK) {
+    err_msg_dbg = g_strdup_printf("failed to create the tables in %s", store_p->db_fn[LURCH_STORE_DB_OMEMO]);
+    ret_val = OMEMO_ERR_STORAGE;
+    goto cleanup;
+  }
+
+  ret_val = lurch_store_chatlist_load(store_p);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to load the chatlist from %s", store_p->db_fn[LURCH_STORE_DB_OMEMO]);
+    goto cleanup;
+  }
+
+  ret_val = lurch_store_db_open(store_p, LURCH_STORE_DB_AXC);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to open the axc db %s", store_p->db_fn[LURCH_STORE_DB_AXC]);
+    goto cleanup;
+  }
+
+  ret_val = lurch_store_sess_backend_open(store_p);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to set up the session store of %s", uname);
+    goto cleanup;
+  }
+
+  if (!done_q_p) {
+    done_q_p = g_async_queue_new();
+  }
+  store_p->req_q_p = g_async_queue_new();
+  store_p->worker_p = g_thread_new("lurch-store", lurch_store_worker_run, store_p);
+
+  *store_pp = store_p;
+
+cleanup:
+  if (ret_val) {
+    lurch_store_close(store_p);
+  }
+  if (err_msg_dbg) {
+    purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
+    g_free(err_msg_dbg);
+  }
+
+  return ret_val;
+}
+
+static gboolean lurch_store_axc_ctx_is_bound_to(gpointer key, gpointer value, gpointer user_data) {
+  (void) key;
+  return value == user_data;
+}
+
+void lurch_store_close(lurch_store * store_p) {
+  int i = 0;
+
+  if (!store_p) {
+    return;
+  }
+
+  g_mutex_lock(&axc_ctx_store_lock);
+  if (axc_ctx_store_map) {
+    (void) g_hash_table_foreach_remove(axc_ctx_store_map, lurch_store_axc_ctx_is_bound_to, store_p);
+  }
+  g_mutex_unlock(&axc_ctx_store_lock);
+
+  // the worker handles everything submitted before it stops
+  if (store_p->worker_p) {
+    g_async_queue_push(store_p->req_q_p, &worker_stop_req);
+    (void) g_thread_join(store_p->worker_p);
+  }
+  if (store_p->req_q_p) {
+    g_async_queue_unref(store_p->req_q_p);
+  }
+  g_mutex_clear(&store_p->pending_lock);
+  g_cond_clear(&store_p->pending_cond);
+
+  lurch_kv_close(store_p->kv_p);
+
+  for (i = 0; i < LURCH_STMT_COUNT; i++) {
+    sqlite3_finalize(store_p->stmt_p[i]);
+  }
+
+  for (i = 0; i < LURCH_STORE_DB_COUNT; i++) {
+    sqlite3_close(store_p->db_p[i]);
+    g_free(store_p->db_fn[i]);
+  }
+
+  if (store_p->chatlist_p) {
+    g_hash_table_destroy(store_p->chatlist_p);
+  }
+  if (store_p->dl_cache_p) {
+    purple_debug_info("lurch", "%s: devicelist cache of %s: %u hits, %u misses\n",
+                      __func__, store_p->uname, store_p->dl_cache_hits, store_p->dl_cache_misses);
+    g_queue_clear(&store_p->dl_lru);
+    g_hash_table_destroy(store_p->dl_cache_p);
+  }
+  if (store_p->msg_sess_p) {
+    g_hash_table_destroy(store_p->msg_sess_p);
+    g_hash_table_destroy(store_p->msg_wiped_p);
+    g_array_free(store_p->msg_pk_removed_p, TRUE);
+    g_hash_table_destroy(store_p->msg_undo_sess_p);
+    g_hash_table_destroy(store_p->msg_undo_wiped_p);
+    g_array_free(store_p->msg_undo_pk_p, TRUE);
+  }
+  g_free(store_p->uname);
+  g_free(store_p);
+}
+
+int lurch_store_get(const char * uname, lurch_store ** store_pp) {
+  int ret_val = 0;
+  lurch_store * store_p = (void *) 0;
+
+  if (!store_map) {
+    store_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) lurch_store_close);
+  }
+
+  store_p = g_hash_table_lookup(store_map, uname);
+  if (!store_p) {
+    ret_val = lurch_store_open(uname, &store_p);
+    if (ret_val) {
+      return ret_val;
+    }
+    (void) g_hash_table_insert(store_map, g_strdup(uname), store_p);
+  }
+
+  *store_pp = store_p;
+  return 0;
+}
+
+void lurch_store_reset_all(void) {
+  if (store_map) {
+    g_hash_table_destroy(store_map);
+    store_map = (void *) 0;
+  }
+  g_mutex_lock(&axc_ctx_store_lock);
+  if (axc_ctx_store_map) {
+    g_hash_table_destroy(axc_ctx_store_map);
+    axc_ctx_store_map = (void *) 0;
+  }
+  g_mutex_unlock(&axc_ctx_store_lock);
+  if (done_q_p) {
+    lurch_store_done_drain();
+    g_async_queue_unref(done_q_p);
+    done_q_p = (void *) 0;
+  }
+}
+
+static const char * const journal_prefs[LURCH_STORE_DB_COUNT] = {
+  [LURCH_STORE_DB_OMEMO] = LURCH_PREF_STORE_OMEMO_JOURNAL,
+  [LURCH_STORE_DB_AXC]   = LURCH_PREF_STORE_AXC_JOURNAL
+};
+
+static const char * const sync_prefs[LURCH_STORE_DB_COUNT] = {
+  [LURCH_STORE_DB_OMEMO] = LURCH_PREF_STORE_OMEMO_SYNC,
+  [LURCH_STORE_DB_AXC]   = LURCH_PREF_STORE_AXC_SYNC
+};
+
+/**
+ * Builds the pragmas for the journal mode and sync level set in the prefs.
+ * Unknown pref values fall back to sqlite's defaults, so that only fixed strings end up in the sql.
+ *
+ * @return The sql, has to be g_free()d.
+ */
+static char * lurch_store_durability_sql(lurch_store_db_t which) {
+  const char * journal = purple_prefs_get_string(journal_prefs[which]);
+  const char * sync = purple_prefs_get_string(sync_prefs[which]);
+
+  return g_strdup_printf("PRAGMA journal_mode=%s; PRAGMA synchronous=%s;",
+                         !g_strcmp0(journal, LURCH_STORE_JOURNAL_WAL) ? "WAL" : "DELETE",
+                         !g_strcmp0(sync, LURCH_STORE_SYNC_NORMAL) ? "NORMAL" : "FULL");
+}
+
+static int lurch_store_durability_work(sqlite3 * db_p, void * data_p, char ** err_msg_pp) {
+  if (sqlite3_exec(db_p, data_p, (void *) 0, (void *) 0, (void *) 0) != SQLITE_OK) {
+    *err_msg_pp = g_strdup_printf("failed to execute '%s': %s", (char *) data_p, sqlite3_errmsg(db_p));
+    return OMEMO_ERR_STORAGE;
+  }
+
+  return 0;
+}
+
+static void lurch_store_durability_done(const char * uname, int ret_val, void * data_p) {
+  (void) uname;
+  (void) ret_val;
+  g_free(data_p);
+}
+
+int lurch_store_apply_durability(lurch_store * store_p) {
+  int ret_val = 0;
+  int i = 0;
+  char * sql = (void *) 0;
+
+  for (i = 0; i < LURCH_STORE_DB_COUNT; i++) {
+    sql = lurch_store_durability_sql(i);
+    purple_debug_info("lurch", "%s: %s: %s\n", __func__, store_p->db_fn[i], sql);
+
+    // synchronous is a setting of the connection, so the worker's handle needs it as well
+    ret_val = lurch_store_db_exec(store_p, i, sql, __func__);
+    if (ret_val) {
+      g_free(sql);
+      return ret_val;
+    }
+    lurch_store_submit(store_p, i, lurch_store_durability_work, lurch_store_durability_done, sql);
+  }
+
+  return 0;
+}
+
+static void lurch_store_sync_one(gpointer key, gpointer value, gpointer user_data) {
+  (void) key;
+  (void) user_data;
+  lurch_store_sync(value);
+}
+
+void lurch_store_sync(lurch_store * store_p) {
+  int i = 0;
+
+  for (i = 0; i < LURCH_STORE_DB_COUNT; i++) {
+    lurch_store_wait(store_p, i);
+  }
+}
+
+void lurch_store_sync_all(void) {
+  if (store_map) {
+    g_hash_table_foreach(store_map, lurch_store_sync_one, (void *) 0);
+  }
+}
+
+void lurch_store_submit(lurch_store * store_p, lurch_store_db_t which,
+                        lurch_store_work_fn work_fn, lurch_store_done_fn done_fn, void * data_p) {
+  lurch_store_req * req_p = g_malloc0(sizeof(lurch_store_req));
+
+  req_p->uname = g_strdup(store_p->uname);
+  req_p->which = which;
+  req_p->work_fn = work_fn;
+  req_p->done_fn = done_fn;
+  req_p->data_p = data_p;
+
+  g_mutex_lock(&store_p->pending_lock);
+  store_p->pending[which]++;
+  g_mutex_unlock(&store_p->pending_lock);
+
+  g_async_queue_push(store_p->req_q_p, req_p);
+}
+
+const char * lurch_store_get_db_fn(const lurch_store * store_p, lurch_store_db_t which) {
+  return store_p ? store_p->db_fn[which] : (void *) 0;
+}
+
+void lurch_store_bind_axc_ctx(lurch_store * store_p, axc_context * axc_ctx_p) {
+  g_mutex_lock(&axc_ctx_store_lock);
+  if (!axc_ctx_store_map) {
+    axc_ctx_store_map = g_hash_table_new(g_direct_hash, g_direct_equal);
+  }
+  (void) g_hash_table_replace(axc_ctx_store_map, axc_ctx_p, store_p);
+  g_mutex_unlock(&axc_ctx_store_lock);
+}
+
+void lurch_store_lease(lurch_store * store_p, GThread * owner_p) {
+  g_mutex_lock(&store_p->pending_lock);
+  store_p->lease_owner_p = owner_p;
+  g_mutex_unlock(&store_p->pending_lock);
+}
+
+void lurch_store_release(lurch_store * store_p) {
+  g_mutex_lock(&store_p->pending_lock);
+  store_p->lease_owner_p = (void *) 0;
+  g_cond_broadcast(&store_p->pending_cond);
+  g_mutex_unlock(&store_p->pending_lock);
+}
+
+int lurch_store_chatlist_save(lurch_store * store_p, const char * chat) {
+  sqlite3_stmt * pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_CL_SAVE);
+  if (!pstmt_p) {
+    return OMEMO_ERR_STORAGE;
+  }
+
+  (void) sqlite3_bind_text(pstmt_p, 1, chat, -1, SQLITE_STATIC);
+  if (lurch_store_stmt_exec(store_p, LURCH_STMT_CL_SAVE, pstmt_p, __func__)) {
+    return OMEMO_ERR_STORAGE;
+  }
+
+  // only update the cache once the db accepted the change, so both stay the same
+  (void) g_hash_table_add(store_p->chatlist_p, g_strdup(chat));
+  return 0;
+}
+
+int lurch_store_chatlist_delete(lurch_store * store_p, const char * chat) {
+  sqlite3_stmt * pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_CL_DELETE);
+  if (!pstmt_p) {
+    return OMEMO_ERR_STORAGE;
+  }
+
+  (void) sqlite3_bind_text(pstmt_p, 1, chat, -1, SQLITE_STATIC);
+  if (lurch_store_stmt_exec(store_p, LURCH_STMT_CL_DELETE, pstmt_p, __func__)) {
+    return OMEMO_ERR_STORAGE;
+  }
+
+  (void) g_hash_table_remove(store_p->chatlist_p, chat);
+  return 0;
+}
+
+int lurch_store_chatlist_exists(lurch_store * store_p, const char * chat) {
+  if (!chat) {
+    return 0;
+  }
+  return g_hash_table_contains(store_p->chatlist_p, chat) ? 1 : 0;
+}
+
+static int lurch_store_dl_db_save(lurch_store * store_p, const char * user, uint32_t device_id) {
+  sqlite3_stmt * pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_DL_SAVE);
+  if (!pstmt_p) {
+    return OMEMO_ERR_STORAGE;
+  }
+
+  (void) sqlite3_bind_text(pstmt_p, 1, user, -1, SQLITE_STATIC);
+  (void) sqlite3_bind_int(pstmt_p, 2, device_id);
+  (void) sqlite3_bind_int(pstmt_p, 3, time((void *) 0));
+  return lurch_store_stmt_exec(store_p, LURCH_STMT_DL_SAVE, pstmt_p, __func__) ? OMEMO_ERR_STORAGE : 0;
+}
+
+static int lurch_store_dl_db_delete(lurch_store * store_p, const char * user, uint32_t device_id) {
+  sqlite3_stmt * pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_DL_DELETE);
+  if (!pstmt_p) {
+    return OMEMO_ERR_STORAGE;
+  }
+
+  (void) sqlite3_bind_text(pstmt_p, 1, user, -1, SQLITE_STATIC);
+  (void) sqlite3_bind_int(pstmt_p, 2, device_id);
+  return lurch_store_stmt_exec(store_p, LURCH_STMT_DL_DELETE, pstmt_p, __func__) ? OMEMO_ERR_STORAGE : 0;
+}
+
+static void lurch_store_dl_cache_add_id(lurch_store * store_p, const char * user, uint32_t device_id) {
+  lurch_store_dl_entry * entry_p = g_hash_table_lookup(store_p->dl_cache_p, user);
+
+  if (entry_p && !lurch_store_dl_entry_contains(entry_p, device_id)) {
+    (void) g_array_append_val(entry_p->ids_p, device_id);
+  }
+}
+
+static void lurch_store_dl_cache_remove_id(lurch_store * store_p, const char * user, uint32_t device_id) {
+  lurch_store_dl_entry * entry_p = g_hash_table_lookup(store_p->dl_cache_p, user);
+  guint i = 0;
+
+  for (i = 0; entry_p && i < entry_p->ids_p->len; i++) {
+    if (g_array_index(entry_p->ids_p, uint32_t, i) == device_id) {
+      (void) g_array_remove_index(entry_p->ids_p, i);
+      break;
+    }
+  }
+}
+
+int lurch_store_device_id_save(lurch_store * store_p, const char * user, uint32_t device_id) {
+  int ret_val = lurch_store_dl_db_save(store_p, user, device_id);
+
+  if (!ret_val) {
+    lurch_store_dl_cache_add_id(store_p, user, device_id);
+  }
+
+  return ret_val;
+}
+
+int lurch_store_device_id_delete(lurch_store * store_p, const char * user, uint32_t device_id) {
+  int ret_val = lurch_store_dl_db_delete(store_p, user, device_id);
+
+  if (!ret_val) {
+    lurch_store_dl_cache_remove_id(store_p, user, device_id);
+  }
+
+  return ret_val;
+}
+
+int lurch_store_devicelist_apply(lurch_store * store_p, const char * user, const GList * add_l_p, const GList * del_l_p) {
+  int ret_val = 0;
+  const GList * curr_p = (void *) 0;
+
+  if (!add_l_p && !del_l_p) {
+    return 0;
+  }
+
+  ret_val = lurch_store_db_exec(store_p, LURCH_STORE_DB_OMEMO, "BEGIN IMMEDIATE;", __func__);
+  if (ret_val) {
+    return ret_val;
+  }
+
+  for (curr_p = add_l_p; curr_p; curr_p = curr_p->next) {
+    ret_val = lurch_store_dl_db_save(store_p, user, omemo_devicelist_list_data((GList *) curr_p));
+    if (ret_val) {
+      goto cleanup;
+    }
+  }
+
+  for (curr_p = del_l_p; curr_p; curr_p = curr_p->next) {
+    ret_val = lurch_store_dl_db_delete(store_p, user, omemo_devicelist_list_data((GList *) curr_p));
+    if (ret_val) {
+      goto cleanup;
+    }
+  }
+
+  ret_val = lurch_store_db_exec(store_p, LURCH_STORE_DB_OMEMO, "COMMIT;", __func__);
+
+cleanup:
+  if (ret_val) {
+    (void) lurch_store_db_exec(store_p, LURCH_STORE_DB_OMEMO, "ROLLBACK;", __func__);
+    return ret_val;
+  }
+
+  // only touch the cache once the changes are in the db
+  for (curr_p = add_l_p; curr_p; curr_p = curr_p->next) {
+    lurch_store_dl_cache_add_id(store_p, user, omemo_devicelist_list_data((GList *) curr_p));
+  }
+  for (curr_p = del_l_p; curr_p; curr_p = curr_p->next) {
+    lurch_store_dl_cache_remove_id(store_p, user, omemo_devicelist_list_data((GList *) curr_p));
+  }
+
+  return 0;
+}
+
+// changes to one user's devicelist, written by the worker
+typedef struct {
+  char * user;
+  GArray * add_p; // of uint32_t
+  GArray * del_p; // of uint32_t
+} lurch_store_dl_change;
+
+static void lurch_store_dl_change_free(lurch_store_dl_change * change_p) {
+  g_free(change_p->user);
+  g_array_free(change_p->add_p, TRUE);
+  g_array_free(change_p->del_p, TRUE);
+  g_free(change_p);
+}
+
+/**
+ * Runs one of the devicelist statements for each of the ids.
+ *
+ * @param with_date Whether the statement takes the current time as third parameter, like LURCH_STMT_DL_SAVE.
+ */
+static int lurch_store_dl_change_exec(sqlite3_stmt * pstmt_p, const char * user, const GArray * ids_p, gboolean with_date) {
+  guint i = 0;
+  int step_result = 0;
+
+  for (i = 0; i < ids_p->len; i++) {
+    (void) sqlite3_bind_text(pstmt_p, 1, user, -1, SQLITE_STATIC);
+    (void) sqlite3_bind_int(pstmt_p, 2, g_array_index(ids_p, uint32_t, i));
+    if (with_date) {
+      (void) sqlite3_bind_int(pstmt_p, 3, time((void *) 0));
+    }
+    step_result = sqlite3_step(pstmt_p);
+    lurch_store_stmt_done(pstmt_p);
+    if (step_result != SQLITE_DONE) {
+      return OMEMO_ERR_STORAGE;
+    }
+  }
+
+  return 0;
+}
+
+static int lurch_store_dl_change_work(sqlite3 * db_p, void * data_p, char ** err_msg_pp) {
+  int ret_val = 0;
+  lurch_store_dl_change * change_p = data_p;
+  sqlite3_stmt * save_stmt_p = (void *) 0;
+  sqlite3_stmt * delete_stmt_p = (void *) 0;
+
+  if (sqlite3_exec(db_p, "BEGIN IMMEDIATE;", (void *) 0, (void *) 0, (void *) 0) != SQLITE_OK) {
+    *err_msg_pp = g_strdup_printf("failed to begin transaction: %s", sqlite3_errmsg(db_p));
+    return OMEMO_ERR_STORAGE;
+  }
+
+  if (sqlite3_prepare_v2(db_p, stmt_infos[LURCH_STMT_DL_SAVE].sql, -1, &save_stmt_p, (void *) 0) != SQLITE_OK
+      || sqlite3_prepare_v2(db_p, stmt_infos[LURCH_STMT_DL_DELETE].sql, -1, &delete_stmt_p, (void *) 0) != SQLITE_OK) {
+    ret_val = OMEMO_ERR_STORAGE;
+    goto cleanup;
+  }
+
+  ret_val = lurch_store_dl_change_exec(save_stmt_p, change_p->user, change_p->add_p, TRUE);
+  if (ret_val) {
+    goto cleanup;
+  }
+
+  ret_val = lurch_store_dl_change_exec(delete_stmt_p, change_p->user, change_p->del_p, FALSE);
+  if (ret_val) {
+    goto cleanup;
+  }
+
+  if (sqlite3_exec(db_p, "COMMIT;", (void *) 0, (void *) 0, (void *) 0) != SQLITE_OK) {
+    ret_val = OMEMO_ERR_STORAGE;
+  }
+
+cleanup:
+  if (ret_val) {
+    *err_msg_pp = g_strdup_printf("failed to write the devicelist changes of %s: %s", change_p->user, sqlite3_errmsg(db_p));
+    (void) sqlite3_exec(db_p, "ROLLBACK;", (void *) 0, (void *) 0, (void *) 0);
+  }
+  sqlite3_finalize(save_stmt_p);
+  sqlite3_finalize(delete_stmt_p);
+
+  return ret_val;
+}
+
+static void lurch_store_dl_change_done(const char * uname, int ret_val, void * data_p) {
+  lurch_store_dl_change * change_p = data_p;
+  lurch_store * store_p = store_map ? g_hash_table_lookup(store_map, uname) : (void *) 0;
+
+  // the cache was changed on submission, so it has to be read from the db again
+  if (ret_val && store_p) {
+    lurch_store_dl_cache_remove(store_p, change_p->user);
+  }
+
+  lurch_store_dl_change_free(change_p);
+}
+
+static GArray * lurch_store_id_list_to_array(const GList * id_l_p) {
+  GArray * ids_p = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+  const GList * curr_p = (void *) 0;
+  uint32_t device_id = 0;
+
+  for (curr_p = id_l_p; curr_p; curr_p = curr_p->next) {
+    device_id = omemo_devicelist_list_data((GList *) curr_p);
+    (void) g_array_append_val(ids_p, device_id);
+  }
+
+  return ids_p;
+}
+
+static void lurch_store_dl_change_submit(lurch_store * store_p, lurch_store_dl_change * change_p) {
+  guint i = 0;
+
+  for (i = 0; i < change_p->add_p->len; i++) {
+    lurch_store_dl_cache_add_id(store_p, change_p->user, g_array_index(change_p->add_p, uint32_t, i));
+  }
+  for (i = 0; i < change_p->del_p->len; i++) {
+    lurch_store_dl_cache_remove_id(store_p, change_p->user, g_array_index(change_p->del_p, uint32_t, i));
+  }
+
+  lurch_store_submit(store_p, LURCH_STORE_DB_OMEMO, lurch_store_dl_change_work, lurch_store_dl_change_done, change_p);
+}
+
+void lurch_store_devicelist_apply_async(lurch_store * store_p, const char * user, const GList * add_l_p, const GList * del_l_p) {
+  lurch_store_dl_change * change_p = (void *) 0;
+
+  if (!add_l_p && !del_l_p) {
+    return;
+  }
+
+  change_p = g_malloc0(sizeof(lurch_store_dl_change));
+  change_p->user = g_strdup(user);
+  change_p->add_p = lurch_store_id_list_to_array(add_l_p);
+  change_p->del_p = lurch_store_id_list_to_array(del_l_p);
+
+  lurch_store_dl_change_submit(store_p, change_p);
+}
+
+void lurch_store_device_id_save_async(lurch_store * store_p, const char * user, uint32_t device_id) {
+  lurch_store_dl_change * change_p = g_malloc0(sizeof(lurch_store_dl_change));
+
+  change_p->user = g_strdup(user);
+  change_p->add_p = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+  change_p->del_p = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+  (void) g_array_append_val(change_p->add_p, device_id);
+
+  lurch_store_dl_change_submit(store_p, change_p);
+}
+
+// a serialized signed pre key, written by the worker
+typedef struct {
+  uint32_t id;
+  signal_buffer * record_p;
+} lurch_store_spk_save;
+
+static int lurch_store_spk_save_work(sqlite3 * db_p, void * data_p, char ** err_msg_pp) {
+  lurch_store_spk_save * save_p = data_p;
+  sqlite3_stmt * pstmt_p = (void *) 0;
+  int ret_val = 0;
+
+  if (sqlite3_prepare_v2(db_p, stmt_infos[LURCH_STMT_SPK_STORE].sql, -1, &pstmt_p, (void *) 0) != SQLITE_OK) {
+    *err_msg_pp = g_strdup_printf("failed to prepare statement: %s", sqlite3_errmsg(db_p));
+    return OMEMO_ERR_STORAGE;
+  }
+
+  (void) sqlite3_bind_int(pstmt_p, 1, save_p->id);
+  (void) sqlite3_bind_blob(pstmt_p, 2, signal_buffer_data(save_p->record_p), signal_buffer_len(save_p->record_p), SQLITE_STATIC);
+  (void) sqlite3_bind_int(pstmt_p, 3, signal_buffer_len(save_p->record_p));
+
+  if (sqlite3_step(pstmt_p) != SQLITE_DONE) {
+    *err_msg_pp = g_strdup_printf("failed to save signed pre key %u: %s", save_p->id, sqlite3_errmsg(db_p));
+    ret_val = OMEMO_ERR_STORAGE;
+  }
+
+  sqlite3_finalize(pstmt_p);
+  return ret_val;
+}
+
+static void lurch_store_spk_save_done(const char * uname, int ret_val, void * data_p) {
+  lurch_store_spk_save * save_p = data_p;
+
+  if (!ret_val) {
+    purple_debug_info("lurch", "%s: saved signed pre key %u of %s\n", __func__, save_p->id, uname);
+  }
+
+  signal_buffer_bzero_free(save_p->record_p);
+  g_free(save_p);
+}
+
+void lurch_store_signed_pre_key_save_async(lurch_store * store_p, uint32_t signed_pre_key_id, signal_buffer * record_p) {
+  lurch_store_spk_save * save_p = g_malloc0(sizeof(lurch_store_spk_save));
+
+  save_p->id = signed_pre_key_id;
+  save_p->record_p = record_p;
+
+  lurch_store_submit(store_p, LURCH_STORE_DB_AXC, lurch_store_spk_save_work, lurch_store_spk_save_done, save_p);
+}
+
+int lurch_store_device_id_exists(lurch_store * store_p, const char * user, uint32_t device_id) {
+  int ret_val = 0;
+  lurch_store_dl_entry * entry_p = (void *) 0;
+  sqlite3_stmt * pstmt_p = (void *) 0;
+
+  entry_p = lurch_store_dl_cache_lookup(store_p, user);
+  if (entry_p) {
+    return lurch_store_dl_entry_contains(entry_p, device_id) ? 1 : 0;
+  }
+
+  pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_DL_EXISTS);
+  if (!pstmt_p) {
+    return OMEMO_ERR_STORAGE;
+  }
+
+  (void) sqlite3_bind_text(pstmt_p, 1, user, -1, SQLITE_STATIC);
+  (void) sqlite3_bind_int(pstmt_p, 2, device_id);
+  ret_val = lurch_store_stmt_has_row(store_p, LURCH_STMT_DL_EXISTS, pstmt_p, __func__);
+  return (ret_val < 0) ? OMEMO_ERR_STORAGE : ret_val;
+}
+
+int lurch_store_global_device_id_exists(lurch_store * store_p, uint32_t device_id) {
+  int ret_val = 0;
+  sqlite3_stmt * pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_DL_GLOBAL_EXISTS);
+  if (!pstmt_p) {
+    return OMEMO_ERR_STORAGE;
+  }
+
+  (void) sqlite3_bind_int(pstmt_p, 1, device_id);
+  ret_val = lurch_store_stmt_has_row(store_p, LURCH_STMT_DL_GLOBAL_EXISTS, pstmt_p, __func__);
+  return (ret_val < 0) ? OMEMO_ERR_STORAGE : ret_val;
+}
+
+/**
+ * Creates a devicelist from a list of ids.
+ */
+static int lurch_store_dl_create(const char * user, const GArray * ids_p, omemo_devicelist ** dl_pp) {
+  int ret_val = 0;
+  guint i = 0;
+  omemo_devicelist * dl_p = (void *) 0;
+
+  ret_val = omemo_devicelist_create(user, &dl_p);
+  if (ret_val) {
+    return ret_val;
+  }
+
+  for (i = 0; i < ids_p->len; i++) {
+    ret_val = omemo_devicelist_add(dl_p, g_array_index(ids_p, uint32_t, i));
+    if (ret_val) {
+      omemo_devicelist_destroy(dl_p);
+      return ret_val;
+    }
+  }
+
+  *dl_pp = dl_p;
+  return 0;
+}
+
+/**
+ * Reads a user's device ids from the db, without looking at the cache.
+ *
+ * @param ids_pp Will point to the ids on success, g_array_free() them when done.
+ * @return 0 on success, OMEMO_ERR_STORAGE on error.
+ */
+static int lurch_store_dl_read(lurch_store * store_p, const char * user, GArray ** ids_pp) {
+  int step_result = 0;
+  uint32_t device_id = 0;
+  GArray * ids_p = (void *) 0;
+  sqlite3_stmt * pstmt_p = (void *) 0;
+
+  pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_DL_RETRIEVE);
+  if (!pstmt_p) {
+    return OMEMO_ERR_STORAGE;
+  }
+
+  ids_p = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+
+  (void) sqlite3_bind_text(pstmt_p, 1, user, -1, SQLITE_STATIC);
+  while ((step_result = sqlite3_step(pstmt_p)) == SQLITE_ROW) {
+    device_id = sqlite3_column_int(pstmt_p, 0);
+    (void) g_array_append_val(ids_p, device_id);
+  }
+  lurch_store_stmt_done(pstmt_p);
+
+  if (step_result != SQLITE_DONE) {
+    lurch_store_log_db_err(store_p, LURCH_STORE_DB_OMEMO, __func__, "failed to retrieve devicelist");
+    g_array_free(ids_p, TRUE);
+    return OMEMO_ERR_STORAGE;
+  }
+
+  *ids_pp = ids_p;
+  return 0;
+}
+
+int lurch_store_devicelist_retrieve(lurch_store * store_p, const char * user, omemo_devicelist ** dl_pp) {
+  int ret_val = 0;
+  lurch_store_dl_entry * entry_p = (void *) 0;
+  GArray * ids_p = (void *) 0;
+
+  entry_p = lurch_store_dl_cache_lookup(store_p, user);
+  if (entry_p) {
+    return lurch_store_dl_create(user, entry_p->ids_p, dl_pp);
+  }
+
+  ret_val = lurch_store_dl_read(store_p, user, &ids_p);
+  if (ret_val) {
+    return ret_val;
+  }
+
+  ret_val = lurch_store_dl_create(user, ids_p, dl_pp);
+  if (ret_val) {
+    g_array_free(ids_p, TRUE);
+    return ret_val;
+  }
+
+  lurch_store_dl_cache_insert(store_p, user, ids_p);
+  return 0;
+}
+
+int lurch_store_devicelist_cache_peek(lurch_store * store_p, const char * user, omemo_devicelist ** dl_pp) {
+  lurch_store_dl_entry * entry_p = lurch_store_dl_cache_lookup(store_p, user);
+
+  *dl_pp = (void *) 0;
+  if (!entry_p) {
+    return 0;
+  }
+
+  return lurch_store_dl_create(user, entry_p->ids_p, dl_pp);
+}
+
+int lurch_store_devicelist_load(lurch_store * store_p, const char * user, omemo_devicelist ** dl_pp) {
+  int ret_val = 0;
+  GArray * ids_p = (void *) 0;
+
+  ret_val = lurch_store_dl_read(store_p, user, &ids_p);
+  if (ret_val) {
+    return ret_val;
+  }
+
+  ret_val = lurch_store_dl_create(user, ids_p, dl_pp);
+  g_array_free(ids_p, TRUE);
+  return ret_val;
+}
+
+void lurch_store_devicelist_cache_update(lurch_store * store_p, const omemo_devicelist * dl_p) {
+  GArray * ids_p = (void *) 0;
+  GList * id_list_p = (void *) 0;
+  GList * curr_p = (void *) 0;
+  uint32_t device_id = 0;
+
+  id_list_p = omemo_devicelist_get_id_list(dl_p);
+  ids_p = g_array_sized_new(FALSE, FALSE, sizeof(uint32_t), g_list_length(id_list_p));
+  for (curr_p = id_list_p; curr_p; curr_p = curr_p->next) {
+    device_id = omemo_devicelist_list_data(curr_p);
+    (void) g_array_append_val(ids_p, device_id);
+  }
+  g_list_free_full(id_list_p, free);
+
+  lurch_store_dl_cache_insert(store_p, omemo_devicelist_get_owner(dl_p), ids_p);
+}
+
+void lurch_store_devicelist_cache_invalidate(lurch_store * store_p, const char * user) {
+  lurch_store_dl_cache_remove(store_p, user);
+}
+
+void lurch_store_devicelist_cache_stats(const lurch_store * store_p, unsigned int * hits_p, unsigned int * misses_p) {
+  *hits_p = store_p->dl_cache_hits;
+  *misses_p = store_p->dl_cache_misses;
+}
+
+lurch_store * lurch_store_from_axc_ctx(axc_context * axc_ctx_p) {
+  lurch_store * store_p = (void *) 0;
+
+  g_mutex_lock(&axc_ctx_store_lock);
+  if (axc_ctx_store_map) {
+    store_p = g_hash_table_lookup(axc_ctx_store_map, axc_ctx_p);
+  }
+  g_mutex_unlock(&axc_ctx_store_lock);
+
+  return store_p;
+}
+
+/**
+ * Database side of the session and pre key stores.
+ * The return values are the ones libsignal expects from the store functions.
+ */
+
+static int lurch_store_sess_db_load(lurch_store * store_p, const char * name, size_t name_len, int32_t device_id, signal_buffer ** record) {
+  int ret_val = 0;
+  sqlite3_stmt * pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_SESS_LOAD);
+
+  if (!pstmt_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  (void) sqlite3_bind_text(pstmt_p, 1, name, name_len, SQLITE_STATIC);
+  (void) sqlite3_bind_int(pstmt_p, 2, device_id);
+
+  switch (sqlite3_step(pstmt_p)) {
+    case SQLITE_ROW:
+      if (record) {
+        *record = signal_buffer_create(sqlite3_column_blob(pstmt_p, 0), sqlite3_column_int(pstmt_p, 1));
+        ret_val = *record ? 1 : SG_ERR_NOMEM;
+      } else {
+        ret_val = 1;
+      }
+      break;
+    case SQLITE_DONE:
+      ret_val = 0;
+      break;
+    default:
+      lurch_store_log_db_err(store_p, LURCH_STORE_DB_AXC, __func__, "failed to load session");
+      ret_val = SG_ERR_UNKNOWN;
+  }
+
+  lurch_store_stmt_done(pstmt_p);
+  return ret_val;
+}
+
+static int lurch_store_sess_db_list(lurch_store * store_p, const char * name, size_t name_len, GArray * ids_p) {
+  int step_result = 0;
+  int32_t device_id = 0;
+  sqlite3_stmt * pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_SESS_SUB_DEVICES);
+
+  if (!pstmt_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  (void) sqlite3_bind_text(pstmt_p, 1, name, name_len, SQLITE_STATIC);
+  while ((step_result = sqlite3_step(pstmt_p)) == SQLITE_ROW) {
+    device_id = sqlite3_column_int(pstmt_p, 0);
+    (void) g_array_append_val(ids_p, device_id);
+  }
+  lurch_store_stmt_done(pstmt_p);
+
+  if (step_result != SQLITE_DONE) {
+    lurch_store_log_db_err(store_p, LURCH_STORE_DB_AXC, __func__, "failed to list sessions");
+    return SG_ERR_UNKNOWN;
+  }
+
+  return 0;
+}
+
+static int lurch_store_sess_db_store(lurch_store * store_p, const char * name, size_t name_len, int32_t device_id,
+                                     const uint8_t * record, size_t record_len) {
+  sqlite3_stmt * pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_SESS_STORE);
+
+  if (!pstmt_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  (void) sqlite3_bind_text(pstmt_p, 1, name, name_len, SQLITE_STATIC);
+  (void) sqlite3_bind_int(pstmt_p, 2, name_len);
+  (void) sqlite3_bind_int(pstmt_p, 3, device_id);
+  (void) sqlite3_bind_blob(pstmt_p, 4, record, record_len, SQLITE_STATIC);
+  (void) sqlite3_bind_int(pstmt_p, 5, record_len);
+
+  return lurch_store_stmt_exec(store_p, LURCH_STMT_SESS_STORE, pstmt_p, __func__) ? SG_ERR_UNKNOWN : 0;
+}
+
+static int lurch_store_sess_db_delete(lurch_store * store_p, const char * name, size_t name_len, int32_t device_id) {
+  sqlite3_stmt * pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_SESS_DELETE);
+
+  if (!pstmt_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  (void) sqlite3_bind_text(pstmt_p, 1, name, name_len, SQLITE_STATIC);
+  (void) sqlite3_bind_int(pstmt_p, 2, device_id);
+
+  if (lurch_store_stmt_exec(store_p, LURCH_STMT_SESS_DELETE, pstmt_p, __func__)) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  return sqlite3_changes(store_p->db_p[LURCH_STORE_DB_AXC]) ? 1 : 0;
+}
+
+static int lurch_store_sess_db_delete_all(lurch_store * store_p, const char * name, size_t name_len) {
+  sqlite3_stmt * pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_SESS_DELETE_ALL);
+
+  if (!pstmt_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  (void) sqlite3_bind_text(pstmt_p, 1, name, name_len, SQLITE_STATIC);
+
+  if (lurch_store_stmt_exec(store_p, LURCH_STMT_SESS_DELETE_ALL, pstmt_p, __func__)) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  return sqlite3_changes(store_p->db_p[LURCH_STORE_DB_AXC]);
+}
+
+static int lurch_store_pk_db_remove(lurch_store * store_p, uint32_t pre_key_id) {
+  sqlite3_stmt * pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_PK_REMOVE);
+
+  if (!pstmt_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  (void) sqlite3_bind_int(pstmt_p, 1, pre_key_id);
+
+  return lurch_store_stmt_exec(store_p, LURCH_STMT_PK_REMOVE, pstmt_p, __func__) ? SG_ERR_UNKNOWN : 0;
+}
+
+static const lurch_store_sess_backend sess_db_backend = {
+  .load = lurch_store_sess_db_load,
+  .list = lurch_store_sess_db_list,
+  .store = lurch_store_sess_db_store,
+  .delete = lurch_store_sess_db_delete,
+  .delete_all = lurch_store_sess_db_delete_all,
+  .begin = (void *) 0,
+  .commit = (void *) 0,
+  .rollback = (void *) 0
+};
+
+/**
+ * Key-value file side of the session store.
+ * Every call waits like the statements do, as the file is shared with a thread holding the lease.
+ */
+
+static char * lurch_store_kv_sess_key(const char * name, size_t name_len, int32_t device_id) {
+  return g_strdup_printf(LURCH_STORE_KV_SESS_PREFIX "%.*s\n%i", (int) name_len, name, device_id);
+}
+
+static char * lurch_store_kv_sess_prefix(const char * name, size_t name_len) {
+  return g_strdup_printf(LURCH_STORE_KV_SESS_PREFIX "%.*s\n", (int) name_len, name);
+}
+
+static int lurch_store_sess_kv_load(lurch_store * store_p, const char * name, size_t name_len, int32_t device_id, signal_buffer ** record) {
+  int ret_val = 0;
+  char * key = lurch_store_kv_sess_key(name, name_len, device_id);
+  const uint8_t * val_p = (void *) 0;
+  size_t val_len = 0;
+
+  lurch_store_wait(store_p, LURCH_STORE_DB_AXC);
+
+  ret_val = lurch_kv_get(store_p->kv_p, key, &val_p, &val_len);
+  g_free(key);
+
+  if (ret_val == 1 && record) {
+    // libsignal takes over the buffer, so this is the only copy on the way
+    *record = signal_buffer_create(val_p, val_len);
+    ret_val = *record ? 1 : SG_ERR_NOMEM;
+  }
+
+  return ret_val;
+}
+
+typedef struct {
+  size_t prefix_len;
+  GArray * ids_p;
+} lurch_store_kv_list_data;
+
+static void lurch_store_kv_list_one(const char * key, const uint8_t * val_p, size_t val_len, void * user_data) {
+  lurch_store_kv_list_data * data_p = user_data;
+  int32_t device_id = g_ascii_strtoll(key + data_p->prefix_len, (void *) 0, 10);
+  (void) val_p;
+  (void) val_len;
+
+  (void) g_array_append_val(data_p->ids_p, device_id);
+}
+
+static int lurch_store_sess_kv_list(lurch_store * store_p, const char * name, size_t name_len, GArray * ids_p) {
+  char * prefix = lurch_store_kv_sess_prefix(name, name_len);
+  lurch_store_kv_list_data data = { .prefix_len = strlen(prefix), .ids_p = ids_p };
+
+  lurch_store_wait(store_p, LURCH_STORE_DB_AXC);
+
+  (void) lurch_kv_foreach_prefix(store_p->kv_p, prefix, lurch_store_kv_list_one, &data);
+  g_free(prefix);
+
+  return 0;
+}
+
+static int lurch_store_sess_kv_store(lurch_store * store_p, const char * name, size_t name_len, int32_t device_id,
+                                     const uint8_t * record, size_t record_len) {
+  int ret_val = 0;
+  char * key = lurch_store_kv_sess_key(name, name_len, device_id);
+
+  lurch_store_wait(store_p, LURCH_STORE_DB_AXC);
+
+  ret_val = lurch_kv_put(store_p->kv_p, key, record, record_len);
+  g_free(key);
+
+  return ret_val ? SG_ERR_UNKNOWN : 0;
+}
+
+static int lurch_store_sess_kv_delete(lurch_store * store_p, const char * name, size_t name_len, int32_t device_id) {
+  int ret_val = 0;
+  char * key = lurch_store_kv_sess_key(name, name_len, device_id);
+
+  lurch_store_wait(store_p, LURCH_STORE_DB_AXC);
+
+  ret_val = lurch_kv_delete(store_p->kv_p, key);
+  g_free(key);
+
+  return (ret_val < 0) ? SG_ERR_UNKNOWN : ret_val;
+}
+
+static void lurch_store_kv_collect_key(const char * key, const uint8_t * val_p, size_t val_len, void * user_data) {
+  (void) val_p;
+  (void) val_len;
+  g_ptr_array_add(user_data, g_strdup(key));
+}
+
+static int lurch_store_sess_kv_delete_all(lurch_store * store_p, const char * name, size_t name_len) {
+  int ret_val = 0;
+  char * prefix = lurch_store_kv_sess_prefix(name, name_len);
+  GPtrArray * keys_p = g_ptr_array_new_with_free_func(g_free);
+  guint i = 0;
+
+  lurch_store_wait(store_p, LURCH_STORE_DB_AXC);
+
+  // the file must not change while it is walked
+  (void) lurch_kv_foreach_prefix(store_p->kv_p, prefix, lurch_store_kv_collect_key, keys_p);
+
+  lurch_kv_begin(store_p->kv_p);
+  for (i = 0; i < keys_p->len && ret_val >= 0; i++) {
+    ret_val = lurch_kv_delete(store_p->kv_p, g_ptr_array_index(keys_p, i));
+  }
+  if (ret_val < 0) {
+    lurch_kv_rollback(store_p->kv_p);
+  } else {
+    ret_val = lurch_kv_commit(store_p->kv_p);
+  }
+
+  if (!ret_val) {
+    ret_val = keys_p->len;
+  }
+
+  g_ptr_array_free(keys_p, TRUE);
+  g_free(prefix);
+
+  return (ret_val < 0) ? SG_ERR_UNKNOWN : ret_val;
+}
+
+static void lurch_store_sess_kv_begin(lurch_store * store_p) {
+  lurch_store_wait(store_p, LURCH_STORE_DB_AXC);
+  lurch_kv_begin(store_p->kv_p);
+}
+
+static int lurch_store_sess_kv_commit(lurch_store * store_p) {
+  return lurch_kv_commit(store_p->kv_p) ? SG_ERR_UNKNOWN : 0;
+}
+
+static void lurch_store_sess_kv_rollback(lurch_store * store_p) {
+  lurch_kv_rollback(store_p->kv_p);
+}
+
+static const lurch_store_sess_backend sess_kv_backend = {
+  .load = lurch_store_sess_kv_load,
+  .list = lurch_store_sess_kv_list,
+  .store = lurch_store_sess_kv_store,
+  .delete = lurch_store_sess_kv_delete,
+  .delete_all = lurch_store_sess_kv_delete_all,
+  .begin = lurch_store_sess_kv_begin,
+  .commit = lurch_store_sess_kv_commit,
+  .rollback = lurch_store_sess_kv_rollback
+};
+
+/**
+ * Copies the sessions in the axc db to the empty key-value file and deletes them from the db,
+ * so that they are not imported again if the file is emptied later on.
+ */
+static int lurch_store_kv_import(lurch_store * store_p) {
+  int ret_val = 0;
+  int step_result = 0;
+  sqlite3 * db_p = store_p->db_p[LURCH_STORE_DB_AXC];
+  sqlite3_stmt * pstmt_p = (void *) 0;
+  char * key = (void *) 0;
+  int count = 0;
+
+  if (sqlite3_prepare_v2(db_p, "SELECT name, device_id, session_record FROM session_store;", -1, &pstmt_p, (void *) 0) != SQLITE_OK) {
+    // axc creates the table when it is installed, so there is nothing to import yet
+    return 0;
+  }
+
+  lurch_kv_begin(store_p->kv_p);
+  while ((step_result = sqlite3_step(pstmt_p)) == SQLITE_ROW) {
+    key = lurch_store_kv_sess_key((const char *) sqlite3_column_text(pstmt_p, 0), sqlite3_column_bytes(pstmt_p, 0),
+                                  sqlite3_column_int(pstmt_p, 1));
+    ret_val = lurch_kv_put(store_p->kv_p, key, sqlite3_column_blob(pstmt_p, 2), sqlite3_column_bytes(pstmt_p, 2));
+    g_free(key);
+    if (ret_val) {
+      break;
+    }
+    count++;
+  }
+  (void) sqlite3_finalize(pstmt_p);
+
+  if (ret_val || step_result != SQLITE_DONE) {
+    lurch_store_log_db_err(store_p, LURCH_STORE_DB_AXC, __func__, "failed to import the sessions");
+    lurch_kv_rollback(store_p->kv_p);
+    return OMEMO_ERR_STORAGE;
+  }
+
+  ret_val = lurch_kv_commit(store_p->kv_p);
+  if (ret_val || count == 0) {
+    return ret_val;
+  }
+
+  purple_debug_info("lurch", "%s: moved %i sessions of %s out of %s\n", __func__, count, store_p->uname, store_p->db_fn[LURCH_STORE_DB_AXC]);
+  return lurch_store_db_exec(store_p, LURCH_STORE_DB_AXC, "DELETE FROM session_store;", __func__);
+}
+
+typedef struct {
+  lurch_store * store_p;
+  int ret_val;
+  int count;
+} lurch_store_kv_export_data;
+
+static void lurch_store_kv_export_one(const char * key, const uint8_t * val_p, size_t val_len, void * user_data) {
+  lurch_store_kv_export_data * data_p = user_data;
+  const char * name = key + strlen(LURCH_STORE_KV_SESS_PREFIX);
+  const char * sep = strchr(name, '\n');
+
+  if (data_p->ret_val || !sep) {
+    return;
+  }
+
+  data_p->ret_val = lurch_store_sess_db_store(data_p->store_p, name, sep - name, g_ascii_strtoll(sep + 1, (void *) 0, 10), val_p, val_len);
+  data_p->count++;
+}
+
+/**
+ * Copies the sessions in the key-value file back to the axc db, replacing the ones there.
+ * The file is deleted afterwards.
+ */
+static int lurch_store_kv_export(lurch_store * store_p, const char * kv_fn) {
+  int ret_val = 0;
+  char * err_msg_dbg = (void *) 0;
+
+  lurch_kv * kv_p = (void *) 0;
+  lurch_store_kv_export_data data = { .store_p = store_p, .ret_val = 0, .count = 0 };
+
+  ret_val = lurch_kv_open(kv_fn, FALSE, &kv_p);
+  if (ret_val) {
+    err_msg_dbg = g_strdup_printf("failed to open %s", kv_fn);
+    goto cleanup;
+  }
+
+  ret_val = lurch_store_db_exec(store_p, LURCH_STORE_DB_AXC, "BEGIN IMMEDIATE;", __func__);
+  if (ret_val) {
+    err_msg_dbg = g_strdup("failed to start the transaction");
+    goto cleanup;
+  }
+
+  ret_val = lurch_store_db_exec(store_p, LURCH_STORE_DB_AXC, "DELETE FROM session_store;", __func__);
+  if (!ret_val) {
+    (void) lurch_kv_foreach_prefix(kv_p, LURCH_STORE_KV_SESS_PREFIX, lurch_store_kv_export_one, &data);
+    ret_val = data.ret_val;
+  }
+  if (!ret_val) {
+    ret_val = lurch_store_db_exec(store_p, LURCH_STORE_DB_AXC, "COMMIT;", __func__);
+  }
+  if (ret_val) {
+    (void) lurch_store_db_exec(store_p, LURCH_STORE_DB_AXC, "ROLLBACK;", __func__);
+    err_msg_dbg = g_strdup_printf("failed to copy the sessions from %s to %s", kv_fn, store_p->db_fn[LURCH_STORE_DB_AXC]);
+    goto cleanup;
+  }
+
+  purple_debug_info("lurch", "%s: moved %i sessions of %s back to %s\n", __func__, data.count, store_p->uname, store_p->db_fn[LURCH_STORE_DB_AXC]);
+
+  lurch_kv_close(kv_p);
+  kv_p = (void *) 0;
+  (void) g_unlink(kv_fn);
+
+cleanup:
+  lurch_kv_close(kv_p);
+  if (err_msg_dbg) {
+    purple_debug_error("lurch", "%s: %s (%i)\n", __func__, err_msg_dbg, ret_val);
+    g_free(err_msg_dbg);
+  }
+
+  return ret_val;
+}
+
+/**
+ * Sets up the session backend chosen in the prefs, moving the sessions over if it was changed.
+ */
+static int lurch_store_sess_backend_open(lurch_store * store_p) {
+  int ret_val = 0;
+  char * kv_fn = g_strconcat(purple_user_dir(), "/", store_p->uname, "_", LURCH_KV_NAME_SESSIONS, LURCH_KV_SUFFIX, NULL);
+  gboolean sync = g_strcmp0(purple_prefs_get_string(LURCH_PREF_STORE_AXC_SYNC), LURCH_STORE_SYNC_NORMAL);
+
+  if (g_strcmp0(purple_prefs_get_string(LURCH_PREF_STORE_SESS_BACKEND), LURCH_STORE_BACKEND_MMAP)) {
+    store_p->sess_backend_p = &sess_db_backend;
+    if (g_file_test(kv_fn, G_FILE_TEST_EXISTS)) {
+      ret_val = lurch_store_kv_export(store_p, kv_fn);
+    }
+    goto cleanup;
+  }
+
+  ret_val = lurch_kv_open(kv_fn, sync, &store_p->kv_p);
+  if (ret_val) {
+    goto cleanup;
+  }
+  store_p->sess_backend_p = &sess_kv_backend;
+
+  if (lurch_kv_count(store_p->kv_p) == 0) {
+    ret_val = lurch_store_kv_import(store_p);
+  }
+
+cleanup:
+  g_free(kv_fn);
+  return ret_val;
+}
+
+/**
+ * Pending changes of the current message, see lurch_store_msg_begin().
+ */
+
+static char * lurch_store_pending_key(const char * name, size_t name_len, int32_t device_id) {
+  return g_strdup_printf("%i:%.*s", device_id, (int) name_len, name);
+}
+
+static lurch_store_pending_sess * lurch_store_pending_sess_lookup(lurch_store * store_p, const char * name, size_t name_len, int32_t device_id) {
+  lurch_store_pending_sess * pending_p = (void *) 0;
+  char * key = lurch_store_pending_key(name, name_len, device_id);
+
+  pending_p = g_hash_table_lookup(store_p->msg_sess_p, key);
+  g_free(key);
+
+  return pending_p;
+}
+
+static gboolean lurch_store_pending_sess_has_name(const lurch_store_pending_sess * pending_p, const char * name, size_t name_len) {
+  return pending_p->name_len == name_len && !memcmp(pending_p->name, name, name_len);
+}
+
+/**
+ * @return TRUE if the current message is part of a batch, so that its changes have to be undoable on their own.
+ */
+static gboolean lurch_store_msg_in_batch(const lurch_store * store_p) {
+  return store_p->msg_batch_depth > 0 && store_p->msg_depth > store_p->msg_batch_depth;
+}
+
+/**
+ * Remembers the pending change of a session as it was before the current message,
+ * if the message is part of a batch and has not touched the session yet.
+ */
+static void lurch_store_undo_note_sess(lurch_store * store_p, const char * key) {
+  const lurch_store_pending_sess * pending_p = (void *) 0;
+  lurch_store_pending_sess * copy_p = (void *) 0;
+
+  if (!lurch_store_msg_in_batch(store_p) || g_hash_table_contains(store_p->msg_undo_sess_p, key)) {
+    return;
+  }
+
+  pending_p = g_hash_table_lookup(store_p->msg_sess_p, key);
+  if (pending_p) {
+    copy_p = g_malloc0(sizeof(lurch_store_pending_sess));
+    copy_p->name = g_strndup(pending_p->name, pending_p->name_len);
+    copy_p->name_len = pending_p->name_len;
+    copy_p->device_id = pending_p->device_id;
+    copy_p->record_p = pending_p->record_p ? signal_buffer_copy(pending_p->record_p) : (void *) 0;
+  }
+
+  (void) g_hash_table_insert(store_p->msg_undo_sess_p, g_strdup(key), copy_p);
+}
+
+static void lurch_store_undo_clear(lurch_store * store_p) {
+  g_hash_table_remove_all(store_p->msg_undo_sess_p);
+  g_hash_table_remove_all(store_p->msg_undo_wiped_p);
+  g_array_set_size(store_p->msg_undo_pk_p, 0);
+}
+
+/**
+ * Takes back the changes of the current message of a batch, leaving those of the messages before it.
+ */
+static void lurch_store_undo_apply(lurch_store * store_p) {
+  GHashTableIter iter;
+  gpointer key = (void *) 0;
+  gpointer value = (void *) 0;
+
+  g_hash_table_iter_init(&iter, store_p->msg_undo_sess_p);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    g_hash_table_iter_steal(&iter);
+    if (value) {
+      (void) g_hash_table_replace(store_p->msg_sess_p, key, value);
+    } else {
+      (void) g_hash_table_remove(store_p->msg_sess_p, key);
+      g_free(key);
+    }
+  }
+
+  g_hash_table_iter_init(&iter, store_p->msg_undo_wiped_p);
+  while (g_hash_table_iter_next(&iter, &key, (void *) 0)) {
+    (void) g_hash_table_remove(store_p->msg_wiped_p, key);
+  }
+
+  g_array_set_size(store_p->msg_pk_removed_p, 0);
+  (void) g_array_append_vals(store_p->msg_pk_removed_p, store_p->msg_undo_pk_p->data, store_p->msg_undo_pk_p->len);
+
+  lurch_store_undo_clear(store_p);
+}
+
+/**
+ * Replaces the pending change of a session.
+ *
+ * @param record_p The new record, or NULL if the session is deleted. Taken over by the store.
+ */
+static void lurch_store_pending_sess_set(lurch_store * store_p, const char * name, size_t name_len, int32_t device_id, signal_buffer * record_p) {
+  lurch_store_pending_sess * pending_p = g_malloc0(sizeof(lurch_store_pending_sess));
+  char * key = lurch_store_pending_key(name, name_len, device_id);
+
+  pending_p->name = g_strndup(name, name_len);
+  pending_p->name_len = name_len;
+  pending_p->device_id = device_id;
+  pending_p->record_p = record_p;
+
+  lurch_store_undo_note_sess(store_p, key);
+  (void) g_hash_table_replace(store_p->msg_sess_p, key, pending_p);
+}
+
+static gboolean lurch_store_msg_is_wiped(lurch_store * store_p, const char * name, size_t name_len) {
+  gboolean ret_val = FALSE;
+  char * name_z = g_strndup(name, name_len);
+
+  ret_val = g_hash_table_contains(store_p->msg_wiped_p, name_z);
+  g_free(name_z);
+
+  return ret_val;
+}
+
+static gboolean lurch_store_msg_pk_is_removed(lurch_store * store_p, uint32_t pre_key_id) {
+  guint i = 0;
+
+  for (i = 0; i < store_p->msg_pk_removed_p->len; i++) {
+    if (g_array_index(store_p->msg_pk_removed_p, uint32_t, i) == pre_key_id) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static void lurch_store_msg_clear(lurch_store * store_p) {
+  g_hash_table_remove_all(store_p->msg_sess_p);
+  g_hash_table_remove_all(store_p->msg_wiped_p);
+  g_array_set_size(store_p->msg_pk_removed_p, 0);
+  store_p->msg_failed = FALSE;
+  store_p->msg_batch_depth = 0;
+  lurch_store_undo_clear(store_p);
+}
+
+void lurch_store_msg_begin(lurch_store * store_p) {
+  if (!store_p) {
+    return;
+  }
+  store_p->msg_depth++;
+
+  if (store_p->msg_batch_depth > 0 && store_p->msg_depth == store_p->msg_batch_depth + 1) {
+    lurch_store_undo_clear(store_p);
+    (void) g_array_append_vals(store_p->msg_undo_pk_p, store_p->msg_pk_removed_p->data, store_p->msg_pk_removed_p->len);
+  }
+}
+
+/**
+ * Writes the pending changes to the axc db and the session backend, all of them or none.
+ * If the sessions are kept apart from the db, the db is committed first, so that on
+ * a failure in between, the pre keys of the message are gone but the sessions stay
+ * as they were, like when the message itself failed.
+ *
+ * @return 0 on success, negative on error.
+ */
+static int lurch_store_msg_flush(lurch_store * store_p) {
+  int ret_val = 0;
+  const lurch_store_sess_backend * backend_p = store_p->sess_backend_p;
+  gboolean db_needed = FALSE;
+  gboolean db_open = FALSE;
+  GHashTableIter iter;
+  gpointer key = (void *) 0;
+  gpointer value = (void *) 0;
+  lurch_store_pending_sess * pending_p = (void *) 0;
+  guint i = 0;
+
+  if (g_hash_table_size(store_p->msg_sess_p) == 0
+      && g_hash_table_size(store_p->msg_wiped_p) == 0
+      && store_p->msg_pk_removed_p->len == 0) {
+    return 0;
+  }
+
+  db_needed = !backend_p->begin || store_p->msg_pk_removed_p->len > 0;
+  if (db_needed) {
+    ret_val = lurch_store_db_exec(store_p, LURCH_STORE_DB_AXC, "BEGIN IMMEDIATE;", __func__);
+    if (ret_val) {
+      return ret_val;
+    }
+    db_open = TRUE;
+  }
+  if (backend_p->begin) {
+    backend_p->begin(store_p);
+  }
+
+  // whole deletions go first, the sessions established afterwards are among the single ones
+  g_hash_table_iter_init(&iter, store_p->msg_wiped_p);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    ret_val = backend_p->delete_all(store_p, key, strlen(key));
+    if (ret_val < 0) {
+      goto cleanup;
+    }
+  }
+
+  g_hash_table_iter_init(&iter, store_p->msg_sess_p);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    pending_p = value;
+    if (pending_p->record_p) {
+      ret_val = backend_p->store(store_p, pending_p->name, pending_p->name_len, pending_p->device_id,
+                                 signal_buffer_data(pending_p->record_p), signal_buffer_len(pending_p->record_p));
+    } else {
+      ret_val = backend_p->delete(store_p, pending_p->name, pending_p->name_len, pending_p->device_id);
+    }
+    if (ret_val < 0) {
+      goto cleanup;
+    }
+  }
+
+  for (i = 0; i < store_p->msg_pk_removed_p->len; i++) {
+    ret_val = lurch_store_pk_db_remove(store_p, g_array_index(store_p->msg_pk_removed_p, uint32_t, i));
+    if (ret_val) {
+      goto cleanup;
+    }
+  }
+
+  if (db_open) {
+    ret_val = lurch_store_db_exec(store_p, LURCH_STORE_DB_AXC, "COMMIT;", __func__);
+    if (ret_val) {
+      goto cleanup;
+    }
+    db_open = FALSE;
+  }
+  if (backend_p->commit) {
+    ret_val = backend_p->commit(store_p);
+  }
+
+cleanup:
+  if (ret_val < 0) {
+    // does nothing if the backend already gave up the transaction in its failed commit
+    if (backend_p->rollback) {
+      backend_p->rollback(store_p);
+    }
+    if (db_open) {
+      (void) lurch_store_db_exec(store_p, LURCH_STORE_DB_AXC, "ROLLBACK;", __func__);
+    }
+    return ret_val;
+  }
+
+  return 0;
+}
+
+int lurch_store_msg_commit(lurch_store * store_p) {
+  int ret_val = 0;
+
+  if (!store_p || store_p->msg_depth == 0) {
+    return 0;
+  }
+
+  store_p->msg_depth--;
+  if (store_p->msg_batch_depth > 0 && store_p->msg_depth == store_p->msg_batch_depth) {
+    // the message is done, its changes stay pending until the end of the batch
+    if (store_p->msg_failed) {
+      purple_debug_error("lurch", "%s: discarding the session changes of a message of %s as an inner scope failed\n", __func__, store_p->uname);
+      lurch_store_undo_apply(store_p);
+      store_p->msg_failed = FALSE;
+      return SG_ERR_UNKNOWN;
+    }
+    lurch_store_undo_clear(store_p);
+    return 0;
+  }
+  if (store_p->msg_depth > 0) {
+    return 0;
+  }
+
+  if (store_p->msg_failed) {
+    purple_debug_error("lurch", "%s: discarding the session changes of %s as an inner scope failed\n", __func__, store_p->uname);
+    ret_val = SG_ERR_UNKNOWN;
+  } else {
+    ret_val = lurch_store_msg_flush(store_p);
+  }
+
+  lurch_store_msg_clear(store_p);
+  return ret_val;
+}
+
+void lurch_store_msg_rollback(lurch_store * store_p) {
+  if (!store_p || store_p->msg_depth == 0) {
+    return;
+  }
+
+  store_p->msg_depth--;
+  if (store_p->msg_batch_depth > 0 && store_p->msg_depth == store_p->msg_batch_depth) {
+    // only this message of the batch fails, the others are kept
+    lurch_store_undo_apply(store_p);
+    store_p->msg_failed = FALSE;
+    return;
+  }
+
+  // if nested, the outermost scope still sees the pending changes and has to discard them as well
+  store_p->msg_failed = TRUE;
+  if (store_p->msg_depth == 0) {
+    lurch_store_msg_clear(store_p);
+  }
+}
+
+int lurch_store_batch_begin(lurch_store * store_p) {
+  if (!store_p) {
+    return 0;
+  }
+  if (store_p->msg_depth > 0) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  lurch_store_msg_begin(store_p);
+  store_p->msg_batch_depth = store_p->msg_depth;
+  return 0;
+}
+
+gboolean lurch_store_batch_is_open(const lurch_store * store_p) {
+  return store_p && store_p->msg_batch_depth > 0;
+}
+
+int lurch_store_batch_commit(lurch_store * store_p) {
+  if (!lurch_store_batch_is_open(store_p) || store_p->msg_depth != store_p->msg_batch_depth) {
+    return 0;
+  }
+
+  return lurch_store_msg_commit(store_p);
+}
+
+/**
+ * Session and pre key store implementations.
+ * These are called by libsignal with the axc context as user data.
+ * While a message is processed, changes are kept back and reads see them on top of the db.
+ */
+
+static int lurch_store_sess_load(signal_buffer ** record, signal_buffer ** user_record,
+                                 const signal_protocol_address * address, void * user_data) {
+  lurch_store * store_p = lurch_store_from_axc_ctx(user_data);
+  lurch_store_pending_sess * pending_p = (void *) 0;
+  (void) user_record;
+
+  if (!store_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  if (store_p->msg_depth > 0) {
+    pending_p = lurch_store_pending_sess_lookup(store_p, address->name, address->name_len, address->device_id);
+    if (pending_p) {
+      if (!pending_p->record_p) {
+        return 0;
+      }
+      *record = signal_buffer_copy(pending_p->record_p);
+      return *record ? 1 : SG_ERR_NOMEM;
+    }
+    if (lurch_store_msg_is_wiped(store_p, address->name, address->name_len)) {
+      return 0;
+    }
+  }
+
+  return store_p->sess_backend_p->load(store_p, address->name, address->name_len, address->device_id, record);
+}
+
+static int lurch_store_sess_get_sub_device_sessions(signal_int_list ** sessions, const char * name, size_t name_len, void * user_data) {
+  int ret_val = 0;
+  int32_t device_id = 0;
+  lurch_store * store_p = lurch_store_from_axc_ctx(user_data);
+  GArray * ids_p = (void *) 0;
+  signal_int_list * session_list_p = (void *) 0;
+  GHashTableIter iter;
+  gpointer key = (void *) 0;
+  gpointer value = (void *) 0;
+  lurch_store_pending_sess * pending_p = (void *) 0;
+  guint i = 0;
+
+  if (!store_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  session_list_p = signal_int_list_alloc();
+  if (!session_list_p) {
+    return SG_ERR_NOMEM;
+  }
+  ids_p = g_array_new(FALSE, FALSE, sizeof(int32_t));
+
+  if (store_p->msg_depth == 0 || !lurch_store_msg_is_wiped(store_p, name, name_len)) {
+    ret_val = store_p->sess_backend_p->list(store_p, name, name_len, ids_p);
+    if (ret_val < 0) {
+      goto cleanup;
+    }
+    for (i = 0; i < ids_p->len; i++) {
+      device_id = g_array_index(ids_p, int32_t, i);
+      // pending sessions are added below
+      if (store_p->msg_depth > 0 && lurch_store_pending_sess_lookup(store_p, name, name_len, device_id)) {
+        continue;
+      }
+      ret_val = signal_int_list_push_back(session_list_p, device_id);
+      if (ret_val < 0) {
+        goto cleanup;
+      }
+    }
+  }
+
+  if (store_p->msg_depth > 0) {
+    g_hash_table_iter_init(&iter, store_p->msg_sess_p);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      pending_p = value;
+      if (!pending_p->record_p || !lurch_store_pending_sess_has_name(pending_p, name, name_len)) {
+        continue;
+      }
+      ret_val = signal_int_list_push_back(session_list_p, pending_p->device_id);
+      if (ret_val < 0) {
+        goto cleanup;
+      }
+    }
+  }
+
+  ret_val = signal_int_list_size(session_list_p);
+  *sessions = session_list_p;
+
+cleanup:
+  g_array_free(ids_p, TRUE);
+  if (ret_val < 0) {
+    signal_int_list_free(session_list_p);
+  }
+
+  return ret_val;
+}
+
+static int lurch_store_sess_store(const signal_protocol_address * address, uint8_t * record, size_t record_len,
+                                  uint8_t * user_record, size_t user_record_len, void * user_data) {
+  lurch_store * store_p = lurch_store_from_axc_ctx(user_data);
+  signal_buffer * record_p = (void *) 0;
+  (void) user_record;
+  (void) user_record_len;
+
+  if (!store_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  if (store_p->msg_depth > 0) {
+    record_p = signal_buffer_create(record, record_len);
+    if (!record_p) {
+      return SG_ERR_NOMEM;
+    }
+    lurch_store_pending_sess_set(store_p, address->name, address->name_len, address->device_id, record_p);
+    return 0;
+  }
+
+  return store_p->sess_backend_p->store(store_p, address->name, address->name_len, address->device_id, record, record_len);
+}
+
+static int lurch_store_sess_contains(const signal_protocol_address * address, void * user_data) {
+  lurch_store * store_p = lurch_store_from_axc_ctx(user_data);
+  lurch_store_pending_sess * pending_p = (void *) 0;
+
+  if (!store_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  if (store_p->msg_depth > 0) {
+    pending_p = lurch_store_pending_sess_lookup(store_p, address->name, address->name_len, address->device_id);
+    if (pending_p) {
+      return pending_p->record_p ? 1 : 0;
+    }
+    if (lurch_store_msg_is_wiped(store_p, address->name, address->name_len)) {
+      return 0;
+    }
+  }
+
+  return store_p->sess_backend_p->load(store_p, address->name, address->name_len, address->device_id, (void *) 0);
+}
+
+static int lurch_store_sess_delete(const signal_protocol_address * address, void * user_data) {
+  int ret_val = 0;
+  lurch_store * store_p = lurch_store_from_axc_ctx(user_data);
+
+  if (!store_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  if (store_p->msg_depth > 0) {
+    ret_val = lurch_store_sess_contains(address, user_data);
+    if (ret_val < 0) {
+      return ret_val;
+    }
+    lurch_store_pending_sess_set(store_p, address->name, address->name_len, address->device_id, (void *) 0);
+    return ret_val;
+  }
+
+  return store_p->sess_backend_p->delete(store_p, address->name, address->name_len, address->device_id);
+}
+
+static gboolean lurch_store_pending_sess_name_is(gpointer key, gpointer value, gpointer user_data) {
+  const signal_protocol_address * address = user_data;
+  (void) key;
+
+  return lurch_store_pending_sess_has_name(value, address->name, address->name_len);
+}
+
+static int lurch_store_sess_delete_all(const char * name, size_t name_len, void * user_data) {
+  int ret_val = 0;
+  lurch_store * store_p = lurch_store_from_axc_ctx(user_data);
+  signal_int_list * sessions_p = (void *) 0;
+  signal_protocol_address address = { .name = name, .name_len = name_len, .device_id = 0 };
+  GHashTableIter iter;
+  gpointer key = (void *) 0;
+  gpointer value = (void *) 0;
+
+  if (!store_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  if (store_p->msg_depth > 0) {
+    ret_val = lurch_store_sess_get_sub_device_sessions(&sessions_p, name, name_len, user_data);
+    if (ret_val < 0) {
+      return ret_val;
+    }
+    signal_int_list_free(sessions_p);
+
+    g_hash_table_iter_init(&iter, store_p->msg_sess_p);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      if (lurch_store_pending_sess_name_is(key, value, &address)) {
+        lurch_store_undo_note_sess(store_p, key);
+        g_hash_table_iter_remove(&iter);
+      }
+    }
+    if (g_hash_table_add(store_p->msg_wiped_p, g_strndup(name, name_len)) && lurch_store_msg_in_batch(store_p)) {
+      (void) g_hash_table_add(store_p->msg_undo_wiped_p, g_strndup(name, name_len));
+    }
+    return ret_val;
+  }
+
+  return store_p->sess_backend_p->delete_all(store_p, name, name_len);
+}
+
+static void lurch_store_destroy_func(void * user_data) {
+  // the store outlives the contexts using it and is closed with the account map
+  (void) user_data;
+}
+
+static int lurch_store_pk_load(signal_buffer ** record, uint32_t pre_key_id, void * user_data) {
+  int ret_val = 0;
+  lurch_store * store_p = lurch_store_from_axc_ctx(user_data);
+  sqlite3_stmt * pstmt_p = (void *) 0;
+
+  if (!store_p || !(pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_PK_LOAD))) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  if (store_p->msg_depth > 0 && lurch_store_msg_pk_is_removed(store_p, pre_key_id)) {
+    return SG_ERR_INVALID_KEY_ID;
+  }
+
+  (void) sqlite3_bind_int(pstmt_p, 1, pre_key_id);
+
+  switch (sqlite3_step(pstmt_p)) {
+    case SQLITE_ROW:
+      *record = signal_buffer_create(sqlite3_column_blob(pstmt_p, 0), sqlite3_column_int(pstmt_p, 1));
+      ret_val = *record ? SG_SUCCESS : SG_ERR_NOMEM;
+      break;
+    case SQLITE_DONE:
+      ret_val = SG_ERR_INVALID_KEY_ID;
+      break;
+    default:
+      lurch_store_log_db_err(store_p, LURCH_STORE_DB_AXC, __func__, "failed to load pre key");
+      ret_val = SG_ERR_UNKNOWN;
+  }
+
+  lurch_store_stmt_done(pstmt_p);
+  return ret_val;
+}
+
+static int lurch_store_pk_store(uint32_t pre_key_id, uint8_t * record, size_t record_len, void * user_data) {
+  lurch_store * store_p = lurch_store_from_axc_ctx(user_data);
+  sqlite3_stmt * pstmt_p = (void *) 0;
+  guint i = 0;
+
+  if (!store_p || !(pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_PK_STORE))) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  // new pre keys are written right away, they must not be removed again at the end of the message
+  for (i = 0; i < store_p->msg_pk_removed_p->len; i++) {
+    if (g_array_index(store_p->msg_pk_removed_p, uint32_t, i) == pre_key_id) {
+      (void) g_array_remove_index_fast(store_p->msg_pk_removed_p, i);
+      break;
+    }
+  }
+
+  (void) sqlite3_bind_int(pstmt_p, 1, pre_key_id);
+  (void) sqlite3_bind_blob(pstmt_p, 2, record, record_len, SQLITE_STATIC);
+  (void) sqlite3_bind_int(pstmt_p, 3, record_len);
+
+  return lurch_store_stmt_exec(store_p, LURCH_STMT_PK_STORE, pstmt_p, __func__) ? SG_ERR_UNKNOWN : 0;
+}
+
+static int lurch_store_pk_contains(uint32_t pre_key_id, void * user_data) {
+  int ret_val = 0;
+  lurch_store * store_p = lurch_store_from_axc_ctx(user_data);
+  sqlite3_stmt * pstmt_p = (void *) 0;
+
+  if (!store_p || !(pstmt_p = lurch_store_stmt(store_p, LURCH_STMT_PK_LOAD))) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  if (store_p->msg_depth > 0 && lurch_store_msg_pk_is_removed(store_p, pre_key_id)) {
+    return 0;
+  }
+
+  (void) sqlite3_bind_int(pstmt_p, 1, pre_key_id);
+
+  ret_val = lurch_store_stmt_has_row(store_p, LURCH_STMT_PK_LOAD, pstmt_p, __func__);
+  return (ret_val < 0) ? SG_ERR_UNKNOWN : ret_val;
+}
+
+static int lurch_store_pk_remove(uint32_t pre_key_id, void * user_data) {
+  lurch_store * store_p = lurch_store_from_axc_ctx(user_data);
+
+  if (!store_p) {
+    return SG_ERR_UNKNOWN;
+  }
+
+  if (store_p->msg_depth > 0) {
+    if (!lurch_store_msg_pk_is_removed(store_p, pre_key_id)) {
+      (void) g_array_append_val(store_p->msg_pk_removed_p, pre_key_id);
+    }
+    return 0;
+  }
+
+  return lurch_store_pk_db_remove(store_p, pre_key_id);
+}
+
+const signal_protocol_session_store lurch_store_session_store_tmpl = {
+  .load_session_func = lurch_store_sess_load,
+  .get_sub_device_sessions_func = lurch_store_sess_get_sub_device_sessions,
+  .store_session_func = lurch_store_sess_store,
+  .contains_session_func = lurch_store_sess_contains,
+  .delete_session_func = lurch_store_sess_delete,
+  .delete_all_sessions_func = lurch_store_sess_delete_all,
+  .destroy_func = lurch_store_destroy_func,
+  .user_data = (void *) 0
+};
+
+const signal_protocol_pre_key_store lurch_store_pre_key_store_tmpl = {
+  .load_pre_key = lurch_store_pk_load,
+  .store_pre_key = lurch_store_pk_store,
+  .contains_pre_key = lurch_store_pk_contains,
+  .remove_pre_key = lurch_store_pk_remove,
+  .destroy_func = lurch_store_destroy_func,
+  .user_data = (void *) 0
+};
@@ -0,0 +1,298 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <glib.h>
+#include <sqlite3.h>
+
+#include "axc.h"
+#include "libomemo.h"
+
+/**
+ * Per-account storage.
+ *
+ * Keeps the account's OMEMO and axc databases open for the lifetime of the account
+ * and caches every compiled statement lurch issues against them, so that the
+ * per-message lookups do not have to open, parse and close the database files again.
+ * The OMEMO tables use the same schema as libomemo's storage, the session and pre key
+ * tables the same schema as axc's, so existing databases keep working.
+ */
+typedef struct lurch_store lurch_store;
+
+typedef enum {
+  LURCH_STORE_DB_OMEMO = 0,
+  LURCH_STORE_DB_AXC,
+  LURCH_STORE_DB_COUNT
+} lurch_store_db_t;
+
+/**
+ * Work done on the store's worker thread, see lurch_store_submit().
+ *
+ * @param db_p The worker's own handle of the db the request was submitted for.
+ * @param data_p The data given to lurch_store_submit().
+ * @param err_msg_pp Can be set to a g_malloc()'d message, which is logged on the main loop on error.
+ * @return 0 on success, negative on error.
+ */
+typedef int (*lurch_store_work_fn)(sqlite3 * db_p, void * data_p, char ** err_msg_pp);
+
+/**
+ * Completion of a request, called on the main loop.
+ *
+ * @param uname The username of the store the request was submitted to.
+ * @param ret_val The return value of the work function.
+ * @param data_p The data given to lurch_store_submit(), to be freed here if needed.
+ */
+typedef void (*lurch_store_done_fn)(const char * uname, int ret_val, void * data_p);
+
+/**
+ * Session store to be bound as the backend of a cache context.
+ * Uses the persistent axc database handle of the store the context was bound to or,
+ * if LURCH_PREF_STORE_SESS_BACKEND is set to LURCH_STORE_BACKEND_MMAP, a key-value file
+ * next to the db (see lurch_kv.h). The backend is chosen when the store is opened, which
+ * also moves the sessions over if the pref was changed since.
+ */
+extern const signal_protocol_session_store lurch_store_session_store_tmpl;
+
+/**
+ * Pre key store using the persistent axc database handle, see above.
+ */
+extern const signal_protocol_pre_key_store lurch_store_pre_key_store_tmpl;
+
+/**
+ * Opens both databases of an account.
+ *
+ * @param uname The username, already stripped.
+ * @param store_pp Will point to the new store on success.
+ * @return 0 on success, negative on error.
+ */
+int lurch_store_open(const char * uname, lurch_store ** store_pp);
+
+/**
+ * Finalizes all cached statements and closes the database handles.
+ */
+void lurch_store_close(lurch_store * store_p);
+
+/**
+ * Returns the store of the given account, opening it on first use.
+ * The store is owned by the account map and must not be closed by the caller.
+ *
+ * @param uname The username, already stripped.
+ * @param store_pp Will point to the store on success.
+ * @return 0 on success, negative on error.
+ */
+int lurch_store_get(const char * uname, lurch_store ** store_pp);
+
+/**
+ * Closes all open stores. Called on plugin unload.
+ * Waits for the storage threads and runs the completions they left behind.
+ */
+void lurch_store_reset_all(void);
+
+/**
+ * @param store_p The store, can be NULL.
+ * @param which Either LURCH_STORE_DB_OMEMO or LURCH_STORE_DB_AXC.
+ * @return The path of the database file, or NULL. Owned by the store.
+ */
+const char * lurch_store_get_db_fn(const lurch_store * store_p, lurch_store_db_t which);
+
+/**
+ * Sets the journal mode and sync level chosen in the LURCH_PREF_STORE_*_JOURNAL and _SYNC prefs
+ * on the handles of both databases. The journal mode is kept in the db file, so it also applies
+ * to the connections axc opens itself, the sync level only to the store's own handles.
+ *
+ * @return 0 on success, negative on error.
+ */
+int lurch_store_apply_durability(lurch_store * store_p);
+
+/**
+ * Makes the session and pre key store templates above use this store
+ * when called with the given axc context as user data.
+ */
+void lurch_store_bind_axc_ctx(lurch_store * store_p, axc_context * axc_ctx_p);
+
+/**
+ * Lets another thread use the store's main handles, e.g. while it initializes the axc context
+ * bound to the store. Until lurch_store_release() is called, all other threads block as soon as
+ * they access the databases through the store. The in-memory chatlist and devicelist cache are
+ * not covered, so the lease owner must not use them.
+ *
+ * @param owner_p The thread which may use the store.
+ */
+void lurch_store_lease(lurch_store * store_p, GThread * owner_p);
+
+/**
+ * Ends the lease started with lurch_store_lease() and wakes up the threads waiting for it.
+ */
+void lurch_store_release(lurch_store * store_p);
+
+/**
+ * Functions playing the same role as omemo_storage_*(), but using the persistent handle.
+ * The return values are the same as those of their libomemo counterparts.
+ *
+ * The chatlist is read into memory when the store is opened. Lookups are answered from
+ * memory only, changes are written to the db first and then to the in-memory copy.
+ */
+int lurch_store_chatlist_save(lurch_store * store_p, const char * chat);
+int lurch_store_chatlist_delete(lurch_store * store_p, const char * chat);
+int lurch_store_chatlist_exists(lurch_store * store_p, const char * chat);
+
+int lurch_store_device_id_save(lurch_store * store_p, const char * user, uint32_t device_id);
+int lurch_store_device_id_delete(lurch_store * store_p, const char * user, uint32_t device_id);
+int lurch_store_device_id_exists(lurch_store * store_p, const char * user, uint32_t device_id);
+int lurch_store_global_device_id_exists(lurch_store * store_p, uint32_t device_id);
+int lurch_store_devicelist_retrieve(lurch_store * store_p, const char * user, omemo_devicelist ** dl_pp);
+
+/**
+ * Saves and deletes a number of device ids of one user in a single transaction,
+ * e.g. the lists returned by omemo_devicelist_diff().
+ * If one of the changes fails, none of them are applied.
+ *
+ * @param user The owner of the device ids.
+ * @param add_l_p List of device ids to save, as used by omemo_devicelist_list_data(). Can be NULL.
+ * @param del_l_p List of device ids to delete, see above. Can be NULL.
+ * @return 0 on success, negative on error.
+ */
+int lurch_store_devicelist_apply(lurch_store * store_p, const char * user, const GList * add_l_p, const GList * del_l_p);
+
+/**
+ * Non-blocking versions of lurch_store_devicelist_apply() and lurch_store_device_id_save().
+ * The cached devicelist is changed right away, the db is written by the worker thread.
+ * If that fails, the user's devicelist is dropped from the cache and the error is logged.
+ */
+void lurch_store_devicelist_apply_async(lurch_store * store_p, const char * user, const GList * add_l_p, const GList * del_l_p);
+void lurch_store_device_id_save_async(lurch_store * store_p, const char * user, uint32_t device_id);
+
+/**
+ * Writes a signed pre key to the axc db on the worker thread, through the worker's own handle
+ * instead of axc's store, which must only be used on the main loop.
+ * Errors are logged on the main loop.
+ *
+ * @param signed_pre_key_id The id of the key.
+ * @param record_p The serialized key, see session_signed_pre_key_serialize(). Taken over by the store.
+ */
+void lurch_store_signed_pre_key_save_async(lurch_store * store_p, uint32_t signed_pre_key_id, signal_buffer * record_p);
+
+/**
+ * Devicelists are cached in memory by bare JID, up to the number of entries set in
+ * LURCH_PREF_STORE_DL_CACHE_SIZE, evicting the least recently used ones.
+ * lurch_store_devicelist_retrieve() and lurch_store_device_id_exists() are answered from
+ * the cache if possible, lurch_store_device_id_save() and _delete() update cached entries.
+ */
+
+/**
+ * Replaces the cached devicelist of its owner with the given one.
+ * Call this after the db was brought in sync with it.
+ */
+void lurch_store_devicelist_cache_update(lurch_store * store_p, const omemo_devicelist * dl_p);
+
+/**
+ * Gets a devicelist only if it is cached, so that it never has to wait for the db.
+ *
+ * @param dl_pp Will point to the devicelist, or to NULL if it is not cached.
+ * @return 0 on success, negative on error.
+ */
+int lurch_store_devicelist_cache_peek(lurch_store * store_p, const char * user, omemo_devicelist ** dl_pp);
+
+/**
+ * Reads a devicelist from the db and leaves the cache alone, as that is not thread-safe,
+ * so that it can be used on the thread the store is leased to.
+ */
+int lurch_store_devicelist_load(lurch_store * store_p, const char * user, omemo_devicelist ** dl_pp);
+
+/**
+ * Drops the cached devicelist of the given user, so that the next lookup reads it from the db.
+ */
+void lurch_store_devicelist_cache_invalidate(lurch_store * store_p, const char * user);
+
+/**
+ * @param hits_p Will be set to the number of lookups answered from the cache.
+ * @param misses_p Will be set to the number of lookups that had to go to the db.
+ */
+void lurch_store_devicelist_cache_stats(const lurch_store * store_p, unsigned int * hits_p, unsigned int * misses_p);
+
+/**
+ * @return The store the given axc context was bound to, or NULL.
+ */
+lurch_store * lurch_store_from_axc_ctx(axc_context * axc_ctx_p);
+
+/**
+ * Starts the session changes of one message.
+ *
+ * Until the matching lurch_store_msg_commit() or _rollback(), session writes and deletions
+ * as well as pre key removals made through the store templates are kept in memory, and
+ * reads through the templates see them on top of the db. The commit then writes all of them
+ * in a single transaction, so that a message either advances all of its ratchets or none.
+ * The changes are not held in an open transaction, as axc writes to the same db file
+ * through its own connections for the identity and signed pre key stores.
+ *
+ * Scopes can be nested, only the outermost one writes to the db.
+ *
+ * @param store_p The store, can be NULL in which case nothing happens.
+ */
+void lurch_store_msg_begin(lurch_store * store_p);
+
+/**
+ * Ends the scope started with lurch_store_msg_begin() and writes the pending changes.
+ * If one of them fails, none are written. The pending changes are dropped either way.
+ *
+ * @return 0 on success, negative on error, also if a nested scope was rolled back.
+ */
+int lurch_store_msg_commit(lurch_store * store_p);
+
+/**
+ * Ends the scope started with lurch_store_msg_begin() and drops the pending changes.
+ */
+void lurch_store_msg_rollback(lurch_store * store_p);
+
+/**
+ * Starts a batch of messages, e.g. the offline messages received after signing on,
+ * whose session changes are written together at its end instead of one transaction per message.
+ *
+ * The batch is an outer scope, see lurch_store_msg_begin(). A message scope directly inside it
+ * keeps its own changes apart, so that rolling it back, or committing it after a nested scope failed,
+ * only drops the changes of that message and leaves the batch intact.
+ * Reads through the templates see the changes of all messages of the batch so far.
+ *
+ * @param store_p The store, can be NULL in which case nothing happens.
+ * @return 0 on success, negative if a scope is already open.
+ */
+int lurch_store_batch_begin(lurch_store * store_p);
+
+/**
+ * @return TRUE if a batch started with lurch_store_batch_begin() is still open.
+ */
+gboolean lurch_store_batch_is_open(const lurch_store * store_p);
+
+/**
+ * Ends the batch and writes the changes of all its messages in a single transaction.
+ * Does nothing if no batch is open or a message of it is still being handled.
+ *
+ * @return 0 on success, negative on error.
+ */
+int lurch_store_batch_commit(lurch_store * store_p);
+
+/**
+ * Each store has a worker thread with its own handles to both databases, which runs the
+ * requests submitted to it in order. Its completions are delivered to the main loop via
+ * g_idle_add(). This is meant for writes nobody waits for, as libsignal needs the results
+ * of its store calls right away. To keep the order of changes, the functions above which
+ * use the main thread's handles wait until the requests for the same db were handled.
+ *
+ * @param which The db whose handle is passed to the work function.
+ * @param work_fn Called on the worker thread. Must not call into libpurple.
+ * @param done_fn Called on the main loop once work_fn returned. Can be NULL.
+ * @param data_p Passed to both functions.
+ */
+void lurch_store_submit(lurch_store * store_p, lurch_store_db_t which,
+                        lurch_store_work_fn work_fn, lurch_store_done_fn done_fn, void * data_p);
+
+/**
+ * Blocks until the worker handled everything submitted to the store so far.
+ * The completions still run on the main loop.
+ */
+void lurch_store_sync(lurch_store * store_p);
+
+/**
+ * Calls lurch_store_sync() for all open stores.
+ */
+void lurch_store_sync_all(void);
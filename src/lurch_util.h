@@ -2,14 +2,40 @@
 
 #include "axc.h"
 
-#define LURCH_PREF_ROOT              "/plugins/core/lurch1317"
-#define LURCH_PREF_AXC_LOGGING       LURCH_PREF_ROOT "/axc_logging"
-#define LURCH_PREF_AXC_LOGGING_LEVEL LURCH_PREF_AXC_LOGGING "/level"
+#define LURCH_PREF_ROOT                 "/plugins/core/lurch1317"
+#define LURCH_PREF_AXC_LOGGING          LURCH_PREF_ROOT "/axc_logging"
+#define LURCH_PREF_AXC_LOGGING_LEVEL    LURCH_PREF_AXC_LOGGING "/level"
+#define LURCH_PREF_STORE                LURCH_PREF_ROOT "/store"
+#define LURCH_PREF_STORE_DL_CACHE_SIZE  LURCH_PREF_STORE "/devicelist_cache_size"
+#define LURCH_PREF_STORE_OMEMO_JOURNAL  LURCH_PREF_STORE "/omemo_journal_mode"
+#define LURCH_PREF_STORE_OMEMO_SYNC     LURCH_PREF_STORE "/omemo_synchronous"
+#define LURCH_PREF_STORE_AXC_JOURNAL    LURCH_PREF_STORE "/axc_journal_mode"
+#define LURCH_PREF_STORE_AXC_SYNC       LURCH_PREF_STORE "/axc_synchronous"
+#define LURCH_PREF_STORE_SESS_BACKEND   LURCH_PREF_STORE "/session_backend"
+#define LURCH_PREF_DECRYPT              LURCH_PREF_ROOT "/decrypt"
+#define LURCH_PREF_DECRYPT_ASYNC        LURCH_PREF_DECRYPT "/async"
+#define LURCH_PREF_ENCRYPT              LURCH_PREF_ROOT "/encrypt"
+#define LURCH_PREF_CRYPTO_AES_GCM       LURCH_PREF_ENCRYPT "/aes_gcm"
+#define LURCH_PREF_CRYPTO_SIGNAL        LURCH_PREF_ENCRYPT "/signal_crypto"
+#define LURCH_PREF_CRYPTO_RNG_POOL      LURCH_PREF_ENCRYPT "/rng_pool"
+
+// values of the journal mode and synchronous prefs
+#define LURCH_STORE_JOURNAL_ROLLBACK "delete"
+#define LURCH_STORE_JOURNAL_WAL      "wal"
+#define LURCH_STORE_SYNC_FULL        "full"
+#define LURCH_STORE_SYNC_NORMAL      "normal"
+
+// values of the session backend pref
+#define LURCH_STORE_BACKEND_SQLITE "sqlite"
+#define LURCH_STORE_BACKEND_MMAP   "mmap"
 
 #define LURCH_DB_SUFFIX     "_db.sqlite"
 #define LURCH_DB_NAME_OMEMO "omemo"
 #define LURCH_DB_NAME_AXC   "axc"
 
+#define LURCH_KV_SUFFIX        ".kv"
+#define LURCH_KV_NAME_SESSIONS "axc_sessions"
+
 
 /**
  * Creates and initializes the axc context.
@@ -0,0 +1,209 @@
+#include <string.h>
+
+#include <glib.h>
+#include <purple.h>
+
+#include "libomemo.h"
+
+#include "lurch_xml.h"
+#include "omemo_helper.h"
+
+/**
+ * Appends the text to the node as a data child, taking over the buffer instead of copying it
+ * like xmlnode_insert_data() does.
+ *
+ * @param node_p Pointer to the node.
+ * @param data The g_malloc()'d text, does not have to be NUL-terminated.
+ * @param len Its length.
+ */
+static void lurch_xml_take_data(xmlnode * node_p, char * data, size_t len) {
+  xmlnode * data_node_p = (void *) 0;
+
+  if (!len) {
+    g_free(data);
+    return;
+  }
+
+  // a placeholder, so that libpurple sets up the node, which then gets the text instead
+  xmlnode_insert_data(node_p, " ", 1);
+  data_node_p = node_p->lastchild;
+  g_free(data_node_p->data);
+  data_node_p->data = data;
+  data_node_p->data_sz = len;
+}
+
+/**
+ * Copies an element of the omemo message, including its attributes and children, into a new xmlnode.
+ * The text of streamed payloads is moved rather than copied, see omemo_text_node_steal().
+ *
+ * @param mxml_node_p Pointer to the element.
+ * @return The new xmlnode, or NULL if it is not an element.
+ */
+static xmlnode * lurch_xml_from_mxml(mxml_node_t * mxml_node_p) {
+  xmlnode * node_p = (void *) 0;
+  mxml_node_t * child_p = (void *) 0;
+  const char * attr_name = (void *) 0;
+  const char * attr_val = (void *) 0;
+  const char * text = (void *) 0;
+  char * stolen = (void *) 0;
+  size_t stolen_len = 0;
+  int i = 0;
+
+  if (mxmlGetType(mxml_node_p) != MXML_ELEMENT) {
+    return (void *) 0;
+  }
+
+  node_p = xmlnode_new(mxmlGetElement(mxml_node_p));
+  for (i = 0; i < mxmlElementGetAttrCount(mxml_node_p); i++) {
+    attr_val = mxmlElementGetAttrByIndex(mxml_node_p, i, &attr_name);
+    if (!g_strcmp0(attr_name, "xmlns")) {
+      xmlnode_set_namespace(node_p, attr_val);
+    } else {
+      xmlnode_set_attrib(node_p, attr_name, attr_val);
+    }
+  }
+
+  for (child_p = mxmlGetFirstChild(mxml_node_p); child_p; child_p = mxmlGetNextSibling(child_p)) {
+    if (mxmlGetType(child_p) == MXML_ELEMENT) {
+      xmlnode_insert_child(node_p, lurch_xml_from_mxml(child_p));
+    } else if (mxmlGetType(child_p) == MXML_CUSTOM) {
+      stolen = omemo_text_node_steal(child_p, &stolen_len);
+      if (stolen) {
+        lurch_xml_take_data(node_p, stolen, stolen_len);
+      }
+    } else {
+      text = mxmlGetOpaque(child_p);
+      if (text) {
+        xmlnode_insert_data(node_p, text, -1);
+      }
+    }
+  }
+
+  return node_p;
+}
+
+/**
+ * Whether the child has to go before the encrypted content is added, see lurch_xml_export_encrypted().
+ */
+static gboolean lurch_xml_is_replaced(const xmlnode * node_p) {
+  const char * xmlns = (void *) 0;
+
+  if (node_p->type != XMLNODE_TYPE_TAG) {
+    return FALSE;
+  }
+
+  xmlns = xmlnode_get_namespace(node_p);
+  return !g_strcmp0(node_p->name, BODY_NODE_NAME)
+         || !g_strcmp0(node_p->name, HTML_NODE_NAME)
+         || (!g_strcmp0(node_p->name, ENCRYPTED_NODE_NAME) && !g_strcmp0(xmlns, OMEMO_NS))
+         || (!g_strcmp0(node_p->name, EME_NODE_NAME) && !g_strcmp0(xmlns, EME_XMLNS))
+         || (!g_strcmp0(node_p->name, HINTS_STORE_NODE_NAME) && !g_strcmp0(xmlns, HINTS_XMLNS));
+}
+
+int lurch_xml_export_encrypted(omemo_message * om_msg_p, int add_msg, xmlnode * msg_stanza_p) {
+  xmlnode * node_p = (void *) 0;
+  xmlnode * next_p = (void *) 0;
+  xmlnode * encrypted_node_p = (void *) 0;
+
+  if (!om_msg_p || !om_msg_p->header_node_p || !msg_stanza_p) {
+    return OMEMO_ERR_NULL;
+  }
+
+  // the attributes are children as well and stay, just like the elements the plaintext is not in
+  for (node_p = msg_stanza_p->child; node_p; node_p = next_p) {
+    next_p = node_p->next;
+    if (lurch_xml_is_replaced(node_p)) {
+      xmlnode_free(node_p);
+    }
+  }
+
+  encrypted_node_p = xmlnode_new_child(msg_stanza_p, ENCRYPTED_NODE_NAME);
+  xmlnode_set_namespace(encrypted_node_p, OMEMO_NS);
+  xmlnode_insert_child(encrypted_node_p, lurch_xml_from_mxml(om_msg_p->header_node_p));
+  if (om_msg_p->payload_node_p) {
+    xmlnode_insert_child(encrypted_node_p, lurch_xml_from_mxml(om_msg_p->payload_node_p));
+  }
+
+  if (add_msg == OMEMO_ADD_MSG_EME) {
+    node_p = xmlnode_new_child(msg_stanza_p, EME_NODE_NAME);
+    xmlnode_set_namespace(node_p, EME_XMLNS);
+    xmlnode_set_attrib(node_p, "namespace", OMEMO_NS);
+    xmlnode_set_attrib(node_p, "name", EME_NAME);
+
+    node_p = xmlnode_new_child(msg_stanza_p, BODY_NODE_NAME);
+    xmlnode_insert_data(node_p, EME_BODY_TEXT, -1);
+  }
+
+  node_p = xmlnode_new_child(msg_stanza_p, HINTS_STORE_NODE_NAME);
+  xmlnode_set_namespace(node_p, HINTS_XMLNS);
+
+  return 0;
+}
+
+mxml_node_t * lurch_xml_to_mxml(xmlnode * node_p, mxml_node_t * parent_p) {
+  mxml_node_t * mxml_node_p = (void *) 0;
+  xmlnode * child_p = (void *) 0;
+  gboolean has_elements = FALSE;
+  char * text = (void *) 0;
+
+  mxml_node_p = mxmlNewElement(parent_p, node_p->name);
+  for (child_p = node_p->child; child_p; child_p = child_p->next) {
+    if (child_p->type == XMLNODE_TYPE_ATTRIB) {
+      mxmlElementSetAttr(mxml_node_p, child_p->name, child_p->data);
+    } else if (child_p->type == XMLNODE_TYPE_TAG) {
+      (void) lurch_xml_to_mxml(child_p, mxml_node_p);
+      has_elements = TRUE;
+    }
+  }
+
+  if (!has_elements) {
+    // the parser may have split the text into several data nodes
+    text = xmlnode_get_data(node_p);
+    if (text) {
+      (void) mxmlNewOpaque(mxml_node_p, text);
+      g_free(text);
+    }
+  }
+
+  return mxml_node_p;
+}
+
+int lurch_xml_prepare_decryption(xmlnode * msg_stanza_p, omemo_message ** om_msg_pp) {
+  xmlnode * encrypted_node_p = (void *) 0;
+  xmlnode * header_node_p = (void *) 0;
+  xmlnode * payload_node_p = (void *) 0;
+
+  encrypted_node_p = xmlnode_get_child(msg_stanza_p, ENCRYPTED_NODE_NAME);
+  if (!encrypted_node_p) {
+    return OMEMO_ERR_MALFORMED_XML;
+  }
+
+  header_node_p = xmlnode_get_child(encrypted_node_p, HEADER_NODE_NAME);
+  if (!header_node_p) {
+    return OMEMO_ERR_MALFORMED_XML;
+  }
+  payload_node_p = xmlnode_get_child(encrypted_node_p, PAYLOAD_NODE_NAME);
+
+  return omemo_message_create_for_decryption(lurch_xml_to_mxml(header_node_p, MXML_NO_PARENT),
+                                             payload_node_p ? lurch_xml_to_mxml(payload_node_p, MXML_NO_PARENT) : (void *) 0,
+                                             om_msg_pp);
+}
+
+xmlnode * lurch_xml_set_decrypted_body(xmlnode * msg_stanza_p, const char * plaintext) {
+  xmlnode * node_p = (void *) 0;
+
+  node_p = xmlnode_get_child(msg_stanza_p, ENCRYPTED_NODE_NAME);
+  if (node_p) {
+    xmlnode_free(node_p);
+  }
+
+  node_p = xmlnode_get_child(msg_stanza_p, BODY_NODE_NAME);
+  if (node_p) {
+    xmlnode_free(node_p);
+  }
+
+  node_p = xmlnode_new_child(msg_stanza_p, BODY_NODE_NAME);
+  xmlnode_insert_data(node_p, plaintext, -1);
+
+  return node_p;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <purple.h>
+
+#include "libomemo.h"
+
+#include "omemo_helper.h"
+
+/**
+ * Puts the encrypted content of the omemo message into the stanza, working on the nodes directly,
+ * so the stanza does not have to be serialized and parsed again.
+ *
+ * Like omemo_message_prepare_encryption() with OMEMO_STRIP_ALL followed by omemo_message_export_encrypted(),
+ * the <body> and <html> elements are removed, as they hold the plaintext, and the stanza's attributes and
+ * its other children, e.g. chat states or receipt requests, are kept. An <encrypted> element, EME element
+ * or store hint already in the stanza is replaced, so that exporting twice does not duplicate them.
+ *
+ * @param om_msg_p Pointer to the omemo message, after the key was encrypted for the recipients.
+ * @param add_msg OMEMO_ADD_MSG_EME to add the EME element and a fallback body, or OMEMO_ADD_MSG_NONE.
+ * @param msg_stanza_p Pointer to the <message> stanza.
+ * @return 0 on success, negative on error.
+ */
+int lurch_xml_export_encrypted(omemo_message * om_msg_p, int add_msg, xmlnode * msg_stanza_p);
+
+/**
+ * Copies an element of a received stanza, including its attributes and children, into a new mxml element.
+ * The text of an element is only kept if it has no child elements, i.e. the whitespace between them is dropped.
+ *
+ * @param node_p Pointer to the element.
+ * @param parent_p The parent of the new element, or MXML_NO_PARENT.
+ * @return The new element.
+ */
+mxml_node_t * lurch_xml_to_mxml(xmlnode * node_p, mxml_node_t * parent_p);
+
+/**
+ * Creates the omemo message from the <encrypted> element of the received stanza,
+ * without the string round-trip of omemo_message_prepare_decryption().
+ *
+ * @param msg_stanza_p Pointer to the <message> stanza.
+ * @param om_msg_pp Will point to the omemo message.
+ * @return 0 on success, negative on error.
+ */
+int lurch_xml_prepare_decryption(xmlnode * msg_stanza_p, omemo_message ** om_msg_pp);
+
+/**
+ * Replaces the <encrypted> element and the fallback body of the received stanza with the decrypted body.
+ *
+ * @param msg_stanza_p Pointer to the <message> stanza.
+ * @param plaintext The decrypted text.
+ * @return Pointer to the new <body> element.
+ */
+xmlnode * lurch_xml_set_decrypted_body(xmlnode * msg_stanza_p, const char * plaintext);
@@ -1,4 +1,11 @@
 #include "omemo_helper.h"
+#include "lurch_b64.h"
+#include "lurch_crypto.h"
+
+typedef struct {
+  char * text;
+  size_t len;
+} omemo_text_node_data;
 
 /**
  * Helps basic sanity checking of received XML.
@@ -45,8 +52,7 @@ int omemo_message_init_key(omemo_message* msg_p, const omemo_crypto_provider * c
   }
   int ret_val = 0;
   uint8_t * iv_p = NULL;
-  gchar * iv_b64 = NULL;
-  mxml_node_t * header_node_p = NULL;
+  char iv_b64[LURCH_B64_ENCODED_LEN(OMEMO_AES_GCM_IV_LENGTH) + 1];
   mxml_node_t * iv_node_p = NULL;
   uint8_t * key_p = NULL;
 
@@ -56,8 +62,8 @@ int omemo_message_init_key(omemo_message* msg_p, const omemo_crypto_provider * c
   }
   msg_p->iv_p = iv_p;
   msg_p->iv_len = OMEMO_AES_GCM_IV_LENGTH;
-  iv_b64 = g_base64_encode(iv_p, OMEMO_AES_GCM_IV_LENGTH);
-  iv_node_p = mxmlNewElement(header_node_p, IV_NODE_NAME);
+  (void) lurch_b64_encode(iv_p, OMEMO_AES_GCM_IV_LENGTH, iv_b64);
+  iv_node_p = mxmlNewElement(msg_p->header_node_p, IV_NODE_NAME);
   (void) mxmlNewOpaque(iv_node_p, iv_b64);
 
   ret_val = crypto_p->random_bytes_func(&key_p, OMEMO_AES_128_KEY_LENGTH + OMEMO_AES_GCM_TAG_LENGTH, crypto_p->user_data_p);
@@ -70,7 +76,6 @@ int omemo_message_init_key(omemo_message* msg_p, const omemo_crypto_provider * c
   msg_p->tag_len = 0;
 
  cleanup:
-  g_free(iv_b64);
   return ret_val;
 }
 
@@ -107,6 +112,142 @@ int omemo_message_set_plain_msg(omemo_message* msg_p, const char* pl_msg)
   return ret_val;
 }
 
+/**
+ * Encrypts the text with the message's key and iv, appends the tag to the key
+ * and sets the ciphertext as the payload.
+ */
+static int omemo_message_encrypt_text(omemo_message* msg_p, const char* text, size_t text_len,
+				      const omemo_crypto_provider * crypto_p)
+{
+  int ret_val = 0;
+  uint8_t * ct_p = NULL;
+  size_t ct_len = 0;
+  gchar * payload_b64 = NULL;
+  mxml_node_t * payload_node_p = NULL;
+  uint8_t * tag_p = NULL;
+
+  ret_val = crypto_p->aes_gcm_encrypt_func((const uint8_t *) text, text_len,
+					   msg_p->iv_p, msg_p->iv_len,
+					   msg_p->key_p, msg_p->key_len,
+					   OMEMO_AES_GCM_TAG_LENGTH,
+					   crypto_p->user_data_p,
+					   &ct_p, &ct_len,
+					   &tag_p);
+  if (ret_val) {
+    goto cleanup;
+  }
+
+  msg_p->tag_len = OMEMO_AES_GCM_TAG_LENGTH;
+  memcpy(msg_p->key_p + msg_p->key_len, tag_p, msg_p->tag_len);
+
+  payload_b64 = lurch_b64_encode_alloc(ct_p, ct_len);
+  payload_node_p = mxmlNewElement(MXML_NO_PARENT, PAYLOAD_NODE_NAME);
+  (void) mxmlNewOpaque(payload_node_p, payload_b64);
+  mxmlDelete(msg_p->payload_node_p);
+  msg_p->payload_node_p = payload_node_p;
+
+ cleanup:
+  free(ct_p);
+  g_free(payload_b64);
+  free(tag_p);
+
+  return ret_val;
+}
+
+static void omemo_text_node_data_destroy(void * data_p)
+{
+  omemo_text_node_data * tnd_p = (omemo_text_node_data *) data_p;
+
+  g_free(tnd_p->text);
+  g_free(tnd_p);
+}
+
+mxml_node_t * omemo_text_node_new(mxml_node_t * parent_p, char * text, size_t len)
+{
+  omemo_text_node_data * tnd_p = g_new0(omemo_text_node_data, 1);
+
+  tnd_p->text = text;
+  tnd_p->len = len;
+
+  return mxmlNewCustom(parent_p, tnd_p, omemo_text_node_data_destroy);
+}
+
+char * omemo_text_node_steal(mxml_node_t * node_p, size_t * len_p)
+{
+  omemo_text_node_data * tnd_p = NULL;
+  char * text = NULL;
+
+  if (mxmlGetType(node_p) != MXML_CUSTOM) {
+    return NULL;
+  }
+
+  // only omemo_text_node_new() creates custom nodes
+  tnd_p = (omemo_text_node_data *) mxmlGetCustom(node_p);
+  if (!tnd_p) {
+    return NULL;
+  }
+
+  text = tnd_p->text;
+  *len_p = tnd_p->len;
+  tnd_p->text = NULL;
+  tnd_p->len = 0;
+
+  return text;
+}
+
+/**
+ * Like omemo_message_encrypt_text(), but encrypts the text in blocks and base64-encodes each of them
+ * straight into the payload, so that neither the whole ciphertext nor a second copy of the payload
+ * is ever held. The payload is a text node, which the caller moves into the stanza.
+ * Uses libgcrypt directly, as the crypto provider only encrypts whole buffers.
+ */
+static int omemo_message_encrypt_text_stream(omemo_message* msg_p, const char* text, size_t text_len)
+{
+  int ret_val = 0;
+  lurch_crypto_gcm_stream * stream_p = NULL;
+  uint8_t ct_buf[OMEMO_HELPER_STREAM_BLOCK_LEN];
+  char * payload_b64 = NULL;
+  size_t payload_b64_len = 0;
+  mxml_node_t * payload_node_p = NULL;
+  size_t pos = 0;
+  size_t len = 0;
+
+  ret_val = lurch_crypto_aes_gcm_stream_begin(msg_p->key_p, msg_p->key_len, msg_p->iv_p, msg_p->iv_len, &stream_p);
+  if (ret_val) {
+    goto cleanup;
+  }
+
+  payload_b64 = g_malloc(LURCH_B64_ENCODED_LEN(text_len) + 1);
+  payload_b64[0] = '\0';
+  for (pos = 0; pos < text_len; pos += len) {
+    len = MIN(sizeof(ct_buf), text_len - pos);
+    ret_val = lurch_crypto_aes_gcm_stream_encrypt(stream_p, (const uint8_t *) text + pos, ct_buf, len, pos + len == text_len);
+    if (ret_val) {
+      goto cleanup;
+    }
+    // the blocks are a multiple of 3 bytes long, so their encodings can simply be appended
+    payload_b64_len += lurch_b64_encode(ct_buf, len, payload_b64 + payload_b64_len);
+  }
+
+  ret_val = lurch_crypto_aes_gcm_stream_get_tag(stream_p, msg_p->key_p + msg_p->key_len, OMEMO_AES_GCM_TAG_LENGTH);
+  if (ret_val) {
+    goto cleanup;
+  }
+  msg_p->tag_len = OMEMO_AES_GCM_TAG_LENGTH;
+
+  payload_node_p = mxmlNewElement(MXML_NO_PARENT, PAYLOAD_NODE_NAME);
+  (void) omemo_text_node_new(payload_node_p, payload_b64, payload_b64_len);
+  payload_b64 = NULL;
+  mxmlDelete(msg_p->payload_node_p);
+  msg_p->payload_node_p = payload_node_p;
+
+ cleanup:
+  lurch_crypto_aes_gcm_stream_free(stream_p);
+  g_free(payload_b64);
+
+  return ret_val;
+}
+
 int omemo_message_pre_encrypt(omemo_message* msg_p, const omemo_crypto_provider * crypto_p)
 {
   if (!msg_p || !msg_p->header_node_p || !msg_p->message_node_p || !msg_p->key_p || !msg_p->iv_p ) {
@@ -115,11 +256,6 @@ int omemo_message_pre_encrypt(omemo_message* msg_p, const omemo_crypto_provider
   int ret_val = 0;
   mxml_node_t * body_node_p = NULL;
   const char * msg_text = NULL;
-  uint8_t * ct_p = NULL;
-  size_t ct_len = 0;
-  gchar * payload_b64 = NULL;
-  mxml_node_t * payload_node_p = NULL;
-  uint8_t * tag_p = NULL;
 
   body_node_p = mxmlFindPath(msg_p->message_node_p, BODY_NODE_NAME);
   if (!body_node_p)
@@ -131,21 +267,11 @@ int omemo_message_pre_encrypt(omemo_message* msg_p, const omemo_crypto_provider
     goto cleanup;
   }
 
-
-  ret_val = crypto_p->aes_gcm_encrypt_func((uint8_t *) msg_text, strlen(msg_text),
-					   msg_p->iv_p, msg_p->iv_len,
-					   msg_p->key_p, msg_p->key_len,
-					   OMEMO_AES_GCM_TAG_LENGTH,
-					   crypto_p->user_data_p,
-					   &ct_p, &ct_len,
-					   &tag_p);
+  ret_val = omemo_message_encrypt_text(msg_p, msg_text, strlen(msg_text), crypto_p);
   if (ret_val) {
     goto cleanup;
   }
 
-  msg_p->tag_len = OMEMO_AES_GCM_TAG_LENGTH;
-  memcpy(msg_p->key_p + msg_p->key_len, tag_p, msg_p->tag_len);
-
   ret_val = expect_next_node(body_node_p, mxmlGetParent, BODY_NODE_NAME, &body_node_p);
   if (ret_val) {
     goto cleanup;
@@ -153,19 +279,235 @@ int omemo_message_pre_encrypt(omemo_message* msg_p, const omemo_crypto_provider
 
   mxmlRemove(body_node_p);
 
-  payload_b64 = g_base64_encode(ct_p, ct_len);
-  payload_node_p = mxmlNewElement(MXML_NO_PARENT, PAYLOAD_NODE_NAME);
-  (void) mxmlNewOpaque(payload_node_p, payload_b64);
+ cleanup:
+  return ret_val;
+}
+
+int omemo_message_create_for_text(const char* text, uint32_t sender_device_id,
+				  const omemo_crypto_provider * crypto_p, omemo_message** msg_pp)
+{
+  return omemo_message_create_for_text_len(text, text ? strlen(text) : 0, sender_device_id, crypto_p, msg_pp);
+}
+
+int omemo_message_create_for_text_len(const char* text, size_t text_len, uint32_t sender_device_id,
+				      const omemo_crypto_provider * crypto_p, omemo_message** msg_pp)
+{
+  if (!crypto_p || !msg_pp) {
+    return OMEMO_ERR_NULL;
+  }
+  int ret_val = 0;
+  omemo_message* msg_p = omemo_message_create_bare();
+
+  if (!msg_p || !msg_p->header_node_p) {
+    ret_val = OMEMO_ERR_NOMEM;
+    goto cleanup;
+  }
+
+  ret_val = omemo_message_set_sender_devid(msg_p, sender_device_id);
+  if (ret_val) {
+    goto cleanup;
+  }
+
+  ret_val = omemo_message_init_key(msg_p, crypto_p);
+  if (ret_val) {
+    goto cleanup;
+  }
+
+  if (text && text_len >= OMEMO_HELPER_STREAM_MIN_LEN) {
+    ret_val = omemo_message_encrypt_text_stream(msg_p, text, text_len);
+  } else if (text) {
+    ret_val = omemo_message_encrypt_text(msg_p, text, text_len, crypto_p);
+  }
+  if (ret_val) {
+    goto cleanup;
+  }
+
+  *msg_pp = msg_p;
+
+ cleanup:
+  if (ret_val) {
+    omemo_message_destroy(msg_p);
+  }
+  return ret_val;
+}
+
+int omemo_message_create_for_decryption(mxml_node_t * header_node_p, mxml_node_t * payload_node_p,
+					 omemo_message** msg_pp)
+{
+  if (!header_node_p || !msg_pp) {
+    mxmlDelete(header_node_p);
+    mxmlDelete(payload_node_p);
+    return OMEMO_ERR_NULL;
+  }
+  omemo_message* msg_p = malloc(sizeof(omemo_message));
+
+  if (!msg_p) {
+    mxmlDelete(header_node_p);
+    mxmlDelete(payload_node_p);
+    return OMEMO_ERR_NOMEM;
+  }
+  memset(msg_p, 0, sizeof(omemo_message));
+  msg_p->header_node_p = header_node_p;
   msg_p->payload_node_p = payload_node_p;
 
+  *msg_pp = msg_p;
+  return 0;
+}
+
+/**
+ * Decrypts large payloads in the buffer they were decoded into, instead of into a new one
+ * which would then be copied once more into the plaintext string.
+ */
+static int omemo_message_decrypt_in_place(uint8_t * buf_p, size_t len, const uint8_t * iv_p, size_t iv_len,
+					  const uint8_t * key_p, const uint8_t * tag_p)
+{
+  int ret_val = 0;
+  lurch_crypto_gcm_stream * stream_p = NULL;
+
+  ret_val = lurch_crypto_aes_gcm_stream_begin(key_p, OMEMO_AES_128_KEY_LENGTH, iv_p, iv_len, &stream_p);
+  if (ret_val) {
+    return ret_val;
+  }
+
+  ret_val = lurch_crypto_aes_gcm_stream_decrypt(stream_p, buf_p, buf_p, len, TRUE);
+  if (!ret_val) {
+    ret_val = lurch_crypto_aes_gcm_stream_check_tag(stream_p, tag_p, OMEMO_AES_GCM_TAG_LENGTH);
+  }
+
+  lurch_crypto_aes_gcm_stream_free(stream_p);
+  return ret_val;
+}
+
+int omemo_message_decrypt_payload(const omemo_message* msg_p, const uint8_t* key_p, size_t key_len,
+				  const omemo_crypto_provider * crypto_p, char** plaintext_pp)
+{
+  if (!msg_p || !msg_p->header_node_p || !msg_p->payload_node_p || !key_p || !crypto_p || !plaintext_pp) {
+    return OMEMO_ERR_NULL;
+  }
+  int ret_val = 0;
+  mxml_node_t * iv_node_p = NULL;
+  const char * iv_b64 = NULL;
+  const char * payload_b64 = NULL;
+  size_t iv_b64_len = 0;
+  size_t payload_b64_len = 0;
+  uint8_t iv_buf[OMEMO_HELPER_IV_BUF_LEN];
+  uint8_t * iv_p = iv_buf;
+  size_t iv_len = 0;
+  uint8_t * payload_p = NULL;
+  size_t payload_len = 0;
+  size_t ct_len = 0;
+  const uint8_t * tag_p = NULL;
+  uint8_t * pt_p = NULL;
+  size_t pt_len = 0;
+
+  iv_node_p = mxmlFindElement(msg_p->header_node_p, msg_p->header_node_p, IV_NODE_NAME, NULL, NULL, MXML_DESCEND_FIRST);
+  iv_b64 = mxmlGetOpaque(iv_node_p);
+  payload_b64 = mxmlGetOpaque(msg_p->payload_node_p);
+  if (!iv_b64 || !payload_b64) {
+    ret_val = OMEMO_ERR_MALFORMED_XML;
+    goto cleanup;
+  }
+
+  // the IV fits on the stack unless it is unusually long or padded with whitespace
+  iv_b64_len = strlen(iv_b64);
+  if (LURCH_B64_DECODED_MAX_LEN(iv_b64_len) > sizeof(iv_buf)) {
+    iv_p = g_malloc(LURCH_B64_DECODED_MAX_LEN(iv_b64_len));
+  }
+  iv_len = lurch_b64_decode(iv_b64, iv_b64_len, iv_p);
+
+  // one more byte for the terminating NUL if the payload is decrypted in place
+  payload_b64_len = strlen(payload_b64);
+  payload_p = g_malloc(LURCH_B64_DECODED_MAX_LEN(payload_b64_len) + 1);
+  payload_len = lurch_b64_decode(payload_b64, payload_b64_len, payload_p);
+
+  // the tag is either sent along with the key, or appended to the payload
+  if (key_len >= OMEMO_AES_128_KEY_LENGTH + OMEMO_AES_GCM_TAG_LENGTH) {
+    ct_len = payload_len;
+    tag_p = key_p + OMEMO_AES_128_KEY_LENGTH;
+  } else if (key_len == OMEMO_AES_128_KEY_LENGTH && payload_len >= OMEMO_AES_GCM_TAG_LENGTH) {
+    ct_len = payload_len - OMEMO_AES_GCM_TAG_LENGTH;
+    tag_p = payload_p + ct_len;
+  } else {
+    ret_val = OMEMO_ERR_UNSUPPORTED_KEY_LEN;
+    goto cleanup;
+  }
+
+  if (payload_b64_len >= OMEMO_HELPER_STREAM_MIN_LEN) {
+    ret_val = omemo_message_decrypt_in_place(payload_p, ct_len, iv_p, iv_len, key_p, tag_p);
+    if (ret_val) {
+      goto cleanup;
+    }
+    payload_p[ct_len] = '\0';
+    *plaintext_pp = (char *) payload_p;
+    payload_p = NULL;
+    goto cleanup;
+  }
+
+  ret_val = crypto_p->aes_gcm_decrypt_func(payload_p, ct_len,
+					   iv_p, iv_len,
+					   key_p, OMEMO_AES_128_KEY_LENGTH,
+					   (uint8_t *) tag_p, OMEMO_AES_GCM_TAG_LENGTH,
+					   crypto_p->user_data_p,
+					   &pt_p, &pt_len);
+  if (ret_val) {
+    goto cleanup;
+  }
+
+  *plaintext_pp = g_strndup((const char *) pt_p, pt_len);
+
  cleanup:
-  free(ct_p);
-  g_free(payload_b64);
-  free(tag_p);
+  if (iv_p != iv_buf) {
+    g_free(iv_p);
+  }
+  g_free(payload_p);
+  free(pt_p);
 
   return ret_val;
 }
 
+GHashTable * omemo_message_index_keys(const omemo_message* msg_p, const char* jid)
+{
+  if (!msg_p || !msg_p->header_node_p || !jid) {
+    return NULL;
+  }
+  GHashTable * index_p = g_hash_table_new(g_direct_hash, g_direct_equal);
+  mxml_node_t * key_node_p = NULL;
+  const char * key_jid = NULL;
+  const char * rid_string = NULL;
+  gpointer rid_key = NULL;
+  bool has_jids = false;
+
+  for (key_node_p = mxmlFindElement(msg_p->header_node_p, msg_p->header_node_p, KEY_NODE_NAME, NULL, NULL, MXML_DESCEND);
+       key_node_p;
+       key_node_p = mxmlFindElement(key_node_p, msg_p->header_node_p, KEY_NODE_NAME, NULL, NULL, MXML_DESCEND)) {
+    key_jid = mxmlElementGetAttr(key_node_p, KEY_NODE_JID_ATTR_NAME);
+    if (!key_jid && mxmlGetParent(key_node_p) != msg_p->header_node_p) {
+      key_jid = mxmlElementGetAttr(mxmlGetParent(key_node_p), KEY_NODE_JID_ATTR_NAME);
+    }
+    rid_string = mxmlElementGetAttr(key_node_p, KEY_NODE_RID_ATTR_NAME);
+    if (!key_jid || !rid_string) {
+      continue;
+    }
+
+    has_jids = true;
+    if (strcmp(key_jid, jid)) {
+      continue;
+    }
+    // the first key wins if a device is listed twice
+    rid_key = GUINT_TO_POINTER(strtoul(rid_string, NULL, 10));
+    if (!g_hash_table_contains(index_p, rid_key)) {
+      (void) g_hash_table_insert(index_p, rid_key, key_node_p);
+    }
+  }
+
+  if (!has_jids) {
+    g_hash_table_destroy(index_p);
+    return NULL;
+  }
+
+  return index_p;
+}
+
 int omemo_message_has_key(const omemo_message* msg_p)
 {
   if (!msg_p || !msg_p->header_node_p ) return false;
@@ -18,6 +18,35 @@ extern "C" {
 
 #define DELAY_URN "urn:xmpp:delay"
 
+// room for the decoded IV of received messages, 12 or 16 bytes in practice
+#define OMEMO_HELPER_IV_BUF_LEN 32
+
+// bodies and payloads from this size on are encrypted in blocks or decrypted in place, see omemo_message_create_for_text()
+#define OMEMO_HELPER_STREAM_MIN_LEN (16 * 1024)
+// a multiple of 16 for AES-GCM and of 3 for base64
+#define OMEMO_HELPER_STREAM_BLOCK_LEN 3072
+
+// what omemo_message_export_encrypted() adds around the <encrypted> element
+#define EME_NODE_NAME "encryption"
+#define EME_XMLNS "urn:xmpp:eme:0"
+#define EME_NAME "OMEMO"
+#define EME_BODY_TEXT "I sent you an OMEMO encrypted message but your client doesn't seem to support that."
+#define HINTS_STORE_NODE_NAME "store"
+#define HINTS_XMLNS "urn:xmpp:hints"
+#define HTML_NODE_NAME "html"
+
+// in case libomemo does not export them, the names of the <key> elements in the header
+#ifndef KEY_NODE_NAME
+#define KEY_NODE_NAME "key"
+#endif
+#ifndef KEY_NODE_RID_ATTR_NAME
+#define KEY_NODE_RID_ATTR_NAME "rid"
+#endif
+// carried by the <key> element itself, or by the element grouping the keys of one jid
+#ifndef KEY_NODE_JID_ATTR_NAME
+#define KEY_NODE_JID_ATTR_NAME "jid"
+#endif
+
 struct omemo_message {
   mxml_node_t * message_node_p;
   mxml_node_t * header_node_p;
@@ -35,6 +64,41 @@ int omemo_message_set_sender_devid(omemo_message* msg_p, uint32_t sender_device_
 int omemo_message_set_plain_msg(omemo_message* msg_p, const char* pl_msg);
 int omemo_message_pre_encrypt(omemo_message* msg_p, const omemo_crypto_provider * crypto_p);
 int omemo_message_has_key(const omemo_message* msg_p);
+
+//Same as omemo_message_prepare_encryption() with OMEMO_STRIP_ALL, but takes the body text instead of
+//the whole stanza, so it does not need to be serialized and parsed again. The message has no
+//message node, the <encrypted> element has to be put into the stanza by the caller (see header_node_p
+//and payload_node_p). Without text, there is no payload, e.g. for key transport messages.
+//Texts of OMEMO_HELPER_STREAM_MIN_LEN bytes or more are encrypted in blocks, each of which is
+//base64-encoded straight into the payload, which then is a text node (see omemo_text_node_steal()).
+int omemo_message_create_for_text(const char* text, uint32_t sender_device_id,
+				  const omemo_crypto_provider * crypto_p, omemo_message** msg_pp);
+int omemo_message_create_for_text_len(const char* text, size_t text_len, uint32_t sender_device_id,
+				      const omemo_crypto_provider * crypto_p, omemo_message** msg_pp);
+
+//Indexes the keys in the header that are meant for jid in a single pass, mapping
+//GUINT_TO_POINTER(rid) to the <key> element, so that the key of this device can be found by probing
+//the rids in question instead of asking omemo_message_get_encrypted_key() for each of them.
+//Returns NULL if none of the keys carries a jid, i.e. the index cannot be built for the message.
+//Free with g_hash_table_destroy().
+GHashTable * omemo_message_index_keys(const omemo_message* msg_p, const char* jid);
+
+//A node holding a g_malloc()'d text, so that the text can be moved into the outgoing stanza instead
+//of being copied. Takes over the text.
+mxml_node_t * omemo_text_node_new(mxml_node_t * parent_p, char * text, size_t len);
+//Takes the text out of a node created by omemo_text_node_new(). Returns NULL for other nodes,
+//or if the text was taken already.
+char * omemo_text_node_steal(mxml_node_t * node_p, size_t * len_p);
+
+//Counterpart of omemo_message_prepare_decryption(), taking the <header> and <payload> (NULL for key
+//transport messages) elements of the received message instead of the whole stanza. The message takes
+//over the nodes, also on error. It has no message node, so it can't be exported.
+int omemo_message_create_for_decryption(mxml_node_t * header_node_p, mxml_node_t * payload_node_p,
+					 omemo_message** msg_pp);
+//Decrypts the payload with the key from the header, which may have the tag appended, and returns
+//the plaintext as a g_malloc()'d string, instead of exporting it into the stanza.
+int omemo_message_decrypt_payload(const omemo_message* msg_p, const uint8_t* key_p, size_t key_len,
+				  const omemo_crypto_provider * crypto_p, char** plaintext_pp);
 #if 0
 {
 #endif
@@ -0,0 +1,139 @@
+/**
+ * Compares the AES-GCM throughput of libomemo's default functions, which open a cipher handle
+ * for every payload, with lurch's cached per-thread handles, for payloads of different sizes.
+ * Each combination runs for about the given number of milliseconds, e.g.
+ * "build/bench_lurch_crypto 500".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "libomemo.h"
+#include "libomemo_crypto.h"
+
+#include "../src/lurch_crypto.h"
+
+static const size_t bench_sizes[] = { 16, 256, 1024, 4096, 65536 };
+
+typedef struct {
+  const char * name;
+  int (*encrypt_func)(const uint8_t *, size_t, const uint8_t *, size_t, const uint8_t *, size_t, size_t, void *,
+                      uint8_t **, size_t *, uint8_t **);
+  int (*decrypt_func)(const uint8_t *, size_t, const uint8_t *, size_t, const uint8_t *, size_t, uint8_t *, size_t, void *,
+                      uint8_t **, size_t *);
+} bench_impl;
+
+static const bench_impl bench_impls[] = {
+  { LURCH_CRYPTO_AES_GCM_DEFAULT, omemo_default_crypto_aes_gcm_encrypt, omemo_default_crypto_aes_gcm_decrypt },
+  { LURCH_CRYPTO_AES_GCM_CACHED, lurch_crypto_aes_gcm_encrypt, lurch_crypto_aes_gcm_decrypt }
+};
+
+/**
+ * Encrypts and decrypts payloads of the given size until the time is up.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int bench_run(const bench_impl * impl_p, size_t size, gint64 duration_us,
+                     double * enc_mb_per_sec_p, double * dec_mb_per_sec_p, double * msgs_per_sec_p) {
+  uint8_t key[OMEMO_AES_128_KEY_LENGTH];
+  uint8_t iv[OMEMO_AES_GCM_IV_LENGTH];
+  uint8_t * pt_p = g_malloc(size);
+  uint8_t * ct_p = (void *) 0;
+  size_t ct_len = 0;
+  uint8_t * tag_p = (void *) 0;
+  uint8_t * dec_p = (void *) 0;
+  size_t dec_len = 0;
+  gint64 enc_us = 0;
+  gint64 dec_us = 0;
+  gint64 start = 0;
+  gint64 end = 0;
+  long count = 0;
+  int ret_val = 0;
+
+  memset(key, 0x4b, sizeof(key));
+  memset(iv, 0x17, sizeof(iv));
+  memset(pt_p, 0x61, size);
+
+  end = g_get_monotonic_time() + duration_us;
+  while (g_get_monotonic_time() < end) {
+    // a new key for every message, like omemo
+    key[count % sizeof(key)]++;
+
+    start = g_get_monotonic_time();
+    ret_val = impl_p->encrypt_func(pt_p, size, iv, sizeof(iv), key, sizeof(key), OMEMO_AES_GCM_TAG_LENGTH, (void *) 0,
+                                   &ct_p, &ct_len, &tag_p);
+    enc_us += g_get_monotonic_time() - start;
+    if (ret_val) {
+      break;
+    }
+
+    start = g_get_monotonic_time();
+    ret_val = impl_p->decrypt_func(ct_p, ct_len, iv, sizeof(iv), key, sizeof(key), tag_p, OMEMO_AES_GCM_TAG_LENGTH, (void *) 0,
+                                   &dec_p, &dec_len);
+    dec_us += g_get_monotonic_time() - start;
+    if (ret_val || dec_len != size || memcmp(dec_p, pt_p, size)) {
+      ret_val = -1;
+      break;
+    }
+
+    free(ct_p);
+    free(tag_p);
+    free(dec_p);
+    ct_p = (void *) 0;
+    tag_p = (void *) 0;
+    dec_p = (void *) 0;
+    count++;
+  }
+
+  free(ct_p);
+  free(tag_p);
+  free(dec_p);
+  g_free(pt_p);
+
+  if (ret_val || !count) {
+    return -1;
+  }
+
+  *enc_mb_per_sec_p = (double) size * count / enc_us;
+  *dec_mb_per_sec_p = (double) size * count / dec_us;
+  *msgs_per_sec_p = count / ((enc_us + dec_us) / (double) G_USEC_PER_SEC);
+
+  return 0;
+}
+
+int main(int argc, char ** argv) {
+  gint64 duration_us = ((argc > 1) ? atoi(argv[1]) : 500) * 1000;
+  double enc_mb_per_sec = 0;
+  double dec_mb_per_sec = 0;
+  double msgs_per_sec = 0;
+  size_t i = 0;
+  size_t j = 0;
+
+  if (duration_us <= 0) {
+    fprintf(stderr, "usage: %s [ms per run]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  omemo_default_crypto_init();
+  lurch_crypto_init();
+
+  printf("AES and GHASH instructions: %s\n", lurch_crypto_has_aes_hw() ? "yes" : "no");
+  printf("%-8s %8s %12s %12s %14s\n", "impl", "bytes", "enc MB/s", "dec MB/s", "enc+dec/sec");
+
+  for (i = 0; i < G_N_ELEMENTS(bench_sizes); i++) {
+    for (j = 0; j < G_N_ELEMENTS(bench_impls); j++) {
+      if (bench_run(&bench_impls[j], bench_sizes[i], duration_us, &enc_mb_per_sec, &dec_mb_per_sec, &msgs_per_sec)) {
+        fprintf(stderr, "failed to run %s with %zu bytes\n", bench_impls[j].name, bench_sizes[i]);
+        return EXIT_FAILURE;
+      }
+      printf("%-8s %8zu %12.1f %12.1f %14.0f\n", bench_impls[j].name, bench_sizes[i], enc_mb_per_sec, dec_mb_per_sec, msgs_per_sec);
+    }
+  }
+
+  lurch_crypto_teardown();
+  omemo_default_crypto_teardown();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,250 @@
+/**
+ * Compares how long the main loop stalls while bursts of received messages are decrypted on it,
+ * as lurch_xml_received_cb() does by default, against handing them to a worker through lurch_pipe
+ * and only passing them on from the main loop, as with LURCH_PREF_DECRYPT_ASYNC.
+ * A timer ticking every millisecond stands in for the UI, its lateness is the stall.
+ * The work per message is a chain key step, the decryption of its key and payload and,
+ * in place of saving the session, a wait of the given number of microseconds, e.g.
+ * "build/bench_lurch_decrypt_latency 2000 50 200" for 2000 messages in bursts of 50 with 200 us of I/O each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "libomemo.h"
+#include "libomemo_crypto.h"
+#include "signal_protocol.h"
+
+#include "../src/lurch_crypto.h"
+#include "../src/lurch_pipe.h"
+
+#define BENCH_TICK_MS 1
+#define BENCH_BURST_INTERVAL_MS 20
+#define BENCH_PAYLOAD_LEN 1024
+#define BENCH_KEY_LEN 32
+#define BENCH_CHAIN_STEPS 4
+
+typedef struct {
+  GMainLoop * loop_p;
+  lurch_pipe * pipe_p;     // NULL in synchronous mode
+  guint msgs;
+  guint burst;
+  gulong io_us;
+  guint sent;
+  guint done;
+  int errors;
+
+  uint8_t key[OMEMO_AES_128_KEY_LENGTH];
+  uint8_t iv[OMEMO_AES_GCM_IV_LENGTH];
+  uint8_t * ct_p;
+  size_t ct_len;
+  uint8_t * tag_p;
+
+  gint64 next_tick_us;
+  GArray * stalls_p;       // of gint64, the lateness of every tick in us
+} bench_state;
+
+typedef struct {
+  bench_state * state_p;
+  int ret_val;
+} bench_msg;
+
+/**
+ * Roughly what decrypting a message costs apart from parsing it.
+ */
+static void bench_msg_work(void * data_p) {
+  bench_msg * msg_p = data_p;
+  bench_state * state_p = msg_p->state_p;
+  uint8_t chain_key[BENCH_KEY_LEN];
+  void * hmac_p = (void *) 0;
+  signal_buffer * out_p = (void *) 0;
+  uint8_t * pt_p = (void *) 0;
+  size_t pt_len = 0;
+  int i = 0;
+
+  memset(chain_key, 0x2a, sizeof(chain_key));
+  for (i = 0; i < BENCH_CHAIN_STEPS && !msg_p->ret_val; i++) {
+    msg_p->ret_val = lurch_crypto_hmac_sha256_init(&hmac_p, chain_key, sizeof(chain_key), (void *) 0);
+    if (!msg_p->ret_val) {
+      msg_p->ret_val = lurch_crypto_hmac_sha256_update(hmac_p, (const uint8_t *) "\x02", 1, (void *) 0);
+    }
+    if (!msg_p->ret_val) {
+      msg_p->ret_val = lurch_crypto_hmac_sha256_final(hmac_p, &out_p, (void *) 0);
+    }
+    lurch_crypto_hmac_sha256_cleanup(hmac_p, (void *) 0);
+    hmac_p = (void *) 0;
+    if (out_p) {
+      memcpy(chain_key, signal_buffer_data(out_p), sizeof(chain_key));
+      signal_buffer_free(out_p);
+      out_p = (void *) 0;
+    }
+  }
+
+  if (!msg_p->ret_val) {
+    msg_p->ret_val = lurch_crypto_aes_gcm_decrypt(state_p->ct_p, state_p->ct_len, state_p->iv, sizeof(state_p->iv),
+                                                  state_p->key, sizeof(state_p->key), state_p->tag_p, OMEMO_AES_GCM_TAG_LENGTH,
+                                                  (void *) 0, &pt_p, &pt_len);
+  }
+  free(pt_p);
+
+  if (state_p->io_us) {
+    g_usleep(state_p->io_us);
+  }
+}
+
+/**
+ * Passing the message on to libpurple, on the main loop.
+ */
+static void bench_msg_done(void * data_p, void * user_data) {
+  bench_msg * msg_p = data_p;
+  bench_state * state_p = user_data;
+
+  if (msg_p->ret_val) {
+    state_p->errors++;
+  }
+  g_free(msg_p);
+
+  state_p->done++;
+  if (state_p->done == state_p->msgs) {
+    g_main_loop_quit(state_p->loop_p);
+  }
+}
+
+/**
+ * A burst of messages read from the connection at once.
+ */
+static gboolean bench_burst_cb(gpointer data) {
+  bench_state * state_p = data;
+  bench_msg * msg_p = (void *) 0;
+  guint i = 0;
+
+  for (i = 0; i < state_p->burst && state_p->sent < state_p->msgs; i++, state_p->sent++) {
+    msg_p = g_malloc0(sizeof(bench_msg));
+    msg_p->state_p = state_p;
+
+    if (state_p->pipe_p) {
+      lurch_pipe_push(state_p->pipe_p, bench_msg_work, msg_p);
+    } else {
+      bench_msg_work(msg_p);
+      bench_msg_done(msg_p, state_p);
+    }
+  }
+
+  return state_p->sent < state_p->msgs ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static gboolean bench_tick_cb(gpointer data) {
+  bench_state * state_p = data;
+  gint64 now_us = g_get_monotonic_time();
+  gint64 stall_us = MAX(now_us - state_p->next_tick_us, 0);
+
+  g_array_append_val(state_p->stalls_p, stall_us);
+  state_p->next_tick_us = now_us + BENCH_TICK_MS * 1000;
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gint bench_cmp_stall(gconstpointer a, gconstpointer b) {
+  gint64 x = *(const gint64 *) a;
+  gint64 y = *(const gint64 *) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Delivers all messages in bursts and records the lateness of the ticks meanwhile.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int bench_run(bench_state * state_p, gboolean async, double * total_ms_p, double * max_ms_p, double * p99_ms_p) {
+  guint tick_id = 0;
+  gint64 start_us = 0;
+
+  state_p->sent = 0;
+  state_p->done = 0;
+  state_p->errors = 0;
+  state_p->stalls_p = g_array_new(FALSE, FALSE, sizeof(gint64));
+  state_p->loop_p = g_main_loop_new((void *) 0, FALSE);
+  state_p->pipe_p = async ? lurch_pipe_new("bench-decrypt", bench_msg_done, (void *) 0, (void *) 0, (void *) 0, state_p) : (void *) 0;
+  if (async && !state_p->pipe_p) {
+    return -1;
+  }
+
+  start_us = g_get_monotonic_time();
+  state_p->next_tick_us = start_us + BENCH_TICK_MS * 1000;
+  tick_id = g_timeout_add(BENCH_TICK_MS, bench_tick_cb, state_p);
+  (void) g_timeout_add(BENCH_BURST_INTERVAL_MS, bench_burst_cb, state_p);
+
+  g_main_loop_run(state_p->loop_p);
+  *total_ms_p = (g_get_monotonic_time() - start_us) / 1000.0;
+
+  (void) g_source_remove(tick_id);
+  lurch_pipe_free(state_p->pipe_p, g_free);
+  state_p->pipe_p = (void *) 0;
+  g_main_loop_unref(state_p->loop_p);
+
+  g_array_sort(state_p->stalls_p, bench_cmp_stall);
+  if (state_p->stalls_p->len) {
+    *max_ms_p = g_array_index(state_p->stalls_p, gint64, state_p->stalls_p->len - 1) / 1000.0;
+    *p99_ms_p = g_array_index(state_p->stalls_p, gint64, state_p->stalls_p->len * 99 / 100) / 1000.0;
+  } else {
+    *max_ms_p = 0;
+    *p99_ms_p = 0;
+  }
+  g_array_free(state_p->stalls_p, TRUE);
+
+  return state_p->errors ? -1 : 0;
+}
+
+int main(int argc, char ** argv) {
+  bench_state state;
+  uint8_t * pt_p = g_malloc(BENCH_PAYLOAD_LEN);
+  double total_ms = 0;
+  double max_ms = 0;
+  double p99_ms = 0;
+  int i = 0;
+  int ret_val = 0;
+
+  memset(&state, 0, sizeof(state));
+  state.msgs = (argc > 1) ? atoi(argv[1]) : 2000;
+  state.burst = (argc > 2) ? atoi(argv[2]) : 50;
+  state.io_us = (argc > 3) ? atol(argv[3]) : 200;
+
+  if (!state.msgs || !state.burst) {
+    fprintf(stderr, "usage: %s [messages] [messages per burst] [us of I/O per message]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  lurch_crypto_init();
+
+  memset(state.key, 0x4b, sizeof(state.key));
+  memset(state.iv, 0x17, sizeof(state.iv));
+  memset(pt_p, 0x61, BENCH_PAYLOAD_LEN);
+  ret_val = lurch_crypto_aes_gcm_encrypt(pt_p, BENCH_PAYLOAD_LEN, state.iv, sizeof(state.iv), state.key, sizeof(state.key),
+                                         OMEMO_AES_GCM_TAG_LENGTH, (void *) 0, &state.ct_p, &state.ct_len, &state.tag_p);
+  g_free(pt_p);
+  if (ret_val) {
+    fprintf(stderr, "failed to encrypt the payload (%i)\n", ret_val);
+    return EXIT_FAILURE;
+  }
+
+  printf("%u messages in bursts of %u every %i ms, %lu us of I/O each\n",
+         state.msgs, state.burst, BENCH_BURST_INTERVAL_MS, state.io_us);
+  printf("%-6s %12s %16s %16s\n", "mode", "total ms", "max stall ms", "p99 stall ms");
+
+  for (i = 0; i < 2; i++) {
+    if (bench_run(&state, i == 1, &total_ms, &max_ms, &p99_ms)) {
+      fprintf(stderr, "failed to run the %s mode\n", i ? "async" : "sync");
+      return EXIT_FAILURE;
+    }
+    printf("%-6s %12.1f %16.2f %16.2f\n", i ? "async" : "sync", total_ms, max_ms, p99_ms);
+  }
+
+  free(state.ct_p);
+  free(state.tag_p);
+  lurch_crypto_teardown();
+
+  return EXIT_SUCCESS;
+}
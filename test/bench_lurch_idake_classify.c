@@ -0,0 +1,105 @@
+/**
+ * Measures what received signal messages used to pay for the speculative IDAKE parse, i.e. a protobuf
+ * unpack bound to fail, against the check of the first byte that now sends them to the ratchet directly.
+ * Also checks that the unpack indeed fails for every message the check rules out.
+ * The key ciphertexts are random bytes behind libsignal's version byte, with the usual lengths of
+ * signal and pre key signal messages, e.g. "build/bench_lurch_idake_classify 500".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "idake2session.h"
+
+#include "../src/axc_dakes_intf.h"
+
+#define BENCH_MSGS 1024
+#define BENCH_VERSION_BYTE 0x33
+
+static const size_t bench_sizes[] = { 74, 150, 220 };
+
+/**
+ * Runs the function over all messages until the time is up.
+ *
+ * @return The time per message in nanoseconds.
+ */
+static double bench_run(int (*classify_func)(const uint8_t *, size_t), uint8_t ** msgs_pp, size_t len, gint64 duration_us) {
+  gint64 start = 0;
+  gint64 elapsed = 0;
+  long count = 0;
+  volatile int sink = 0;
+  int i = 0;
+
+  start = g_get_monotonic_time();
+  do {
+    for (i = 0; i < BENCH_MSGS; i++) {
+      sink += classify_func(msgs_pp[i], len);
+    }
+    count += BENCH_MSGS;
+    elapsed = g_get_monotonic_time() - start;
+  } while (elapsed < duration_us);
+
+  (void) sink;
+  return elapsed * 1000.0 / count;
+}
+
+/**
+ * What dakectx_handle_idakemsg() did for every message before: try to unpack it.
+ */
+static int bench_unpack(const uint8_t * msg_p, size_t len) {
+  Signaldakez__IdakeMessage * idakemsg_p = signaldakez__idake_message__unpack((void *) 0, len, msg_p);
+
+  if (!idakemsg_p) {
+    return 0;
+  }
+
+  signaldakez__idake_message__free_unpacked(idakemsg_p, (void *) 0);
+  return 1;
+}
+
+int main(int argc, char ** argv) {
+  gint64 duration_us = ((argc > 1) ? atoi(argv[1]) : 500) * 1000;
+  GRand * rand_p = g_rand_new_with_seed(1317);
+  uint8_t * msgs[BENCH_MSGS];
+  double unpack_ns = 0;
+  double check_ns = 0;
+  size_t i = 0;
+  size_t j = 0;
+  size_t k = 0;
+
+  if (duration_us <= 0) {
+    fprintf(stderr, "usage: %s [ms per run]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("%6s %14s %14s\n", "bytes", "unpack ns/msg", "check ns/msg");
+
+  for (i = 0; i < G_N_ELEMENTS(bench_sizes); i++) {
+    for (j = 0; j < BENCH_MSGS; j++) {
+      msgs[j] = g_malloc(bench_sizes[i]);
+      msgs[j][0] = BENCH_VERSION_BYTE;
+      for (k = 1; k < bench_sizes[i]; k++) {
+        msgs[j][k] = g_rand_int_range(rand_p, 0, 256);
+      }
+
+      if (dakectx_msg_may_be_idakemsg(msgs[j], bench_sizes[i]) || bench_unpack(msgs[j], bench_sizes[i])) {
+        fprintf(stderr, "message %zu of %zu bytes was not told apart from an IDAKE message\n", j, bench_sizes[i]);
+        return EXIT_FAILURE;
+      }
+    }
+
+    unpack_ns = bench_run(bench_unpack, msgs, bench_sizes[i], duration_us);
+    check_ns = bench_run(dakectx_msg_may_be_idakemsg, msgs, bench_sizes[i], duration_us);
+    printf("%6zu %14.1f %14.1f\n", bench_sizes[i], unpack_ns, check_ns);
+
+    for (j = 0; j < BENCH_MSGS; j++) {
+      g_free(msgs[j]);
+    }
+  }
+
+  g_rand_free(rand_p);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+/**
+ * Compares the session backends: how many messages per second they can save,
+ * how long opening the store takes with all sessions in place, and how many
+ * sessions per second can be loaded afterwards.
+ *
+ * The sessions are spread over contacts with a handful of devices each.
+ * Run it on the disk the purple user dir lives on, e.g.
+ * "build/bench_lurch_sess_backend 5000 ~/.purple".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sqlite3.h>
+
+#include "axc.h"
+#include "signal_protocol.h"
+
+#include "../src/lurch_store.h"
+#include "../src/lurch_util.h"
+
+#define BENCH_UNAME "bench-uname@example.com"
+#define BENCH_DEVICES_PER_CONTACT 4
+#define BENCH_DEVICES_PER_MSG 3
+#define BENCH_RECORD_LEN 1024
+#define BENCH_LOADS 20000
+
+// same tables as created by axc
+#define AXC_TABLES "CREATE TABLE IF NOT EXISTS session_store(" \
+                     "name TEXT NOT NULL, " \
+                     "name_len INTEGER NOT NULL, " \
+                     "device_id INTEGER NOT NULL, " \
+                     "session_record BLOB NOT NULL, " \
+                     "record_len INTEGER NOT NULL, " \
+                     "PRIMARY KEY(name, device_id));" \
+                   "CREATE TABLE IF NOT EXISTS pre_key_store(" \
+                     "id INTEGER NOT NULL PRIMARY KEY, " \
+                     "pre_key_record BLOB NOT NULL, " \
+                     "record_len INTEGER NOT NULL);"
+
+static char * bench_dir = (void *) 0;
+static const char * bench_backend = (void *) 0;
+static const char * bench_sync = (void *) 0;
+
+const char * __wrap_purple_user_dir(void) {
+  return bench_dir;
+}
+
+int __wrap_purple_prefs_get_int(const char * pref_name) {
+  (void) pref_name;
+  return 256;
+}
+
+const char * __wrap_purple_prefs_get_string(const char * pref_name) {
+  if (!g_strcmp0(pref_name, LURCH_PREF_STORE_SESS_BACKEND)) {
+    return bench_backend;
+  }
+  if (!g_strcmp0(pref_name, LURCH_PREF_STORE_OMEMO_JOURNAL) || !g_strcmp0(pref_name, LURCH_PREF_STORE_AXC_JOURNAL)) {
+    return LURCH_STORE_JOURNAL_WAL;
+  }
+  return bench_sync;
+}
+
+void __wrap_purple_debug_error(const char * category, const char * format, ...) {
+}
+
+void __wrap_purple_debug_info(const char * category, const char * format, ...) {
+}
+
+static void bench_remove_files(void) {
+  const char * names[] = { LURCH_DB_NAME_OMEMO, LURCH_DB_NAME_AXC };
+  const char * suffixes[] = { "", "-wal", "-shm", "-journal" };
+  char * db_fn = (void *) 0;
+  char * fn = (void *) 0;
+  size_t i = 0;
+  size_t j = 0;
+
+  for (i = 0; i < G_N_ELEMENTS(names); i++) {
+    db_fn = lurch_util_uname_get_db_fn(BENCH_UNAME, names[i]);
+    for (j = 0; j < G_N_ELEMENTS(suffixes); j++) {
+      fn = g_strconcat(db_fn, suffixes[j], NULL);
+      g_unlink(fn);
+      g_free(fn);
+    }
+    g_free(db_fn);
+  }
+
+  fn = g_strconcat(bench_dir, "/", BENCH_UNAME, "_", LURCH_KV_NAME_SESSIONS, LURCH_KV_SUFFIX, NULL);
+  g_unlink(fn);
+  g_free(fn);
+}
+
+static void bench_addr(signal_protocol_address * addr_p, char * name_buf, size_t name_buf_len, int session) {
+  addr_p->name_len = g_snprintf(name_buf, name_buf_len, "contact%d@example.com", session / BENCH_DEVICES_PER_CONTACT);
+  addr_p->name = name_buf;
+  addr_p->device_id = session % BENCH_DEVICES_PER_CONTACT + 1;
+}
+
+static double bench_per_sec(int count, gint64 usecs) {
+  return count / (usecs / (double) G_USEC_PER_SEC);
+}
+
+/**
+ * Saves the sessions a few per message, reopens the store and loads random sessions.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int bench_run(int sess_count, double * store_per_sec_p, double * open_ms_p, double * load_per_sec_p) {
+  lurch_store * store_p = (void *) 0;
+  axc_context * fake_ctx_p = (void *) &"fake non-null pointer";
+  const signal_protocol_session_store * sess_store_p = &lurch_store_session_store_tmpl;
+  signal_protocol_address addr = { 0 };
+  char name_buf[64];
+  uint8_t record[BENCH_RECORD_LEN];
+  signal_buffer * record_buf_p = (void *) 0;
+  sqlite3 * db_p = (void *) 0;
+  char * db_fn = (void *) 0;
+  GRand * rand_p = (void *) 0;
+  gint64 start = 0;
+  int i = 0;
+  int j = 0;
+
+  bench_remove_files();
+  db_fn = lurch_util_uname_get_db_fn(BENCH_UNAME, LURCH_DB_NAME_AXC);
+  if (sqlite3_open(db_fn, &db_p) != SQLITE_OK || sqlite3_exec(db_p, AXC_TABLES, NULL, NULL, NULL) != SQLITE_OK) {
+    sqlite3_close(db_p);
+    g_free(db_fn);
+    return -1;
+  }
+  sqlite3_close(db_p);
+  g_free(db_fn);
+
+  if (lurch_store_get(BENCH_UNAME, &store_p) || lurch_store_apply_durability(store_p)) {
+    return -1;
+  }
+  lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+  lurch_store_sync(store_p);
+
+  memset(record, 0xab, sizeof(record));
+
+  start = g_get_monotonic_time();
+  for (i = 0; i < sess_count; i += BENCH_DEVICES_PER_MSG) {
+    lurch_store_msg_begin(store_p);
+    for (j = i; j < i + BENCH_DEVICES_PER_MSG && j < sess_count; j++) {
+      bench_addr(&addr, name_buf, sizeof(name_buf), j);
+      record[0] = j;
+      if (sess_store_p->store_session_func(&addr, record, sizeof(record), NULL, 0, fake_ctx_p)) {
+        lurch_store_msg_rollback(store_p);
+        return -1;
+      }
+    }
+    if (lurch_store_msg_commit(store_p)) {
+      return -1;
+    }
+  }
+  *store_per_sec_p = bench_per_sec((sess_count + BENCH_DEVICES_PER_MSG - 1) / BENCH_DEVICES_PER_MSG, g_get_monotonic_time() - start);
+
+  lurch_store_reset_all();
+
+  // the first load is part of the cold start, as the db only reads its pages on demand
+  start = g_get_monotonic_time();
+  if (lurch_store_get(BENCH_UNAME, &store_p)) {
+    return -1;
+  }
+  lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+  bench_addr(&addr, name_buf, sizeof(name_buf), sess_count - 1);
+  if (sess_store_p->load_session_func(&record_buf_p, NULL, &addr, fake_ctx_p) != 1) {
+    return -1;
+  }
+  *open_ms_p = (g_get_monotonic_time() - start) / 1000.0;
+  signal_buffer_free(record_buf_p);
+
+  rand_p = g_rand_new_with_seed(1317);
+  start = g_get_monotonic_time();
+  for (i = 0; i < BENCH_LOADS; i++) {
+    bench_addr(&addr, name_buf, sizeof(name_buf), g_rand_int_range(rand_p, 0, sess_count));
+    if (sess_store_p->load_session_func(&record_buf_p, NULL, &addr, fake_ctx_p) != 1) {
+      g_rand_free(rand_p);
+      return -1;
+    }
+    signal_buffer_free(record_buf_p);
+  }
+  *load_per_sec_p = bench_per_sec(BENCH_LOADS, g_get_monotonic_time() - start);
+  g_rand_free(rand_p);
+
+  lurch_store_reset_all();
+  bench_remove_files();
+
+  return 0;
+}
+
+int main(int argc, char ** argv) {
+  const char * backends[] = { LURCH_STORE_BACKEND_SQLITE, LURCH_STORE_BACKEND_MMAP };
+  const char * sync_levels[] = { LURCH_STORE_SYNC_FULL, LURCH_STORE_SYNC_NORMAL };
+  int sess_count = (argc > 1) ? atoi(argv[1]) : 5000;
+  double store_per_sec = 0;
+  double open_ms = 0;
+  double load_per_sec = 0;
+  size_t i = 0;
+  size_t j = 0;
+
+  bench_dir = (argc > 2) ? g_strdup(argv[2]) : g_dir_make_tmp("lurch-bench-XXXXXX", NULL);
+  if (!bench_dir || sess_count <= 0) {
+    fprintf(stderr, "usage: %s [session count] [dir]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("%d sessions of %d bytes each, %d per message, %d random loads, in %s\n",
+         sess_count, BENCH_RECORD_LEN, BENCH_DEVICES_PER_MSG, BENCH_LOADS, bench_dir);
+  printf("%-8s %-8s %12s %12s %12s\n", "backend", "sync", "msgs/sec", "open ms", "loads/sec");
+
+  for (i = 0; i < G_N_ELEMENTS(backends); i++) {
+    for (j = 0; j < G_N_ELEMENTS(sync_levels); j++) {
+      bench_backend = backends[i];
+      bench_sync = sync_levels[j];
+
+      if (bench_run(sess_count, &store_per_sec, &open_ms, &load_per_sec)) {
+        fprintf(stderr, "failed to run with %s/%s\n", bench_backend, bench_sync);
+        return EXIT_FAILURE;
+      }
+      printf("%-8s %-8s %12.1f %12.2f %12.1f\n", bench_backend, bench_sync, store_per_sec, open_ms, load_per_sec);
+    }
+  }
+
+  if (argc <= 2) {
+    g_rmdir(bench_dir);
+  }
+  g_free(bench_dir);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,188 @@
+/**
+ * Compares axc's crypto provider, which opens a libgcrypt handle for every operation, with
+ * lurch's cached per-thread handles, for each primitive libsignal uses in a ratchet step:
+ * HMAC-SHA256 (chain and message keys, message MACs), SHA-512 (fingerprints) and AES-CBC.
+ * Each combination runs for about the given number of milliseconds, e.g.
+ * "build/bench_lurch_signal_crypto 500".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "axc.h"
+#include "libomemo_crypto.h"
+#include "signal_protocol.h"
+
+#include "../src/lurch_crypto.h"
+
+#define BENCH_KEY_LEN 32
+#define BENCH_IV_LEN 16
+
+typedef enum {
+  BENCH_HMAC_SHA256,
+  BENCH_SHA512,
+  BENCH_AES_CBC_ENCRYPT,
+  BENCH_AES_CBC_DECRYPT
+} bench_primitive;
+
+typedef struct {
+  bench_primitive primitive;
+  const char * name;
+  size_t size;
+} bench_case;
+
+// a chain key step HMACs a single byte
+static const bench_case bench_cases[] = {
+  { BENCH_HMAC_SHA256, "hmac-sha256", 1 },
+  { BENCH_HMAC_SHA256, "hmac-sha256", 1024 },
+  { BENCH_SHA512, "sha512", 64 },
+  { BENCH_SHA512, "sha512", 1024 },
+  { BENCH_AES_CBC_ENCRYPT, "aes-cbc-enc", 16 },
+  { BENCH_AES_CBC_ENCRYPT, "aes-cbc-enc", 1024 },
+  { BENCH_AES_CBC_ENCRYPT, "aes-cbc-enc", 4096 },
+  { BENCH_AES_CBC_DECRYPT, "aes-cbc-dec", 16 },
+  { BENCH_AES_CBC_DECRYPT, "aes-cbc-dec", 1024 },
+  { BENCH_AES_CBC_DECRYPT, "aes-cbc-dec", 4096 }
+};
+
+/**
+ * Runs one operation of the primitive.
+ *
+ * @return 0 on success, negative on error.
+ */
+static int bench_op(const signal_crypto_provider * provider_p, const bench_case * case_p,
+                    const uint8_t * key_p, const uint8_t * iv_p, const uint8_t * data_p,
+                    const uint8_t * ct_p, size_t ct_len) {
+  void * ctx_p = (void *) 0;
+  signal_buffer * output_p = (void *) 0;
+  int ret_val = 0;
+
+  switch (case_p->primitive) {
+    case BENCH_HMAC_SHA256:
+      ret_val = provider_p->hmac_sha256_init_func(&ctx_p, key_p, BENCH_KEY_LEN, provider_p->user_data);
+      if (ret_val) {
+        return ret_val;
+      }
+      ret_val = provider_p->hmac_sha256_update_func(ctx_p, data_p, case_p->size, provider_p->user_data);
+      if (!ret_val) {
+        ret_val = provider_p->hmac_sha256_final_func(ctx_p, &output_p, provider_p->user_data);
+      }
+      provider_p->hmac_sha256_cleanup_func(ctx_p, provider_p->user_data);
+      break;
+    case BENCH_SHA512:
+      ret_val = provider_p->sha512_digest_init_func(&ctx_p, provider_p->user_data);
+      if (ret_val) {
+        return ret_val;
+      }
+      ret_val = provider_p->sha512_digest_update_func(ctx_p, data_p, case_p->size, provider_p->user_data);
+      if (!ret_val) {
+        ret_val = provider_p->sha512_digest_final_func(ctx_p, &output_p, provider_p->user_data);
+      }
+      provider_p->sha512_digest_cleanup_func(ctx_p, provider_p->user_data);
+      break;
+    case BENCH_AES_CBC_ENCRYPT:
+      ret_val = provider_p->encrypt_func(&output_p, SG_CIPHER_AES_CBC_PKCS5, key_p, BENCH_KEY_LEN, iv_p, BENCH_IV_LEN,
+                                         data_p, case_p->size, provider_p->user_data);
+      break;
+    case BENCH_AES_CBC_DECRYPT:
+      ret_val = provider_p->decrypt_func(&output_p, SG_CIPHER_AES_CBC_PKCS5, key_p, BENCH_KEY_LEN, iv_p, BENCH_IV_LEN,
+                                         ct_p, ct_len, provider_p->user_data);
+      if (!ret_val && (signal_buffer_len(output_p) != case_p->size || memcmp(signal_buffer_data(output_p), data_p, case_p->size))) {
+        ret_val = -1;
+      }
+      break;
+  }
+
+  signal_buffer_free(output_p);
+  return ret_val;
+}
+
+/**
+ * Runs the primitive until the time is up.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int bench_run(const signal_crypto_provider * provider_p, const bench_case * case_p, gint64 duration_us,
+                     double * ops_per_sec_p, double * mb_per_sec_p) {
+  uint8_t key[BENCH_KEY_LEN];
+  uint8_t iv[BENCH_IV_LEN];
+  uint8_t * data_p = g_malloc(case_p->size);
+  signal_buffer * ct_buf_p = (void *) 0;
+  gint64 start = 0;
+  gint64 elapsed = 0;
+  long count = 0;
+  int ret_val = 0;
+
+  memset(key, 0x4b, sizeof(key));
+  memset(iv, 0x17, sizeof(iv));
+  memset(data_p, 0x61, case_p->size);
+
+  // the ciphertext to decrypt comes from axc's provider, so that the implementations are checked against each other
+  if (case_p->primitive == BENCH_AES_CBC_DECRYPT
+      && axc_crypto_provider_tmpl.encrypt_func(&ct_buf_p, SG_CIPHER_AES_CBC_PKCS5, key, sizeof(key), iv, sizeof(iv),
+                                               data_p, case_p->size, axc_crypto_provider_tmpl.user_data)) {
+    g_free(data_p);
+    return -1;
+  }
+
+  start = g_get_monotonic_time();
+  do {
+    ret_val = bench_op(provider_p, case_p, key, iv, data_p,
+                       ct_buf_p ? signal_buffer_data(ct_buf_p) : (void *) 0, ct_buf_p ? signal_buffer_len(ct_buf_p) : 0);
+    count++;
+    elapsed = g_get_monotonic_time() - start;
+  } while (!ret_val && elapsed < duration_us);
+
+  signal_buffer_free(ct_buf_p);
+  g_free(data_p);
+
+  if (ret_val) {
+    return -1;
+  }
+
+  *ops_per_sec_p = count / (elapsed / (double) G_USEC_PER_SEC);
+  *mb_per_sec_p = (double) case_p->size * count / elapsed;
+
+  return 0;
+}
+
+int main(int argc, char ** argv) {
+  gint64 duration_us = ((argc > 1) ? atoi(argv[1]) : 500) * 1000;
+  signal_crypto_provider cached = axc_crypto_provider_tmpl;
+  const signal_crypto_provider * providers[] = { &axc_crypto_provider_tmpl, &cached };
+  const char * names[] = { LURCH_CRYPTO_SIGNAL_DEFAULT, LURCH_CRYPTO_SIGNAL_CACHED };
+  double ops_per_sec = 0;
+  double mb_per_sec = 0;
+  size_t i = 0;
+  size_t j = 0;
+
+  if (duration_us <= 0) {
+    fprintf(stderr, "usage: %s [ms per run]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  omemo_default_crypto_init();
+  lurch_crypto_init();
+  lurch_crypto_signal_provider_select(&cached, LURCH_CRYPTO_SIGNAL_CACHED);
+
+  printf("AES and GHASH instructions: %s, SHA instructions: %s\n",
+         lurch_crypto_has_aes_hw() ? "yes" : "no", lurch_crypto_has_sha_hw() ? "yes" : "no");
+  printf("%-12s %6s %-8s %12s %10s\n", "primitive", "bytes", "impl", "ops/sec", "MB/s");
+
+  for (i = 0; i < G_N_ELEMENTS(bench_cases); i++) {
+    for (j = 0; j < G_N_ELEMENTS(providers); j++) {
+      if (bench_run(providers[j], &bench_cases[i], duration_us, &ops_per_sec, &mb_per_sec)) {
+        fprintf(stderr, "failed to run %s with %zu bytes on %s\n", bench_cases[i].name, bench_cases[i].size, names[j]);
+        return EXIT_FAILURE;
+      }
+      printf("%-12s %6zu %-8s %12.0f %10.1f\n", bench_cases[i].name, bench_cases[i].size, names[j], ops_per_sec, mb_per_sec);
+    }
+  }
+
+  lurch_crypto_teardown();
+  omemo_default_crypto_teardown();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,180 @@
+/**
+ * Measures how many messages per second the session store can save
+ * with the different journal modes and sync levels.
+ *
+ * Each message writes the session records of a few devices in one transaction,
+ * the same as lurch_msg_encrypt_for_addrs() does. Run it on the disk the
+ * purple user dir lives on, e.g. "build/bench_lurch_store 500 ~/.purple".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sqlite3.h>
+
+#include "axc.h"
+#include "signal_protocol.h"
+
+#include "../src/lurch_store.h"
+#include "../src/lurch_util.h"
+
+#define BENCH_UNAME "bench-uname@example.com"
+#define BENCH_DEVICES_PER_MSG 3
+#define BENCH_RECORD_LEN 1024
+
+// same tables as created by axc
+#define AXC_TABLES "CREATE TABLE IF NOT EXISTS session_store(" \
+                     "name TEXT NOT NULL, " \
+                     "name_len INTEGER NOT NULL, " \
+                     "device_id INTEGER NOT NULL, " \
+                     "session_record BLOB NOT NULL, " \
+                     "record_len INTEGER NOT NULL, " \
+                     "PRIMARY KEY(name, device_id));" \
+                   "CREATE TABLE IF NOT EXISTS pre_key_store(" \
+                     "id INTEGER NOT NULL PRIMARY KEY, " \
+                     "pre_key_record BLOB NOT NULL, " \
+                     "record_len INTEGER NOT NULL);"
+
+static char * bench_dir = (void *) 0;
+static const char * bench_journal_mode = (void *) 0;
+static const char * bench_sync = (void *) 0;
+
+const char * __wrap_purple_user_dir(void) {
+  return bench_dir;
+}
+
+int __wrap_purple_prefs_get_int(const char * pref_name) {
+  (void) pref_name;
+  return 256;
+}
+
+const char * __wrap_purple_prefs_get_string(const char * pref_name) {
+  if (!g_strcmp0(pref_name, LURCH_PREF_STORE_OMEMO_JOURNAL) || !g_strcmp0(pref_name, LURCH_PREF_STORE_AXC_JOURNAL)) {
+    return bench_journal_mode;
+  }
+  return bench_sync;
+}
+
+void __wrap_purple_debug_error(const char * category, const char * format, ...) {
+}
+
+void __wrap_purple_debug_info(const char * category, const char * format, ...) {
+}
+
+static void bench_remove_dbs(void) {
+  const char * names[] = { LURCH_DB_NAME_OMEMO, LURCH_DB_NAME_AXC };
+  const char * suffixes[] = { "", "-wal", "-shm", "-journal" };
+  char * db_fn = (void *) 0;
+  char * fn = (void *) 0;
+  size_t i = 0;
+  size_t j = 0;
+
+  for (i = 0; i < G_N_ELEMENTS(names); i++) {
+    db_fn = lurch_util_uname_get_db_fn(BENCH_UNAME, names[i]);
+    for (j = 0; j < G_N_ELEMENTS(suffixes); j++) {
+      fn = g_strconcat(db_fn, suffixes[j], NULL);
+      g_unlink(fn);
+      g_free(fn);
+    }
+    g_free(db_fn);
+  }
+}
+
+/**
+ * @return The messages per second, or a negative value on error.
+ */
+static double bench_run(int msg_count) {
+  lurch_store * store_p = (void *) 0;
+  axc_context * fake_ctx_p = (void *) &"fake non-null pointer";
+  const signal_protocol_session_store * sess_store_p = &lurch_store_session_store_tmpl;
+  signal_protocol_address addr = { .name = "alice@example.com", .name_len = 17, .device_id = 0 };
+  uint8_t record[BENCH_RECORD_LEN];
+  sqlite3 * db_p = (void *) 0;
+  char * db_fn = (void *) 0;
+  gint64 start = 0;
+  gint64 elapsed = 0;
+  int i = 0;
+  int j = 0;
+
+  bench_remove_dbs();
+  db_fn = lurch_util_uname_get_db_fn(BENCH_UNAME, LURCH_DB_NAME_AXC);
+  if (sqlite3_open(db_fn, &db_p) != SQLITE_OK || sqlite3_exec(db_p, AXC_TABLES, NULL, NULL, NULL) != SQLITE_OK) {
+    sqlite3_close(db_p);
+    g_free(db_fn);
+    return -1;
+  }
+  sqlite3_close(db_p);
+  g_free(db_fn);
+
+  if (lurch_store_get(BENCH_UNAME, &store_p) || lurch_store_apply_durability(store_p)) {
+    return -1;
+  }
+  lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+  lurch_store_sync(store_p);
+
+  memset(record, 0xab, sizeof(record));
+
+  start = g_get_monotonic_time();
+  for (i = 0; i < msg_count; i++) {
+    lurch_store_msg_begin(store_p);
+    for (j = 0; j < BENCH_DEVICES_PER_MSG; j++) {
+      addr.device_id = j + 1;
+      record[0] = i;
+      if (sess_store_p->store_session_func(&addr, record, sizeof(record), NULL, 0, fake_ctx_p)) {
+        lurch_store_msg_rollback(store_p);
+        return -1;
+      }
+    }
+    if (lurch_store_msg_commit(store_p)) {
+      return -1;
+    }
+  }
+  elapsed = g_get_monotonic_time() - start;
+
+  lurch_store_reset_all();
+  bench_remove_dbs();
+
+  return msg_count / (elapsed / (double) G_USEC_PER_SEC);
+}
+
+int main(int argc, char ** argv) {
+  const char * journal_modes[] = { LURCH_STORE_JOURNAL_ROLLBACK, LURCH_STORE_JOURNAL_WAL };
+  const char * sync_levels[] = { LURCH_STORE_SYNC_FULL, LURCH_STORE_SYNC_NORMAL };
+  int msg_count = (argc > 1) ? atoi(argv[1]) : 200;
+  double msgs_per_sec = 0;
+  size_t i = 0;
+  size_t j = 0;
+
+  bench_dir = (argc > 2) ? g_strdup(argv[2]) : g_dir_make_tmp("lurch-bench-XXXXXX", NULL);
+  if (!bench_dir || msg_count <= 0) {
+    fprintf(stderr, "usage: %s [message count] [dir]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("%d messages, %d session records of %d bytes each, in %s\n",
+         msg_count, BENCH_DEVICES_PER_MSG, BENCH_RECORD_LEN, bench_dir);
+  printf("%-10s %-8s %12s\n", "journal", "sync", "msgs/sec");
+
+  for (i = 0; i < G_N_ELEMENTS(journal_modes); i++) {
+    for (j = 0; j < G_N_ELEMENTS(sync_levels); j++) {
+      bench_journal_mode = journal_modes[i];
+      bench_sync = sync_levels[j];
+
+      msgs_per_sec = bench_run(msg_count);
+      if (msgs_per_sec < 0) {
+        fprintf(stderr, "failed to run with %s/%s\n", bench_journal_mode, bench_sync);
+        return EXIT_FAILURE;
+      }
+      printf("%-10s %-8s %12.1f\n", bench_journal_mode, bench_sync, msgs_per_sec);
+    }
+  }
+
+  if (argc <= 2) {
+    g_rmdir(bench_dir);
+  }
+  g_free(bench_dir);
+
+  return EXIT_SUCCESS;
+}
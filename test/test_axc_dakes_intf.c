@@ -0,0 +1,203 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+#include <glib.h>
+
+#include "idake2session.h"
+#include "signal_protocol.h"
+
+#include "../src/axc_dakes_intf.h"
+#include "../src/lurch_arena.h"
+
+// tag of a length-delimited field 100, which IdakeMessage does not have, so protobuf-c keeps it as an unknown field
+#define TEST_UNKNOWN_FIELD_TAG_0 0xa2
+#define TEST_UNKNOWN_FIELD_TAG_1 0x06
+
+static int test_handle_calls = 0;
+
+int __wrap_axc_Idake_handle_msg(axc_context_dake * ctx_p, Signaldakez__IdakeMessage * idakemsg_p,
+                                const signal_protocol_address * addr_p, const signal_buffer ** lastauthmsg_pp) {
+    (void) ctx_p;
+    (void) addr_p;
+    (void) lastauthmsg_pp;
+
+    assert_non_null(idakemsg_p);
+    test_handle_calls++;
+    return 0;
+}
+
+/**
+ * Appends the tag of the unknown field and the given length as a varint of up to 10 bytes.
+ *
+ * @return The number of bytes written.
+ */
+static size_t test_put_field_header(uint8_t * buf_p, uint64_t len) {
+    size_t pos = 0;
+
+    buf_p[pos++] = TEST_UNKNOWN_FIELD_TAG_0;
+    buf_p[pos++] = TEST_UNKNOWN_FIELD_TAG_1;
+    do {
+        buf_p[pos] = (uint8_t) (len & 0x7f);
+        len >>= 7;
+        if (len) {
+            buf_p[pos] |= 0x80;
+        }
+        pos++;
+    } while (len);
+
+    return pos;
+}
+
+/**
+ * Nothing to look at means the message has to be parsed to tell.
+ */
+static void test_dakectx_msg_may_be_idakemsg_empty(void ** state) {
+    (void) state;
+
+    const uint8_t msg[] = { 0x33 };
+
+    assert_true(dakectx_msg_may_be_idakemsg(msg, 0));
+    assert_true(dakectx_msg_may_be_idakemsg((void *) 0, 0));
+    assert_true(dakectx_msg_may_be_idakemsg((void *) 0, 1));
+}
+
+/**
+ * First bytes with the group wire types or the unassigned ones cannot start an IDAKE message,
+ * which includes libsignal's version byte, and such a message is not handed to protobuf-c.
+ */
+static void test_dakectx_msg_may_be_idakemsg_rejected_wire_types(void ** state) {
+    (void) state;
+
+    // wire types 3, 4, 6 and 7 of fields 1 and 15, and a signal message's version byte
+    const uint8_t first_bytes[] = { 0x0b, 0x0c, 0x0e, 0x0f, 0x7b, 0x7c, 0x7e, 0x7f, 0x33 };
+    signal_protocol_address addr = { .name = "alice@example.com", .name_len = 17, .device_id = 1111 };
+    uint8_t msg[8];
+    size_t i = 0;
+
+    memset(msg, 0x2a, sizeof(msg));
+    test_handle_calls = 0;
+
+    for (i = 0; i < G_N_ELEMENTS(first_bytes); i++) {
+        msg[0] = first_bytes[i];
+        assert_false(dakectx_msg_may_be_idakemsg(msg, sizeof(msg)));
+        assert_false(dakectx_msg_may_be_idakemsg(msg, 1));
+        assert_int_equal(dakectx_handle_idakemsg((void *) 0, &addr, msg, sizeof(msg), (void *) 0), SG_ERR_INVALID_MESSAGE);
+    }
+
+    assert_int_equal(test_handle_calls, 0);
+}
+
+/**
+ * First bytes with the varint, 64-bit, length-delimited and 32-bit wire types may start an IDAKE message.
+ */
+static void test_dakectx_msg_may_be_idakemsg_accepted_wire_types(void ** state) {
+    (void) state;
+
+    // wire types 0, 1, 2 and 5 of fields 1 and 15
+    const uint8_t first_bytes[] = { 0x08, 0x09, 0x0a, 0x0d, 0x78, 0x79, 0x7a, 0x7d };
+    uint8_t msg[8];
+    size_t i = 0;
+
+    memset(msg, 0x2a, sizeof(msg));
+
+    for (i = 0; i < G_N_ELEMENTS(first_bytes); i++) {
+        msg[0] = first_bytes[i];
+        assert_true(dakectx_msg_may_be_idakemsg(msg, sizeof(msg)));
+        assert_true(dakectx_msg_may_be_idakemsg(msg, 1));
+    }
+}
+
+/**
+ * The tag of a field from 16 on takes more than one byte, the first one with the continuation bit set,
+ * and still has the wire type in its low 3 bits.
+ */
+static void test_dakectx_msg_may_be_idakemsg_multi_byte_tag(void ** state) {
+    (void) state;
+
+    // field 16 as length-delimited and as start group, field 100 as 32-bit and as end group
+    const uint8_t accepted[][3] = { { 0x82, 0x01, 0x2a }, { 0xa5, 0x06, 0x2a } };
+    const uint8_t rejected[][3] = { { 0x83, 0x01, 0x2a }, { 0xa4, 0x06, 0x2a } };
+    size_t i = 0;
+
+    for (i = 0; i < G_N_ELEMENTS(accepted); i++) {
+        assert_true(accepted[i][0] >= 0x80);
+        assert_true(dakectx_msg_may_be_idakemsg(accepted[i], sizeof(accepted[i])));
+    }
+    for (i = 0; i < G_N_ELEMENTS(rejected); i++) {
+        assert_true(rejected[i][0] >= 0x80);
+        assert_false(dakectx_msg_may_be_idakemsg(rejected[i], sizeof(rejected[i])));
+    }
+}
+
+/**
+ * A length field claiming more bytes than the message has is rejected by the unpack,
+ * before anything of that size is taken from the arena, and the message is not handled.
+ */
+static void test_dakectx_handle_idakemsg_oversized_len(void ** state) {
+    (void) state;
+
+    const uint64_t lens[] = { 17, 0xffffffffULL, SIZE_MAX - 8, UINT64_MAX };
+    signal_protocol_address addr = { .name = "alice@example.com", .name_len = 17, .device_id = 1111 };
+    uint8_t msg[64];
+    size_t msg_len = 0;
+    size_t i = 0;
+
+    memset(msg, 0x2a, sizeof(msg));
+    test_handle_calls = 0;
+
+    for (i = 0; i < G_N_ELEMENTS(lens); i++) {
+        msg_len = test_put_field_header(msg, lens[i]);
+        // a few bytes of data, far fewer than claimed
+        msg_len += 16;
+
+        assert_true(dakectx_msg_may_be_idakemsg(msg, msg_len));
+        assert_int_equal(dakectx_handle_idakemsg((void *) 0, &addr, msg, msg_len, (void *) 0), SG_ERR_INVALID_MESSAGE);
+    }
+
+    assert_int_equal(test_handle_calls, 0);
+}
+
+/**
+ * A field that is larger than the arena's inline block and its regular blocks, but within the message,
+ * is unpacked into the arena and the message is handled.
+ */
+static void test_dakectx_handle_idakemsg_large_field(void ** state) {
+    (void) state;
+
+    const size_t data_len = 3 * LURCH_ARENA_BLOCK_LEN + 5;
+    signal_protocol_address addr = { .name = "alice@example.com", .name_len = 17, .device_id = 1111 };
+    uint8_t * msg_p = g_malloc(data_len + 16);
+    size_t msg_len = 0;
+
+    test_handle_calls = 0;
+
+    msg_len = test_put_field_header(msg_p, data_len);
+    memset(msg_p + msg_len, 0x2a, data_len);
+    msg_len += data_len;
+
+    assert_int_equal(dakectx_handle_idakemsg((void *) 0, &addr, msg_p, msg_len, (void *) 0), 0);
+    assert_int_equal(test_handle_calls, 1);
+
+    // one byte short of the claimed length
+    assert_int_equal(dakectx_handle_idakemsg((void *) 0, &addr, msg_p, msg_len - 1, (void *) 0), SG_ERR_INVALID_MESSAGE);
+    assert_int_equal(test_handle_calls, 1);
+
+    g_free(msg_p);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_dakectx_msg_may_be_idakemsg_empty),
+        cmocka_unit_test(test_dakectx_msg_may_be_idakemsg_rejected_wire_types),
+        cmocka_unit_test(test_dakectx_msg_may_be_idakemsg_accepted_wire_types),
+        cmocka_unit_test(test_dakectx_msg_may_be_idakemsg_multi_byte_tag),
+        cmocka_unit_test(test_dakectx_handle_idakemsg_oversized_len),
+        cmocka_unit_test(test_dakectx_handle_idakemsg_large_field)
+    };
+
+    return cmocka_run_group_tests_name("axc_dakes_intf", tests, NULL, NULL);
+}
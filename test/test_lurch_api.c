@@ -10,8 +10,15 @@
 #include "axc.h"
 #include "libomemo.h"
 
+#include "../src/axc_dakes_intf.h"
 #include "../src/lurch_api.h"
 #include "../src/lurch_api_internal.h"
+#include "../src/lurch_store.h"
+
+// the account's context from the map, only its address is used
+static axc_context_dake_cache test_cachectx;
+static char * test_cachectx_name = (void *) 0;
+static axc_context * test_session_ctx_p = (void *) 0;
 
 char * __wrap_purple_account_get_username(PurpleAccount * acc_p) {
     char * username;
@@ -21,7 +28,19 @@ char * __wrap_purple_account_get_username(PurpleAccount * acc_p) {
     return username;
 }
 
-int __wrap_omemo_storage_user_devicelist_retrieve(const char * user, const char * db_fn, omemo_devicelist ** dl_pp) {
+int __wrap_lurch_store_get(const char * uname, lurch_store ** store_pp) {
+    *store_pp = NULL;
+    return 0;
+}
+
+int __wrap_cachectx_get_from_map(GHashTable * map, const char * name, axc_context_dake_cache ** ctx_pp) {
+    g_free(test_cachectx_name);
+    test_cachectx_name = g_strdup(name);
+    *ctx_pp = &test_cachectx;
+    return 0;
+}
+
+int __wrap_lurch_store_devicelist_retrieve(lurch_store * store_p, const char * user, omemo_devicelist ** dl_pp) {
     omemo_devicelist * dl_p;
     dl_p = mock_ptr_type(omemo_devicelist *);
     *dl_pp = dl_p;
@@ -117,7 +136,7 @@ void __wrap_jabber_iq_send(JabberIq *iq) {
     check_expected(to);
 }
 
-int __wrap_omemo_storage_chatlist_delete(const char * chat, const char * db_fn) {
+int __wrap_lurch_store_chatlist_delete(lurch_store * store_p, const char * chat) {
     check_expected(chat);
 
     int ret_val;
@@ -125,7 +144,7 @@ int __wrap_omemo_storage_chatlist_delete(const char * chat, const char * db_fn)
     return ret_val;
 }
 
-int __wrap_omemo_storage_chatlist_save(const char * chat, const char * db_fn) {
+int __wrap_lurch_store_chatlist_save(lurch_store * store_p, const char * chat) {
     check_expected(chat);
 
     int ret_val;
@@ -133,7 +152,7 @@ int __wrap_omemo_storage_chatlist_save(const char * chat, const char * db_fn) {
     return ret_val;
 }
 
-int __wrap_omemo_storage_chatlist_exists(const char * chat, const char * db_fn) {
+int __wrap_lurch_store_chatlist_exists(lurch_store * store_p, const char * chat) {
     check_expected(chat);
     
     int ret_val;
@@ -170,6 +189,7 @@ int __wrap_axc_session_exists_any(const char * name, axc_context * ctx_p) {
     int ret_val;
 
     check_expected(name);
+    test_session_ctx_p = ctx_p;
 
     ret_val = mock_type(int);
     return ret_val;
@@ -226,8 +246,8 @@ static void test_lurch_api_id_list_handler(void ** state) {
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, test_jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     uint32_t test_own_id = 1337;
     will_return(__wrap_axc_get_device_id, test_own_id);
@@ -254,8 +274,8 @@ static void test_lurch_api_id_list_handler_error(void ** state) {
     will_return(__wrap_purple_account_get_username, test_jid);
 
     int test_errcode = -12345;
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, NULL);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, test_errcode);
+    will_return(__wrap_lurch_store_devicelist_retrieve, NULL);
+    will_return(__wrap_lurch_store_devicelist_retrieve, test_errcode);
 
     char * test_user_data = "TEST USER DATA";
     expect_value(lurch_api_id_list_handler_cb_err_mock, err, test_errcode);
@@ -290,8 +310,8 @@ static void test_lurch_api_id_remove_handler(void ** state) {
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, test_jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     expect_function_call(__wrap_purple_account_get_connection);
     will_return(__wrap_purple_connection_get_protocol_data, NULL);
@@ -325,8 +345,8 @@ static void test_lurch_api_id_remove_handler_id_not_in_list(void ** state) {
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, test_jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     char * test_user_data = "TEST USER DATA";
     expect_value(lurch_api_id_remove_handler_cb_mock, err, LURCH_ERR_DEVICE_NOT_IN_LIST);
@@ -350,8 +370,8 @@ static void test_lurch_api_enable_im_handler(void ** state) {
     const char * test_jid = "me-testing@test.org/resource";
     will_return(__wrap_purple_account_get_username, test_jid);
 
-    expect_string(__wrap_omemo_storage_chatlist_delete, chat, contact_bare_jid);
-    will_return(__wrap_omemo_storage_chatlist_delete, EXIT_SUCCESS);
+    expect_string(__wrap_lurch_store_chatlist_delete, chat, contact_bare_jid);
+    will_return(__wrap_lurch_store_chatlist_delete, EXIT_SUCCESS);
 
     char * test_user_data = "TEST USER DATA";
     expect_value(lurch_api_enable_disable_handler_cb_mock, err, EXIT_SUCCESS);
@@ -370,8 +390,8 @@ static void test_lurch_api_enable_im_handler_err(void ** state) {
     const char * test_jid = "me-testing@test.org/resource";
     will_return(__wrap_purple_account_get_username, test_jid);
 
-    expect_string(__wrap_omemo_storage_chatlist_delete, chat, contact_bare_jid);
-    will_return(__wrap_omemo_storage_chatlist_delete, EXIT_FAILURE);
+    expect_string(__wrap_lurch_store_chatlist_delete, chat, contact_bare_jid);
+    will_return(__wrap_lurch_store_chatlist_delete, EXIT_FAILURE);
 
     char * test_user_data = "TEST USER DATA";
     expect_value(lurch_api_enable_disable_handler_cb_mock, err, EXIT_FAILURE);
@@ -390,8 +410,8 @@ static void test_lurch_api_enable_chat_handler(void ** state) {
     const char * user_jid = "me-testing@test.org/resource";
     will_return(__wrap_purple_account_get_username, user_jid);
 
-    expect_string(__wrap_omemo_storage_chatlist_save, chat, conv_name);
-    will_return(__wrap_omemo_storage_chatlist_save, EXIT_SUCCESS);
+    expect_string(__wrap_lurch_store_chatlist_save, chat, conv_name);
+    will_return(__wrap_lurch_store_chatlist_save, EXIT_SUCCESS);
 
     char * test_user_data = "TEST USER DATA";
     expect_value(lurch_api_enable_disable_handler_cb_mock, err, EXIT_SUCCESS);
@@ -410,8 +430,8 @@ static void test_lurch_api_enable_chat_handler_err(void ** state) {
     const char * user_jid = "me-testing@test.org/resource";
     will_return(__wrap_purple_account_get_username, user_jid);
 
-    expect_string(__wrap_omemo_storage_chatlist_save, chat, conv_name);
-    will_return(__wrap_omemo_storage_chatlist_save, EXIT_FAILURE);
+    expect_string(__wrap_lurch_store_chatlist_save, chat, conv_name);
+    will_return(__wrap_lurch_store_chatlist_save, EXIT_FAILURE);
 
     char * test_user_data = "TEST USER DATA";
     expect_value(lurch_api_enable_disable_handler_cb_mock, err, EXIT_FAILURE);
@@ -430,8 +450,8 @@ static void test_lurch_api_disable_im_handler(void ** state) {
     const char * test_jid = "me-testing@test.org/resource";
     will_return(__wrap_purple_account_get_username, test_jid);
 
-    expect_string(__wrap_omemo_storage_chatlist_save, chat, contact_bare_jid);
-    will_return(__wrap_omemo_storage_chatlist_save, EXIT_SUCCESS);
+    expect_string(__wrap_lurch_store_chatlist_save, chat, contact_bare_jid);
+    will_return(__wrap_lurch_store_chatlist_save, EXIT_SUCCESS);
 
     char * test_user_data = "TEST USER DATA";
     expect_value(lurch_api_enable_disable_handler_cb_mock, err, EXIT_SUCCESS);
@@ -450,8 +470,8 @@ static void test_lurch_api_disable_im_handler_err(void ** state) {
     const char * test_jid = "me-testing@test.org/resource";
     will_return(__wrap_purple_account_get_username, test_jid);
 
-    expect_string(__wrap_omemo_storage_chatlist_save, chat, contact_bare_jid);
-    will_return(__wrap_omemo_storage_chatlist_save, 12345);
+    expect_string(__wrap_lurch_store_chatlist_save, chat, contact_bare_jid);
+    will_return(__wrap_lurch_store_chatlist_save, 12345);
 
     char * test_user_data = "TEST USER DATA";
     expect_value(lurch_api_enable_disable_handler_cb_mock, err, 12345);
@@ -470,8 +490,8 @@ static void test_lurch_api_disable_chat_handler(void ** state) {
     const char * user_jid = "me-testing@test.org/resource";
     will_return(__wrap_purple_account_get_username, user_jid);
 
-    expect_string(__wrap_omemo_storage_chatlist_delete, chat, conv_name);
-    will_return(__wrap_omemo_storage_chatlist_delete, EXIT_SUCCESS);
+    expect_string(__wrap_lurch_store_chatlist_delete, chat, conv_name);
+    will_return(__wrap_lurch_store_chatlist_delete, EXIT_SUCCESS);
 
     char * test_user_data = "TEST USER DATA";
     expect_value(lurch_api_enable_disable_handler_cb_mock, err, EXIT_SUCCESS);
@@ -490,8 +510,8 @@ static void test_lurch_api_disable_chat_handler_err(void ** state) {
     const char * user_jid = "me-testing@test.org/resource";
     will_return(__wrap_purple_account_get_username, user_jid);
 
-    expect_string(__wrap_omemo_storage_chatlist_delete, chat, conv_name);
-    will_return(__wrap_omemo_storage_chatlist_delete, EXIT_FAILURE);
+    expect_string(__wrap_lurch_store_chatlist_delete, chat, conv_name);
+    will_return(__wrap_lurch_store_chatlist_delete, EXIT_FAILURE);
 
     char * test_user_data = "TEST USER DATA";
     expect_value(lurch_api_enable_disable_handler_cb_mock, err, EXIT_FAILURE);
@@ -606,8 +626,8 @@ static void test_lurch_api_fp_list_handler(void ** state) {
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, test_jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     uint32_t test_own_id = 1337;
     will_return(__wrap_axc_get_device_id, test_own_id);
@@ -669,8 +689,8 @@ static void test_lurch_api_fp_list_handler_err(void ** state) {
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, test_jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     uint32_t id_which_does_not_matter = 123;
     will_return(__wrap_axc_get_device_id, id_which_does_not_matter);
@@ -701,8 +721,8 @@ static void test_lurch_api_fp_other_handler(void ** state) {
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, other_jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     int id_4223 = 4223;
     expect_string(__wrap_axc_key_load_public_addr, name, other_bare_jid);
@@ -744,8 +764,8 @@ static void test_lurch_api_fp_other_handler_keyerr(void ** state) {
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, other_jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     int id_4223 = 4223;
     expect_string(__wrap_axc_key_load_public_addr, name, other_bare_jid);
@@ -779,8 +799,8 @@ static void test_lurch_api_fp_other_handler_empty(void ** state) {
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, other_jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     expect_value(list_handling_cb_mock, err, EXIT_SUCCESS);
     lurch_api_fp_other_handler(NULL, other_bare_jid, list_handling_cb_mock, NULL);
@@ -797,8 +817,8 @@ static void test_lurch_api_fp_other_handler_err(void ** state) {
     will_return(__wrap_purple_account_get_username, own_jid);
 
     int test_errcode = -1234;
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, NULL);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, test_errcode);
+    will_return(__wrap_lurch_store_devicelist_retrieve, NULL);
+    will_return(__wrap_lurch_store_devicelist_retrieve, test_errcode);
 
     expect_value(list_handling_cb_mock, err, test_errcode);
     lurch_api_fp_other_handler(NULL, other_bare_jid, list_handling_cb_mock, NULL);
@@ -820,8 +840,8 @@ static void test_lurch_api_status_im_handler_disabled(void ** state) {
     const char * other_bare_jid = "other-guy-testing@test.org";
     will_return(__wrap_purple_account_get_username, own_jid);
 
-    expect_value(__wrap_omemo_storage_chatlist_exists, chat, other_bare_jid);
-    will_return(__wrap_omemo_storage_chatlist_exists, 1);
+    expect_value(__wrap_lurch_store_chatlist_exists, chat, other_bare_jid);
+    will_return(__wrap_lurch_store_chatlist_exists, 1);
 
     expect_value(lurch_api_status_im_handler_cb_mock, err, 0);
     expect_value(lurch_api_status_im_handler_cb_mock, status, LURCH_STATUS_DISABLED);
@@ -842,8 +862,8 @@ static void test_lurch_api_status_im_handler_not_supported(void ** state) {
     const char * other_bare_jid = "other-guy-testing@test.org";
     will_return(__wrap_purple_account_get_username, own_jid);
 
-    expect_value(__wrap_omemo_storage_chatlist_exists, chat, other_bare_jid);
-    will_return(__wrap_omemo_storage_chatlist_exists, 0);
+    expect_value(__wrap_lurch_store_chatlist_exists, chat, other_bare_jid);
+    will_return(__wrap_lurch_store_chatlist_exists, 0);
 
 
     char * devicelist = "<items node='urn:xmpp:omemo:0:devicelist'>"
@@ -855,8 +875,8 @@ static void test_lurch_api_status_im_handler_not_supported(void ** state) {
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, other_jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     expect_value(lurch_api_status_im_handler_cb_mock, err, 0);
     expect_value(lurch_api_status_im_handler_cb_mock, status, LURCH_STATUS_NOT_SUPPORTED);
@@ -877,8 +897,8 @@ static void test_lurch_api_status_im_handler_no_session(void ** state) {
     const char * other_bare_jid = "other-guy-testing@test.org";
     will_return(__wrap_purple_account_get_username, own_jid);
 
-    expect_value(__wrap_omemo_storage_chatlist_exists, chat, other_bare_jid);
-    will_return(__wrap_omemo_storage_chatlist_exists, 0);
+    expect_value(__wrap_lurch_store_chatlist_exists, chat, other_bare_jid);
+    will_return(__wrap_lurch_store_chatlist_exists, 0);
 
 
     char * devicelist = "<items node='urn:xmpp:omemo:0:devicelist'>"
@@ -891,8 +911,8 @@ static void test_lurch_api_status_im_handler_no_session(void ** state) {
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, other_jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     expect_value(__wrap_axc_session_exists_any, name, other_bare_jid);
     will_return(__wrap_axc_session_exists_any, 0);
@@ -916,8 +936,8 @@ static void test_lurch_api_status_im_handler_ok(void ** state) {
     const char * other_bare_jid = "other-guy-testing@test.org";
     will_return(__wrap_purple_account_get_username, own_jid);
 
-    expect_value(__wrap_omemo_storage_chatlist_exists, chat, other_bare_jid);
-    will_return(__wrap_omemo_storage_chatlist_exists, 0);
+    expect_value(__wrap_lurch_store_chatlist_exists, chat, other_bare_jid);
+    will_return(__wrap_lurch_store_chatlist_exists, 0);
 
 
     char * devicelist = "<items node='urn:xmpp:omemo:0:devicelist'>"
@@ -930,8 +950,8 @@ static void test_lurch_api_status_im_handler_ok(void ** state) {
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, other_jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     expect_value(__wrap_axc_session_exists_any, name, other_bare_jid);
     will_return(__wrap_axc_session_exists_any, 1);
@@ -956,8 +976,8 @@ static void test_lurch_api_status_im_handler_err(void ** state) {
 
     int fake_errcode = -1337;
 
-    expect_value(__wrap_omemo_storage_chatlist_exists, chat, other_bare_jid);
-    will_return(__wrap_omemo_storage_chatlist_exists, fake_errcode);
+    expect_value(__wrap_lurch_store_chatlist_exists, chat, other_bare_jid);
+    will_return(__wrap_lurch_store_chatlist_exists, fake_errcode);
 
     expect_value(lurch_api_status_im_handler_cb_mock, err, fake_errcode);
     expect_value(lurch_api_status_im_handler_cb_mock, status, LURCH_STATUS_DISABLED);
@@ -967,6 +987,49 @@ static void test_lurch_api_status_im_handler_err(void ** state) {
     lurch_api_status_im_handler(NULL, other_bare_jid, lurch_api_status_im_handler_cb_mock, mock_user_data);
 }
 
+/**
+ * With the sessions in the mmap backend, they are looked up through the account's context,
+ * whose session store is lurch_store's, and not through a new context on axc's own DB, which holds none.
+ */
+static void test_lurch_api_status_im_handler_mmap_backend(void ** state) {
+    (void) state;
+
+    const char * own_jid = "me-testing@test.org/resource";
+    const char * other_jid = "other-guy-testing@test.org/resource";
+    const char * other_bare_jid = "other-guy-testing@test.org";
+    will_return(__wrap_purple_account_get_username, own_jid);
+
+    expect_value(__wrap_lurch_store_chatlist_exists, chat, other_bare_jid);
+    will_return(__wrap_lurch_store_chatlist_exists, 0);
+
+    char * devicelist = "<items node='urn:xmpp:omemo:0:devicelist'>"
+                              "<item>"
+                                "<list xmlns='urn:xmpp:omemo:0'>"
+                                    "<device id='4223' />"
+                                "</list>"
+                              "</item>"
+                            "</items>";
+
+    omemo_devicelist * dl_p;
+    omemo_devicelist_import(devicelist, other_jid, &dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
+
+    expect_value(__wrap_axc_session_exists_any, name, other_bare_jid);
+    will_return(__wrap_axc_session_exists_any, 1);
+
+    expect_value(lurch_api_status_im_handler_cb_mock, err, 0);
+    expect_value(lurch_api_status_im_handler_cb_mock, status, LURCH_STATUS_OK);
+    const char * mock_user_data = "MOCK_USER_DATA";
+    expect_value(lurch_api_status_im_handler_cb_mock, user_data_p, mock_user_data);
+
+    test_session_ctx_p = (void *) 0;
+    lurch_api_status_im_handler(NULL, other_bare_jid, lurch_api_status_im_handler_cb_mock, mock_user_data);
+
+    assert_string_equal(test_cachectx_name, "me-testing@test.org");
+    assert_ptr_equal(test_session_ctx_p, &test_cachectx.base.base);
+}
+
 static void lurch_api_status_chat_handler_cb_mock(int32_t err, lurch_status_chat_t status, void * user_data_p) {
     check_expected(err);
     check_expected(status);
@@ -983,8 +1046,8 @@ static void test_lurch_api_status_chat_handler_disabled(void ** state) {
     const char * test_conversation_name = "test-room@conference.test.org";
     will_return(__wrap_purple_account_get_username, own_jid);
 
-    expect_value(__wrap_omemo_storage_chatlist_exists, chat, test_conversation_name);
-    will_return(__wrap_omemo_storage_chatlist_exists, 0);
+    expect_value(__wrap_lurch_store_chatlist_exists, chat, test_conversation_name);
+    will_return(__wrap_lurch_store_chatlist_exists, 0);
 
     expect_value(lurch_api_status_chat_handler_cb_mock, err, EXIT_SUCCESS);
     expect_value(lurch_api_status_chat_handler_cb_mock, status, LURCH_STATUS_CHAT_DISABLED);
@@ -1006,8 +1069,8 @@ static void test_lurch_api_status_chat_handler_enabled(void ** state) {
     const char * test_conversation_name = "test-room@conference.test.org";
     will_return(__wrap_purple_account_get_username, own_jid);
 
-    expect_value(__wrap_omemo_storage_chatlist_exists, chat, test_conversation_name);
-    will_return(__wrap_omemo_storage_chatlist_exists, 1);
+    expect_value(__wrap_lurch_store_chatlist_exists, chat, test_conversation_name);
+    will_return(__wrap_lurch_store_chatlist_exists, 1);
 
     expect_function_call(__wrap_purple_account_get_connection);
     JabberStream fake_js = {.next_id = 1}; // needed so an iq can be created
@@ -1136,8 +1199,8 @@ static void test_lurch_api_status_chat_discover_cb_no_devicelist(void ** state)
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, member.jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     expect_value(__wrap_purple_find_conversation_with_account, type, PURPLE_CONV_TYPE_CHAT);
     expect_value(__wrap_purple_find_conversation_with_account, name, test_conversation_name);
@@ -1221,8 +1284,8 @@ static void test_lurch_api_status_chat_discover_cb_ok(void ** state) {
 
     omemo_devicelist * dl_p;
     omemo_devicelist_import(devicelist, member.jid, &dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, dl_p);
-    will_return(__wrap_omemo_storage_user_devicelist_retrieve, EXIT_SUCCESS);
+    will_return(__wrap_lurch_store_devicelist_retrieve, dl_p);
+    will_return(__wrap_lurch_store_devicelist_retrieve, EXIT_SUCCESS);
 
     expect_value(__wrap_purple_find_conversation_with_account, type, PURPLE_CONV_TYPE_CHAT);
     expect_value(__wrap_purple_find_conversation_with_account, name, test_conversation_name);
@@ -1308,6 +1371,7 @@ int main(void) {
         cmocka_unit_test(test_lurch_api_status_im_handler_no_session),
         cmocka_unit_test(test_lurch_api_status_im_handler_ok),
         cmocka_unit_test(test_lurch_api_status_im_handler_err),
+        cmocka_unit_test(test_lurch_api_status_im_handler_mmap_backend),
         cmocka_unit_test(test_lurch_api_status_chat_handler_disabled),
         cmocka_unit_test(test_lurch_api_status_chat_handler_enabled),
         cmocka_unit_test(test_lurch_api_status_chat_discover_cb_anonymous),
@@ -0,0 +1,190 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+#include <glib.h>
+
+#include "../src/lurch_arena.h"
+
+static void test_lurch_arena_alloc_inline(void ** state) {
+    (void) state;
+
+    lurch_arena arena;
+    uint8_t * a_p = (void *) 0;
+    uint8_t * b_p = (void *) 0;
+    uint8_t * c_p = (void *) 0;
+
+    lurch_arena_init(&arena);
+
+    a_p = lurch_arena_alloc(&arena, 1);
+    b_p = lurch_arena_alloc(&arena, 0);
+    c_p = lurch_arena_alloc(&arena, 17);
+
+    // taken from the arena itself, aligned, and distinct
+    assert_true(a_p >= arena.inline_block.data && c_p < arena.inline_block.data + LURCH_ARENA_INLINE_LEN);
+    assert_int_equal((uintptr_t) a_p % _Alignof(max_align_t), 0);
+    assert_int_equal((uintptr_t) b_p % _Alignof(max_align_t), 0);
+    assert_int_equal((uintptr_t) c_p % _Alignof(max_align_t), 0);
+    assert_true(a_p < b_p && b_p < c_p);
+    assert_null(arena.blocks_p);
+
+    lurch_arena_release(&arena);
+}
+
+/**
+ * Sizes that are a multiple of the alignment are not padded, others only up to the next multiple.
+ */
+static void test_lurch_arena_alloc_padding(void ** state) {
+    (void) state;
+
+    const size_t align = _Alignof(max_align_t);
+    lurch_arena arena;
+    uint8_t * a_p = (void *) 0;
+    uint8_t * b_p = (void *) 0;
+    uint8_t * c_p = (void *) 0;
+    uint8_t * d_p = (void *) 0;
+
+    lurch_arena_init(&arena);
+
+    a_p = lurch_arena_alloc(&arena, align);
+    b_p = lurch_arena_alloc(&arena, 2 * align);
+    c_p = lurch_arena_alloc(&arena, align + 1);
+    d_p = lurch_arena_alloc(&arena, 1);
+
+    assert_ptr_equal(a_p, arena.inline_block.data);
+    assert_ptr_equal(b_p, a_p + align);
+    assert_ptr_equal(c_p, b_p + 2 * align);
+    assert_ptr_equal(d_p, c_p + 2 * align);
+    assert_ptr_equal(arena.next_p, d_p + align);
+
+    // a full inline block is used up exactly, without starting a block
+    lurch_arena_release(&arena);
+    a_p = lurch_arena_alloc(&arena, LURCH_ARENA_INLINE_LEN);
+    assert_ptr_equal(a_p, arena.inline_block.data);
+    assert_null(arena.blocks_p);
+
+    lurch_arena_release(&arena);
+}
+
+/**
+ * Sizes that would wrap around once padded are rejected, and the arena stays usable.
+ */
+static void test_lurch_arena_alloc_overflow(void ** state) {
+    (void) state;
+
+    const size_t align = _Alignof(max_align_t);
+    const size_t lens[] = { SIZE_MAX, SIZE_MAX - 1, SIZE_MAX - align + 1, SIZE_MAX - align, SIZE_MAX / 2 * 2 - 8 };
+    lurch_arena arena;
+    uint8_t * next_p = (void *) 0;
+    uint8_t * p = (void *) 0;
+    size_t i = 0;
+
+    lurch_arena_init(&arena);
+    (void) lurch_arena_alloc(&arena, 3);
+    next_p = arena.next_p;
+
+    for (i = 0; i < G_N_ELEMENTS(lens); i++) {
+        assert_null(lurch_arena_alloc(&arena, lens[i]));
+        assert_ptr_equal(arena.next_p, next_p);
+        assert_null(arena.blocks_p);
+    }
+
+    p = lurch_arena_alloc(&arena, 5);
+    assert_ptr_equal(p, next_p);
+    memset(p, 0x2a, 5);
+
+    lurch_arena_release(&arena);
+}
+
+static void test_lurch_arena_alloc_blocks(void ** state) {
+    (void) state;
+
+    lurch_arena arena;
+    uint8_t * p = (void *) 0;
+    uint8_t * large_p = (void *) 0;
+    int i = 0;
+
+    lurch_arena_init(&arena);
+
+    // more than the inline block holds, so that blocks are chained
+    for (i = 0; i < 100; i++) {
+        p = lurch_arena_alloc(&arena, 100);
+        memset(p, i, 100);
+        assert_int_equal((uintptr_t) p % _Alignof(max_align_t), 0);
+    }
+    assert_non_null(arena.blocks_p);
+
+    // larger than a regular block
+    large_p = lurch_arena_alloc(&arena, LURCH_ARENA_BLOCK_LEN * 3);
+    memset(large_p, 0x2a, LURCH_ARENA_BLOCK_LEN * 3);
+    assert_int_equal(p[99], 99);
+
+    lurch_arena_release(&arena);
+    assert_null(arena.blocks_p);
+
+    // usable again
+    p = lurch_arena_alloc(&arena, 8);
+    assert_ptr_equal(p, arena.inline_block.data);
+
+    lurch_arena_release(&arena);
+}
+
+static void test_lurch_arena_strings(void ** state) {
+    (void) state;
+
+    lurch_arena arena;
+    char long_str[3000];
+
+    memset(long_str, 'x', sizeof(long_str) - 1);
+    long_str[sizeof(long_str) - 1] = '\0';
+
+    lurch_arena_init(&arena);
+
+    assert_null(lurch_arena_strdup(&arena, (void *) 0));
+    assert_string_equal(lurch_arena_strdup(&arena, ""), "");
+    assert_string_equal(lurch_arena_strdup(&arena, "alice@example.com"), "alice@example.com");
+    assert_string_equal(lurch_arena_strndup(&arena, "alice@example.com/phone", 17), "alice@example.com");
+    assert_string_equal(lurch_arena_strndup(&arena, "abc", 10), "abc");
+    assert_string_equal(lurch_arena_printf(&arena, "%s:%i", "bob@example.com", 1317), "bob@example.com:1317");
+    assert_string_equal(lurch_arena_strdup(&arena, long_str), long_str);
+    assert_int_equal(strlen(lurch_arena_printf(&arena, "%s%s", long_str, long_str)), 2 * strlen(long_str));
+
+    lurch_arena_release(&arena);
+}
+
+static void test_lurch_arena_bare_jid(void ** state) {
+    (void) state;
+
+    lurch_arena arena;
+
+    lurch_arena_init(&arena);
+
+    assert_null(lurch_arena_bare_jid(&arena, (void *) 0));
+    assert_string_equal(lurch_arena_bare_jid(&arena, "alice@example.com/phone"), "alice@example.com");
+    assert_string_equal(lurch_arena_bare_jid(&arena, "alice@example.com"), "alice@example.com");
+    assert_string_equal(lurch_arena_bare_jid(&arena, "room@conference.example.com/nick/with/slashes"), "room@conference.example.com");
+    assert_string_equal(lurch_arena_bare_jid(&arena, "example.com/res"), "example.com");
+    assert_string_equal(lurch_arena_bare_jid(&arena, "a.b-c_d+e@sub-1.example.com"), "a.b-c_d+e@sub-1.example.com");
+
+    // not canonical, left to libpurple
+    assert_string_equal(lurch_arena_bare_jid(&arena, "Alice@Example.COM/phone"), "alice@example.com");
+    assert_null(lurch_arena_bare_jid(&arena, "@example.com"));
+    assert_null(lurch_arena_bare_jid(&arena, "alice@"));
+
+    lurch_arena_release(&arena);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_lurch_arena_alloc_inline),
+        cmocka_unit_test(test_lurch_arena_alloc_padding),
+        cmocka_unit_test(test_lurch_arena_alloc_overflow),
+        cmocka_unit_test(test_lurch_arena_alloc_blocks),
+        cmocka_unit_test(test_lurch_arena_strings),
+        cmocka_unit_test(test_lurch_arena_bare_jid)
+    };
+
+    return cmocka_run_group_tests_name("lurch_arena", tests, NULL, NULL);
+}
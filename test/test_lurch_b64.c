@@ -0,0 +1,179 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+#include <glib.h>
+
+#include "../src/lurch_b64.h"
+
+#define TEST_FUZZ_ROUNDS 2000
+#define TEST_FUZZ_MAX_LEN 300
+
+static const lurch_b64_impl test_impls[] = { LURCH_B64_IMPL_SCALAR, LURCH_B64_IMPL_SSSE3, LURCH_B64_IMPL_AVX2 };
+
+// characters GLib treats specially or skips, to be mixed into valid input
+static const char test_noise[] = "=\n\r \t.-_*\x80\xff";
+
+static lurch_b64_impl test_default_impl = LURCH_B64_IMPL_SCALAR;
+
+static int test_teardown(void ** state) {
+    (void) state;
+
+    assert_true(lurch_b64_set_impl(test_default_impl));
+
+    return 0;
+}
+
+static void test_random_bytes(GRand * rand_p, guchar * buf_p, size_t len) {
+    size_t i = 0;
+
+    for (i = 0; i < len; i++) {
+        buf_p[i] = g_rand_int_range(rand_p, 0, 256);
+    }
+}
+
+/**
+ * Decodes with lurch into a buffer of exactly the documented size and compares with GLib.
+ */
+static void test_assert_decode_like_glib(const char * b64) {
+    guchar * expected_p = (void *) 0;
+    gsize expected_len = 0;
+    size_t len = strlen(b64);
+    uint8_t * out_p = g_malloc(LURCH_B64_DECODED_MAX_LEN(len) + 1);
+    guchar * alloc_p = (void *) 0;
+    gsize alloc_len = 0;
+
+    expected_p = g_base64_decode(b64, &expected_len);
+
+    assert_int_equal(lurch_b64_decode(b64, len, out_p), expected_len);
+    assert_memory_equal(out_p, expected_p, expected_len);
+
+    alloc_p = lurch_b64_decode_alloc(b64, &alloc_len);
+    assert_int_equal(alloc_len, expected_len);
+    assert_memory_equal(alloc_p, expected_p, expected_len);
+
+    g_free(alloc_p);
+    g_free(out_p);
+    g_free(expected_p);
+}
+
+static void test_lurch_b64_rfc4648_vectors(void ** state) {
+    (void) state;
+
+    const char * plain[] = { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+    const char * encoded[] = { "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy" };
+    char out[16];
+    uint8_t dec[16];
+    size_t i = 0;
+    size_t j = 0;
+
+    for (i = 0; i < G_N_ELEMENTS(test_impls); i++) {
+        if (!lurch_b64_set_impl(test_impls[i])) {
+            continue;
+        }
+        for (j = 0; j < G_N_ELEMENTS(plain); j++) {
+            assert_int_equal(lurch_b64_encode((const uint8_t *) plain[j], strlen(plain[j]), out), strlen(encoded[j]));
+            assert_string_equal(out, encoded[j]);
+            assert_int_equal(lurch_b64_decode(encoded[j], strlen(encoded[j]), dec), strlen(plain[j]));
+            assert_memory_equal(dec, plain[j], strlen(plain[j]));
+        }
+    }
+}
+
+static void test_lurch_b64_encode_fuzz(void ** state) {
+    (void) state;
+
+    GRand * rand_p = g_rand_new_with_seed(1317);
+    guchar data[TEST_FUZZ_MAX_LEN];
+    char out[LURCH_B64_ENCODED_LEN(TEST_FUZZ_MAX_LEN) + 1];
+    gchar * expected = (void *) 0;
+    gchar * alloc = (void *) 0;
+    size_t len = 0;
+    size_t i = 0;
+    int round = 0;
+
+    for (i = 0; i < G_N_ELEMENTS(test_impls); i++) {
+        if (!lurch_b64_set_impl(test_impls[i])) {
+            continue;
+        }
+        for (round = 0; round < TEST_FUZZ_ROUNDS; round++) {
+            len = g_rand_int_range(rand_p, 0, TEST_FUZZ_MAX_LEN + 1);
+            test_random_bytes(rand_p, data, len);
+
+            expected = g_base64_encode(data, len);
+            assert_int_equal(lurch_b64_encode(data, len, out), strlen(expected));
+            assert_string_equal(out, expected);
+
+            alloc = lurch_b64_encode_alloc(data, len);
+            assert_string_equal(alloc, expected);
+
+            g_free(alloc);
+            g_free(expected);
+        }
+    }
+
+    g_rand_free(rand_p);
+}
+
+static void test_lurch_b64_decode_fuzz(void ** state) {
+    (void) state;
+
+    GRand * rand_p = g_rand_new_with_seed(1317);
+    guchar data[TEST_FUZZ_MAX_LEN];
+    gchar * b64 = (void *) 0;
+    GString * mangled_p = (void *) 0;
+    size_t len = 0;
+    size_t i = 0;
+    size_t j = 0;
+    int round = 0;
+
+    for (i = 0; i < G_N_ELEMENTS(test_impls); i++) {
+        if (!lurch_b64_set_impl(test_impls[i])) {
+            continue;
+        }
+        for (round = 0; round < TEST_FUZZ_ROUNDS; round++) {
+            len = g_rand_int_range(rand_p, 0, TEST_FUZZ_MAX_LEN + 1);
+            test_random_bytes(rand_p, data, len);
+            b64 = g_base64_encode(data, len);
+
+            // valid input
+            test_assert_decode_like_glib(b64);
+
+            // the same with noise in between, e.g. line breaks or padding in the middle
+            mangled_p = g_string_new(NULL);
+            for (j = 0; b64[j]; j++) {
+                if (g_rand_int_range(rand_p, 0, 16) == 0) {
+                    g_string_append_c(mangled_p, test_noise[g_rand_int_range(rand_p, 0, sizeof(test_noise) - 1)]);
+                }
+                g_string_append_c(mangled_p, b64[j]);
+            }
+            test_assert_decode_like_glib(mangled_p->str);
+            g_string_free(mangled_p, TRUE);
+
+            // arbitrary bytes
+            for (j = 0; j < len; j++) {
+                data[j] = g_rand_int_range(rand_p, 1, 256);
+            }
+            data[len ? len - 1 : 0] = '\0';
+            test_assert_decode_like_glib((const char *) data);
+
+            g_free(b64);
+        }
+    }
+
+    g_rand_free(rand_p);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_teardown(test_lurch_b64_rfc4648_vectors, test_teardown),
+        cmocka_unit_test_teardown(test_lurch_b64_encode_fuzz, test_teardown),
+        cmocka_unit_test_teardown(test_lurch_b64_decode_fuzz, test_teardown)
+    };
+
+    test_default_impl = lurch_b64_get_impl();
+
+    return cmocka_run_group_tests_name("lurch_b64", tests, NULL, NULL);
+}
@@ -0,0 +1,683 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+#include <gcrypt.h>
+#include <glib.h>
+
+#include "axc.h"
+#include "libomemo.h"
+#include "libomemo_crypto.h"
+#include "signal_protocol.h"
+
+#include "../src/lurch_crypto.h"
+
+#define TEST_DATA_LEN 4099
+#define TEST_THREADS 4
+#define TEST_THREAD_ROUNDS 200
+#define TEST_THREAD_DATA_LEN 1000
+// what lurch_crypto.c keeps of each ChaCha20 block of its pool
+#define TEST_RNG_BLOCK_LEN (1024 - 32)
+#define TEST_RNG_RESEED_BYTES (1024 * 1024)
+#define TEST_RNG_RESEED_US (10 * 60 * G_USEC_PER_SEC)
+// OMEMO_HELPER_STREAM_BLOCK_LEN
+#define TEST_STREAM_BLOCK_LEN 3072
+
+static uint8_t test_data[TEST_DATA_LEN];
+static uint8_t test_key[32];
+static uint8_t test_iv[16];
+
+static int test_randomize_calls = 0;
+static gint64 test_time_offset = 0;
+static gint test_cipher_closes = 0;
+
+void __real_gcry_randomize(void * buffer, size_t length, int level);
+gint64 __real_g_get_monotonic_time(void);
+void __real_gcry_cipher_close(gcry_cipher_hd_t hd);
+
+void __wrap_gcry_randomize(void * buffer, size_t length, int level) {
+    test_randomize_calls++;
+    __real_gcry_randomize(buffer, length, level);
+}
+
+gint64 __wrap_g_get_monotonic_time(void) {
+    return __real_g_get_monotonic_time() + test_time_offset;
+}
+
+void __wrap_gcry_cipher_close(gcry_cipher_hd_t hd) {
+    g_atomic_int_inc(&test_cipher_closes);
+    __real_gcry_cipher_close(hd);
+}
+
+static int test_setup_group(void ** state) {
+    (void) state;
+
+    size_t i = 0;
+
+    omemo_default_crypto_init();
+    lurch_crypto_init();
+
+    for (i = 0; i < sizeof(test_data); i++) {
+        test_data[i] = (uint8_t) (i * 7 + 3);
+    }
+    memset(test_key, 0x4b, sizeof(test_key));
+    memset(test_iv, 0x17, sizeof(test_iv));
+
+    return 0;
+}
+
+static int test_teardown_group(void ** state) {
+    (void) state;
+
+    lurch_crypto_teardown();
+
+    return 0;
+}
+
+static void test_assert_buf_equal(signal_buffer * a_p, signal_buffer * b_p) {
+    assert_non_null(a_p);
+    assert_non_null(b_p);
+    assert_int_equal(signal_buffer_len(a_p), signal_buffer_len(b_p));
+    assert_memory_equal(signal_buffer_data(a_p), signal_buffer_data(b_p), signal_buffer_len(a_p));
+}
+
+/**
+ * "cached" and "default" select the respective functions regardless of the CPU,
+ * "auto" and unknown values go by the AES instructions.
+ */
+static void test_lurch_crypto_provider_select(void ** state) {
+    (void) state;
+
+    omemo_crypto_provider crypto = { 0 };
+
+    assert_true(lurch_crypto_provider_select(&crypto, LURCH_CRYPTO_AES_GCM_CACHED));
+    assert_ptr_equal(crypto.aes_gcm_encrypt_func, lurch_crypto_aes_gcm_encrypt);
+    assert_ptr_equal(crypto.aes_gcm_decrypt_func, lurch_crypto_aes_gcm_decrypt);
+
+    assert_false(lurch_crypto_provider_select(&crypto, LURCH_CRYPTO_AES_GCM_DEFAULT));
+    assert_ptr_equal(crypto.aes_gcm_encrypt_func, omemo_default_crypto_aes_gcm_encrypt);
+    assert_ptr_equal(crypto.aes_gcm_decrypt_func, omemo_default_crypto_aes_gcm_decrypt);
+
+    assert_int_equal(lurch_crypto_provider_select(&crypto, LURCH_CRYPTO_AES_GCM_AUTO), lurch_crypto_has_aes_hw());
+    assert_int_equal(lurch_crypto_provider_select(&crypto, "unknown"), lurch_crypto_has_aes_hw());
+}
+
+/**
+ * "auto" takes the cached digest functions if there are SHA instructions,
+ * and the cached ciphers if there are AES instructions, independently of each other.
+ */
+static void test_lurch_crypto_signal_provider_select(void ** state) {
+    (void) state;
+
+    signal_crypto_provider provider = axc_crypto_provider_tmpl;
+
+    assert_true(lurch_crypto_signal_provider_select(&provider, LURCH_CRYPTO_SIGNAL_CACHED));
+    assert_ptr_equal(provider.hmac_sha256_init_func, lurch_crypto_hmac_sha256_init);
+    assert_ptr_equal(provider.sha512_digest_init_func, lurch_crypto_sha512_digest_init);
+    assert_ptr_equal(provider.encrypt_func, lurch_crypto_encrypt);
+    assert_ptr_equal(provider.decrypt_func, lurch_crypto_decrypt);
+    assert_ptr_equal(provider.random_func, axc_crypto_provider_tmpl.random_func);
+
+    provider = axc_crypto_provider_tmpl;
+    assert_false(lurch_crypto_signal_provider_select(&provider, LURCH_CRYPTO_SIGNAL_DEFAULT));
+    assert_memory_equal(&provider, &axc_crypto_provider_tmpl, sizeof(provider));
+
+    provider = axc_crypto_provider_tmpl;
+    assert_int_equal(lurch_crypto_signal_provider_select(&provider, LURCH_CRYPTO_SIGNAL_AUTO),
+                     lurch_crypto_has_sha_hw() || lurch_crypto_has_aes_hw());
+    assert_int_equal(provider.hmac_sha256_init_func == lurch_crypto_hmac_sha256_init, lurch_crypto_has_sha_hw());
+    assert_int_equal(provider.sha512_digest_final_func == lurch_crypto_sha512_digest_final, lurch_crypto_has_sha_hw());
+    assert_int_equal(provider.encrypt_func == lurch_crypto_encrypt, lurch_crypto_has_aes_hw());
+}
+
+/**
+ * The cached AES-GCM functions give the same ciphertext and tag as libomemo's,
+ * and each side decrypts what the other one encrypted.
+ */
+static void test_lurch_crypto_aes_gcm_same_as_default(void ** state) {
+    (void) state;
+
+    const size_t lens[] = { 0, 1, 15, 16, 17, 1024, TEST_DATA_LEN };
+    const size_t key_lens[] = { 16, 24, 32 };
+    uint8_t * ct_def_p = (void *) 0;
+    uint8_t * ct_p = (void *) 0;
+    uint8_t * tag_def_p = (void *) 0;
+    uint8_t * tag_p = (void *) 0;
+    uint8_t * pt_p = (void *) 0;
+    size_t ct_def_len = 0;
+    size_t ct_len = 0;
+    size_t pt_len = 0;
+    size_t i = 0;
+    size_t k = 0;
+
+    for (k = 0; k < G_N_ELEMENTS(key_lens); k++) {
+        for (i = 0; i < G_N_ELEMENTS(lens); i++) {
+            assert_int_equal(omemo_default_crypto_aes_gcm_encrypt(test_data, lens[i], test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                                  test_key, key_lens[k], OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                                                  &ct_def_p, &ct_def_len, &tag_def_p), 0);
+            assert_int_equal(lurch_crypto_aes_gcm_encrypt(test_data, lens[i], test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                          test_key, key_lens[k], OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                                          &ct_p, &ct_len, &tag_p), 0);
+
+            assert_int_equal(ct_len, ct_def_len);
+            assert_memory_equal(ct_p, ct_def_p, ct_len);
+            assert_memory_equal(tag_p, tag_def_p, OMEMO_AES_GCM_TAG_LENGTH);
+
+            assert_int_equal(lurch_crypto_aes_gcm_decrypt(ct_def_p, ct_def_len, test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                          test_key, key_lens[k], tag_def_p, OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                                          &pt_p, &pt_len), 0);
+            assert_int_equal(pt_len, lens[i]);
+            assert_memory_equal(pt_p, test_data, pt_len);
+            free(pt_p);
+
+            assert_int_equal(omemo_default_crypto_aes_gcm_decrypt(ct_p, ct_len, test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                                  test_key, key_lens[k], tag_p, OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                                                  &pt_p, &pt_len), 0);
+            assert_int_equal(pt_len, lens[i]);
+            assert_memory_equal(pt_p, test_data, pt_len);
+            free(pt_p);
+
+            free(ct_def_p);
+            free(ct_p);
+            free(tag_def_p);
+            free(tag_p);
+        }
+    }
+}
+
+/**
+ * A wrong tag is rejected by the cached decryption.
+ */
+static void test_lurch_crypto_aes_gcm_auth_fail(void ** state) {
+    (void) state;
+
+    uint8_t * ct_p = (void *) 0;
+    uint8_t * tag_p = (void *) 0;
+    uint8_t * pt_p = (void *) 0;
+    size_t ct_len = 0;
+    size_t pt_len = 0;
+
+    assert_int_equal(lurch_crypto_aes_gcm_encrypt(test_data, 100, test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                  test_key, 16, OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                                  &ct_p, &ct_len, &tag_p), 0);
+    tag_p[0] ^= 0x01;
+    assert_int_not_equal(lurch_crypto_aes_gcm_decrypt(ct_p, ct_len, test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                      test_key, 16, tag_p, OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                                      &pt_p, &pt_len), 0);
+
+    free(ct_p);
+    free(tag_p);
+}
+
+/**
+ * Encrypts with the cached and with libomemo's function and compares ciphertext and tag.
+ *
+ * @return 0 if they match, 1 if not, negative if one of them failed.
+ */
+static int test_aes_gcm_compare(const uint8_t * pt_p, size_t pt_len, const uint8_t * iv_p, size_t iv_len,
+                                const uint8_t * key_p, size_t key_len) {
+    uint8_t * ct_def_p = (void *) 0;
+    uint8_t * ct_p = (void *) 0;
+    uint8_t * tag_def_p = (void *) 0;
+    uint8_t * tag_p = (void *) 0;
+    size_t ct_def_len = 0;
+    size_t ct_len = 0;
+    int ret_val = 0;
+
+    ret_val = omemo_default_crypto_aes_gcm_encrypt(pt_p, pt_len, iv_p, iv_len, key_p, key_len, OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                                   &ct_def_p, &ct_def_len, &tag_def_p);
+    if (!ret_val) {
+        ret_val = lurch_crypto_aes_gcm_encrypt(pt_p, pt_len, iv_p, iv_len, key_p, key_len, OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                               &ct_p, &ct_len, &tag_p);
+    }
+    if (!ret_val) {
+        ret_val = (ct_len != ct_def_len || memcmp(ct_p, ct_def_p, ct_len)
+                   || memcmp(tag_p, tag_def_p, OMEMO_AES_GCM_TAG_LENGTH)) ? 1 : 0;
+    }
+
+    free(ct_def_p);
+    free(ct_p);
+    free(tag_def_p);
+    free(tag_p);
+
+    return ret_val;
+}
+
+/**
+ * A thread's handle of a key length is reused with other keys and IVs, also after a failed
+ * decryption left it with a finished tag, and nothing of the previous use carries over.
+ */
+static void test_lurch_crypto_aes_gcm_handle_reuse(void ** state) {
+    (void) state;
+
+    uint8_t key_b[32];
+    uint8_t iv_b[12];
+    uint8_t * ct_p = (void *) 0;
+    uint8_t * tag_p = (void *) 0;
+    uint8_t * pt_p = (void *) 0;
+    size_t ct_len = 0;
+    size_t pt_len = 0;
+
+    memset(key_b, 0x5c, sizeof(key_b));
+    memset(iv_b, 0x33, sizeof(iv_b));
+
+    assert_int_equal(test_aes_gcm_compare(test_data, 100, test_iv, OMEMO_AES_GCM_IV_LENGTH, test_key, 16), 0);
+    assert_int_equal(test_aes_gcm_compare(test_data, 100, test_iv, OMEMO_AES_GCM_IV_LENGTH, key_b, 16), 0);
+    assert_int_equal(test_aes_gcm_compare(test_data, 100, iv_b, sizeof(iv_b), key_b, 16), 0);
+    assert_int_equal(test_aes_gcm_compare(test_data, 100, test_iv, OMEMO_AES_GCM_IV_LENGTH, test_key, 16), 0);
+
+    assert_int_equal(lurch_crypto_aes_gcm_encrypt(test_data, 100, test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                  key_b, 32, OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                                  &ct_p, &ct_len, &tag_p), 0);
+    tag_p[3] ^= 0x10;
+    assert_int_equal(lurch_crypto_aes_gcm_decrypt(ct_p, ct_len, test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                  key_b, 32, tag_p, OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                                  &pt_p, &pt_len), OMEMO_ERR_AUTH_FAIL);
+    assert_null(pt_p);
+    tag_p[3] ^= 0x10;
+    assert_int_equal(lurch_crypto_aes_gcm_decrypt(ct_p, ct_len, test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                  key_b, 32, tag_p, OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                                  &pt_p, &pt_len), 0);
+    assert_int_equal(pt_len, 100);
+    assert_memory_equal(pt_p, test_data, pt_len);
+    free(pt_p);
+    free(ct_p);
+    free(tag_p);
+
+    assert_int_equal(test_aes_gcm_compare(test_data, TEST_DATA_LEN, iv_b, sizeof(iv_b), test_key, 32), 0);
+}
+
+static gpointer test_aes_gcm_thread_fn(gpointer data_p) {
+    uint8_t key[16];
+    int failures = 0;
+    int i = 0;
+
+    memset(key, GPOINTER_TO_INT(data_p), sizeof(key));
+    for (i = 0; i < TEST_THREAD_ROUNDS; i++) {
+        if (test_aes_gcm_compare(test_data + i, TEST_THREAD_DATA_LEN, test_iv, OMEMO_AES_GCM_IV_LENGTH, key, sizeof(key))) {
+            failures++;
+        }
+    }
+
+    return GINT_TO_POINTER(failures);
+}
+
+/**
+ * Threads encrypting at the same time each use their own handles, also after lurch_crypto_teardown()
+ * closed the ones they had before.
+ */
+static void test_lurch_crypto_aes_gcm_threads(void ** state) {
+    (void) state;
+
+    GThread * threads[TEST_THREADS];
+    int round = 0;
+    int i = 0;
+
+    for (round = 0; round < 2; round++) {
+        for (i = 0; i < TEST_THREADS; i++) {
+            threads[i] = g_thread_new("test-aes-gcm", test_aes_gcm_thread_fn, GINT_TO_POINTER(0x10 + i));
+        }
+        for (i = 0; i < TEST_THREADS; i++) {
+            assert_int_equal(GPOINTER_TO_INT(g_thread_join(threads[i])), 0);
+        }
+
+        lurch_crypto_teardown();
+        assert_int_equal(test_aes_gcm_compare(test_data, 100, test_iv, OMEMO_AES_GCM_IV_LENGTH, test_key, 16), 0);
+    }
+}
+
+// what a thread saw of its own lurch_crypto_thread_release() calls
+typedef struct {
+    GAsyncQueue * go_q_p;
+    GAsyncQueue * done_q_p;
+    int encrypt_failures;
+    int closes_first;
+    int closes_again;
+} test_release_data;
+
+static int test_release_encrypt(void) {
+    uint8_t * ct_p = (void *) 0;
+    uint8_t * tag_p = (void *) 0;
+    size_t ct_len = 0;
+    int ret_val = 0;
+
+    ret_val = lurch_crypto_aes_gcm_encrypt(test_data, 100, test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                           test_key, 16, OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                           &ct_p, &ct_len, &tag_p);
+    free(ct_p);
+    free(tag_p);
+
+    return ret_val ? 1 : 0;
+}
+
+static gpointer test_release_thread_fn(gpointer data_p) {
+    test_release_data * data = data_p;
+    gint before = 0;
+
+    data->encrypt_failures += test_release_encrypt();
+
+    // lets the main thread tear down meanwhile, if it wants to
+    if (data->go_q_p) {
+        g_async_queue_push(data->done_q_p, data);
+        (void) g_async_queue_pop(data->go_q_p);
+    }
+
+    before = g_atomic_int_get(&test_cipher_closes);
+    lurch_crypto_thread_release();
+    data->closes_first = g_atomic_int_get(&test_cipher_closes) - before;
+
+    before = g_atomic_int_get(&test_cipher_closes);
+    lurch_crypto_thread_release();
+    data->closes_again = g_atomic_int_get(&test_cipher_closes) - before;
+
+    // a new context is opened and released again
+    data->encrypt_failures += test_release_encrypt();
+    lurch_crypto_thread_release();
+
+    return NULL;
+}
+
+/**
+ * A thread closes its own handles when it releases them, only once, and not again in lurch_crypto_teardown().
+ */
+static void test_lurch_crypto_thread_release(void ** state) {
+    (void) state;
+
+    test_release_data data = {0};
+    gint before = 0;
+
+    lurch_crypto_teardown();
+
+    g_thread_join(g_thread_new("test-release", test_release_thread_fn, &data));
+    assert_int_equal(data.encrypt_failures, 0);
+    assert_true(data.closes_first > 0);
+    assert_int_equal(data.closes_again, 0);
+
+    // only the main thread's handle is left
+    assert_int_equal(test_release_encrypt(), 0);
+    before = g_atomic_int_get(&test_cipher_closes);
+    lurch_crypto_teardown();
+    assert_int_equal(g_atomic_int_get(&test_cipher_closes) - before, 1);
+}
+
+/**
+ * A thread releasing its context after lurch_crypto_teardown() closed it does not close it a second time.
+ */
+static void test_lurch_crypto_thread_release_after_teardown(void ** state) {
+    (void) state;
+
+    test_release_data data = {0};
+    GThread * thread_p = (void *) 0;
+
+    data.go_q_p = g_async_queue_new();
+    data.done_q_p = g_async_queue_new();
+
+    thread_p = g_thread_new("test-release", test_release_thread_fn, &data);
+    (void) g_async_queue_pop(data.done_q_p);
+    lurch_crypto_teardown();
+    g_async_queue_push(data.go_q_p, &data);
+    g_thread_join(thread_p);
+
+    assert_int_equal(data.encrypt_failures, 0);
+    assert_int_equal(data.closes_first, 0);
+    assert_int_equal(data.closes_again, 0);
+
+    g_async_queue_unref(data.go_q_p);
+    g_async_queue_unref(data.done_q_p);
+}
+
+/**
+ * The cached HMAC and digest handles give the same results as axc's, also when reused
+ * and when several of them are open at the same time.
+ */
+static void test_lurch_crypto_digests_same_as_default(void ** state) {
+    (void) state;
+
+    const signal_crypto_provider * def_p = &axc_crypto_provider_tmpl;
+    const size_t lens[] = { 0, 1, 64, 1000, TEST_DATA_LEN };
+    void * def_ctx_p = (void *) 0;
+    void * ctx_p = (void *) 0;
+    void * outer_ctx_p = (void *) 0;
+    signal_buffer * def_out_p = (void *) 0;
+    signal_buffer * out_p = (void *) 0;
+    size_t i = 0;
+    int round = 0;
+
+    for (round = 0; round < 2; round++) {
+        for (i = 0; i < G_N_ELEMENTS(lens); i++) {
+            // an open outer handle, as in libsignal's key derivation
+            assert_int_equal(lurch_crypto_hmac_sha256_init(&outer_ctx_p, test_key, 16, NULL), 0);
+
+            assert_int_equal(def_p->hmac_sha256_init_func(&def_ctx_p, test_key, sizeof(test_key), NULL), 0);
+            assert_int_equal(def_p->hmac_sha256_update_func(def_ctx_p, test_data, lens[i], NULL), 0);
+            assert_int_equal(def_p->hmac_sha256_final_func(def_ctx_p, &def_out_p, NULL), 0);
+            def_p->hmac_sha256_cleanup_func(def_ctx_p, NULL);
+
+            assert_int_equal(lurch_crypto_hmac_sha256_init(&ctx_p, test_key, sizeof(test_key), NULL), 0);
+            assert_int_equal(lurch_crypto_hmac_sha256_update(ctx_p, test_data, lens[i], NULL), 0);
+            assert_int_equal(lurch_crypto_hmac_sha256_final(ctx_p, &out_p, NULL), 0);
+            lurch_crypto_hmac_sha256_cleanup(ctx_p, NULL);
+
+            test_assert_buf_equal(out_p, def_out_p);
+            signal_buffer_free(out_p);
+            signal_buffer_free(def_out_p);
+            lurch_crypto_hmac_sha256_cleanup(outer_ctx_p, NULL);
+
+            assert_int_equal(def_p->sha512_digest_init_func(&def_ctx_p, NULL), 0);
+            assert_int_equal(def_p->sha512_digest_update_func(def_ctx_p, test_data, lens[i], NULL), 0);
+            assert_int_equal(def_p->sha512_digest_final_func(def_ctx_p, &def_out_p, NULL), 0);
+            def_p->sha512_digest_cleanup_func(def_ctx_p, NULL);
+
+            assert_int_equal(lurch_crypto_sha512_digest_init(&ctx_p, NULL), 0);
+            assert_int_equal(lurch_crypto_sha512_digest_update(ctx_p, test_data, lens[i], NULL), 0);
+            assert_int_equal(lurch_crypto_sha512_digest_final(ctx_p, &out_p, NULL), 0);
+            test_assert_buf_equal(out_p, def_out_p);
+            signal_buffer_free(out_p);
+
+            // the final resets the digest for the next one
+            assert_int_equal(lurch_crypto_sha512_digest_update(ctx_p, test_data, lens[i], NULL), 0);
+            assert_int_equal(lurch_crypto_sha512_digest_final(ctx_p, &out_p, NULL), 0);
+            test_assert_buf_equal(out_p, def_out_p);
+            lurch_crypto_sha512_digest_cleanup(ctx_p, NULL);
+
+            signal_buffer_free(out_p);
+            signal_buffer_free(def_out_p);
+        }
+    }
+}
+
+/**
+ * The cached AES-CBC and -CTR handles give the same ciphertext as axc's and decrypt it.
+ */
+static void test_lurch_crypto_ciphers_same_as_default(void ** state) {
+    (void) state;
+
+    const signal_crypto_provider * def_p = &axc_crypto_provider_tmpl;
+    const int ciphers[] = { SG_CIPHER_AES_CBC_PKCS5, SG_CIPHER_AES_CTR_NOPADDING };
+    const size_t lens[] = { 1, 15, 16, 17, 1024, TEST_DATA_LEN };
+    const size_t key_lens[] = { 16, 32 };
+    signal_buffer * def_out_p = (void *) 0;
+    signal_buffer * out_p = (void *) 0;
+    signal_buffer * pt_p = (void *) 0;
+    size_t c = 0;
+    size_t i = 0;
+    size_t k = 0;
+
+    for (c = 0; c < G_N_ELEMENTS(ciphers); c++) {
+        for (k = 0; k < G_N_ELEMENTS(key_lens); k++) {
+            for (i = 0; i < G_N_ELEMENTS(lens); i++) {
+                assert_int_equal(def_p->encrypt_func(&def_out_p, ciphers[c], test_key, key_lens[k], test_iv, sizeof(test_iv),
+                                                     test_data, lens[i], NULL), 0);
+                assert_int_equal(lurch_crypto_encrypt(&out_p, ciphers[c], test_key, key_lens[k], test_iv, sizeof(test_iv),
+                                                      test_data, lens[i], NULL), 0);
+                test_assert_buf_equal(out_p, def_out_p);
+
+                assert_int_equal(lurch_crypto_decrypt(&pt_p, ciphers[c], test_key, key_lens[k], test_iv, sizeof(test_iv),
+                                                      signal_buffer_data(def_out_p), signal_buffer_len(def_out_p), NULL), 0);
+                assert_int_equal(signal_buffer_len(pt_p), lens[i]);
+                assert_memory_equal(signal_buffer_data(pt_p), test_data, lens[i]);
+
+                signal_buffer_free(pt_p);
+                signal_buffer_free(out_p);
+                signal_buffer_free(def_out_p);
+            }
+        }
+    }
+}
+
+/**
+ * Encrypting in blocks gives the same ciphertext and tag as the one-shot function,
+ * also at and around the block boundaries, and decrypting in place gives the plaintext back.
+ */
+static void test_lurch_crypto_aes_gcm_stream_same_as_oneshot(void ** state) {
+    (void) state;
+
+    const size_t lens[] = { 0, 1, 15, 16, 17, TEST_STREAM_BLOCK_LEN - 1, TEST_STREAM_BLOCK_LEN, TEST_STREAM_BLOCK_LEN + 1,
+                            2 * TEST_STREAM_BLOCK_LEN, 3 * TEST_STREAM_BLOCK_LEN + 5 };
+    const size_t block_lens[] = { 16, TEST_STREAM_BLOCK_LEN };
+    const size_t max_len = 3 * TEST_STREAM_BLOCK_LEN + 5;
+    uint8_t * pt_p = g_malloc(max_len);
+    uint8_t * buf_p = g_malloc(max_len);
+    uint8_t * ct_p = (void *) 0;
+    uint8_t * tag_p = (void *) 0;
+    uint8_t tag[OMEMO_AES_GCM_TAG_LENGTH];
+    size_t ct_len = 0;
+    lurch_crypto_gcm_stream * stream_p = (void *) 0;
+    size_t pos = 0;
+    size_t len = 0;
+    size_t i = 0;
+    size_t b = 0;
+
+    for (i = 0; i < max_len; i++) {
+        pt_p[i] = (uint8_t) (i * 13 + 1);
+    }
+
+    for (b = 0; b < G_N_ELEMENTS(block_lens); b++) {
+        for (i = 0; i < G_N_ELEMENTS(lens); i++) {
+            assert_int_equal(lurch_crypto_aes_gcm_encrypt(pt_p, lens[i], test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                          test_key, OMEMO_AES_128_KEY_LENGTH, OMEMO_AES_GCM_TAG_LENGTH, NULL,
+                                                          &ct_p, &ct_len, &tag_p), 0);
+            assert_int_equal(ct_len, lens[i]);
+
+            assert_int_equal(lurch_crypto_aes_gcm_stream_begin(test_key, OMEMO_AES_128_KEY_LENGTH, test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                               &stream_p), 0);
+            // the loop of omemo_message_encrypt_text_stream(), which does not feed empty payloads
+            for (pos = 0; pos < lens[i]; pos += len) {
+                len = MIN(block_lens[b], lens[i] - pos);
+                assert_int_equal(lurch_crypto_aes_gcm_stream_encrypt(stream_p, pt_p + pos, buf_p + pos, len, pos + len == lens[i]), 0);
+            }
+            assert_int_equal(lurch_crypto_aes_gcm_stream_get_tag(stream_p, tag, sizeof(tag)), 0);
+            lurch_crypto_aes_gcm_stream_free(stream_p);
+
+            assert_memory_equal(buf_p, ct_p, lens[i]);
+            assert_memory_equal(tag, tag_p, sizeof(tag));
+
+            assert_int_equal(lurch_crypto_aes_gcm_stream_begin(test_key, OMEMO_AES_128_KEY_LENGTH, test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                               &stream_p), 0);
+            assert_int_equal(lurch_crypto_aes_gcm_stream_decrypt(stream_p, buf_p, buf_p, lens[i], TRUE), 0);
+            assert_int_equal(lurch_crypto_aes_gcm_stream_check_tag(stream_p, tag, sizeof(tag)), 0);
+            lurch_crypto_aes_gcm_stream_free(stream_p);
+            assert_memory_equal(buf_p, pt_p, lens[i]);
+
+            free(ct_p);
+            free(tag_p);
+        }
+    }
+
+    // a changed tag is rejected
+    tag[0] ^= 0x01;
+    assert_int_equal(lurch_crypto_aes_gcm_stream_begin(test_key, OMEMO_AES_128_KEY_LENGTH, test_iv, OMEMO_AES_GCM_IV_LENGTH,
+                                                       &stream_p), 0);
+    assert_int_equal(lurch_crypto_aes_gcm_stream_decrypt(stream_p, buf_p, buf_p, max_len, TRUE), 0);
+    assert_int_equal(lurch_crypto_aes_gcm_stream_check_tag(stream_p, tag, sizeof(tag)), OMEMO_ERR_AUTH_FAIL);
+    lurch_crypto_aes_gcm_stream_free(stream_p);
+
+    g_free(pt_p);
+    g_free(buf_p);
+}
+
+/**
+ * Requests larger than the pool are served from several blocks, which differ from each other.
+ */
+static void test_lurch_crypto_random_fill_large(void ** state) {
+    (void) state;
+
+    const size_t len = 4 * TEST_RNG_BLOCK_LEN + 123;
+    uint8_t * a_p = g_malloc0(len);
+    uint8_t * b_p = g_malloc0(len);
+    uint8_t * zeroes_p = g_malloc0(len);
+    size_t i = 0;
+
+    assert_int_equal(lurch_crypto_random_fill(a_p, len), 0);
+    assert_int_equal(lurch_crypto_random_fill(b_p, len), 0);
+
+    assert_memory_not_equal(a_p, b_p, len);
+    for (i = 0; i + 2 * TEST_RNG_BLOCK_LEN <= len; i += TEST_RNG_BLOCK_LEN) {
+        assert_memory_not_equal(a_p + i, a_p + i + TEST_RNG_BLOCK_LEN, TEST_RNG_BLOCK_LEN);
+    }
+    // the tail after the last full block is filled as well
+    assert_memory_not_equal(a_p + len - 123, zeroes_p, 123);
+
+    g_free(a_p);
+    g_free(b_p);
+    g_free(zeroes_p);
+}
+
+/**
+ * The pool is keyed from libgcrypt's strong RNG on first use, after 1 MiB of output
+ * and after ten minutes, and again by a thread after lurch_crypto_teardown().
+ */
+static void test_lurch_crypto_random_reseed(void ** state) {
+    (void) state;
+
+    uint8_t * buf_p = g_malloc(TEST_RNG_RESEED_BYTES);
+    uint8_t byte = 0;
+
+    lurch_crypto_teardown();
+    test_randomize_calls = 0;
+
+    assert_int_equal(lurch_crypto_random_fill(&byte, 1), 0);
+    assert_int_equal(test_randomize_calls, 1);
+
+    // the pool has to be refilled after 1 MiB to notice, which is not at a block boundary
+    assert_int_equal(lurch_crypto_random_fill(buf_p, TEST_RNG_RESEED_BYTES - 1), 0);
+    assert_int_equal(test_randomize_calls, 1);
+    assert_int_equal(lurch_crypto_random_fill(buf_p, TEST_RNG_BLOCK_LEN), 0);
+    assert_int_equal(test_randomize_calls, 2);
+
+    // the same for the time, checked on the next refill as well
+    test_time_offset += TEST_RNG_RESEED_US;
+    assert_int_equal(lurch_crypto_random_fill(buf_p, TEST_RNG_BLOCK_LEN), 0);
+    assert_int_equal(test_randomize_calls, 3);
+    assert_int_equal(lurch_crypto_random_fill(buf_p, 2 * TEST_RNG_BLOCK_LEN), 0);
+    assert_int_equal(test_randomize_calls, 3);
+
+    lurch_crypto_teardown();
+    assert_int_equal(lurch_crypto_random_fill(&byte, 1), 0);
+    assert_int_equal(test_randomize_calls, 4);
+
+    g_free(buf_p);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_lurch_crypto_provider_select),
+        cmocka_unit_test(test_lurch_crypto_signal_provider_select),
+        cmocka_unit_test(test_lurch_crypto_aes_gcm_same_as_default),
+        cmocka_unit_test(test_lurch_crypto_aes_gcm_auth_fail),
+        cmocka_unit_test(test_lurch_crypto_aes_gcm_handle_reuse),
+        cmocka_unit_test(test_lurch_crypto_aes_gcm_threads),
+        cmocka_unit_test(test_lurch_crypto_thread_release),
+        cmocka_unit_test(test_lurch_crypto_thread_release_after_teardown),
+        cmocka_unit_test(test_lurch_crypto_digests_same_as_default),
+        cmocka_unit_test(test_lurch_crypto_ciphers_same_as_default),
+        cmocka_unit_test(test_lurch_crypto_aes_gcm_stream_same_as_oneshot),
+        cmocka_unit_test(test_lurch_crypto_random_fill_large),
+        cmocka_unit_test(test_lurch_crypto_random_reseed)
+    };
+
+    return cmocka_run_group_tests_name("lurch_crypto", tests, test_setup_group, test_teardown_group);
+}
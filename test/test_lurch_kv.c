@@ -0,0 +1,231 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "../src/lurch_kv.h"
+
+static char * test_dir = (void *) 0;
+static char * test_fn = (void *) 0;
+
+void __wrap_purple_debug_error(const char * category, const char * format, ...) {
+}
+
+void __wrap_purple_debug_info(const char * category, const char * format, ...) {
+}
+
+static int test_setup(void ** state) {
+    (void) state;
+
+    test_dir = g_dir_make_tmp("lurch-kv-XXXXXX", NULL);
+    if (!test_dir) {
+        return -1;
+    }
+    test_fn = g_strconcat(test_dir, "/test.kv", NULL);
+
+    return 0;
+}
+
+static int test_teardown(void ** state) {
+    (void) state;
+
+    g_unlink(test_fn);
+    g_free(test_fn);
+    test_fn = (void *) 0;
+
+    g_rmdir(test_dir);
+    g_free(test_dir);
+    test_dir = (void *) 0;
+
+    return 0;
+}
+
+static void test_count_fn(const char * key, const uint8_t * val_p, size_t val_len, void * user_data) {
+    (*(int *) user_data)++;
+}
+
+static void test_lurch_kv_put_get_delete(void ** state) {
+    (void) state;
+
+    lurch_kv * kv_p = (void *) 0;
+    const uint8_t * val_p = (void *) 0;
+    size_t val_len = 0;
+
+    assert_int_equal(lurch_kv_open(test_fn, TRUE, &kv_p), 0);
+    assert_int_equal(lurch_kv_get(kv_p, "a", &val_p, &val_len), 0);
+
+    assert_int_equal(lurch_kv_put(kv_p, "a", (const uint8_t *) "hello", 5), 0);
+    assert_int_equal(lurch_kv_get(kv_p, "a", &val_p, &val_len), 1);
+    assert_int_equal(val_len, 5);
+    assert_memory_equal(val_p, "hello", 5);
+
+    assert_int_equal(lurch_kv_put(kv_p, "a", (const uint8_t *) "", 0), 0);
+    assert_int_equal(lurch_kv_get(kv_p, "a", &val_p, &val_len), 1);
+    assert_int_equal(val_len, 0);
+
+    assert_int_equal(lurch_kv_delete(kv_p, "a"), 1);
+    assert_int_equal(lurch_kv_delete(kv_p, "a"), 0);
+    assert_int_equal(lurch_kv_get(kv_p, "a", &val_p, &val_len), 0);
+    assert_int_equal(lurch_kv_count(kv_p), 0);
+
+    lurch_kv_close(kv_p);
+}
+
+/**
+ * Changes in a transaction are visible to the reader right away, but are dropped by a rollback.
+ */
+static void test_lurch_kv_transaction(void ** state) {
+    (void) state;
+
+    lurch_kv * kv_p = (void *) 0;
+    const uint8_t * val_p = (void *) 0;
+    size_t val_len = 0;
+    int count = 0;
+
+    assert_int_equal(lurch_kv_open(test_fn, FALSE, &kv_p), 0);
+    assert_int_equal(lurch_kv_put(kv_p, "s:alice\n1", (const uint8_t *) "one", 3), 0);
+
+    lurch_kv_begin(kv_p);
+    assert_int_equal(lurch_kv_put(kv_p, "s:alice\n2", (const uint8_t *) "two", 3), 0);
+    assert_int_equal(lurch_kv_delete(kv_p, "s:alice\n1"), 1);
+    assert_int_equal(lurch_kv_get(kv_p, "s:alice\n1", &val_p, &val_len), 0);
+    assert_int_equal(lurch_kv_foreach_prefix(kv_p, "s:alice\n", test_count_fn, &count), 1);
+    assert_int_equal(count, 1);
+    lurch_kv_rollback(kv_p);
+
+    assert_int_equal(lurch_kv_get(kv_p, "s:alice\n1", &val_p, &val_len), 1);
+    assert_int_equal(lurch_kv_get(kv_p, "s:alice\n2", &val_p, &val_len), 0);
+
+    // a failed inner transaction makes the outer one fail as well
+    lurch_kv_begin(kv_p);
+    assert_int_equal(lurch_kv_put(kv_p, "s:alice\n2", (const uint8_t *) "two", 3), 0);
+    lurch_kv_begin(kv_p);
+    lurch_kv_rollback(kv_p);
+    assert_true(lurch_kv_commit(kv_p) < 0);
+    assert_int_equal(lurch_kv_get(kv_p, "s:alice\n2", &val_p, &val_len), 0);
+
+    lurch_kv_begin(kv_p);
+    assert_int_equal(lurch_kv_put(kv_p, "s:alice\n2", (const uint8_t *) "two", 3), 0);
+    assert_int_equal(lurch_kv_put(kv_p, "s:bob\n3", (const uint8_t *) "three", 5), 0);
+    assert_int_equal(lurch_kv_commit(kv_p), 0);
+
+    count = 0;
+    assert_int_equal(lurch_kv_foreach_prefix(kv_p, "s:alice\n", test_count_fn, &count), 2);
+    assert_int_equal(lurch_kv_count(kv_p), 3);
+
+    lurch_kv_close(kv_p);
+
+    assert_int_equal(lurch_kv_open(test_fn, FALSE, &kv_p), 0);
+    assert_int_equal(lurch_kv_count(kv_p), 3);
+    assert_int_equal(lurch_kv_get(kv_p, "s:bob\n3", &val_p, &val_len), 1);
+    assert_memory_equal(val_p, "three", 5);
+    lurch_kv_close(kv_p);
+}
+
+/**
+ * Whatever follows the last commit record, e.g. after a crash in the middle of a write, is cut off on open.
+ */
+static void test_lurch_kv_damaged_tail(void ** state) {
+    (void) state;
+
+    lurch_kv * kv_p = (void *) 0;
+    const uint8_t * val_p = (void *) 0;
+    size_t val_len = 0;
+    gchar * content = (void *) 0;
+    gsize len = 0;
+    gchar * damaged = (void *) 0;
+    GStatBuf st;
+
+    assert_int_equal(lurch_kv_open(test_fn, FALSE, &kv_p), 0);
+    assert_int_equal(lurch_kv_put(kv_p, "a", (const uint8_t *) "hello", 5), 0);
+    lurch_kv_close(kv_p);
+
+    assert_true(g_file_get_contents(test_fn, &content, &len, NULL));
+    damaged = g_malloc0(len + 20);
+    memcpy(damaged, content, len);
+    memset(damaged + len, 0x2a, 20);
+    assert_true(g_file_set_contents(test_fn, damaged, len + 20, NULL));
+
+    assert_int_equal(lurch_kv_open(test_fn, FALSE, &kv_p), 0);
+    assert_int_equal(g_stat(test_fn, &st), 0);
+    assert_int_equal(st.st_size, len);
+    assert_int_equal(lurch_kv_get(kv_p, "a", &val_p, &val_len), 1);
+    assert_memory_equal(val_p, "hello", 5);
+    lurch_kv_close(kv_p);
+
+    // a damaged commit record drops its transaction
+    content[len - 1] ^= 0xff;
+    assert_true(g_file_set_contents(test_fn, content, len, NULL));
+    assert_int_equal(lurch_kv_open(test_fn, FALSE, &kv_p), 0);
+    assert_int_equal(lurch_kv_get(kv_p, "a", &val_p, &val_len), 0);
+    lurch_kv_close(kv_p);
+
+    g_free(content);
+    g_free(damaged);
+}
+
+/**
+ * A file mostly made up of overwritten values is compacted on open, keeping the current ones.
+ */
+static void test_lurch_kv_compact(void ** state) {
+    (void) state;
+
+    lurch_kv * kv_p = (void *) 0;
+    const uint8_t * val_p = (void *) 0;
+    size_t val_len = 0;
+    uint8_t val[1000];
+    int i = 0;
+    GStatBuf st;
+
+    memset(val, 0x5a, sizeof(val));
+
+    assert_int_equal(lurch_kv_open(test_fn, FALSE, &kv_p), 0);
+    assert_int_equal(lurch_kv_put(kv_p, "a", (const uint8_t *) "hello", 5), 0);
+    // also makes the file outgrow the first map
+    for (i = 0; i < 3000; i++) {
+        val[0] = i & 0xff;
+        assert_int_equal(lurch_kv_put(kv_p, "big", val, sizeof(val)), 0);
+    }
+    assert_int_equal(lurch_kv_get(kv_p, "big", &val_p, &val_len), 1);
+    assert_memory_equal(val_p, val, sizeof(val));
+    lurch_kv_close(kv_p);
+
+    assert_int_equal(g_stat(test_fn, &st), 0);
+    assert_true(st.st_size > 3000 * sizeof(val));
+
+    assert_int_equal(lurch_kv_open(test_fn, FALSE, &kv_p), 0);
+    assert_int_equal(g_stat(test_fn, &st), 0);
+    assert_true(st.st_size < 2 * sizeof(val));
+    assert_int_equal(lurch_kv_count(kv_p), 2);
+    assert_int_equal(lurch_kv_get(kv_p, "big", &val_p, &val_len), 1);
+    assert_int_equal(val_len, sizeof(val));
+    assert_memory_equal(val_p, val, sizeof(val));
+    assert_int_equal(lurch_kv_get(kv_p, "a", &val_p, &val_len), 1);
+    assert_memory_equal(val_p, "hello", 5);
+    lurch_kv_close(kv_p);
+}
+
+static void test_lurch_kv_not_a_kv_file(void ** state) {
+    (void) state;
+
+    lurch_kv * kv_p = (void *) 0;
+
+    assert_true(g_file_set_contents(test_fn, "SQLite format 3", -1, NULL));
+    assert_true(lurch_kv_open(test_fn, FALSE, &kv_p) < 0);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_lurch_kv_put_get_delete, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_kv_transaction, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_kv_damaged_tail, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_kv_compact, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_kv_not_a_kv_file, test_setup, test_teardown)
+    };
+
+    return cmocka_run_group_tests_name("lurch_kv", tests, NULL, NULL);
+}
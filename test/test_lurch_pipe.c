@@ -0,0 +1,268 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+#include <glib.h>
+
+#include "../src/lurch_pipe.h"
+
+#define TEST_ITEMS 200
+
+typedef struct {
+    GArray * worked_p;  // of int, only used by the worker
+    GArray * done_p;    // of int, in the order of the completions
+    int busy_calls;
+    int flush_calls;
+    int idle_calls;
+    gboolean worker_busy;
+    lurch_pipe * pipe_p;
+    gboolean free_in_done;
+
+    // lets the first flush wait for a push
+    gboolean block_flush;
+    GMutex flush_lock;
+    GCond flush_cond;
+    gboolean flushing;
+    gboolean pushed;
+} test_state;
+
+typedef struct {
+    test_state * state_p;
+    int index;
+} test_item;
+
+static test_item * test_item_new(test_state * state_p, int index) {
+    test_item * item_p = g_malloc0(sizeof(test_item));
+
+    item_p->state_p = state_p;
+    item_p->index = index;
+    return item_p;
+}
+
+static void test_work(void * data_p) {
+    test_item * item_p = data_p;
+
+    assert_true(item_p->state_p->worker_busy);
+    g_array_append_val(item_p->state_p->worked_p, item_p->index);
+    if (item_p->index % 16 == 0) {
+        g_usleep(100);
+    }
+}
+
+static void test_done(void * data_p, void * user_data) {
+    test_item * item_p = data_p;
+    test_state * state_p = user_data;
+
+    g_array_append_val(state_p->done_p, item_p->index);
+    g_free(item_p);
+
+    if (state_p->free_in_done) {
+        lurch_pipe_free(state_p->pipe_p, g_free);
+        state_p->pipe_p = (void *) 0;
+    }
+}
+
+static void test_busy(void * user_data) {
+    test_state * state_p = user_data;
+
+    assert_false(state_p->worker_busy);
+    state_p->worker_busy = TRUE;
+    state_p->busy_calls++;
+}
+
+static void test_flush(void * user_data) {
+    test_state * state_p = user_data;
+    gint64 end_time = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
+
+    assert_true(state_p->worker_busy);
+    state_p->flush_calls++;
+
+    if (!state_p->block_flush || state_p->flush_calls > 1) {
+        return;
+    }
+
+    g_mutex_lock(&state_p->flush_lock);
+    state_p->flushing = TRUE;
+    g_cond_broadcast(&state_p->flush_cond);
+    while (!state_p->pushed) {
+        if (!g_cond_wait_until(&state_p->flush_cond, &state_p->flush_lock, end_time)) {
+            break;
+        }
+    }
+    g_mutex_unlock(&state_p->flush_lock);
+}
+
+static void test_idle(void * user_data) {
+    test_state * state_p = user_data;
+
+    assert_true(state_p->worker_busy);
+    state_p->worker_busy = FALSE;
+    state_p->idle_calls++;
+}
+
+static void test_state_init(test_state * state_p) {
+    memset(state_p, 0, sizeof(test_state));
+    state_p->worked_p = g_array_new(FALSE, FALSE, sizeof(int));
+    state_p->done_p = g_array_new(FALSE, FALSE, sizeof(int));
+    g_mutex_init(&state_p->flush_lock);
+    g_cond_init(&state_p->flush_cond);
+    state_p->pipe_p = lurch_pipe_new("test-pipe", test_done, test_busy, test_flush, test_idle, state_p);
+    assert_non_null(state_p->pipe_p);
+}
+
+static void test_state_clear(test_state * state_p) {
+    lurch_pipe_free(state_p->pipe_p, g_free);
+    g_array_free(state_p->worked_p, TRUE);
+    g_array_free(state_p->done_p, TRUE);
+    g_mutex_clear(&state_p->flush_lock);
+    g_cond_clear(&state_p->flush_cond);
+}
+
+/**
+ * Items without work keep their place between the others.
+ */
+static void test_lurch_pipe_order(void ** state) {
+    (void) state;
+
+    test_state st;
+    int i = 0;
+    int worked = 0;
+
+    test_state_init(&st);
+
+    for (i = 0; i < TEST_ITEMS; i++) {
+        lurch_pipe_push(st.pipe_p, (i % 5 == 0) ? (void *) 0 : test_work, test_item_new(&st, i));
+    }
+    assert_true(lurch_pipe_pending(st.pipe_p));
+
+    while (lurch_pipe_pending(st.pipe_p)) {
+        (void) g_main_context_iteration(NULL, TRUE);
+    }
+
+    assert_int_equal(st.done_p->len, TEST_ITEMS);
+    for (i = 0; i < TEST_ITEMS; i++) {
+        assert_int_equal(g_array_index(st.done_p, int, i), i);
+        if (i % 5) {
+            assert_int_equal(g_array_index(st.worked_p, int, worked), i);
+            worked++;
+        }
+    }
+    assert_int_equal(st.worked_p->len, worked);
+
+    assert_true(st.busy_calls >= 1);
+    assert_int_equal(st.busy_calls, st.idle_calls);
+    assert_true(st.flush_calls >= st.idle_calls);
+    assert_false(st.worker_busy);
+
+    test_state_clear(&st);
+}
+
+/**
+ * Draining waits for the work, but leaves the completions to the main loop.
+ */
+static void test_lurch_pipe_drain(void ** state) {
+    (void) state;
+
+    test_state st;
+    int i = 0;
+
+    test_state_init(&st);
+
+    for (i = 0; i < 64; i++) {
+        lurch_pipe_push(st.pipe_p, test_work, test_item_new(&st, i));
+    }
+    lurch_pipe_drain(st.pipe_p);
+
+    assert_int_equal(st.worked_p->len, 64);
+    assert_false(st.worker_busy);
+    assert_int_equal(st.done_p->len, 0);
+    assert_true(lurch_pipe_pending(st.pipe_p));
+
+    lurch_pipe_dispatch(st.pipe_p);
+    assert_int_equal(st.done_p->len, 64);
+    assert_false(lurch_pipe_pending(st.pipe_p));
+
+    // the idle sources queued meanwhile find nothing to do
+    while (g_main_context_iteration(NULL, FALSE)) {
+    }
+    assert_int_equal(st.done_p->len, 64);
+
+    test_state_clear(&st);
+}
+
+/**
+ * A push does not wait for the flush, and the worker stays busy for the pushed item.
+ */
+static void test_lurch_pipe_push_during_flush(void ** state) {
+    (void) state;
+
+    test_state st;
+
+    test_state_init(&st);
+    st.block_flush = TRUE;
+
+    lurch_pipe_push(st.pipe_p, test_work, test_item_new(&st, 0));
+
+    g_mutex_lock(&st.flush_lock);
+    while (!st.flushing) {
+        g_cond_wait(&st.flush_cond, &st.flush_lock);
+    }
+    g_mutex_unlock(&st.flush_lock);
+
+    // would block until the flush gave up if the flush held the pipe's lock
+    lurch_pipe_push(st.pipe_p, test_work, test_item_new(&st, 1));
+
+    g_mutex_lock(&st.flush_lock);
+    st.pushed = TRUE;
+    g_cond_broadcast(&st.flush_cond);
+    g_mutex_unlock(&st.flush_lock);
+
+    lurch_pipe_drain(st.pipe_p);
+    lurch_pipe_dispatch(st.pipe_p);
+
+    assert_int_equal(st.done_p->len, 2);
+    assert_int_equal(st.busy_calls, 1);
+    assert_int_equal(st.idle_calls, 1);
+    assert_int_equal(st.flush_calls, 2);
+    assert_false(st.worker_busy);
+
+    test_state_clear(&st);
+}
+
+/**
+ * A completion can free the pipe, the remaining items are dropped.
+ */
+static void test_lurch_pipe_free_in_done(void ** state) {
+    (void) state;
+
+    test_state st;
+    int i = 0;
+
+    test_state_init(&st);
+    st.free_in_done = TRUE;
+
+    for (i = 0; i < 8; i++) {
+        lurch_pipe_push(st.pipe_p, test_work, test_item_new(&st, i));
+    }
+    lurch_pipe_drain(st.pipe_p);
+    lurch_pipe_dispatch(st.pipe_p);
+
+    assert_null(st.pipe_p);
+    assert_int_equal(st.done_p->len, 1);
+    assert_int_equal(st.worked_p->len, 8);
+
+    test_state_clear(&st);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_lurch_pipe_order),
+        cmocka_unit_test(test_lurch_pipe_drain),
+        cmocka_unit_test(test_lurch_pipe_push_during_flush),
+        cmocka_unit_test(test_lurch_pipe_free_in_done)
+    };
+
+    return cmocka_run_group_tests_name("lurch_pipe", tests, NULL, NULL);
+}
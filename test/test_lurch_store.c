@@ -0,0 +1,879 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sqlite3.h>
+
+#include "axc.h"
+#include "libomemo.h"
+#include "signal_protocol.h"
+
+#include "../src/lurch_store.h"
+#include "../src/lurch_util.h"
+
+#define TEST_UNAME "test-uname@example.com"
+
+// same tables as created by axc
+#define AXC_TABLES "CREATE TABLE IF NOT EXISTS session_store(" \
+                     "name TEXT NOT NULL, " \
+                     "name_len INTEGER NOT NULL, " \
+                     "device_id INTEGER NOT NULL, " \
+                     "session_record BLOB NOT NULL, " \
+                     "record_len INTEGER NOT NULL, " \
+                     "PRIMARY KEY(name, device_id));" \
+                   "CREATE TABLE IF NOT EXISTS pre_key_store(" \
+                     "id INTEGER NOT NULL PRIMARY KEY, " \
+                     "pre_key_record BLOB NOT NULL, " \
+                     "record_len INTEGER NOT NULL);" \
+                   "CREATE TABLE IF NOT EXISTS signed_pre_key_store(" \
+                     "id INTEGER NOT NULL PRIMARY KEY, " \
+                     "signed_pre_key_record BLOB NOT NULL, " \
+                     "record_len INTEGER NOT NULL);"
+
+static char * test_dir = (void *) 0;
+static int test_dl_cache_size = 2;
+
+const char * __wrap_purple_user_dir(void) {
+    return test_dir;
+}
+
+int __wrap_purple_prefs_get_int(const char * pref_name) {
+    assert_string_equal(pref_name, LURCH_PREF_STORE_DL_CACHE_SIZE);
+    return test_dl_cache_size;
+}
+
+static const char * test_journal_mode = LURCH_STORE_JOURNAL_ROLLBACK;
+static const char * test_sess_backend = LURCH_STORE_BACKEND_SQLITE;
+
+const char * __wrap_purple_prefs_get_string(const char * pref_name) {
+    if (!g_strcmp0(pref_name, LURCH_PREF_STORE_OMEMO_JOURNAL) || !g_strcmp0(pref_name, LURCH_PREF_STORE_AXC_JOURNAL)) {
+        return test_journal_mode;
+    }
+    if (!g_strcmp0(pref_name, LURCH_PREF_STORE_SESS_BACKEND)) {
+        return test_sess_backend;
+    }
+    assert_true(!g_strcmp0(pref_name, LURCH_PREF_STORE_OMEMO_SYNC) || !g_strcmp0(pref_name, LURCH_PREF_STORE_AXC_SYNC));
+    return LURCH_STORE_SYNC_NORMAL;
+}
+
+static int test_debug_errors = 0;
+
+void __wrap_purple_debug_error(const char * category, const char * format, ...) {
+    test_debug_errors++;
+}
+
+void __wrap_purple_debug_info(const char * category, const char * format, ...) {
+}
+
+static int test_setup(void ** state) {
+    (void) state;
+
+    sqlite3 * db_p = (void *) 0;
+    char * db_fn = (void *) 0;
+
+    test_dir = g_dir_make_tmp("lurch-store-XXXXXX", NULL);
+    if (!test_dir) {
+        return -1;
+    }
+
+    db_fn = lurch_util_uname_get_db_fn(TEST_UNAME, LURCH_DB_NAME_AXC);
+    if (sqlite3_open(db_fn, &db_p) != SQLITE_OK || sqlite3_exec(db_p, AXC_TABLES, NULL, NULL, NULL) != SQLITE_OK) {
+        return -1;
+    }
+    sqlite3_close(db_p);
+    g_free(db_fn);
+
+    return 0;
+}
+
+static int test_teardown(void ** state) {
+    (void) state;
+
+    char * db_fn = (void *) 0;
+
+    lurch_store_reset_all();
+
+    db_fn = lurch_util_uname_get_db_fn(TEST_UNAME, LURCH_DB_NAME_OMEMO);
+    g_unlink(db_fn);
+    g_free(db_fn);
+    db_fn = lurch_util_uname_get_db_fn(TEST_UNAME, LURCH_DB_NAME_AXC);
+    g_unlink(db_fn);
+    g_free(db_fn);
+    db_fn = g_strconcat(test_dir, "/", TEST_UNAME, "_", LURCH_KV_NAME_SESSIONS, LURCH_KV_SUFFIX, NULL);
+    g_unlink(db_fn);
+    g_free(db_fn);
+    test_sess_backend = LURCH_STORE_BACKEND_SQLITE;
+
+    g_rmdir(test_dir);
+    g_free(test_dir);
+    test_dir = (void *) 0;
+
+    return 0;
+}
+
+/**
+ * The store is opened once and then returned from the map.
+ */
+static void test_lurch_store_get(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    lurch_store * store_again_p = (void *) 0;
+    char * db_fn = lurch_util_uname_get_db_fn(TEST_UNAME, LURCH_DB_NAME_OMEMO);
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    assert_non_null(store_p);
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_again_p), 0);
+    assert_ptr_equal(store_p, store_again_p);
+
+    assert_string_equal(lurch_store_get_db_fn(store_p, LURCH_STORE_DB_OMEMO), db_fn);
+    assert_null(lurch_store_get_db_fn(NULL, LURCH_STORE_DB_OMEMO));
+
+    g_free(db_fn);
+}
+
+static void test_lurch_store_chatlist(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    const char * chat = "room@conference.example.com";
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+
+    assert_int_equal(lurch_store_chatlist_exists(store_p, chat), 0);
+    assert_int_equal(lurch_store_chatlist_save(store_p, chat), 0);
+    assert_int_equal(lurch_store_chatlist_exists(store_p, chat), 1);
+    assert_int_equal(lurch_store_chatlist_save(store_p, chat), 0);
+    assert_int_equal(lurch_store_chatlist_delete(store_p, chat), 0);
+    assert_int_equal(lurch_store_chatlist_exists(store_p, chat), 0);
+}
+
+/**
+ * The chatlist is loaded from the db when the store is opened again.
+ */
+static void test_lurch_store_chatlist_reload(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    const char * chat = "contact@example.com";
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    assert_int_equal(lurch_store_chatlist_save(store_p, chat), 0);
+    assert_int_equal(lurch_store_chatlist_save(store_p, "other@example.com"), 0);
+    assert_int_equal(lurch_store_chatlist_delete(store_p, "other@example.com"), 0);
+
+    lurch_store_reset_all();
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    assert_int_equal(lurch_store_chatlist_exists(store_p, chat), 1);
+    assert_int_equal(lurch_store_chatlist_exists(store_p, "other@example.com"), 0);
+    assert_int_equal(lurch_store_chatlist_exists(store_p, NULL), 0);
+}
+
+static void test_lurch_store_devicelist(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    omemo_devicelist * dl_p = (void *) 0;
+    const char * user = "alice@example.com";
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+
+    assert_int_equal(lurch_store_device_id_save(store_p, user, 1111), 0);
+    assert_int_equal(lurch_store_device_id_save(store_p, user, 2222), 0);
+    assert_int_equal(lurch_store_device_id_save(store_p, "bob@example.com", 3333), 0);
+
+    assert_int_equal(lurch_store_device_id_exists(store_p, user, 1111), 1);
+    assert_int_equal(lurch_store_device_id_exists(store_p, user, 3333), 0);
+    assert_int_equal(lurch_store_global_device_id_exists(store_p, 3333), 1);
+    assert_int_equal(lurch_store_global_device_id_exists(store_p, 4444), 0);
+
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, user, &dl_p), 0);
+    assert_true(omemo_devicelist_contains_id(dl_p, 1111));
+    assert_true(omemo_devicelist_contains_id(dl_p, 2222));
+    assert_false(omemo_devicelist_contains_id(dl_p, 3333));
+    omemo_devicelist_destroy(dl_p);
+
+    assert_int_equal(lurch_store_device_id_delete(store_p, user, 1111), 0);
+    assert_int_equal(lurch_store_device_id_exists(store_p, user, 1111), 0);
+}
+
+/**
+ * Devicelists are served from the cache after the first lookup, and changes go to both.
+ */
+static void test_lurch_store_devicelist_cache(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    omemo_devicelist * dl_p = (void *) 0;
+    unsigned int hits = 0;
+    unsigned int misses = 0;
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    assert_int_equal(lurch_store_device_id_save(store_p, "alice@example.com", 1111), 0);
+
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "alice@example.com", &dl_p), 0);
+    omemo_devicelist_destroy(dl_p);
+    lurch_store_devicelist_cache_stats(store_p, &hits, &misses);
+    assert_int_equal(hits, 0);
+    assert_int_equal(misses, 1);
+
+    // written through to the cached entry
+    assert_int_equal(lurch_store_device_id_save(store_p, "alice@example.com", 2222), 0);
+    assert_int_equal(lurch_store_device_id_delete(store_p, "alice@example.com", 1111), 0);
+
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "alice@example.com", &dl_p), 0);
+    assert_false(omemo_devicelist_contains_id(dl_p, 1111));
+    assert_true(omemo_devicelist_contains_id(dl_p, 2222));
+    omemo_devicelist_destroy(dl_p);
+    assert_int_equal(lurch_store_device_id_exists(store_p, "alice@example.com", 2222), 1);
+    lurch_store_devicelist_cache_stats(store_p, &hits, &misses);
+    assert_int_equal(hits, 2);
+    assert_int_equal(misses, 1);
+
+    // the cache holds two entries, so alice is evicted by the third one
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "bob@example.com", &dl_p), 0);
+    omemo_devicelist_destroy(dl_p);
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "carol@example.com", &dl_p), 0);
+    omemo_devicelist_destroy(dl_p);
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "bob@example.com", &dl_p), 0);
+    omemo_devicelist_destroy(dl_p);
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "dave@example.com", &dl_p), 0);
+    omemo_devicelist_destroy(dl_p);
+    lurch_store_devicelist_cache_stats(store_p, &hits, &misses);
+    assert_int_equal(hits, 3);
+    assert_int_equal(misses, 4);
+
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "bob@example.com", &dl_p), 0);
+    omemo_devicelist_destroy(dl_p);
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "carol@example.com", &dl_p), 0);
+    omemo_devicelist_destroy(dl_p);
+    lurch_store_devicelist_cache_stats(store_p, &hits, &misses);
+    assert_int_equal(hits, 4);
+    assert_int_equal(misses, 5);
+
+    lurch_store_devicelist_cache_invalidate(store_p, "carol@example.com");
+    assert_int_equal(lurch_store_device_id_exists(store_p, "carol@example.com", 1), 0);
+    lurch_store_devicelist_cache_stats(store_p, &hits, &misses);
+    assert_int_equal(misses, 6);
+}
+
+/**
+ * An updated devicelist replaces the cached one.
+ */
+static void test_lurch_store_devicelist_cache_update(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    omemo_devicelist * dl_in_p = (void *) 0;
+    omemo_devicelist * dl_p = (void *) 0;
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+
+    assert_int_equal(omemo_devicelist_create("alice@example.com", &dl_in_p), 0);
+    assert_int_equal(omemo_devicelist_add(dl_in_p, 5555), 0);
+    lurch_store_devicelist_cache_update(store_p, dl_in_p);
+    omemo_devicelist_destroy(dl_in_p);
+
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "alice@example.com", &dl_p), 0);
+    assert_true(omemo_devicelist_contains_id(dl_p, 5555));
+    omemo_devicelist_destroy(dl_p);
+}
+
+/**
+ * Peeking only answers from the cache, loading only reads the db and leaves the cache alone.
+ */
+static void test_lurch_store_devicelist_peek_load(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    omemo_devicelist * dl_p = (void *) 0;
+    unsigned int hits = 0;
+    unsigned int misses = 0;
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    assert_int_equal(lurch_store_device_id_save(store_p, "alice@example.com", 1111), 0);
+
+    assert_int_equal(lurch_store_devicelist_cache_peek(store_p, "alice@example.com", &dl_p), 0);
+    assert_null(dl_p);
+
+    assert_int_equal(lurch_store_devicelist_load(store_p, "alice@example.com", &dl_p), 0);
+    assert_true(omemo_devicelist_contains_id(dl_p, 1111));
+    omemo_devicelist_destroy(dl_p);
+    dl_p = (void *) 0;
+
+    // still not cached
+    assert_int_equal(lurch_store_devicelist_cache_peek(store_p, "alice@example.com", &dl_p), 0);
+    assert_null(dl_p);
+    lurch_store_devicelist_cache_stats(store_p, &hits, &misses);
+    assert_int_equal(hits, 0);
+    assert_int_equal(misses, 2);
+
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "alice@example.com", &dl_p), 0);
+    omemo_devicelist_destroy(dl_p);
+    dl_p = (void *) 0;
+
+    assert_int_equal(lurch_store_devicelist_cache_peek(store_p, "alice@example.com", &dl_p), 0);
+    assert_true(omemo_devicelist_contains_id(dl_p, 1111));
+    omemo_devicelist_destroy(dl_p);
+    lurch_store_devicelist_cache_stats(store_p, &hits, &misses);
+    assert_int_equal(hits, 1);
+    assert_int_equal(misses, 3);
+}
+
+/**
+ * Additions and deletions are applied together and reflected in the cache.
+ */
+static void test_lurch_store_devicelist_apply(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    omemo_devicelist * dl_p = (void *) 0;
+    omemo_devicelist * dl_in_p = (void *) 0;
+    GList * add_l_p = (void *) 0;
+    GList * del_l_p = (void *) 0;
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    assert_int_equal(lurch_store_device_id_save(store_p, "alice@example.com", 1111), 0);
+    assert_int_equal(lurch_store_device_id_save(store_p, "alice@example.com", 2222), 0);
+
+    // cache the old list
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "alice@example.com", &dl_p), 0);
+
+    assert_int_equal(omemo_devicelist_create("alice@example.com", &dl_in_p), 0);
+    assert_int_equal(omemo_devicelist_add(dl_in_p, 2222), 0);
+    assert_int_equal(omemo_devicelist_add(dl_in_p, 3333), 0);
+    assert_int_equal(omemo_devicelist_add(dl_in_p, 4444), 0);
+    assert_int_equal(omemo_devicelist_diff(dl_in_p, dl_p, &add_l_p, &del_l_p), 0);
+    omemo_devicelist_destroy(dl_p);
+
+    assert_int_equal(lurch_store_devicelist_apply(store_p, "alice@example.com", add_l_p, del_l_p), 0);
+    assert_int_equal(lurch_store_devicelist_apply(store_p, "alice@example.com", NULL, NULL), 0);
+
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "alice@example.com", &dl_p), 0);
+    assert_false(omemo_devicelist_contains_id(dl_p, 1111));
+    assert_true(omemo_devicelist_contains_id(dl_p, 2222));
+    assert_true(omemo_devicelist_contains_id(dl_p, 3333));
+    assert_true(omemo_devicelist_contains_id(dl_p, 4444));
+    omemo_devicelist_destroy(dl_p);
+
+    // and in the db
+    lurch_store_devicelist_cache_invalidate(store_p, "alice@example.com");
+    assert_int_equal(lurch_store_device_id_exists(store_p, "alice@example.com", 1111), 0);
+    assert_int_equal(lurch_store_device_id_exists(store_p, "alice@example.com", 4444), 1);
+
+    omemo_devicelist_destroy(dl_in_p);
+    g_list_free_full(add_l_p, free);
+    g_list_free_full(del_l_p, free);
+}
+
+static void test_lurch_store_session_store(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    axc_context * fake_ctx_p = (void *) &"fake non-null pointer";
+    const signal_protocol_session_store * sess_store_p = &lurch_store_session_store_tmpl;
+    signal_protocol_address addr = { .name = "alice@example.com", .name_len = 17, .device_id = 1111 };
+    uint8_t record[] = { 0x01, 0x00, 0x02, 0x03 };
+    signal_buffer * record_buf_p = (void *) 0;
+    signal_int_list * sessions_p = (void *) 0;
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+
+    assert_int_equal(sess_store_p->load_session_func(&record_buf_p, NULL, &addr, fake_ctx_p), 0);
+    assert_int_equal(sess_store_p->contains_session_func(&addr, fake_ctx_p), 0);
+
+    assert_int_equal(sess_store_p->store_session_func(&addr, record, sizeof(record), NULL, 0, fake_ctx_p), 0);
+    assert_int_equal(sess_store_p->contains_session_func(&addr, fake_ctx_p), 1);
+    assert_int_equal(sess_store_p->load_session_func(&record_buf_p, NULL, &addr, fake_ctx_p), 1);
+    assert_int_equal(signal_buffer_len(record_buf_p), sizeof(record));
+    assert_memory_equal(signal_buffer_data(record_buf_p), record, sizeof(record));
+    signal_buffer_free(record_buf_p);
+
+    addr.device_id = 2222;
+    assert_int_equal(sess_store_p->store_session_func(&addr, record, sizeof(record), NULL, 0, fake_ctx_p), 0);
+    assert_int_equal(sess_store_p->get_sub_device_sessions_func(&sessions_p, addr.name, addr.name_len, fake_ctx_p), 2);
+    signal_int_list_free(sessions_p);
+
+    assert_int_equal(sess_store_p->delete_session_func(&addr, fake_ctx_p), 1);
+    assert_int_equal(sess_store_p->delete_session_func(&addr, fake_ctx_p), 0);
+    assert_int_equal(sess_store_p->delete_all_sessions_func(addr.name, addr.name_len, fake_ctx_p), 1);
+}
+
+static void test_lurch_store_pre_key_store(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    axc_context * fake_ctx_p = (void *) &"fake non-null pointer";
+    const signal_protocol_pre_key_store * pk_store_p = &lurch_store_pre_key_store_tmpl;
+    uint8_t record[] = { 0x0a, 0x0b, 0x00, 0x0c };
+    signal_buffer * record_buf_p = (void *) 0;
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+
+    assert_int_equal(pk_store_p->load_pre_key(&record_buf_p, 42, fake_ctx_p), SG_ERR_INVALID_KEY_ID);
+    assert_int_equal(pk_store_p->store_pre_key(42, record, sizeof(record), fake_ctx_p), 0);
+    assert_int_equal(pk_store_p->contains_pre_key(42, fake_ctx_p), 1);
+    assert_int_equal(pk_store_p->load_pre_key(&record_buf_p, 42, fake_ctx_p), SG_SUCCESS);
+    assert_memory_equal(signal_buffer_data(record_buf_p), record, sizeof(record));
+    signal_buffer_free(record_buf_p);
+
+    assert_int_equal(pk_store_p->remove_pre_key(42, fake_ctx_p), 0);
+    assert_int_equal(pk_store_p->contains_pre_key(42, fake_ctx_p), 0);
+}
+
+/**
+ * Changes made during a message are visible right away, but only reach the db on commit.
+ */
+static void test_lurch_store_msg_commit(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    axc_context * fake_ctx_p = (void *) &"fake non-null pointer";
+    const signal_protocol_session_store * sess_store_p = &lurch_store_session_store_tmpl;
+    signal_protocol_address addr = { .name = "alice@example.com", .name_len = 17, .device_id = 1111 };
+    uint8_t record[] = { 0x01, 0x00, 0x02, 0x03 };
+    uint8_t record_new[] = { 0x04, 0x05 };
+    signal_buffer * record_buf_p = (void *) 0;
+    signal_int_list * sessions_p = (void *) 0;
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+    assert_int_equal(sess_store_p->store_session_func(&addr, record, sizeof(record), NULL, 0, fake_ctx_p), 0);
+
+    lurch_store_msg_begin(store_p);
+    assert_int_equal(sess_store_p->store_session_func(&addr, record_new, sizeof(record_new), NULL, 0, fake_ctx_p), 0);
+    assert_int_equal(sess_store_p->load_session_func(&record_buf_p, NULL, &addr, fake_ctx_p), 1);
+    assert_memory_equal(signal_buffer_data(record_buf_p), record_new, sizeof(record_new));
+    signal_buffer_free(record_buf_p);
+
+    addr.device_id = 2222;
+    assert_int_equal(sess_store_p->store_session_func(&addr, record, sizeof(record), NULL, 0, fake_ctx_p), 0);
+    assert_int_equal(sess_store_p->get_sub_device_sessions_func(&sessions_p, addr.name, addr.name_len, fake_ctx_p), 2);
+    signal_int_list_free(sessions_p);
+
+    // nested scopes are written by the outermost one
+    lurch_store_msg_begin(store_p);
+    assert_int_equal(sess_store_p->delete_session_func(&addr, fake_ctx_p), 1);
+    assert_int_equal(lurch_store_msg_commit(store_p), 0);
+    assert_int_equal(sess_store_p->contains_session_func(&addr, fake_ctx_p), 0);
+
+    assert_int_equal(lurch_store_msg_commit(store_p), 0);
+
+    // open the db again to make sure the changes were written
+    lurch_store_reset_all();
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+
+    assert_int_equal(sess_store_p->contains_session_func(&addr, fake_ctx_p), 0);
+    addr.device_id = 1111;
+    assert_int_equal(sess_store_p->load_session_func(&record_buf_p, NULL, &addr, fake_ctx_p), 1);
+    assert_int_equal(signal_buffer_len(record_buf_p), sizeof(record_new));
+    assert_memory_equal(signal_buffer_data(record_buf_p), record_new, sizeof(record_new));
+    signal_buffer_free(record_buf_p);
+}
+
+static void test_lurch_store_msg_rollback(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    axc_context * fake_ctx_p = (void *) &"fake non-null pointer";
+    const signal_protocol_session_store * sess_store_p = &lurch_store_session_store_tmpl;
+    const signal_protocol_pre_key_store * pk_store_p = &lurch_store_pre_key_store_tmpl;
+    signal_protocol_address addr = { .name = "alice@example.com", .name_len = 17, .device_id = 1111 };
+    uint8_t record[] = { 0x01, 0x00, 0x02, 0x03 };
+    signal_buffer * record_buf_p = (void *) 0;
+    signal_int_list * sessions_p = (void *) 0;
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+    assert_int_equal(sess_store_p->store_session_func(&addr, record, sizeof(record), NULL, 0, fake_ctx_p), 0);
+    assert_int_equal(pk_store_p->store_pre_key(42, record, sizeof(record), fake_ctx_p), 0);
+
+    lurch_store_msg_begin(store_p);
+    assert_int_equal(pk_store_p->remove_pre_key(42, fake_ctx_p), 0);
+    assert_int_equal(pk_store_p->load_pre_key(&record_buf_p, 42, fake_ctx_p), SG_ERR_INVALID_KEY_ID);
+    assert_int_equal(sess_store_p->delete_all_sessions_func(addr.name, addr.name_len, fake_ctx_p), 1);
+    assert_int_equal(sess_store_p->contains_session_func(&addr, fake_ctx_p), 0);
+    assert_int_equal(sess_store_p->get_sub_device_sessions_func(&sessions_p, addr.name, addr.name_len, fake_ctx_p), 0);
+    signal_int_list_free(sessions_p);
+    lurch_store_msg_rollback(store_p);
+
+    assert_int_equal(sess_store_p->contains_session_func(&addr, fake_ctx_p), 1);
+    assert_int_equal(pk_store_p->contains_pre_key(42, fake_ctx_p), 1);
+
+    // a failed inner scope makes the outer one fail as well
+    lurch_store_msg_begin(store_p);
+    assert_int_equal(sess_store_p->delete_session_func(&addr, fake_ctx_p), 1);
+    lurch_store_msg_begin(store_p);
+    lurch_store_msg_rollback(store_p);
+    assert_true(lurch_store_msg_commit(store_p) < 0);
+
+    assert_int_equal(sess_store_p->contains_session_func(&addr, fake_ctx_p), 1);
+}
+
+/**
+ * A failed message of a batch only drops its own changes, the others are written at the end.
+ */
+static void test_lurch_store_batch(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    axc_context * fake_ctx_p = (void *) &"fake non-null pointer";
+    const signal_protocol_session_store * sess_store_p = &lurch_store_session_store_tmpl;
+    const signal_protocol_pre_key_store * pk_store_p = &lurch_store_pre_key_store_tmpl;
+    signal_protocol_address addr = { .name = "alice@example.com", .name_len = 17, .device_id = 1111 };
+    uint8_t record[] = { 0x01, 0x00, 0x02, 0x03 };
+    uint8_t record_new[] = { 0x04, 0x05 };
+    uint8_t record_failed[] = { 0x06 };
+    signal_buffer * record_buf_p = (void *) 0;
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+    assert_int_equal(sess_store_p->store_session_func(&addr, record, sizeof(record), NULL, 0, fake_ctx_p), 0);
+    assert_int_equal(pk_store_p->store_pre_key(42, record, sizeof(record), fake_ctx_p), 0);
+    assert_int_equal(pk_store_p->store_pre_key(43, record, sizeof(record), fake_ctx_p), 0);
+
+    assert_int_equal(lurch_store_batch_begin(store_p), 0);
+    assert_true(lurch_store_batch_is_open(store_p));
+
+    lurch_store_msg_begin(store_p);
+    assert_int_equal(sess_store_p->store_session_func(&addr, record_new, sizeof(record_new), NULL, 0, fake_ctx_p), 0);
+    assert_int_equal(pk_store_p->remove_pre_key(42, fake_ctx_p), 0);
+    assert_int_equal(lurch_store_msg_commit(store_p), 0);
+
+    // rolled back on its own
+    lurch_store_msg_begin(store_p);
+    assert_int_equal(sess_store_p->store_session_func(&addr, record_failed, sizeof(record_failed), NULL, 0, fake_ctx_p), 0);
+    assert_int_equal(pk_store_p->remove_pre_key(43, fake_ctx_p), 0);
+    lurch_store_msg_rollback(store_p);
+
+    // failed through a nested scope
+    lurch_store_msg_begin(store_p);
+    assert_int_equal(sess_store_p->delete_all_sessions_func(addr.name, addr.name_len, fake_ctx_p), 1);
+    lurch_store_msg_begin(store_p);
+    lurch_store_msg_rollback(store_p);
+    assert_true(lurch_store_msg_commit(store_p) < 0);
+
+    assert_true(lurch_store_batch_is_open(store_p));
+    assert_int_equal(sess_store_p->load_session_func(&record_buf_p, NULL, &addr, fake_ctx_p), 1);
+    assert_memory_equal(signal_buffer_data(record_buf_p), record_new, sizeof(record_new));
+    signal_buffer_free(record_buf_p);
+    assert_int_equal(pk_store_p->contains_pre_key(42, fake_ctx_p), 0);
+    assert_int_equal(pk_store_p->contains_pre_key(43, fake_ctx_p), 1);
+
+    assert_int_equal(lurch_store_batch_commit(store_p), 0);
+    assert_false(lurch_store_batch_is_open(store_p));
+
+    // open the db again to make sure the changes were written
+    lurch_store_reset_all();
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+
+    assert_int_equal(sess_store_p->load_session_func(&record_buf_p, NULL, &addr, fake_ctx_p), 1);
+    assert_int_equal(signal_buffer_len(record_buf_p), sizeof(record_new));
+    assert_memory_equal(signal_buffer_data(record_buf_p), record_new, sizeof(record_new));
+    signal_buffer_free(record_buf_p);
+    assert_int_equal(pk_store_p->contains_pre_key(42, fake_ctx_p), 0);
+    assert_int_equal(pk_store_p->contains_pre_key(43, fake_ctx_p), 1);
+}
+
+static void test_lurch_store_device_id_save_async(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    omemo_devicelist * dl_p = (void *) 0;
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+
+    // cached entries are changed right away, db lookups wait for the worker
+    assert_int_equal(lurch_store_devicelist_retrieve(store_p, "alice@example.com", &dl_p), 0);
+    omemo_devicelist_destroy(dl_p);
+    lurch_store_device_id_save_async(store_p, "alice@example.com", 1111);
+    lurch_store_device_id_save_async(store_p, "bob@example.com", 2222);
+    assert_int_equal(lurch_store_device_id_exists(store_p, "alice@example.com", 1111), 1);
+    assert_int_equal(lurch_store_device_id_exists(store_p, "bob@example.com", 2222), 1);
+
+    lurch_store_devicelist_cache_invalidate(store_p, "alice@example.com");
+    assert_int_equal(lurch_store_device_id_exists(store_p, "alice@example.com", 1111), 1);
+
+    while (g_main_context_iteration(NULL, FALSE)) {
+    }
+}
+
+/**
+ * The signed pre key is written to axc's table by the worker, through the worker's handle.
+ */
+static void test_lurch_store_signed_pre_key_save_async(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    const uint8_t record[] = {0x0a, 0x0b, 0x0c, 0x0d};
+    sqlite3 * db_p = (void *) 0;
+    sqlite3_stmt * pstmt_p = (void *) 0;
+    char * db_fn = lurch_util_uname_get_db_fn(TEST_UNAME, LURCH_DB_NAME_AXC);
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+
+    lurch_store_signed_pre_key_save_async(store_p, 42, signal_buffer_create(record, sizeof(record)));
+    lurch_store_sync(store_p);
+
+    assert_int_equal(sqlite3_open(db_fn, &db_p), SQLITE_OK);
+    assert_int_equal(sqlite3_prepare_v2(db_p, "SELECT signed_pre_key_record, record_len FROM signed_pre_key_store WHERE id IS 42;",
+                                        -1, &pstmt_p, NULL), SQLITE_OK);
+    assert_int_equal(sqlite3_step(pstmt_p), SQLITE_ROW);
+    assert_int_equal(sqlite3_column_int(pstmt_p, 1), sizeof(record));
+    assert_memory_equal(sqlite3_column_blob(pstmt_p, 0), record, sizeof(record));
+    sqlite3_finalize(pstmt_p);
+    sqlite3_close(db_p);
+    g_free(db_fn);
+
+    while (g_main_context_iteration(NULL, FALSE)) {
+    }
+}
+
+static GThread * test_work_thread_p = (void *) 0;
+static int test_done_ret_val = 0;
+static int test_done_calls = 0;
+
+static int test_work_fn(sqlite3 * db_p, void * data_p, char ** err_msg_pp) {
+    (void) db_p;
+    test_work_thread_p = g_thread_self();
+    *err_msg_pp = g_strdup("test error");
+    return *((int *) data_p);
+}
+
+static void test_done_fn(const char * uname, int ret_val, void * data_p) {
+    (void) data_p;
+    assert_string_equal(uname, TEST_UNAME);
+    assert_ptr_not_equal(g_thread_self(), test_work_thread_p);
+    test_done_ret_val = ret_val;
+    test_done_calls++;
+}
+
+static void test_lurch_store_submit(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    int work_ret_val = -42;
+
+    test_done_calls = 0;
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+
+    lurch_store_submit(store_p, LURCH_STORE_DB_AXC, test_work_fn, test_done_fn, &work_ret_val);
+    lurch_store_sync(store_p);
+    assert_non_null(test_work_thread_p);
+
+    while (test_done_calls == 0) {
+        (void) g_main_context_iteration(NULL, TRUE);
+    }
+    assert_int_equal(test_done_ret_val, -42);
+
+    // completions which did not run yet are delivered when the stores are closed
+    lurch_store_submit(store_p, LURCH_STORE_DB_OMEMO, test_work_fn, test_done_fn, &work_ret_val);
+    lurch_store_reset_all();
+    assert_int_equal(test_done_calls, 2);
+}
+
+static int test_journal_mode_cb(void * data_p, int n_cols, char ** vals, char ** names) {
+    (void) n_cols;
+    (void) names;
+    *((char **) data_p) = g_strdup(vals[0]);
+    return 0;
+}
+
+/**
+ * The journal mode is kept in the db file, so a new connection has to see it.
+ */
+static void test_lurch_store_apply_durability(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    sqlite3 * db_p = (void *) 0;
+    char * mode = (void *) 0;
+
+    test_journal_mode = LURCH_STORE_JOURNAL_WAL;
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    assert_int_equal(lurch_store_apply_durability(store_p), 0);
+    lurch_store_sync(store_p);
+    test_journal_mode = LURCH_STORE_JOURNAL_ROLLBACK;
+
+    assert_int_equal(sqlite3_open(lurch_store_get_db_fn(store_p, LURCH_STORE_DB_AXC), &db_p), SQLITE_OK);
+    assert_int_equal(sqlite3_exec(db_p, "PRAGMA journal_mode;", test_journal_mode_cb, &mode, NULL), SQLITE_OK);
+    assert_string_equal(mode, "wal");
+    g_free(mode);
+    sqlite3_close(db_p);
+
+    // the store still works on top of it
+    assert_int_equal(lurch_store_device_id_save(store_p, "alice@example.com", 1111), 0);
+    assert_int_equal(lurch_store_global_device_id_exists(store_p, 1111), 1);
+}
+
+/**
+ * Calls with a context that was never bound fail instead of touching another account's db.
+ */
+static void test_lurch_store_unbound_ctx(void ** state) {
+    (void) state;
+
+    signal_protocol_address addr = { .name = "alice@example.com", .name_len = 17, .device_id = 1111 };
+
+    assert_true(lurch_store_session_store_tmpl.contains_session_func(&addr, (void *) &"unbound") < 0);
+    assert_true(lurch_store_pre_key_store_tmpl.contains_pre_key(42, (void *) &"unbound") < 0);
+}
+
+static gint test_lease_go = 0;
+static gint test_lease_stored = 0;
+
+static gpointer test_lease_thread_fn(gpointer data_p) {
+    lurch_store * store_p = data_p;
+    axc_context * fake_ctx_p = (void *) &"fake non-null pointer";
+    signal_protocol_address addr = { .name = "alice@example.com", .name_len = 17, .device_id = 1111 };
+    uint8_t record[] = { 0x01, 0x00, 0x02, 0x03 };
+
+    while (!g_atomic_int_get(&test_lease_go)) {
+        g_usleep(1000);
+    }
+    // give the main thread time to block on the store
+    g_usleep(50000);
+
+    if (!lurch_store_session_store_tmpl.store_session_func(&addr, record, sizeof(record), NULL, 0, fake_ctx_p)) {
+        g_atomic_int_set(&test_lease_stored, 1);
+    }
+    lurch_store_release(store_p);
+
+    return NULL;
+}
+
+/**
+ * While another thread holds the lease, the main thread waits for it instead of using the handles at the same time.
+ */
+static void test_lurch_store_lease(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    axc_context * fake_ctx_p = (void *) &"fake non-null pointer";
+    signal_protocol_address addr = { .name = "alice@example.com", .name_len = 17, .device_id = 1111 };
+    GThread * thread_p = (void *) 0;
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+
+    thread_p = g_thread_new("test-lease", test_lease_thread_fn, store_p);
+    lurch_store_lease(store_p, thread_p);
+    g_atomic_int_set(&test_lease_go, 1);
+
+    assert_int_equal(lurch_store_session_store_tmpl.contains_session_func(&addr, fake_ctx_p), 1);
+    assert_int_equal(g_atomic_int_get(&test_lease_stored), 1);
+
+    (void) g_thread_join(thread_p);
+}
+
+static int test_count_db_sessions(void) {
+    sqlite3 * db_p = (void *) 0;
+    sqlite3_stmt * pstmt_p = (void *) 0;
+    char * db_fn = lurch_util_uname_get_db_fn(TEST_UNAME, LURCH_DB_NAME_AXC);
+    int count = -1;
+
+    if (sqlite3_open(db_fn, &db_p) == SQLITE_OK
+        && sqlite3_prepare_v2(db_p, "SELECT COUNT(*) FROM session_store;", -1, &pstmt_p, NULL) == SQLITE_OK
+        && sqlite3_step(pstmt_p) == SQLITE_ROW) {
+        count = sqlite3_column_int(pstmt_p, 0);
+    }
+    sqlite3_finalize(pstmt_p);
+    sqlite3_close(db_p);
+    g_free(db_fn);
+
+    return count;
+}
+
+/**
+ * Switching the session backend moves the sessions over when the store is opened again,
+ * and the message scope works the same on the key-value file.
+ */
+static void test_lurch_store_kv_backend(void ** state) {
+    (void) state;
+
+    lurch_store * store_p = (void *) 0;
+    axc_context * fake_ctx_p = (void *) &"fake non-null pointer";
+    const signal_protocol_session_store * sess_store_p = &lurch_store_session_store_tmpl;
+    signal_protocol_address addr = { .name = "alice@example.com", .name_len = 17, .device_id = 1111 };
+    uint8_t record[] = { 0x01, 0x00, 0x02, 0x03 };
+    uint8_t record_new[] = { 0x04, 0x05 };
+    signal_buffer * record_buf_p = (void *) 0;
+    signal_int_list * sessions_p = (void *) 0;
+
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+    assert_int_equal(sess_store_p->store_session_func(&addr, record, sizeof(record), NULL, 0, fake_ctx_p), 0);
+    lurch_store_reset_all();
+
+    test_sess_backend = LURCH_STORE_BACKEND_MMAP;
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+    assert_int_equal(test_count_db_sessions(), 0);
+    assert_int_equal(sess_store_p->load_session_func(&record_buf_p, NULL, &addr, fake_ctx_p), 1);
+    assert_memory_equal(signal_buffer_data(record_buf_p), record, sizeof(record));
+    signal_buffer_free(record_buf_p);
+
+    lurch_store_msg_begin(store_p);
+    assert_int_equal(sess_store_p->store_session_func(&addr, record_new, sizeof(record_new), NULL, 0, fake_ctx_p), 0);
+    addr.device_id = 2222;
+    assert_int_equal(sess_store_p->store_session_func(&addr, record, sizeof(record), NULL, 0, fake_ctx_p), 0);
+    assert_int_equal(lurch_store_msg_commit(store_p), 0);
+
+    lurch_store_msg_begin(store_p);
+    assert_int_equal(sess_store_p->delete_all_sessions_func(addr.name, addr.name_len, fake_ctx_p), 2);
+    lurch_store_msg_rollback(store_p);
+    assert_int_equal(sess_store_p->get_sub_device_sessions_func(&sessions_p, addr.name, addr.name_len, fake_ctx_p), 2);
+    signal_int_list_free(sessions_p);
+
+    lurch_store_reset_all();
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+    assert_int_equal(sess_store_p->delete_session_func(&addr, fake_ctx_p), 1);
+    assert_int_equal(sess_store_p->contains_session_func(&addr, fake_ctx_p), 0);
+    lurch_store_reset_all();
+
+    test_sess_backend = LURCH_STORE_BACKEND_SQLITE;
+    assert_int_equal(lurch_store_get(TEST_UNAME, &store_p), 0);
+    lurch_store_bind_axc_ctx(store_p, fake_ctx_p);
+    assert_int_equal(test_count_db_sessions(), 1);
+    addr.device_id = 1111;
+    assert_int_equal(sess_store_p->load_session_func(&record_buf_p, NULL, &addr, fake_ctx_p), 1);
+    assert_int_equal(signal_buffer_len(record_buf_p), sizeof(record_new));
+    assert_memory_equal(signal_buffer_data(record_buf_p), record_new, sizeof(record_new));
+    signal_buffer_free(record_buf_p);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_lurch_store_get, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_chatlist, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_chatlist_reload, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_devicelist, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_devicelist_cache, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_devicelist_cache_update, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_devicelist_peek_load, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_devicelist_apply, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_session_store, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_pre_key_store, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_msg_commit, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_msg_rollback, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_batch, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_device_id_save_async, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_signed_pre_key_save_async, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_submit, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_apply_durability, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_unbound_ctx, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_lease, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_lurch_store_kv_backend, test_setup, test_teardown)
+    };
+
+    return cmocka_run_group_tests_name("lurch_store", tests, NULL, NULL);
+}
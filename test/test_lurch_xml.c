@@ -0,0 +1,361 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+#include <glib.h>
+#include <mxml.h>
+#include <purple.h>
+
+#include "libomemo.h"
+
+#include "../src/lurch_xml.h"
+#include "../src/omemo_helper.h"
+
+#define TEST_TO "bob@example.com"
+#define TEST_TYPE "chat"
+#define TEST_ID "purple2f5e9a1c"
+#define TEST_RECEIPTS_XMLNS "urn:xmpp:receipts"
+#define TEST_CHATSTATES_XMLNS "http://jabber.org/protocol/chatstates"
+#define TEST_PAYLOAD "c2VjcmV0IHBheWxvYWQ="
+
+/**
+ * A message with a header holding a key and an IV, and a payload if asked for,
+ * the streamed kind of payload that is moved into the stanza.
+ */
+static omemo_message * test_create_message(int with_payload) {
+    omemo_message * msg_p = omemo_message_create_bare();
+    mxml_node_t * node_p = (void *) 0;
+
+    assert_non_null(msg_p);
+    mxmlElementSetAttr(msg_p->header_node_p, HEADER_NODE_SID_ATTR_NAME, "1111");
+    node_p = mxmlNewElement(msg_p->header_node_p, KEY_NODE_NAME);
+    mxmlElementSetAttr(node_p, KEY_NODE_RID_ATTR_NAME, "2222");
+    (void) mxmlNewOpaque(node_p, "a2V5");
+    node_p = mxmlNewElement(msg_p->header_node_p, IV_NODE_NAME);
+    (void) mxmlNewOpaque(node_p, "aXY=");
+
+    if (with_payload) {
+        msg_p->payload_node_p = mxmlNewElement(MXML_NO_PARENT, PAYLOAD_NODE_NAME);
+        (void) omemo_text_node_new(msg_p->payload_node_p, g_strdup(TEST_PAYLOAD), strlen(TEST_PAYLOAD));
+    }
+
+    return msg_p;
+}
+
+static xmlnode * test_create_stanza(void) {
+    xmlnode * stanza_p = xmlnode_new("message");
+    xmlnode * node_p = (void *) 0;
+
+    xmlnode_set_attrib(stanza_p, "to", TEST_TO);
+    xmlnode_set_attrib(stanza_p, "type", TEST_TYPE);
+    xmlnode_set_attrib(stanza_p, "id", TEST_ID);
+
+    node_p = xmlnode_new_child(stanza_p, "active");
+    xmlnode_set_namespace(node_p, TEST_CHATSTATES_XMLNS);
+    node_p = xmlnode_new_child(stanza_p, BODY_NODE_NAME);
+    xmlnode_insert_data(node_p, "the plaintext", -1);
+    node_p = xmlnode_new_child(stanza_p, HTML_NODE_NAME);
+    xmlnode_insert_data(node_p, "the <b>plaintext</b>", -1);
+    node_p = xmlnode_new_child(stanza_p, "request");
+    xmlnode_set_namespace(node_p, TEST_RECEIPTS_XMLNS);
+
+    return stanza_p;
+}
+
+static int test_count_children(const xmlnode * stanza_p, const char * name) {
+    const xmlnode * node_p = (void *) 0;
+    int count = 0;
+
+    for (node_p = stanza_p->child; node_p; node_p = node_p->next) {
+        if (node_p->type == XMLNODE_TYPE_TAG && !g_strcmp0(node_p->name, name)) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static void test_assert_stanza_kept(const xmlnode * stanza_p) {
+    assert_string_equal(xmlnode_get_attrib(stanza_p, "to"), TEST_TO);
+    assert_string_equal(xmlnode_get_attrib(stanza_p, "type"), TEST_TYPE);
+    assert_string_equal(xmlnode_get_attrib(stanza_p, "id"), TEST_ID);
+    assert_non_null(xmlnode_get_child_with_namespace(stanza_p, "request", TEST_RECEIPTS_XMLNS));
+    assert_non_null(xmlnode_get_child_with_namespace(stanza_p, "active", TEST_CHATSTATES_XMLNS));
+}
+
+/**
+ * The plaintext goes, the stanza's attributes and its other children stay,
+ * and the encrypted content, the EME element, the fallback body and the store hint are added.
+ */
+static void test_lurch_xml_export_encrypted_keeps_stanza(void ** state) {
+    (void) state;
+
+    omemo_message * msg_p = test_create_message(1);
+    xmlnode * stanza_p = test_create_stanza();
+    xmlnode * encrypted_node_p = (void *) 0;
+    xmlnode * header_node_p = (void *) 0;
+    xmlnode * node_p = (void *) 0;
+    char * data = (void *) 0;
+
+    assert_int_equal(lurch_xml_export_encrypted(msg_p, OMEMO_ADD_MSG_EME, stanza_p), 0);
+
+    test_assert_stanza_kept(stanza_p);
+    assert_null(xmlnode_get_child(stanza_p, HTML_NODE_NAME));
+
+    assert_int_equal(test_count_children(stanza_p, BODY_NODE_NAME), 1);
+    data = xmlnode_get_data(xmlnode_get_child(stanza_p, BODY_NODE_NAME));
+    assert_string_equal(data, EME_BODY_TEXT);
+    g_free(data);
+
+    node_p = xmlnode_get_child_with_namespace(stanza_p, EME_NODE_NAME, EME_XMLNS);
+    assert_non_null(node_p);
+    assert_string_equal(xmlnode_get_attrib(node_p, "namespace"), OMEMO_NS);
+    assert_string_equal(xmlnode_get_attrib(node_p, "name"), EME_NAME);
+    assert_non_null(xmlnode_get_child_with_namespace(stanza_p, HINTS_STORE_NODE_NAME, HINTS_XMLNS));
+
+    encrypted_node_p = xmlnode_get_child_with_namespace(stanza_p, ENCRYPTED_NODE_NAME, OMEMO_NS);
+    assert_non_null(encrypted_node_p);
+    header_node_p = xmlnode_get_child(encrypted_node_p, HEADER_NODE_NAME);
+    assert_non_null(header_node_p);
+    assert_string_equal(xmlnode_get_attrib(header_node_p, HEADER_NODE_SID_ATTR_NAME), "1111");
+    node_p = xmlnode_get_child(header_node_p, KEY_NODE_NAME);
+    assert_non_null(node_p);
+    assert_string_equal(xmlnode_get_attrib(node_p, KEY_NODE_RID_ATTR_NAME), "2222");
+    data = xmlnode_get_data(node_p);
+    assert_string_equal(data, "a2V5");
+    g_free(data);
+
+    data = xmlnode_get_data(xmlnode_get_child(encrypted_node_p, PAYLOAD_NODE_NAME));
+    assert_string_equal(data, TEST_PAYLOAD);
+    g_free(data);
+
+    xmlnode_free(stanza_p);
+    omemo_message_destroy(msg_p);
+}
+
+/**
+ * Exporting into a stanza that has the encrypted content already replaces it instead of adding a second one.
+ */
+static void test_lurch_xml_export_encrypted_twice(void ** state) {
+    (void) state;
+
+    omemo_message * msg_p = test_create_message(0);
+    xmlnode * stanza_p = test_create_stanza();
+
+    assert_int_equal(lurch_xml_export_encrypted(msg_p, OMEMO_ADD_MSG_EME, stanza_p), 0);
+    assert_int_equal(lurch_xml_export_encrypted(msg_p, OMEMO_ADD_MSG_EME, stanza_p), 0);
+
+    test_assert_stanza_kept(stanza_p);
+    assert_int_equal(test_count_children(stanza_p, ENCRYPTED_NODE_NAME), 1);
+    assert_int_equal(test_count_children(stanza_p, EME_NODE_NAME), 1);
+    assert_int_equal(test_count_children(stanza_p, BODY_NODE_NAME), 1);
+    assert_int_equal(test_count_children(stanza_p, HINTS_STORE_NODE_NAME), 1);
+
+    xmlnode_free(stanza_p);
+    omemo_message_destroy(msg_p);
+}
+
+/**
+ * Key transport and IDAKE messages have no payload and no fallback body, but keep their addressing.
+ */
+static void test_lurch_xml_export_encrypted_no_payload(void ** state) {
+    (void) state;
+
+    omemo_message * msg_p = test_create_message(0);
+    xmlnode * stanza_p = test_create_stanza();
+    xmlnode * encrypted_node_p = (void *) 0;
+
+    assert_int_equal(lurch_xml_export_encrypted(msg_p, OMEMO_ADD_MSG_NONE, stanza_p), 0);
+
+    test_assert_stanza_kept(stanza_p);
+    assert_null(xmlnode_get_child(stanza_p, BODY_NODE_NAME));
+    assert_null(xmlnode_get_child(stanza_p, EME_NODE_NAME));
+    assert_non_null(xmlnode_get_child_with_namespace(stanza_p, HINTS_STORE_NODE_NAME, HINTS_XMLNS));
+
+    encrypted_node_p = xmlnode_get_child_with_namespace(stanza_p, ENCRYPTED_NODE_NAME, OMEMO_NS);
+    assert_non_null(encrypted_node_p);
+    assert_non_null(xmlnode_get_child(encrypted_node_p, HEADER_NODE_NAME));
+    assert_null(xmlnode_get_child(encrypted_node_p, PAYLOAD_NODE_NAME));
+
+    xmlnode_free(stanza_p);
+    omemo_message_destroy(msg_p);
+}
+
+static void test_lurch_xml_export_encrypted_null(void ** state) {
+    (void) state;
+
+    omemo_message * msg_p = test_create_message(0);
+    xmlnode * stanza_p = test_create_stanza();
+
+    assert_int_equal(lurch_xml_export_encrypted((void *) 0, OMEMO_ADD_MSG_EME, stanza_p), OMEMO_ERR_NULL);
+    assert_int_equal(lurch_xml_export_encrypted(msg_p, OMEMO_ADD_MSG_EME, (void *) 0), OMEMO_ERR_NULL);
+    // the stanza is left alone
+    assert_non_null(xmlnode_get_child(stanza_p, BODY_NODE_NAME));
+
+    xmlnode_free(stanza_p);
+    omemo_message_destroy(msg_p);
+}
+
+/**
+ * A received <encrypted> element, with whitespace between the elements of the header
+ * and the payload split over several data nodes, as the parser may leave it.
+ */
+static xmlnode * test_create_encrypted_stanza(void) {
+    xmlnode * stanza_p = test_create_stanza();
+    xmlnode * encrypted_node_p = (void *) 0;
+    xmlnode * header_node_p = (void *) 0;
+    xmlnode * node_p = (void *) 0;
+
+    encrypted_node_p = xmlnode_new_child(stanza_p, ENCRYPTED_NODE_NAME);
+    xmlnode_set_namespace(encrypted_node_p, OMEMO_NS);
+
+    header_node_p = xmlnode_new_child(encrypted_node_p, HEADER_NODE_NAME);
+    xmlnode_set_attrib(header_node_p, HEADER_NODE_SID_ATTR_NAME, "1111");
+    xmlnode_insert_data(header_node_p, "\n  ", -1);
+    node_p = xmlnode_new_child(header_node_p, KEY_NODE_NAME);
+    xmlnode_set_attrib(node_p, KEY_NODE_RID_ATTR_NAME, "2222");
+    xmlnode_set_attrib(node_p, KEY_NODE_PREKEY_ATTR_NAME, "true");
+    xmlnode_insert_data(node_p, "a2V5", -1);
+    xmlnode_insert_data(header_node_p, "\n  ", -1);
+    node_p = xmlnode_new_child(header_node_p, KEY_NODE_NAME);
+    xmlnode_set_attrib(node_p, KEY_NODE_RID_ATTR_NAME, "3333");
+    xmlnode_insert_data(node_p, "b3RoZXI=", -1);
+    node_p = xmlnode_new_child(header_node_p, IV_NODE_NAME);
+    xmlnode_insert_data(node_p, "aXY=", -1);
+    xmlnode_insert_data(header_node_p, "\n", -1);
+
+    node_p = xmlnode_new_child(encrypted_node_p, PAYLOAD_NODE_NAME);
+    xmlnode_insert_data(node_p, "c2VjcmV0", -1);
+    xmlnode_insert_data(node_p, "IHBheWxv", -1);
+    xmlnode_insert_data(node_p, "YWQ=", -1);
+
+    return stanza_p;
+}
+
+/**
+ * The header keeps its attributes and elements, but not the whitespace between them,
+ * and the text of the payload is joined into one node.
+ */
+static void test_lurch_xml_to_mxml(void ** state) {
+    (void) state;
+
+    xmlnode * stanza_p = test_create_encrypted_stanza();
+    xmlnode * encrypted_node_p = xmlnode_get_child(stanza_p, ENCRYPTED_NODE_NAME);
+    mxml_node_t * header_node_p = (void *) 0;
+    mxml_node_t * payload_node_p = (void *) 0;
+    mxml_node_t * node_p = (void *) 0;
+
+    header_node_p = lurch_xml_to_mxml(xmlnode_get_child(encrypted_node_p, HEADER_NODE_NAME), MXML_NO_PARENT);
+    assert_non_null(header_node_p);
+    assert_string_equal(mxmlGetElement(header_node_p), HEADER_NODE_NAME);
+    assert_string_equal(mxmlElementGetAttr(header_node_p, HEADER_NODE_SID_ATTR_NAME), "1111");
+
+    node_p = mxmlGetFirstChild(header_node_p);
+    assert_int_equal(mxmlGetType(node_p), MXML_ELEMENT);
+    assert_string_equal(mxmlGetElement(node_p), KEY_NODE_NAME);
+    assert_string_equal(mxmlElementGetAttr(node_p, KEY_NODE_RID_ATTR_NAME), "2222");
+    assert_string_equal(mxmlElementGetAttr(node_p, KEY_NODE_PREKEY_ATTR_NAME), "true");
+    assert_string_equal(mxmlGetOpaque(mxmlGetFirstChild(node_p)), "a2V5");
+
+    node_p = mxmlGetNextSibling(node_p);
+    assert_string_equal(mxmlGetElement(node_p), KEY_NODE_NAME);
+    assert_string_equal(mxmlElementGetAttr(node_p, KEY_NODE_RID_ATTR_NAME), "3333");
+    assert_null(mxmlElementGetAttr(node_p, KEY_NODE_PREKEY_ATTR_NAME));
+    assert_string_equal(mxmlGetOpaque(mxmlGetFirstChild(node_p)), "b3RoZXI=");
+
+    node_p = mxmlGetNextSibling(node_p);
+    assert_string_equal(mxmlGetElement(node_p), IV_NODE_NAME);
+    assert_string_equal(mxmlGetOpaque(mxmlGetFirstChild(node_p)), "aXY=");
+    assert_null(mxmlGetNextSibling(node_p));
+
+    payload_node_p = lurch_xml_to_mxml(xmlnode_get_child(encrypted_node_p, PAYLOAD_NODE_NAME), MXML_NO_PARENT);
+    assert_non_null(payload_node_p);
+    node_p = mxmlGetFirstChild(payload_node_p);
+    assert_int_equal(mxmlGetType(node_p), MXML_OPAQUE);
+    assert_string_equal(mxmlGetOpaque(node_p), TEST_PAYLOAD);
+    assert_null(mxmlGetNextSibling(node_p));
+
+    // the received stanza is left as it was
+    assert_non_null(xmlnode_get_child(encrypted_node_p, HEADER_NODE_NAME));
+
+    mxmlDelete(header_node_p);
+    mxmlDelete(payload_node_p);
+    xmlnode_free(stanza_p);
+}
+
+static void test_lurch_xml_prepare_decryption(void ** state) {
+    (void) state;
+
+    xmlnode * stanza_p = test_create_encrypted_stanza();
+    omemo_message * msg_p = (void *) 0;
+
+    assert_int_equal(lurch_xml_prepare_decryption(stanza_p, &msg_p), 0);
+    assert_non_null(msg_p);
+    assert_string_equal(mxmlGetElement(msg_p->header_node_p), HEADER_NODE_NAME);
+    assert_string_equal(mxmlElementGetAttr(msg_p->header_node_p, HEADER_NODE_SID_ATTR_NAME), "1111");
+    assert_non_null(mxmlFindElement(msg_p->header_node_p, msg_p->header_node_p, KEY_NODE_NAME,
+                                    KEY_NODE_RID_ATTR_NAME, "3333", MXML_DESCEND));
+    assert_string_equal(mxmlGetOpaque(mxmlGetFirstChild(msg_p->payload_node_p)), TEST_PAYLOAD);
+    omemo_message_destroy(msg_p);
+    msg_p = (void *) 0;
+
+    // key transport messages have no payload
+    xmlnode_free(xmlnode_get_child(xmlnode_get_child(stanza_p, ENCRYPTED_NODE_NAME), PAYLOAD_NODE_NAME));
+    assert_int_equal(lurch_xml_prepare_decryption(stanza_p, &msg_p), 0);
+    assert_non_null(msg_p);
+    assert_null(msg_p->payload_node_p);
+    omemo_message_destroy(msg_p);
+    msg_p = (void *) 0;
+
+    xmlnode_free(xmlnode_get_child(xmlnode_get_child(stanza_p, ENCRYPTED_NODE_NAME), HEADER_NODE_NAME));
+    assert_int_equal(lurch_xml_prepare_decryption(stanza_p, &msg_p), OMEMO_ERR_MALFORMED_XML);
+    assert_null(msg_p);
+
+    xmlnode_free(xmlnode_get_child(stanza_p, ENCRYPTED_NODE_NAME));
+    assert_int_equal(lurch_xml_prepare_decryption(stanza_p, &msg_p), OMEMO_ERR_MALFORMED_XML);
+    assert_null(msg_p);
+
+    xmlnode_free(stanza_p);
+}
+
+/**
+ * The <encrypted> element and the fallback body make way for the decrypted body,
+ * the stanza's attributes and other children stay.
+ */
+static void test_lurch_xml_set_decrypted_body(void ** state) {
+    (void) state;
+
+    xmlnode * stanza_p = test_create_encrypted_stanza();
+    xmlnode * body_node_p = (void *) 0;
+    char * data = (void *) 0;
+
+    body_node_p = lurch_xml_set_decrypted_body(stanza_p, "the decrypted text");
+    assert_non_null(body_node_p);
+    assert_ptr_equal(body_node_p->parent, stanza_p);
+
+    test_assert_stanza_kept(stanza_p);
+    assert_null(xmlnode_get_child(stanza_p, ENCRYPTED_NODE_NAME));
+    assert_int_equal(test_count_children(stanza_p, BODY_NODE_NAME), 1);
+    assert_ptr_equal(xmlnode_get_child(stanza_p, BODY_NODE_NAME), body_node_p);
+    data = xmlnode_get_data(body_node_p);
+    assert_string_equal(data, "the decrypted text");
+    g_free(data);
+
+    xmlnode_free(stanza_p);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_lurch_xml_export_encrypted_keeps_stanza),
+        cmocka_unit_test(test_lurch_xml_export_encrypted_twice),
+        cmocka_unit_test(test_lurch_xml_export_encrypted_no_payload),
+        cmocka_unit_test(test_lurch_xml_export_encrypted_null),
+        cmocka_unit_test(test_lurch_xml_to_mxml),
+        cmocka_unit_test(test_lurch_xml_prepare_decryption),
+        cmocka_unit_test(test_lurch_xml_set_decrypted_body)
+    };
+
+    return cmocka_run_group_tests_name("lurch_xml", tests, NULL, NULL);
+}
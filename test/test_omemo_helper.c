@@ -0,0 +1,156 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+#include <glib.h>
+#include <mxml.h>
+
+#include "libomemo.h"
+
+#include "../src/omemo_helper.h"
+
+#define TEST_OWN_JID "me-testing@test.org"
+#define TEST_OTHER_JID "bob@example.com"
+
+static mxml_node_t * test_add_key(mxml_node_t * parent_p, const char * jid, const char * rid) {
+    mxml_node_t * key_node_p = mxmlNewElement(parent_p, KEY_NODE_NAME);
+
+    if (jid) {
+        mxmlElementSetAttr(key_node_p, KEY_NODE_JID_ATTR_NAME, jid);
+    }
+    mxmlElementSetAttr(key_node_p, KEY_NODE_RID_ATTR_NAME, rid);
+    return key_node_p;
+}
+
+/**
+ * Only the keys for the given jid are indexed, whether the jid is on the <key> element itself
+ * or on the element grouping the keys of one jid.
+ */
+static void test_omemo_message_index_keys_recipients(void ** state) {
+    (void) state;
+
+    omemo_message * msg_p = omemo_message_create_bare();
+    mxml_node_t * own_1_p = (void *) 0;
+    mxml_node_t * own_2_p = (void *) 0;
+    mxml_node_t * own_grouped_p = (void *) 0;
+    mxml_node_t * group_p = (void *) 0;
+    GHashTable * index_p = (void *) 0;
+
+    assert_non_null(msg_p);
+    own_1_p = test_add_key(msg_p->header_node_p, TEST_OWN_JID, "1111");
+    (void) test_add_key(msg_p->header_node_p, TEST_OTHER_JID, "3333");
+    own_2_p = test_add_key(msg_p->header_node_p, TEST_OWN_JID, "2222");
+
+    group_p = mxmlNewElement(msg_p->header_node_p, "keys");
+    mxmlElementSetAttr(group_p, KEY_NODE_JID_ATTR_NAME, TEST_OWN_JID);
+    own_grouped_p = test_add_key(group_p, NULL, "4444");
+    group_p = mxmlNewElement(msg_p->header_node_p, "keys");
+    mxmlElementSetAttr(group_p, KEY_NODE_JID_ATTR_NAME, TEST_OTHER_JID);
+    (void) test_add_key(group_p, NULL, "5555");
+
+    index_p = omemo_message_index_keys(msg_p, TEST_OWN_JID);
+    assert_non_null(index_p);
+    assert_int_equal(g_hash_table_size(index_p), 3);
+    assert_ptr_equal(g_hash_table_lookup(index_p, GUINT_TO_POINTER(1111)), own_1_p);
+    assert_ptr_equal(g_hash_table_lookup(index_p, GUINT_TO_POINTER(2222)), own_2_p);
+    assert_ptr_equal(g_hash_table_lookup(index_p, GUINT_TO_POINTER(4444)), own_grouped_p);
+    assert_null(g_hash_table_lookup(index_p, GUINT_TO_POINTER(3333)));
+    assert_null(g_hash_table_lookup(index_p, GUINT_TO_POINTER(5555)));
+    g_hash_table_destroy(index_p);
+
+    index_p = omemo_message_index_keys(msg_p, TEST_OTHER_JID);
+    assert_non_null(index_p);
+    assert_int_equal(g_hash_table_size(index_p), 2);
+    assert_non_null(g_hash_table_lookup(index_p, GUINT_TO_POINTER(3333)));
+    assert_non_null(g_hash_table_lookup(index_p, GUINT_TO_POINTER(5555)));
+    g_hash_table_destroy(index_p);
+
+    omemo_message_destroy(msg_p);
+}
+
+/**
+ * If a device is listed twice, the first key is the one that is found.
+ */
+static void test_omemo_message_index_keys_repeated_rid(void ** state) {
+    (void) state;
+
+    omemo_message * msg_p = omemo_message_create_bare();
+    mxml_node_t * first_p = (void *) 0;
+    GHashTable * index_p = (void *) 0;
+
+    assert_non_null(msg_p);
+    first_p = test_add_key(msg_p->header_node_p, TEST_OWN_JID, "1111");
+    (void) test_add_key(msg_p->header_node_p, TEST_OWN_JID, "1111");
+    // the same rid for another jid is another device
+    (void) test_add_key(msg_p->header_node_p, TEST_OTHER_JID, "1111");
+
+    index_p = omemo_message_index_keys(msg_p, TEST_OWN_JID);
+    assert_non_null(index_p);
+    assert_int_equal(g_hash_table_size(index_p), 1);
+    assert_ptr_equal(g_hash_table_lookup(index_p, GUINT_TO_POINTER(1111)), first_p);
+    g_hash_table_destroy(index_p);
+
+    omemo_message_destroy(msg_p);
+}
+
+/**
+ * A message without a key for this device or jid gives an index that does not have it,
+ * so that the caller does not have to ask libomemo for it.
+ */
+static void test_omemo_message_index_keys_missing_own_rid(void ** state) {
+    (void) state;
+
+    omemo_message * msg_p = omemo_message_create_bare();
+    GHashTable * index_p = (void *) 0;
+
+    assert_non_null(msg_p);
+    (void) test_add_key(msg_p->header_node_p, TEST_OWN_JID, "1111");
+    (void) test_add_key(msg_p->header_node_p, TEST_OTHER_JID, "2222");
+
+    index_p = omemo_message_index_keys(msg_p, TEST_OWN_JID);
+    assert_non_null(index_p);
+    assert_false(g_hash_table_contains(index_p, GUINT_TO_POINTER(2222)));
+    assert_false(g_hash_table_contains(index_p, GUINT_TO_POINTER(9999)));
+    g_hash_table_destroy(index_p);
+
+    index_p = omemo_message_index_keys(msg_p, "carol@example.com");
+    assert_non_null(index_p);
+    assert_int_equal(g_hash_table_size(index_p), 0);
+    g_hash_table_destroy(index_p);
+
+    omemo_message_destroy(msg_p);
+}
+
+/**
+ * Without any jids on the keys, as in messages of the old namespace, the index cannot be built.
+ */
+static void test_omemo_message_index_keys_no_jids(void ** state) {
+    (void) state;
+
+    omemo_message * msg_p = omemo_message_create_bare();
+
+    assert_non_null(msg_p);
+    assert_null(omemo_message_index_keys(msg_p, TEST_OWN_JID));
+
+    (void) test_add_key(msg_p->header_node_p, NULL, "1111");
+    (void) test_add_key(msg_p->header_node_p, NULL, "2222");
+    assert_null(omemo_message_index_keys(msg_p, TEST_OWN_JID));
+
+    assert_null(omemo_message_index_keys(msg_p, NULL));
+    assert_null(omemo_message_index_keys(NULL, TEST_OWN_JID));
+
+    omemo_message_destroy(msg_p);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_omemo_message_index_keys_recipients),
+        cmocka_unit_test(test_omemo_message_index_keys_repeated_rid),
+        cmocka_unit_test(test_omemo_message_index_keys_missing_own_rid),
+        cmocka_unit_test(test_omemo_message_index_keys_no_jids)
+    };
+
+    return cmocka_run_group_tests_name("omemo_helper", tests, NULL, NULL);
+}